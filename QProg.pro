@@ -31,8 +31,32 @@ SOURCES	+= src/delegate.cc
 
 HEADERS	+= src/kitsrus.h
 SOURCES	+= src/kitsrus.cc
+HEADERS	+= src/logging.h
+SOURCES	+= src/logging.cc
 HEADERS	+= src/chipinfo.h
 SOURCES	+= src/chipinfo.cc
+HEADERS	+= src/corefamily.h
+SOURCES	+= src/corefamily.cc
+HEADERS	+= src/imagecache.h
+SOURCES	+= src/imagecache.cc
+HEADERS	+= src/qpimg.h
+SOURCES	+= src/qpimg.cc
+HEADERS	+= src/cli.h
+SOURCES	+= src/cli.cc
+HEADERS	+= src/verify.h
+SOURCES	+= src/verify.cc
+HEADERS	+= src/checksum.h
+SOURCES	+= src/checksum.cc
+HEADERS	+= src/compose.h
+SOURCES	+= src/compose.cc
+HEADERS	+= src/serialno.h
+SOURCES	+= src/serialno.cc
+HEADERS	+= src/devicelibrary.h
+SOURCES	+= src/devicelibrary.cc
+HEADERS	+= src/production.h
+SOURCES	+= src/production.cc
+HEADERS	+= src/programmer.h
+SOURCES	+= src/programmer.cc
 
 macx {
 	# Carbon-Cocoa interface for Sparkle
@@ -53,6 +77,8 @@ SOURCES	+= qextserialport/qextserialbase.cpp qextserialport/qextserialport.cpp
 
 unix:HEADERS	+= qextserialport/posix_qextserialport.h
 unix:SOURCES	+= qextserialport/posix_qextserialport.cpp
+unix:HEADERS	+= qextserialport/posix_qextserialuring.h
+unix:SOURCES	+= qextserialport/posix_qextserialuring.cpp
 unix:DEFINES	+= _TTY_POSIX_
 
 win32:HEADERS	+= qextserialport/win_qextserialport.h
@@ -12,7 +12,13 @@ warnings) in the project.  Note that _TTY_NOWARN_ will also turn off portability
 */
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 #include "posix_qextserialport.h"
 
 /*!
@@ -60,6 +66,9 @@ Posix_QextSerialPort::Posix_QextSerialPort(const Posix_QextSerialPort& s)
     lastErr=s.lastErr;
 
     fd = s.fd;
+    lowLatencyState.wanted = s.lowLatencyState.wanted;
+    configState.exclusive = s.configState.exclusive;
+    uringState.wanted = s.uringState.wanted;
     memcpy(&Posix_Timeout, &s.Posix_Timeout, sizeof(struct timeval));
     memcpy(&Posix_Copy_Timeout, &s.Posix_Copy_Timeout, sizeof(struct timeval));
     memcpy(&Posix_CommConfig, &s.Posix_CommConfig, sizeof(struct termios));
@@ -82,13 +91,7 @@ Constructs a port with default name and specified settings.
 Posix_QextSerialPort::Posix_QextSerialPort(const PortSettings& settings)
  : QextSerialBase()
 {
-    setBaudRate(settings.BaudRate);
-    setDataBits(settings.DataBits);
-    setParity(settings.Parity);
-    setStopBits(settings.StopBits);
-    setFlowControl(settings.FlowControl);
-
-    setTimeout(settings.Timeout_Sec, settings.Timeout_Millisec);
+    setPortSettings(settings);
 }
 
 /*!
@@ -98,13 +101,7 @@ Constructs a port with specified name and settings.
 Posix_QextSerialPort::Posix_QextSerialPort(const QString & name, const PortSettings& settings)
  : QextSerialBase(name)
 {
-    setBaudRate(settings.BaudRate);
-    setDataBits(settings.DataBits);
-    setParity(settings.Parity);
-    setStopBits(settings.StopBits);
-    setFlowControl(settings.FlowControl);
-
-    setTimeout(settings.Timeout_Sec, settings.Timeout_Millisec);
+    setPortSettings(settings);
 }
 
 /*!
@@ -123,6 +120,9 @@ Posix_QextSerialPort& Posix_QextSerialPort::operator=(const Posix_QextSerialPort
     lastErr=s.lastErr;
 
     fd = s.fd;
+    lowLatencyState.wanted = s.lowLatencyState.wanted;
+    configState.exclusive = s.configState.exclusive;
+    uringState.wanted = s.uringState.wanted;
     memcpy(&Posix_Timeout, &(s.Posix_Timeout), sizeof(struct timeval));
     memcpy(&Posix_Copy_Timeout, &(s.Posix_Copy_Timeout), sizeof(struct timeval));
     memcpy(&Posix_CommConfig, &(s.Posix_CommConfig), sizeof(struct termios));
@@ -479,7 +479,7 @@ void Posix_QextSerialPort::setBaudRate(BaudRateType baudRate)
 #endif
                 break;
         }
-        tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+        applyConfig();
     }
     UNLOCK_MUTEX();
 }
@@ -526,7 +526,7 @@ void Posix_QextSerialPort::setDataBits(DataBitsType dataBits)
                     Settings.DataBits=dataBits;
                     Posix_CommConfig.c_cflag&=(~CSIZE);
                     Posix_CommConfig.c_cflag|=CS5;
-                    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                    applyConfig();
                 }
                 break;
 
@@ -539,7 +539,7 @@ void Posix_QextSerialPort::setDataBits(DataBitsType dataBits)
                     Settings.DataBits=dataBits;
                     Posix_CommConfig.c_cflag&=(~CSIZE);
                     Posix_CommConfig.c_cflag|=CS6;
-                    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                    applyConfig();
                 }
                 break;
 
@@ -552,7 +552,7 @@ void Posix_QextSerialPort::setDataBits(DataBitsType dataBits)
                     Settings.DataBits=dataBits;
                     Posix_CommConfig.c_cflag&=(~CSIZE);
                     Posix_CommConfig.c_cflag|=CS7;
-                    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                    applyConfig();
                 }
                 break;
 
@@ -565,7 +565,7 @@ void Posix_QextSerialPort::setDataBits(DataBitsType dataBits)
                     Settings.DataBits=dataBits;
                     Posix_CommConfig.c_cflag&=(~CSIZE);
                     Posix_CommConfig.c_cflag|=CS8;
-                    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                    applyConfig();
                 }
                 break;
         }
@@ -634,7 +634,7 @@ void Posix_QextSerialPort::setParity(ParityType parity)
                         case DATA_8:
                             break;
                     }
-                    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                    applyConfig();
                 }
                 break;
 
@@ -646,20 +646,20 @@ void Posix_QextSerialPort::setParity(ParityType parity)
             /*no parity*/
             case PAR_NONE:
                 Posix_CommConfig.c_cflag&=(~PARENB);
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
 
             /*even parity*/
             case PAR_EVEN:
                 Posix_CommConfig.c_cflag&=(~PARODD);
                 Posix_CommConfig.c_cflag|=PARENB;
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
 
             /*odd parity*/
             case PAR_ODD:
                 Posix_CommConfig.c_cflag|=(PARENB|PARODD);
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
         }
     }
@@ -698,7 +698,7 @@ void Posix_QextSerialPort::setStopBits(StopBitsType stopBits)
             case STOP_1:
                 Settings.StopBits=stopBits;
                 Posix_CommConfig.c_cflag&=(~CSTOPB);
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
 
             /*1.5 stop bits*/
@@ -714,7 +714,7 @@ void Posix_QextSerialPort::setStopBits(StopBitsType stopBits)
                 else {
                     Settings.StopBits=stopBits;
                     Posix_CommConfig.c_cflag|=CSTOPB;
-                    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                    applyConfig();
                 }
                 break;
         }
@@ -748,26 +748,68 @@ void Posix_QextSerialPort::setFlowControl(FlowType flow)
             case FLOW_OFF:
                 Posix_CommConfig.c_cflag&=(~CRTSCTS);
                 Posix_CommConfig.c_iflag&=(~(IXON|IXOFF|IXANY));
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
 
             /*software (XON/XOFF) flow control*/
             case FLOW_XONXOFF:
                 Posix_CommConfig.c_cflag&=(~CRTSCTS);
                 Posix_CommConfig.c_iflag|=(IXON|IXOFF|IXANY);
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
 
             case FLOW_HARDWARE:
                 Posix_CommConfig.c_cflag|=CRTSCTS;
                 Posix_CommConfig.c_iflag&=(~(IXON|IXOFF|IXANY));
-                tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+                applyConfig();
                 break;
         }
     }
     UNLOCK_MUTEX();
 }
 
+/*!
+\fn bool Posix_QextSerialPort::setPortSettings(const PortSettings& settings)
+Changes every setting of the port at once.  On an open port the new configuration is built up
+and then applied with a single tcsetattr(TCSANOW) call, so the port never runs with half of the
+new settings and neither pending output nor received input is waited on or thrown away.
+Returns false if the configuration couldn't be applied.
+*/
+bool Posix_QextSerialPort::setPortSettings(const PortSettings& settings)
+{
+    configState.deferred = true;
+    setBaudRate(settings.BaudRate);
+    setDataBits(settings.DataBits);
+    setParity(settings.Parity);
+    setStopBits(settings.StopBits);
+    setFlowControl(settings.FlowControl);
+    setTimeout(settings.Timeout_Sec, settings.Timeout_Millisec);
+    configState.deferred = false;
+    return !isOpen() || applyConfig();
+}
+
+/*!
+\fn void Posix_QextSerialPort::setExclusive(bool set)
+Locks the port against being opened again, by this or any other process, while it's open
+(TIOCEXCL).  Takes effect the next time the port is opened.
+*/
+void Posix_QextSerialPort::setExclusive(bool set)
+{
+    configState.exclusive = set;
+}
+
+/*!
+\fn bool Posix_QextSerialPort::applyConfig()
+Applies Posix_CommConfig to the open port right away, unless setPortSettings() is collecting
+changes.  Used internally.
+*/
+bool Posix_QextSerialPort::applyConfig()
+{
+    if (configState.deferred)
+        return true;
+    return tcsetattr(fd, TCSANOW, &Posix_CommConfig) == 0;
+}
+
 /*!
 \fn void Posix_QextSerialPort::setTimeout(ulong sec, ulong millisec);
 Sets the read and write timeouts for the port to sec seconds and millisec milliseconds.
@@ -793,9 +835,8 @@ void Posix_QextSerialPort::setTimeout(ulong sec, ulong millisec)
     Posix_Copy_Timeout.tv_sec=sec;
     Posix_Copy_Timeout.tv_usec=millisec;
     if (isOpen()) {
-        tcgetattr(fd, &Posix_CommConfig);
         Posix_CommConfig.c_cc[VTIME]=sec*10+millisec/100;
-        tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+        applyConfig();
     }
     UNLOCK_MUTEX();
 }
@@ -851,6 +892,9 @@ void display_termios(termios buff)
 Opens the serial port associated to this class.
 This function has no effect if the port associated with the class is already open.
 The port is also configured to the current settings, as stored in the Settings structure.
+The whole configuration is applied with a single tcsetattr() call, and the port is
+locked against other opens with TIOCEXCL if setExclusive() was called.
+If the port can't be opened or locked, errno says why when this returns.
 */
 bool Posix_QextSerialPort::open(OpenMode mode)
 {
@@ -859,10 +903,15 @@ bool Posix_QextSerialPort::open(OpenMode mode)
     	return isOpen();
     if (!isOpen()) {
         /*open the port*/
-        qDebug("Trying to open File");
-	if ( (fd = ::open(port.toAscii(), O_RDWR | O_NOCTTY | O_FSYNC)) != -1 )
+	if ( (fd = ::open(port.toAscii(), O_RDWR | O_NOCTTY)) != -1 )
 	{
-            qDebug("Opened File succesfully");
+	    if (configState.exclusive && (ioctl(fd, TIOCEXCL) == -1)) {
+		const int err = errno;
+		::close(fd);
+		UNLOCK_MUTEX();
+		errno = err;
+		return false;
+	    }
 
 	    setOpenMode(mode);			// Flag the port as opened
 	    tcgetattr(fd, &old_termios);	// Save the old termios
@@ -886,16 +935,18 @@ bool Posix_QextSerialPort::open(OpenMode mode)
 	    Posix_CommConfig.c_cc[VSTOP] = vdisable;
 	    Posix_CommConfig.c_cc[VSUSP] = vdisable;
 #endif //_POSIX_VDISABLE
-            setBaudRate(Settings.BaudRate);	// !! This updates Posix_CommConfig
-//            setDataBits(Settings.DataBits);
-//            setParity(Settings.Parity);
-//            setStopBits(Settings.StopBits);
-//            setFlowControl(Settings.FlowControl);
-            setTimeout(Settings.Timeout_Sec, Settings.Timeout_Millisec);
-	    tcflush(fd, TCIOFLUSH);
-	    tcsetattr(fd, TCSAFLUSH, &Posix_CommConfig);
+	    tcflush(fd, TCIOFLUSH);		// Drop anything left over from before the port was opened
+	    const PortSettings settings = Settings;
+	    setPortSettings(settings);		// !! This updates Posix_CommConfig and applies it
+	    if (lowLatencyState.wanted)
+		applyLowLatency();
+	    if (uringState.wanted && (Posix_QextSerialUring::instance() != NULL))
+		uringState.port = Posix_QextSerialUring::instance()->attach(fd);
         } else {
-            qDebug("Could not open File! Error code : %d", errno);
+            const int err = errno;
+            UNLOCK_MUTEX();
+            errno = err;
+            return false;
         }
     }
     UNLOCK_MUTEX();
@@ -914,8 +965,15 @@ void Posix_QextSerialPort::close()
     {
 	// Force a flush and then restore the original termios
 	flush();
+	if (uringState.port != NULL) {
+	    Posix_QextSerialUring::instance()->detach(uringState.port);
+	    uringState.port = NULL;
+	}
 	// Using both TCSAFLUSH and TCSANOW here discards any pending input
 	tcsetattr(fd, TCSAFLUSH | TCSANOW, &old_termios);   // Restore termios
+	restoreLowLatency();
+	if (configState.exclusive)
+	    ioctl(fd, TIOCNXCL);
 	// Be a good QIODevice and call QIODevice::close() before POSIX close()
 	//  so the aboutToClose() signal is emitted at the proper time
 	QIODevice::close();	// Flag the device as closed
@@ -927,14 +985,39 @@ void Posix_QextSerialPort::close()
 
 /*!
 \fn void Posix_QextSerialPort::flush()
-Flushes all pending I/O to the serial port.  This function has no effect if the serial port
-associated with the class is not currently open.
+Waits until everything written to the serial port has been transmitted, like FlushFileBuffers()
+on Windows.  Received data is kept, use discardInput() to throw it away.  This function has no
+effect if the serial port associated with the class is not currently open.
 */
 void Posix_QextSerialPort::flush()
 {
     LOCK_MUTEX();
-    if (isOpen())
-	tcflush(fd, TCIOFLUSH);
+    if (isOpen()) {
+	if (uringState.port != NULL)
+	    Posix_QextSerialUring::instance()->drain(uringState.port);
+	tcdrain(fd);
+    }
+    UNLOCK_MUTEX();
+}
+
+/*!
+\fn void Posix_QextSerialPort::discardInput()
+Throws away everything that has been received but not yet read, both in the driver and in
+the QIODevice buffer.  On io_uring the read in flight is cancelled and whatever it brought in is
+thrown away too.  This function has no effect if the serial port associated with the class is
+not currently open.
+*/
+void Posix_QextSerialPort::discardInput()
+{
+    const qint64 buffered = QIODevice::bytesAvailable();
+    if (buffered > 0)
+        QIODevice::read(buffered);
+    LOCK_MUTEX();
+    if (isOpen()) {
+	tcflush(fd, TCIFLUSH);
+	if (uringState.port != NULL)
+	    Posix_QextSerialUring::instance()->discard(uringState.port);
+    }
     UNLOCK_MUTEX();
 }
 
@@ -951,6 +1034,8 @@ qint64 Posix_QextSerialPort::size() const
     if (ioctl(fd, FIONREAD, &numBytes)<0) {
         numBytes=0;
     }
+    if (uringState.port != NULL)
+        return Posix_QextSerialUring::instance()->queued(uringState.port) + numBytes;
     return (qint64)numBytes;
 }
 
@@ -962,6 +1047,18 @@ Posix_QextSerialPort::getLastError().
 */
 qint64 Posix_QextSerialPort::bytesAvailable()
 {
+    if (isOpen() && (uringState.port != NULL)) {
+        /*the ring thread keeps a read queued, wait on the receive ring instead of select().  The
+          ring is lock free and the port has one user, so the mutex isn't needed*/
+        const qint64 n = Posix_QextSerialUring::instance()->available(uringState.port,
+            Posix_Copy_Timeout.tv_sec*1000 + Posix_Copy_Timeout.tv_usec/1000);
+        if (n <= 0) {
+            lastErr = n ? E_READ_FAILED : E_PORT_TIMEOUT;
+            return -1;
+        }
+        lastErr=E_NO_ERROR;
+        return n + QIODevice::bytesAvailable();
+    }
     LOCK_MUTEX();
     if (isOpen()) {
         int bytesQueued;
@@ -1128,6 +1225,151 @@ unsigned long Posix_QextSerialPort::lineStatus()
     return Status;
 }
 
+/*!
+\fn bool Posix_QextSerialPort::setLowLatency(bool enable)
+Turns low latency mode on or off, on an open port the change takes effect immediately and
+otherwise it's applied when the port is opened.  On Linux this sets ASYNC_LOW_LATENCY with
+TIOCSSERIAL and, for USB serial bridges, lowers the driver's latency timer to 1 ms when its
+sysfs file is writable.  A bridge otherwise holds received bytes for up to its latency timer
+(16 ms by default on FTDI parts) before passing them on, which is added to every turnaround of
+a request/response protocol.  The original settings are restored when the port is closed.
+Returns true if low latency mode is in effect, always false on other systems.
+*/
+bool Posix_QextSerialPort::setLowLatency(bool enable)
+{
+    LOCK_MUTEX();
+    lowLatencyState.wanted = enable;
+    if (isOpen()) {
+        if (enable)
+            applyLowLatency();
+        else
+            restoreLowLatency();
+    }
+    UNLOCK_MUTEX();
+    return lowLatency();
+}
+
+/*!
+\fn bool Posix_QextSerialPort::lowLatency() const
+Returns true if either the driver flag or the latency timer was changed on the open port.
+*/
+bool Posix_QextSerialPort::lowLatency() const
+{
+    return isOpen() && (lowLatencyState.serialSaved || (lowLatencyState.oldLatencyTimer >= 0));
+}
+
+/*!
+\fn void Posix_QextSerialPort::applyLowLatency()
+Puts the open port in low latency mode, saving what it changes.  Used internally.
+*/
+void Posix_QextSerialPort::applyLowLatency()
+{
+#ifdef __linux__
+    struct serial_struct serial;
+    if (!lowLatencyState.serialSaved && (ioctl(fd, TIOCGSERIAL, &serial) == 0)) {
+        const int flags = serial.flags;
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &serial) == 0) {
+            lowLatencyState.oldSerialFlags = flags;
+            lowLatencyState.serialSaved = true;
+        }
+    }
+
+    /*USB serial bridges expose their latency timer under the name of the tty,
+      follow symlinks such as /dev/serial/by-id to find it*/
+    char device[PATH_MAX];
+    if ((lowLatencyState.oldLatencyTimer < 0) && (realpath(port.toAscii(), device) != NULL)) {
+        const char *name = strrchr(device, '/');
+        lowLatencyState.latencyTimerPath = QString("/sys/bus/usb-serial/devices/%1/latency_timer").arg(name ? name+1 : device);
+        FILE *fp = fopen(lowLatencyState.latencyTimerPath.toAscii(), "r+");
+        int old;
+        if (fp != NULL) {
+            if ((fscanf(fp, "%d", &old) == 1) && (old > 1)) {
+                rewind(fp);
+                if ((fprintf(fp, "1\n") > 0) && (fflush(fp) == 0))
+                    lowLatencyState.oldLatencyTimer = old;
+            }
+            fclose(fp);
+        }
+    }
+#endif
+}
+
+/*!
+\fn void Posix_QextSerialPort::restoreLowLatency()
+Undoes applyLowLatency().  Used internally.
+*/
+void Posix_QextSerialPort::restoreLowLatency()
+{
+#ifdef __linux__
+    struct serial_struct serial;
+    if (lowLatencyState.serialSaved && (ioctl(fd, TIOCGSERIAL, &serial) == 0)) {
+        serial.flags = lowLatencyState.oldSerialFlags;
+        ioctl(fd, TIOCSSERIAL, &serial);
+    }
+    if (lowLatencyState.oldLatencyTimer >= 0) {
+        FILE *fp = fopen(lowLatencyState.latencyTimerPath.toAscii(), "w");
+        if (fp != NULL) {
+            fprintf(fp, "%d\n", lowLatencyState.oldLatencyTimer);
+            fclose(fp);
+        }
+    }
+#endif
+    lowLatencyState.serialSaved = false;
+    lowLatencyState.oldLatencyTimer = -1;
+}
+
+bool Posix_QextSerialPort::UringState::byDefault = true;
+
+/*!
+\fn bool Posix_QextSerialPort::setIoUring(bool enable)
+Moves the port's reads and writes onto the io_uring transport shared by all ports, see
+Posix_QextSerialUring.  The change takes effect the next time the port is opened.  With many
+ports open this replaces a blocking read() per port with one thread submitting every port's
+reads and writes in batches.  The port then exchanges data with that thread through lock free
+rings, so its reads, writes and bytesAvailable() don't take the mutex shared by every port and
+it has to be used from one thread at a time.  Ports use it by default, see setIoUringDefault().
+Returns true if the transport is available, it needs Linux 5.7 or later and is always false on
+other systems, in which case the port keeps using read() and write().
+*/
+bool Posix_QextSerialPort::setIoUring(bool enable)
+{
+    LOCK_MUTEX();
+    uringState.wanted = enable;
+    UNLOCK_MUTEX();
+    return Posix_QextSerialUring::instance() != NULL;
+}
+
+/*!
+\fn bool Posix_QextSerialPort::ioUring() const
+Returns true if the open port's reads and writes go through io_uring.
+*/
+bool Posix_QextSerialPort::ioUring() const
+{
+    return isOpen() && (uringState.port != NULL);
+}
+
+/*!
+\fn bool Posix_QextSerialPort::setIoUringDefault(bool enable)
+Sets whether ports constructed from now on use io_uring, see setIoUring().  It's on to start
+with, and a port falls back to read() and write() when the kernel can't do it.  Returns true if
+the transport is available.
+*/
+bool Posix_QextSerialPort::setIoUringDefault(bool enable)
+{
+    Posix_QextSerialPort::UringState::byDefault = enable;
+    return Posix_QextSerialUring::instance() != NULL;
+}
+
+/*!
+\fn bool Posix_QextSerialPort::ioUringDefault()
+Returns whether ports constructed from now on ask for io_uring, see setIoUringDefault().
+*/
+bool Posix_QextSerialPort::ioUringDefault()
+{
+    return Posix_QextSerialPort::UringState::byDefault;
+}
+
 /*!
 \fn qint64 Posix_QextSerialPort::readData(char * data, qint64 maxSize)
 Reads a block of data from the serial port.  This function will read at most maxSize bytes from
@@ -1139,8 +1381,16 @@ is currently open (use isOpen() function to check if port is open).
 */
 qint64 Posix_QextSerialPort::readData(char * data, qint64 maxSize)
 {
-    LOCK_MUTEX();
     int retVal=0;
+    if (isOpen() && (uringState.port != NULL)) {
+	/*VTIME is in tenths of a second and 0 blocks until something arrives, as read() does with VMIN=1*/
+	const int vtime = Posix_CommConfig.c_cc[VTIME];
+	retVal = Posix_QextSerialUring::instance()->read(uringState.port, data, maxSize, vtime ? vtime*100 : -1);
+	if (retVal==-1)
+	    lastErr=E_READ_FAILED;
+	return retVal;
+    }
+    LOCK_MUTEX();
     if( isOpen() )
     {
 	retVal = ::read(fd, data, maxSize);
@@ -1163,8 +1413,14 @@ is currently open (use isOpen() function to check if port is open).
 */
 qint64 Posix_QextSerialPort::writeData(const char * data, qint64 maxSize)
 {
-    LOCK_MUTEX();
     int retVal=0;
+    if (isOpen() && (uringState.port != NULL)) {
+	retVal = Posix_QextSerialUring::instance()->write(uringState.port, data, maxSize);
+	if (retVal==-1)
+	    lastErr=E_WRITE_FAILED;
+	return retVal;
+    }
+    LOCK_MUTEX();
     if( isOpen() )
     {
 	retVal = ::write(fd, data, maxSize);
@@ -1173,6 +1429,5 @@ qint64 Posix_QextSerialPort::writeData(const char * data, qint64 maxSize)
     }
     UNLOCK_MUTEX();
 
-    flush();
     return retVal;
 }
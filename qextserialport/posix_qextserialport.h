@@ -10,6 +10,7 @@
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include "qextserialbase.h"
+#include "posix_qextserialuring.h"
 
 class Posix_QextSerialPort:public QextSerialBase {
 public:
@@ -27,10 +28,13 @@ public:
     virtual void setStopBits(StopBitsType);
     virtual void setFlowControl(FlowType);
     virtual void setTimeout(ulong, ulong);
+    virtual bool setPortSettings(const PortSettings&);
+    virtual void setExclusive(bool set=true);
 
     virtual bool open(OpenMode mode=0);
     virtual void close();
     virtual void flush();
+    virtual void discardInput();
 
     virtual qint64 size() const;
     virtual qint64 bytesAvailable();
@@ -43,8 +47,44 @@ public:
     virtual void setRts(bool set=true);
     virtual ulong lineStatus();
 
+    virtual bool setLowLatency(bool enable=true);
+    virtual bool lowLatency() const;
+
+    virtual bool setIoUring(bool enable=true);
+    virtual bool ioUring() const;
+    static bool setIoUringDefault(bool enable);
+    static bool ioUringDefault();
+
 protected:
+    /*driver state changed by low latency mode, restored on close*/
+    struct LowLatencyState {
+        bool wanted;            //Apply on open
+        bool serialSaved;       //oldSerialFlags holds the flags from TIOCGSERIAL
+        int oldSerialFlags;
+        int oldLatencyTimer;    //Milliseconds, -1 if the latency timer wasn't changed
+        QString latencyTimerPath;
+        LowLatencyState() : wanted(false), serialSaved(false), oldSerialFlags(0), oldLatencyTimer(-1) {}
+    };
+
+    /*how the configuration is applied*/
+    struct ConfigState {
+        bool deferred;          //setPortSettings() is collecting changes
+        bool exclusive;         //Lock the port with TIOCEXCL when it's opened
+        ConfigState() : deferred(false), exclusive(false) {}
+    };
+
+    /*io_uring transport, see Posix_QextSerialUring*/
+    struct UringState {
+        static bool byDefault;  //For ports constructed from now on
+        bool wanted;            //Attach to the ring on open
+        Posix_QextSerialUring::Port *port;      //NULL when read() and write() are used
+        UringState() : wanted(byDefault), port(NULL) {}
+    };
+
     int	fd;
+    LowLatencyState lowLatencyState;
+    ConfigState configState;
+    UringState uringState;
     struct termios Posix_CommConfig;
     struct termios old_termios;
     struct timeval Posix_Timeout;
@@ -52,6 +92,10 @@ protected:
 
     virtual qint64 readData(char * data, qint64 maxSize);
     virtual qint64 writeData(const char * data, qint64 maxSize);
+
+    bool applyConfig();
+    void applyLowLatency();
+    void restoreLowLatency();
 };
 
 #endif
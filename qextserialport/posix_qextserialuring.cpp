@@ -0,0 +1,577 @@
+
+#include <algorithm>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <QTime>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "posix_qextserialuring.h"
+
+/*!
+\class Posix_QextSerialUring
+
+io_uring transport shared by every Posix_QextSerialPort that asks for it, Linux only.
+
+One thread owns the ring.  It keeps a read queued on every attached port, so received bytes
+land straight in the port's receive ring, and every time round it submits the reads and the
+writes that all of the ports have queued since the last round with a single io_uring_enter()
+call.  Small writes from the protocol code are collected in the port's transmit ring while the
+previous write is in flight and go out together.  The rings are used through the raw system
+calls, there's no dependency on liburing.
+
+The port rings are single producer, single consumer and lock free, so a port's user never takes
+a lock to read or write.  The user parks on a futex only when it has to wait, and the ring thread
+only makes the wake call when the user is parked.  The ring thread is kicked through its eventfd
+only when a transmit ring goes from empty to not empty, a full receive ring makes room, or a
+discard is asked for, at any other time it's already going to look at the port again.
+*/
+
+/*what a completion is for, kept in the low bits of the Port pointer*/
+enum {
+    OP_WAKE,                    //The eventfd, no port
+    OP_READ,
+    OP_WRITE,
+    OP_CANCEL
+};
+#define OP_MASK 3ULL
+
+static unsigned long long tag(Posix_QextSerialUring::Port *port, unsigned op)
+{
+    return (unsigned long long)(unsigned long)port | op;
+}
+
+/*!
+\fn Posix_QextSerialUring *Posix_QextSerialUring::instance()
+Returns the process wide ring, setting it up the first time.  Returns NULL if the kernel
+doesn't have io_uring, it's been turned off, or it's older than 5.7.
+*/
+Posix_QextSerialUring *Posix_QextSerialUring::instance()
+{
+    static QMutex lock;
+    static Posix_QextSerialUring *ring = NULL;
+    static bool tried = false;
+
+    lock.lock();
+    if (!tried) {
+        tried = true;
+        Posix_QextSerialUring *r = new Posix_QextSerialUring();
+        if (r->setup()) {
+            r->start();
+            ring = r;
+        } else
+            delete r;
+    }
+    lock.unlock();
+    return ring;
+}
+
+Posix_QextSerialUring::Posix_QextSerialUring()
+ : ringFd(-1), wakeFd(-1), wakeCount(0), wakeQueued(false), broken(false), pending(0), starved(false),
+   sqHead(NULL), sqTail(NULL), sqMask(NULL), sqArray(NULL), sqEntries(0), sqes(NULL),
+   cqHead(NULL), cqTail(NULL), cqMask(NULL), cqes(NULL)
+{}
+
+/*!
+\fn Posix_QextSerialUring::Port *Posix_QextSerialUring::attach(int fd)
+Starts reading fd into a new receive ring.  The port is the caller's until it's passed to
+detach().  Returns NULL if the ring has stopped working.
+*/
+Posix_QextSerialUring::Port *Posix_QextSerialUring::attach(int fd)
+{
+    mutex.lock();
+    if (broken) {
+        mutex.unlock();
+        return NULL;
+    }
+    Port *port = new Port(fd);
+    ports.push_back(port);
+    mutex.unlock();
+    kick();
+    return port;
+}
+
+/*!
+\fn void Posix_QextSerialUring::detach(Port *port)
+Cancels the port's read and any write still in flight, waits for the ring thread to let go of
+it, and deletes it.  Anything still in the transmit ring is dropped, use drain() first.
+*/
+void Posix_QextSerialUring::detach(Port *port)
+{
+    mutex.lock();
+    port->closing = true;
+    kick();
+    while (!port->released && !broken)
+        detached.wait(&mutex);
+    mutex.unlock();
+    delete port;
+}
+
+/*!
+\fn bool Posix_QextSerialUring::waitFor(Port *port, Condition what, long msec)
+Waits up to msec milliseconds, or forever if msec is negative, for the receive ring to hold
+something (RX_DATA), the transmit ring to have room (TX_ROOM) or be empty (TX_EMPTY), or the
+ring thread to finish the last discard (DISCARDED).  Returns
+false if it didn't happen or the port failed.  Used internally by the port's user.
+*/
+bool Posix_QextSerialUring::waitFor(Port *port, Condition what, long msec)
+{
+    QTime timer;
+    bool ready = false;
+    for (bool first = true; ; first = false) {
+        /*announce the wait before looking, so either the ring thread sees waiting and bumps event,
+          or the check below sees what it did*/
+        port->waiting = 1;
+        __sync_synchronize();
+        const int event = port->event;
+        __sync_synchronize();
+        switch (what) {
+            case RX_DATA:
+                ready = port->rxTail != port->rxHead;
+                break;
+            case TX_ROOM:
+                ready = (port->txTail - port->txHead) < URING_TX_SIZE;
+                break;
+            case TX_EMPTY:
+                ready = port->txTail == port->txHead;
+                break;
+            case DISCARDED:
+                ready = port->discarded == port->discards;
+                break;
+        }
+        if (ready || port->failed)
+            break;
+        if (first)
+            timer.start();
+        long left = -1;
+        if (msec >= 0) {
+            left = msec - timer.elapsed();
+            if (left <= 0)
+                break;
+        }
+#ifdef __linux__
+        struct timespec timeout;
+        timeout.tv_sec = left/1000;
+        timeout.tv_nsec = (left%1000)*1000000L;
+        syscall(SYS_futex, &port->event, FUTEX_WAIT_PRIVATE, event, (left < 0) ? NULL : &timeout, NULL, 0);
+#endif
+    }
+    port->waiting = 0;
+    return ready;
+}
+
+/*!
+\fn qint64 Posix_QextSerialUring::read(Port *port, char *data, qint64 maxSize, long msec)
+Takes up to maxSize bytes from the receive ring, waiting up to msec milliseconds for the first
+one (forever if msec is negative).  Returns the number of bytes taken, 0 on a timeout, or -1 if
+the port failed and nothing is left.
+*/
+qint64 Posix_QextSerialUring::read(Port *port, char *data, qint64 maxSize, long msec)
+{
+    if ((port->rxTail == port->rxHead) && !waitFor(port, RX_DATA, msec))
+        return port->failed ? -1 : 0;
+    const unsigned tail = port->rxTail;
+    __sync_synchronize();       //Read the bytes after the index that says they're there
+    const unsigned start = port->rxHead;
+    unsigned head = start;
+    qint64 n = 0;
+    while ((n < maxSize) && (head != tail)) {
+        const unsigned at = head & (URING_RX_SIZE-1);
+        const unsigned chunk = (unsigned)std::min<qint64>(maxSize - n, std::min(tail - head, URING_RX_SIZE - at));
+        memcpy(data + n, port->rx + at, chunk);
+        head += chunk;
+        n += chunk;
+    }
+    __sync_synchronize();       //Done with the bytes before the ring thread can reuse them
+    port->rxHead = head;
+    kickIfFilled(port, start);
+    return n;
+}
+
+/*!
+\fn qint64 Posix_QextSerialUring::available(Port *port, long msec)
+Waits up to msec milliseconds for the receive ring to hold something and returns how much it
+holds, 0 if nothing arrived in time or -1 if the port failed.
+*/
+qint64 Posix_QextSerialUring::available(Port *port, long msec)
+{
+    if ((port->rxTail == port->rxHead) && !waitFor(port, RX_DATA, msec))
+        return port->failed ? -1 : 0;
+    return port->rxTail - port->rxHead;
+}
+
+/*!
+\fn qint64 Posix_QextSerialUring::queued(Port *port)
+Returns the number of bytes in the receive ring without waiting.
+*/
+qint64 Posix_QextSerialUring::queued(Port *port)
+{
+    return port->rxTail - port->rxHead;
+}
+
+/*!
+\fn qint64 Posix_QextSerialUring::write(Port *port, const char *data, qint64 size)
+Copies the data into the transmit ring, waiting for room if it's full, and has the ring thread
+send it.  Returns size, or -1 if the port failed.
+*/
+qint64 Posix_QextSerialUring::write(Port *port, const char *data, qint64 size)
+{
+    qint64 n = 0;
+    while (n < size) {
+        if (port->failed)
+            return -1;
+        const unsigned head = port->txHead;
+        const unsigned tail = port->txTail;
+        const unsigned used = tail - head;
+        if (used == URING_TX_SIZE) {
+            waitFor(port, TX_ROOM, -1);
+            continue;
+        }
+        __sync_synchronize();   //Don't overwrite bytes the ring thread might still be sending
+        const unsigned at = tail & (URING_TX_SIZE-1);
+        const unsigned chunk = (unsigned)std::min<qint64>(size - n, std::min(URING_TX_SIZE - used, URING_TX_SIZE - at));
+        memcpy(port->tx + at, data + n, chunk);
+        __sync_synchronize();   //The bytes before the index that says they're there
+        port->txTail = tail + chunk;
+        n += chunk;
+        /*while the ring isn't empty a write is in flight, and the ring thread looks for more
+          when it completes.  The head is read again after the new tail is out, if the write
+          finished in between the ring thread might have seen the ring empty and stopped*/
+        __sync_synchronize();
+        if (port->txHead == tail)
+            kick();
+    }
+    return n;
+}
+
+/*!
+\fn void Posix_QextSerialUring::drain(Port *port)
+Waits until everything in the transmit ring has been handed to the driver.
+*/
+void Posix_QextSerialUring::drain(Port *port)
+{
+    if (port->txTail != port->txHead)
+        waitFor(port, TX_EMPTY, -1);
+}
+
+/*!
+\fn void Posix_QextSerialUring::discard(Port *port)
+Empties the receive ring, including whatever the read in flight brings in.  The ring thread
+cancels the read and empties the ring once the read's completion is in, so nothing received
+before the call turns up afterwards.
+*/
+void Posix_QextSerialUring::discard(Port *port)
+{
+    ++port->discards;
+    kick();
+    waitFor(port, DISCARDED, -1);
+}
+
+/*!
+\fn void Posix_QextSerialUring::kickIfFilled(Port *port, unsigned start)
+Kicks the ring thread if the receive ring was full with its head at start, after the user has
+moved the head on.  The ring thread stops reading a full port, and the tail is read again after
+the new head is out because a read can fill the ring after the user last looked.  Used
+internally by the port's user.
+*/
+void Posix_QextSerialUring::kickIfFilled(Port *port, unsigned start)
+{
+    __sync_synchronize();       //The new head before the look at the tail, see notify()
+    if (port->rxTail - start == URING_RX_SIZE)
+        kick();
+}
+
+#ifdef __linux__
+
+/*!
+\fn bool Posix_QextSerialUring::setup()
+Creates the ring and maps its queues.  Used internally.
+*/
+bool Posix_QextSerialUring::setup()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if ((ringFd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) < 0)
+        return false;
+
+    /*reads and writes on file descriptors came in 5.6, and before 5.7 a read on a quiet port
+      would tie up one of the kernel's worker threads instead of waiting on the tty's poll queue*/
+    size_t sqSize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+        sqSize = cqSize = std::max(sqSize, cqSize);
+    void *sq = MAP_FAILED, *cq = MAP_FAILED, *entries = MAP_FAILED;
+    if (params.features & IORING_FEAT_FAST_POLL) {
+        sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cq = single ? sq : mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        entries = mmap(NULL, params.sq_entries*sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+    }
+    if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (entries == MAP_FAILED) || (wakeFd < 0)) {
+        if (entries != MAP_FAILED)
+            munmap(entries, params.sq_entries*sizeof(struct io_uring_sqe));
+        if ((cq != MAP_FAILED) && !single)
+            munmap(cq, cqSize);
+        if (sq != MAP_FAILED)
+            munmap(sq, sqSize);
+        if (wakeFd >= 0)
+            ::close(wakeFd);
+        ::close(ringFd);
+        ringFd = wakeFd = -1;
+        return false;
+    }
+
+    sqHead = (unsigned*)((char*)sq + params.sq_off.head);
+    sqTail = (unsigned*)((char*)sq + params.sq_off.tail);
+    sqMask = (unsigned*)((char*)sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)((char*)sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+    sqes = (struct io_uring_sqe*)entries;
+    cqHead = (unsigned*)((char*)cq + params.cq_off.head);
+    cqTail = (unsigned*)((char*)cq + params.cq_off.tail);
+    cqMask = (unsigned*)((char*)cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((char*)cq + params.cq_off.cqes);
+    return true;
+}
+
+/*!
+\fn void Posix_QextSerialUring::kick()
+Gets the ring thread out of io_uring_enter() to look at the ports again.  Called by the ports'
+users, only when the ring thread might not otherwise look.
+*/
+void Posix_QextSerialUring::kick()
+{
+    const unsigned long long one = 1;
+    if (::write(wakeFd, &one, sizeof(one)) < 0)
+        qWarning("Posix_QextSerialUring: can't wake the ring thread (%d)", errno);
+}
+
+/*!
+\fn void Posix_QextSerialUring::notify(Port *port)
+Wakes the port's user if it's waiting on the port.  Used internally by the ring thread after it
+changes the port.
+*/
+void Posix_QextSerialUring::notify(Port *port)
+{
+    __sync_synchronize();       //The change before the look at waiting, see waitFor()
+    if (port->waiting) {
+        __sync_fetch_and_add(&port->event, 1);
+        syscall(SYS_futex, &port->event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*!
+\fn struct io_uring_sqe *Posix_QextSerialUring::nextSqe()
+Returns a cleared submission queue entry, or NULL if the queue is full.  It's handed to the
+kernel with the rest of the round's entries.  Used internally.
+*/
+struct io_uring_sqe *Posix_QextSerialUring::nextSqe()
+{
+    const unsigned tail = *sqTail + pending;
+    const unsigned head = *(volatile unsigned*)sqHead;
+    if (tail - head >= sqEntries) {
+        starved = true;
+        return NULL;
+    }
+    const unsigned i = tail & *sqMask;
+    struct io_uring_sqe *sqe = &sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[i] = i;
+    ++pending;
+    return sqe;
+}
+
+static void prepare(struct io_uring_sqe *sqe, unsigned char opcode, int fd, void *buffer, unsigned size, unsigned long long tag)
+{
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buffer;
+    sqe->len = size;
+    if (opcode != IORING_OP_ASYNC_CANCEL)
+        sqe->off = (unsigned long long)-1;  //The current position, ttys don't have one
+    sqe->user_data = tag;
+}
+
+/*!
+\fn void Posix_QextSerialUring::queueWork()
+Queues a read on every port with room in its receive ring, a write for every port with
+something in its transmit ring, and cancels for the ports being detached.  A port with a
+discard waiting has its read cancelled, and its receive ring emptied once the read is back.
+Used internally, the mutex must be held.
+*/
+void Posix_QextSerialUring::queueWork()
+{
+    struct io_uring_sqe *sqe;
+    if (!wakeQueued && ((sqe = nextSqe()) != NULL)) {
+        prepare(sqe, IORING_OP_READ, wakeFd, &wakeCount, sizeof(wakeCount), tag(NULL, OP_WAKE));
+        wakeQueued = true;
+    }
+
+    for (size_t i = 0; i < ports.size(); ) {
+        Port *port = ports[i];
+        if (port->closing) {
+            if (!port->readQueued && !port->writeQueued) {
+                ports.erase(ports.begin() + i);
+                port->released = true;
+                detached.wakeAll();
+                continue;
+            }
+            /*each cancel is only marked once its entry is queued, one that didn't fit goes next round*/
+            if (port->readQueued && !port->readCancelQueued && ((sqe = nextSqe()) != NULL)) {
+                prepare(sqe, IORING_OP_ASYNC_CANCEL, -1, (void*)(unsigned long)tag(port, OP_READ), 0, tag(port, OP_CANCEL));
+                port->readCancelQueued = true;
+            }
+            if (port->writeQueued && !port->writeCancelQueued && ((sqe = nextSqe()) != NULL)) {
+                prepare(sqe, IORING_OP_ASYNC_CANCEL, -1, (void*)(unsigned long)tag(port, OP_WRITE), 0, tag(port, OP_CANCEL));
+                port->writeCancelQueued = true;
+            }
+        } else if (!port->failed) {
+            const unsigned discards = port->discards;
+            if (port->discarded != discards) {
+                if (!port->readQueued) {
+                    /*the user is waiting in discard(), so the tail can go back to the head*/
+                    port->readCancelQueued = false;
+                    port->rxTail = port->rxHead;
+                    port->discarded = discards;
+                    notify(port);
+                } else if (!port->readCancelQueued && ((sqe = nextSqe()) != NULL)) {
+                    prepare(sqe, IORING_OP_ASYNC_CANCEL, -1, (void*)(unsigned long)tag(port, OP_READ), 0, tag(port, OP_CANCEL));
+                    port->readCancelQueued = true;
+                }
+            }
+            const unsigned rxUsed = port->rxTail - port->rxHead;
+            const unsigned txUsed = port->txTail - port->txHead;
+            __sync_synchronize();       //Read the indexes before the rings
+            if (!port->readQueued && (rxUsed < URING_RX_SIZE) && ((sqe = nextSqe()) != NULL)) {
+                const unsigned at = port->rxTail & (URING_RX_SIZE-1);
+                prepare(sqe, IORING_OP_READ, port->fd, port->rx + at, std::min(URING_RX_SIZE - rxUsed, URING_RX_SIZE - at), tag(port, OP_READ));
+                port->readQueued = true;
+            }
+            if (!port->writeQueued && (txUsed > 0) && ((sqe = nextSqe()) != NULL)) {
+                const unsigned at = port->txHead & (URING_TX_SIZE-1);
+                prepare(sqe, IORING_OP_WRITE, port->fd, port->tx + at, std::min(txUsed, URING_TX_SIZE - at), tag(port, OP_WRITE));
+                port->writeQueued = true;
+            }
+        }
+        ++i;
+    }
+}
+
+/*!
+\fn void Posix_QextSerialUring::complete(unsigned long long tag, int res)
+Handles one completion.  Used internally, the mutex must be held.
+*/
+void Posix_QextSerialUring::complete(unsigned long long tag, int res)
+{
+    Port *port = (Port*)(unsigned long)(tag & ~OP_MASK);
+    /*a cancelled or interrupted request is simply queued again, anything else that isn't
+      progress means the port is gone, a read of 0 is a hangup*/
+    const bool retry = (res == -EAGAIN) || (res == -EINTR) || (res == -ECANCELED);
+    switch (tag & OP_MASK) {
+        case OP_WAKE:
+            wakeQueued = false;
+            break;
+        case OP_READ:
+            port->readQueued = false;
+            if (res > 0)
+                port->rxTail += res;
+            else if (!retry)
+                port->failed = true;
+            notify(port);
+            break;
+        case OP_WRITE:
+            port->writeQueued = false;
+            if (res > 0)
+                port->txHead += res;
+            else if (!retry)
+                port->failed = true;
+            notify(port);
+            break;
+        default:
+            break;
+    }
+}
+
+/*!
+\fn void Posix_QextSerialUring::reap()
+Handles every completion that's waiting.  Used internally, the mutex must be held.
+*/
+void Posix_QextSerialUring::reap()
+{
+    unsigned head = *cqHead;
+    const unsigned tail = *(volatile unsigned*)cqTail;
+    __sync_synchronize();       //Read the entries after the tail
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+        complete(cqe->user_data, cqe->res);
+    }
+    __sync_synchronize();       //Done with the entries before the kernel can reuse them
+    *cqHead = head;
+}
+
+/*!
+\fn void Posix_QextSerialUring::run()
+The ring thread, runs for the life of the process.
+*/
+void Posix_QextSerialUring::run()
+{
+    mutex.lock();
+    for (;;) {
+        queueWork();
+        __sync_synchronize();   //Entries before the tail
+        *sqTail += pending;
+        pending = 0;
+        const unsigned submit = *sqTail - *(volatile unsigned*)sqHead;
+        const unsigned wait = starved ? 0 : 1;  //Something didn't fit, there's room once this lot is in
+        starved = false;
+        mutex.unlock();
+
+        const int r = syscall(__NR_io_uring_enter, ringFd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        mutex.lock();
+        if ((r < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+            qWarning("Posix_QextSerialUring: io_uring_enter failed (%d), the ports are closed", errno);
+            for (size_t i = 0; i < ports.size(); ++i) {
+                ports[i]->failed = true;
+                ports[i]->readQueued = ports[i]->writeQueued = false;
+                ports[i]->released = true;
+                notify(ports[i]);
+            }
+            ports.clear();
+            broken = true;
+            detached.wakeAll();
+            break;
+        }
+        reap();
+    }
+    mutex.unlock();
+}
+
+#else
+
+bool Posix_QextSerialUring::setup()
+{
+    return false;
+}
+
+void Posix_QextSerialUring::kick()
+{}
+
+void Posix_QextSerialUring::notify(Port *)
+{}
+
+void Posix_QextSerialUring::run()
+{}
+
+#endif
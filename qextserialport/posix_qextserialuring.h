@@ -0,0 +1,94 @@
+
+#ifndef _POSIX_QEXTSERIALURING_H_
+#define _POSIX_QEXTSERIALURING_H_
+
+#include <vector>
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+/*per-port buffers, powers of two*/
+#define URING_RX_SIZE 4096
+#define URING_TX_SIZE 4096
+#define URING_ENTRIES 256       //Submission queue entries, two per port are in flight at most
+
+class Posix_QextSerialUring : public QThread {
+public:
+    /*the receive ring is filled by the ring thread and emptied by the port's user, the transmit
+      ring the other way round.  Each index is written by one side only, so neither takes a lock*/
+    struct Port {
+        int fd;
+        volatile bool closing;  //detach() is waiting for the reads and writes to finish
+        volatile bool failed;   //A read or write failed, the port is dead
+        volatile unsigned rxHead, rxTail;       //Free running, the ring holds rxTail-rxHead bytes
+        volatile unsigned txHead, txTail;
+        char rx[URING_RX_SIZE];
+        char tx[URING_TX_SIZE];
+        volatile int waiting;   //The user is parked on event
+        volatile int event;     //Bumped by the ring thread to wake the user, a futex
+        volatile unsigned discards;     //Bumped by the user to have the receive ring emptied
+        volatile unsigned discarded;    //Set to discards by the ring thread once it's done
+
+        /*the ring thread's own*/
+        bool readQueued;
+        bool writeQueued;
+        bool readCancelQueued;
+        bool writeCancelQueued;
+        bool released;          //Done with the port, guarded by the mutex
+
+        Port(int f) : fd(f), closing(false), failed(false), rxHead(0), rxTail(0), txHead(0), txTail(0),
+            waiting(0), event(0), discards(0), discarded(0), readQueued(false), writeQueued(false),
+            readCancelQueued(false), writeCancelQueued(false), released(false) {}
+    };
+
+    static Posix_QextSerialUring *instance();   //NULL if the kernel can't do it
+
+    Port *attach(int fd);
+    void detach(Port *port);
+
+    /*a port is used from one thread at a time*/
+    qint64 read(Port *port, char *data, qint64 maxSize, long msec);
+    qint64 available(Port *port, long msec);
+    qint64 queued(Port *port);
+    qint64 write(Port *port, const char *data, qint64 size);
+    void drain(Port *port);
+    void discard(Port *port);
+
+protected:
+    virtual void run();
+
+private:
+    enum Condition { RX_DATA, TX_ROOM, TX_EMPTY, DISCARDED };
+
+    Posix_QextSerialUring();
+    bool setup();
+    void kick();
+    void kickIfFilled(Port *port, unsigned start);
+    void notify(Port *port);
+    bool waitFor(Port *port, Condition what, long msec);
+    void queueWork();
+    void reap();
+    void complete(unsigned long long tag, int res);
+    struct io_uring_sqe *nextSqe();
+
+    int ringFd;
+    int wakeFd;                 //eventfd the ring thread keeps a read queued on
+    unsigned long long wakeCount;
+    bool wakeQueued;
+    volatile bool broken;       //io_uring_enter() failed, every port has failed
+    unsigned pending;           //SQEs filled in but not published to the kernel yet
+    bool starved;               //nextSqe() ran out this round, go round again without waiting
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    QMutex mutex;               //Guards the list of ports, reads and writes don't take it
+    QWaitCondition detached;
+    std::vector<Port*> ports;
+};
+
+#endif
@@ -167,6 +167,40 @@ FlowType QextSerialBase::flowControl() const
     return Settings.FlowControl;
 }
 
+/*!
+\fn bool QextSerialBase::setPortSettings(const PortSettings& settings)
+Changes every setting of the port at once.  This implementation calls each setter in turn,
+ports that can apply a whole configuration in one step override it.
+*/
+bool QextSerialBase::setPortSettings(const PortSettings& settings)
+{
+    setBaudRate(settings.BaudRate);
+    setDataBits(settings.DataBits);
+    setParity(settings.Parity);
+    setStopBits(settings.StopBits);
+    setFlowControl(settings.FlowControl);
+    setTimeout(settings.Timeout_Sec, settings.Timeout_Millisec);
+    return true;
+}
+
+/*!
+\fn const PortSettings& QextSerialBase::portSettings() const
+Returns the settings the port is configured with.
+*/
+const PortSettings& QextSerialBase::portSettings() const
+{
+    return Settings;
+}
+
+/*!
+\fn void QextSerialBase::setExclusive(bool set)
+Asks for the port to be locked against other opens while it's open.  Ports that are always
+opened exclusively, or can't be locked, ignore it.
+*/
+void QextSerialBase::setExclusive(bool)
+{
+}
+
 /*!
 \fn bool QextSerialBase::isSequential() const
 Returns true if device is sequential, otherwise returns false. Serial port is sequential device
@@ -218,6 +252,25 @@ qint64 QextSerialBase::readLine(char * data, qint64 maxSize)
     return (pData-data);
 }
 
+/*!
+\fn bool QextSerialBase::setLowLatency(bool enable)
+Asks the driver to hand received bytes over as soon as they arrive instead of batching them.
+Ports that don't support it ignore the request and return false.
+*/
+bool QextSerialBase::setLowLatency(bool)
+{
+    return false;
+}
+
+/*!
+\fn bool QextSerialBase::lowLatency() const
+Returns true if low latency mode is in effect on the open port.
+*/
+bool QextSerialBase::lowLatency() const
+{
+    return false;
+}
+
 /*!
 \fn ulong QextSerialBase::lastError() const
 Returns the code for the last error encountered by the port, or E_NO_ERROR if the last port
@@ -158,11 +158,15 @@ public:
     virtual void setFlowControl(FlowType)=0;
     virtual FlowType flowControl() const;
     virtual void setTimeout(ulong, ulong)=0;
+    virtual bool setPortSettings(const PortSettings&);
+    virtual const PortSettings& portSettings() const;
+    virtual void setExclusive(bool set=true);
 
     virtual bool open(OpenMode mode=0)=0;
     virtual bool isSequential() const;
     virtual void close()=0;
     virtual void flush()=0;
+    virtual void discardInput()=0;
 
     virtual qint64 size() const=0;
     virtual qint64 bytesAvailable()=0;
@@ -178,6 +182,9 @@ public:
     virtual void setRts(bool set=true)=0;
     virtual ulong lineStatus()=0;
 
+    virtual bool setLowLatency(bool enable=true);
+    virtual bool lowLatency() const;
+
 protected:
     QString port;
     PortSettings Settings;
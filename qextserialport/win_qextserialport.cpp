@@ -204,6 +204,23 @@ void Win_QextSerialPort::flush() {
     UNLOCK_MUTEX();
 }
 
+/*!
+\fn void Win_QextSerialPort::discardInput()
+Throws away everything that has been received but not yet read, both in the driver and in
+the QIODevice buffer.  This function has no effect if the serial port associated with the
+class is not currently open.
+*/
+void Win_QextSerialPort::discardInput() {
+    const qint64 buffered = QIODevice::bytesAvailable();
+    if (buffered > 0)
+        QIODevice::read(buffered);
+    LOCK_MUTEX();
+    if (isOpen()) {
+        PurgeComm(Win_Handle, PURGE_RXABORT | PURGE_RXCLEAR);
+    }
+    UNLOCK_MUTEX();
+}
+
 /*!
 \fn qint64 Win_QextSerialPort::size() const
 This function will return the number of bytes waiting in the receive queue of the serial port.
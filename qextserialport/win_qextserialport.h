@@ -22,6 +22,7 @@ public:
     virtual bool open(OpenMode mode=0);
     virtual void close();
     virtual void flush();
+    virtual void discardInput();
     virtual qint64 size() const;
     virtual void ungetChar(char c);
     virtual void setFlowControl(FlowType);
@@ -0,0 +1,52 @@
+######################################################################
+# qprogbench, benchmarks of the host side of programming
+#	Prints one JSON object per result, see src/qprogbench_main.cc
+######################################################################
+
+TEMPLATE = app
+TARGET = qprogbench
+CONFIG	+= warn_on qt stl console release
+CONFIG	-= app_bundle
+QT	-= gui
+MOC_DIR = build/qprogbench
+OBJECTS_DIR = obj/qprogbench
+
+# Input
+HEADERS	+= src/bench.h src/kitsim.h
+SOURCES	+= src/qprogbench_main.cc src/bench.cc src/kitsim.cc
+
+HEADERS	+= src/intelhex.h
+SOURCES	+= src/intelhex.cc
+HEADERS	+= src/kitsrus.h
+SOURCES	+= src/kitsrus.cc
+HEADERS	+= src/logging.h
+SOURCES	+= src/logging.cc
+HEADERS	+= src/chipinfo.h
+SOURCES	+= src/chipinfo.cc
+HEADERS	+= src/corefamily.h
+SOURCES	+= src/corefamily.cc
+HEADERS	+= src/imagecache.h
+SOURCES	+= src/imagecache.cc
+HEADERS	+= src/qpimg.h
+SOURCES	+= src/qpimg.cc
+HEADERS	+= src/verify.h
+SOURCES	+= src/verify.cc
+HEADERS	+= src/checksum.h
+SOURCES	+= src/checksum.cc
+HEADERS	+= src/programmer.h
+SOURCES	+= src/programmer.cc
+HEADERS	+= src/reactor.h
+SOURCES	+= src/reactor.cc
+HEADERS	+= src/kitasync.h
+SOURCES	+= src/kitasync.cc
+unix:LIBS	+= -lrt		# clock_gettime
+
+# qextserialport stuff, the simulated programmer is on a pty so it's POSIX only
+INCLUDEPATH += qextserialport
+HEADERS	+= qextserialport/qextserialbase.h qextserialport/qextserialport.h
+SOURCES	+= qextserialport/qextserialbase.cpp qextserialport/qextserialport.cpp
+HEADERS	+= qextserialport/posix_qextserialport.h
+SOURCES	+= qextserialport/posix_qextserialport.cpp
+HEADERS	+= qextserialport/posix_qextserialuring.h
+SOURCES	+= qextserialport/posix_qextserialuring.cpp
+DEFINES	+= _TTY_POSIX_
@@ -0,0 +1,51 @@
+######################################################################
+# qprogd, the programming daemon
+######################################################################
+
+QPROG_VERSION = "0.4"
+TEMPLATE = app
+TARGET = qprogd
+CONFIG	+= warn_on qt stl console
+CONFIG	-= app_bundle
+QT	-= gui
+QT	+= network
+DEFINES += QPROG_VERSION=\"$${QPROG_VERSION}\"
+MOC_DIR = build/qprogd
+OBJECTS_DIR = obj/qprogd
+
+# Input
+HEADERS	+= src/qprogd.h src/jobs.h
+SOURCES	+= src/qprogd_main.cc src/qprogd.cc src/jobs.cc
+
+HEADERS	+= src/intelhex.h
+SOURCES	+= src/intelhex.cc
+HEADERS	+= src/kitsrus.h
+SOURCES	+= src/kitsrus.cc
+HEADERS	+= src/logging.h
+SOURCES	+= src/logging.cc
+HEADERS	+= src/chipinfo.h
+SOURCES	+= src/chipinfo.cc
+HEADERS	+= src/corefamily.h
+SOURCES	+= src/corefamily.cc
+HEADERS	+= src/imagecache.h
+SOURCES	+= src/imagecache.cc
+HEADERS	+= src/qpimg.h
+SOURCES	+= src/qpimg.cc
+HEADERS	+= src/verify.h
+SOURCES	+= src/verify.cc
+HEADERS	+= src/checksum.h
+SOURCES	+= src/checksum.cc
+HEADERS	+= src/devicelibrary.h
+SOURCES	+= src/devicelibrary.cc
+HEADERS	+= src/programmer.h
+SOURCES	+= src/programmer.cc
+
+# qextserialport stuff, the daemon uses local sockets so it's POSIX only
+INCLUDEPATH += qextserialport
+HEADERS	+= qextserialport/qextserialbase.h qextserialport/qextserialport.h
+SOURCES	+= qextserialport/qextserialbase.cpp qextserialport/qextserialport.cpp
+HEADERS	+= qextserialport/posix_qextserialport.h
+SOURCES	+= qextserialport/posix_qextserialport.cpp
+HEADERS	+= qextserialport/posix_qextserialuring.h
+SOURCES	+= qextserialport/posix_qextserialuring.cpp
+DEFINES	+= _TTY_POSIX_
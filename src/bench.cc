@@ -0,0 +1,131 @@
+/*	Filename:	bench.cc
+	Timing harness for qprogbench
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "bench.h"
+
+namespace bench
+{
+	static uint64_t now_usec()
+	{
+		struct timeval	tv;
+		gettimeofday(&tv, NULL);
+		return uint64_t(tv.tv_sec)*1000000 + tv.tv_usec;
+	}
+
+	//Escape a string for a JSON value
+	static std::string quote(const std::string &s)
+	{
+		std::string	r("\"");
+		for(std::string::const_iterator i=s.begin(); i != s.end(); ++i)
+		{
+			const unsigned char	c(*i);
+			if( (c == '"') || (c == '\\') )
+			{
+				r += '\\';
+				r += c;
+			}
+			else if( c < 0x20 )
+			{
+				char	u[8];
+				snprintf(u, sizeof(u), "\\u%04X", c);
+				r += u;
+			}
+			else
+				r += c;
+		}
+		return r + "\"";
+	}
+
+	bool runner_t::wanted(const std::string &name) const
+	{
+		return filter.empty() || (name.find(filter) != std::string::npos);
+	}
+
+	void runner_t::report(const result_t &r)
+	{
+		char	line[256];
+		os << "{\"bench\":" << quote(r.name);
+		if( !tag.empty() )
+			os << ",\"tag\":" << quote(tag);
+		if( !r.error.empty() )
+			os << ",\"error\":" << quote(r.error);
+		else
+		{
+			snprintf(line, sizeof(line), ",\"iterations\":%u,\"samples\":%u,\"median_ns\":%.1f,\"min_ns\":%.1f,\"max_ns\":%.1f,\"items\":%llu,\"ns_per_item\":%.3f",
+				r.iterations, r.samples, r.median_ns, r.min_ns, r.max_ns, (unsigned long long)r.items, r.items ? r.median_ns/r.items : 0.0);
+			os << line;
+		}
+		os << "}" << std::endl;
+	}
+
+	void runner_t::fail(const std::string &name, const std::string &error)
+	{
+		if( !wanted(name) )
+			return;
+		result_t	r;
+		r.name = name;
+		r.error = error;
+		++failures;
+		report(r);
+	}
+
+	void runner_t::run(const std::string &name, case_t &c, uint64_t items)
+	{
+		if( !wanted(name) )
+			return;
+		result_t	r;
+		r.name = name;
+		r.items = items;
+		r.samples = samples;
+
+		//Double the iterations until a sample takes long enough to time,
+		//	this also warms the caches up
+		unsigned	n(1);
+		uint64_t	elapsed(0);
+		for(;;)
+		{
+			const uint64_t	start(now_usec());
+			for(unsigned i=0; i < n; ++i)
+				if( !c.run() )
+				{
+					fail(name, "Case failed");
+					return;
+				}
+			elapsed = now_usec() - start;
+			if( (elapsed >= min_sample_usec) || (n >= (1U << 30)) )
+				break;
+			//Jump most of the way in one go once the time is measurable
+			n = (elapsed > min_sample_usec/16) ? unsigned(double(n)*min_sample_usec/elapsed) + 1 : 2*n;
+		}
+		r.iterations = n;
+
+		std::vector<double>	ns;
+		ns.reserve(samples);
+		for(unsigned s=0; s < samples; ++s)
+		{
+			const uint64_t	start(now_usec());
+			for(unsigned i=0; i < n; ++i)
+				if( !c.run() )
+				{
+					fail(name, "Case failed");
+					return;
+				}
+			ns.push_back(1000.0*(now_usec() - start)/n);
+		}
+		std::sort(ns.begin(), ns.end());
+		r.min_ns = ns.front();
+		r.max_ns = ns.back();
+		r.median_ns = (samples % 2) ? ns[samples/2] : (ns[samples/2 - 1] + ns[samples/2])/2;
+		report(r);
+	}
+}
@@ -0,0 +1,68 @@
+/*	Filename:	bench.h
+	Timing harness for qprogbench
+
+	Every case is run in samples of enough iterations to last the minimum
+	sample time, and the median of the samples is reported. Results are
+	written one JSON object per line so they can be collected per commit
+	and compared by a script.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	BENCH_H
+#define	BENCH_H
+
+#include <ostream>
+#include <string>
+
+#include <stdint.h>
+
+namespace bench
+{
+	//One thing to measure
+	class case_t
+	{
+	public:
+		virtual ~case_t() {}
+		virtual bool	run() = 0;		//One iteration, false if it failed
+	};
+
+	struct result_t
+	{
+		std::string	name;
+		unsigned	iterations;		//Per sample
+		unsigned	samples;
+		double	median_ns;			//Per iteration
+		double	min_ns;
+		double	max_ns;
+		uint64_t	items;			//Words, bytes or keys handled by one iteration
+		std::string	error;			//Set if the case failed, nothing else is valid then
+	};
+
+	class runner_t
+	{
+		std::ostream	&os;
+		std::string	filter;
+		std::string	tag;
+		unsigned	samples;
+		unsigned	min_sample_usec;
+		unsigned	failures;
+
+		void	report(const result_t &);
+	public:
+		runner_t(std::ostream &o) : os(o), samples(5), min_sample_usec(50000), failures(0) {}
+
+		void	set_filter(const std::string &f)	{ filter = f; }		//Only run cases whose names contain f
+		void	set_tag(const std::string &t)	{ tag = t; }		//Added to every result, e.g. a commit hash
+		void	set_samples(unsigned n)	{ samples = n ? n : 1; }
+		void	set_min_sample_time(unsigned usec)	{ min_sample_usec = usec; }
+
+		bool	wanted(const std::string &name) const;
+		void	run(const std::string &name, case_t &, uint64_t items);
+		void	fail(const std::string &name, const std::string &error);	//Report a case that couldn't be set up
+		unsigned	failed() const	{ return failures; }
+	};
+}
+
+#endif	//BENCH_H
@@ -11,12 +11,16 @@
 
 #include <iostream>
 
+#include <QCryptographicHash>
+#include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QGridLayout>
 #include <QLabel>
 #include <QMessageBox>
 #include <QSettings>
 #include <QStringList>
+#include <QTime>
 
 #ifdef	Q_OS_DARWIN
 #include <sstream>
@@ -28,13 +32,37 @@
 #endif	//Q_OS_DARWIN
 
 #include "chipinfo.h"
+#include "devicelibrary.h"
+#include "imagecache.h"
 #include "intelhex.h"
 #include "centralwidget.h"
+#include "programmer.h"
+#include "verify.h"
 
 #include "qextserialport.h"
 
-CentralWidget::CentralWidget() : QWidget()
+//Labels the progress dialog with the step that's running
+class dialog_observer_t : public programmer::observer_t
 {
+	QProgressDialog	*dialog;
+public:
+	dialog_observer_t(QProgressDialog *d) : dialog(d) {}
+	void	phase(const char *s)	{ dialog->setLabelText(s); }
+};
+
+CentralWidget::CentralWidget() : QWidget(), busy(false), session(NULL), productionState(PRODUCTION_OFF)
+{
+	//The watcher has to exist before the checkbox states are restored
+	fileWatcher = new QFileSystemWatcher(this);
+	connect(fileWatcher, SIGNAL(fileChanged(const QString&)), this, SLOT(onWatchedFileChanged(const QString&)));
+	reprogramTimer = new QTimer(this);
+	reprogramTimer->setSingleShot(true);
+	reprogramTimer->setInterval(500);	//Editors and linkers write in bursts, wait for them to settle
+	connect(reprogramTimer, SIGNAL(timeout()), this, SLOT(onReprogramTimeout()));
+	productionTimer = new QTimer(this);
+	productionTimer->setInterval(50);
+	connect(productionTimer, SIGNAL(timeout()), this, SLOT(onProductionPoll()));
+
 	QLabel	*ProgrammerDeviceNodeLabel = new QLabel("Programmer Port");
 	QLabel	*TargetTypeLabel = new QLabel("Target Device");
 	
@@ -48,25 +76,32 @@ CentralWidget::CentralWidget() : QWidget()
 	VerifyCheckBox = new QCheckBox("Verify after programming");
 	NewWindowOnReadCheckBox = new QCheckBox("Open new window on read");
 	ProgramOnFileChangeCheckBox = new QCheckBox("Reprogram on file change");
-	ProgramOnFileChangeCheckBox->setEnabled(false);
+	ContinuousCheckBox = new QCheckBox("Continuous production");
+	productionLabel = new QLabel;
 
 	//Connect the checkbox change signals so the state changes can be saved to settings
 	connect(EraseCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onEraseCheckBoxChange(int)));
 	connect(VerifyCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onVerifyCheckBoxChange(int)));
 	connect(NewWindowOnReadCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onNewWindowOnReadCheckBoxChange(int)));
 	connect(ProgramOnFileChangeCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onProgramOnFileChangeCheckBoxChange(int)));
+	connect(ContinuousCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onContinuousCheckBoxChange(int)));
 
 	QPushButton	*ProgramButton = new QPushButton("Program");
 	QPushButton	*ReadButton = new QPushButton("Read");
 	QPushButton	*VerifyButton = new QPushButton("Verify");
 	QPushButton	*EraseButton = new QPushButton("Erase");
+	QPushButton	*BlankCheckButton = new QPushButton("Blank Check");
+	QPushButton	*DetectButton = new QPushButton("Detect");
 	connect(ProgramButton, SIGNAL(clicked()), this, SLOT(program_all()));
 	connect(ReadButton, SIGNAL(clicked()), this, SLOT(read()));
 	connect(VerifyButton, SIGNAL(clicked()), this, SLOT(onVerify()));
 	connect(EraseButton, SIGNAL(clicked()), this, SLOT(bulk_erase()));
+	connect(BlankCheckButton, SIGNAL(clicked()), this, SLOT(blank_check()));
+	connect(DetectButton, SIGNAL(clicked()), this, SLOT(detect()));
 
 	FileName = new QComboBox();
 	FileName->setMaxCount(5);
+	connect(FileName, SIGNAL(activated(int)), this, SLOT(onFileNameComboChange(int)));
 
 	QPushButton	*BrowseButton = new QPushButton("Browse");
 	connect(BrowseButton, SIGNAL(clicked()), this, SLOT(browse()));
@@ -95,6 +130,10 @@ CentralWidget::CentralWidget() : QWidget()
 	Layout0->addWidget(ReadButton, 5, 1);
 	Layout0->addWidget(VerifyButton, 5, 2);
 	Layout0->addWidget(EraseButton, 5, 3);
+	Layout0->addWidget(ContinuousCheckBox, 6, 0, 1, 2);
+	Layout0->addWidget(DetectButton, 6, 2);
+	Layout0->addWidget(BlankCheckButton, 6, 3);
+	Layout0->addWidget(productionLabel, 7, 0, 1, 4);
 	
 	setLayout(Layout0);
 
@@ -124,6 +163,15 @@ CentralWidget::CentralWidget() : QWidget()
 	
 	progressDialog = new QProgressDialog(this);
 	progressDialog->setModal(true);
+	observer = new dialog_observer_t(progressDialog);
+
+	updateFileWatch();	//Start watching the restored file if reprogramming is enabled
+}
+
+CentralWidget::~CentralWidget()
+{
+	closeSession();
+	delete observer;
 }
 
 void CentralWidget::onEraseCheckBoxChange(int state)
@@ -144,11 +192,26 @@ void CentralWidget::onNewWindowOnReadCheckBoxChange(int state)
 void CentralWidget::onProgramOnFileChangeCheckBoxChange(int state)
 {
 	settings.setValue("CentralWidget/ProgramOnFileChangeCheckBox/checkState", state);
+	updateFileWatch();
+}
+
+void CentralWidget::onContinuousCheckBoxChange(int state)
+{
+	if( state == Qt::Checked )
+		startProduction();
+	else if( productionState != PRODUCTION_OFF )
+		stopProduction(tr("Continuous production stopped"));
+}
+
+void CentralWidget::onFileNameComboChange(int)
+{
+	updateFileWatch();
 }
 
 bool CentralWidget::FillTargetCombo()
 {
 	TargetType->clear();
+	devicelibrary::library().load();	//Pick up any changes to the device info
 
 	QSettings	settings;
 	if( !settings.childGroups().contains("DeviceInfo") )
@@ -193,11 +256,13 @@ bool CentralWidget::FillTargetCombo()
 void CentralWidget::onTargetComboChange(const QString &text)
 {
 	settings.setValue("CentralWidget/TargetCombo/Last/Text", text);
+	closeSession();		//The open session was initialized for the old target
 }
 
 void CentralWidget::onDeviceComboChange(const QString &text)
 {
 	settings.setValue("CentralWidget/DeviceCombo/Last/Text", text);
+	closeSession();
 }
 
 void CentralWidget::browse()
@@ -225,249 +290,208 @@ void CentralWidget::browse()
 			settings.setValue("Path", FileName->itemData(i));
 		}
 		settings.endArray();
+
+		updateFileWatch();
 	}
 }
 
-//Load the chip info from the settings
-bool loadChipInfo(QString &part, chipinfo::chipinfo &chip_info)
+//Hash the contents of a file so that touching a file without changing it
+//	doesn't trigger a reprogram
+static QByteArray fileHash(const QString &path)
 {
-	QSettings	settings;
-	if( !settings.childGroups().contains("DeviceInfo") )
-		return false;
+	QFile	file(path);
+	if( !file.open(QIODevice::ReadOnly) )
+		return QByteArray();
+	QCryptographicHash	hash(QCryptographicHash::Md5);
+	hash.addData(file.readAll());
+	return hash.result();
+}
 
-	settings.beginGroup("DeviceInfo");
-	
-	if( !settings.childGroups().contains("Devices") )
-		return false;
-	
-	size_t numDevices = settings.beginReadArray("Devices");
-	QStringList devices = settings.childGroups();
-	numDevices = devices.count();	// Rude hack to deal with QSettings bug
-	
-	for(size_t i=0; i<numDevices; ++i)
+//Start or stop watching the selected file according to the checkbox state
+void CentralWidget::updateFileWatch()
+{
+	const QString path = ProgramOnFileChangeCheckBox->isChecked() ? currentFile() : QString();
+	if( path == watchedFile )
+		return;
+
+	if( !watchedFile.isEmpty() )
+		fileWatcher->removePath(watchedFile);
+	reprogramTimer->stop();
+	watchedFile = path;
+	if( watchedFile.isEmpty() )
 	{
-		settings.setArrayIndex(i);
-		QVariant n = settings.value("Name");
-		if( n.isValid() && (n.toString()==part) )
-		{
-			QStringList keys = settings.childKeys();
-			QStringListIterator i(keys);
-			while(i.hasNext())
-			{
-				QString	key(i.next());
-				QString	value(settings.value(key).toString());
-				if( value.size() == 0 )	//Skip empty keys
-					continue;
-				chip_info.set(key.toStdString(), value.toStdString());
-			}
-		}
+		closeSession();
+		return;
 	}
-	settings.endArray();
-	settings.endGroup();
 
-	return true;
+	//Only changes made after this point trigger a reprogram
+	watchedHash = fileHash(watchedFile);
+	fileWatcher->addPath(watchedFile);
 }
 
-
-bool do_reset(kitsrus::kitsrus_t &programmer)
+void CentralWidget::onWatchedFileChanged(const QString &path)
 {
-	if(!programmer.hard_reset())
-	{
-//		std::cout << "Hard reset failed. Trying a K149 reset...\n";
-		//Try assuming that the programmer is a Kit149
-		//programmer.set_149();
-		if(!programmer.hard_reset())
-		{
-			QMessageBox::critical(0, "Error", "Could not reset programmer");
-			return false;
-		}
-	}
-	
-	//Enter command mode
-	if(!programmer.command_mode())
-	{
-		QMessageBox::critical(0, "Error", "Could not enter Command Mode");
-		return false;
-	}
-	return true;
+	if( path == watchedFile )
+		reprogramTimer->start();	//Restarting the timer collapses a burst of writes into one event
 }
 
-bool do_erase(kitsrus::kitsrus_t &programmer)
+void CentralWidget::onReprogramTimeout()
 {
-	programmer.chip_power_on();		//Activate programming voltages
-	if( !programmer.erase_chip() )	//Erase the chip first
+	if( watchedFile.isEmpty() )
+		return;
+
+	//Editors that save by renaming a new file over the old one cause the watcher
+	//	to drop the path, so keep re-adding it. Wait for the file if it's missing.
+	if( !QFile::exists(watchedFile) )
 	{
-		QMessageBox::critical(0, "Error", "Could not erase part");
-		return false;
+		reprogramTimer->start();
+		return;
 	}
-	programmer.chip_power_off();		//Turn the chip off
-	return true;
-}
+	if( !fileWatcher->files().contains(watchedFile) )
+		fileWatcher->addPath(watchedFile);
 
-bool do_rom_write(kitsrus::kitsrus_t &programmer, intelhex::hex_data &HexData)
-{
-	const intelhex::hex_data::size_type num_rom_bytes = HexData.size_below_addr(programmer.get_rom_size());
-	
-	if( num_rom_bytes > 0 )
+	//Try again after the current cycle finishes. A production run keeps the
+	//	session waiting on the socket, so wait until it's stopped too.
+	if( busy || (productionState != PRODUCTION_OFF) )
 	{
-		programmer.chip_power_on();		//Activate programming voltages
-//		std::cout << "Programming " << num_rom_bytes << " ROM words for " << PartName << std::endl;
-		if( !programmer.write_rom(HexData) )
-		{
-			std::cerr << "Error programming ROM\n";
-			programmer.hard_reset();		//Do a hard reset to clear the error and turn power off
-			return false;								// and then bail out
-		}
-		programmer.chip_power_off();		//Turn the chip off
+		reprogramTimer->start();
+		return;
 	}
-	else
-		std::cout << "No ROM words in file\n";
-	return true;
+
+	const QByteArray hash = fileHash(watchedFile);
+	if( hash.isEmpty() || (hash == watchedHash) )
+		return;		//Nothing changed, don't bother parsing
+
+	watchedHash = hash;
+	reprogram();
 }
 
-bool do_config_write(kitsrus::kitsrus_t &programmer, intelhex::hex_data &HexData)
+//Load the chip info from the settings
+bool loadChipInfo(QString &part, chipinfo::chipinfo &chip_info)
 {
-	programmer.chip_power_on();		//Activate programming voltages
-//	std::cout << "Programming Config for " << PartName << std::endl;
-	if( !programmer.write_config(HexData) )
-	{
-		programmer.hard_reset();		//Do a hard reset to clear the error and turn power off
+	const chipinfo::chipinfo	*info = devicelibrary::library().find(part.toStdString());
+	if( !info )
 		return false;
-	}
-	programmer.chip_power_off();		//Turn the chip off
+	chip_info = *info;
 	return true;
 }
 
-bool do_eeprom_write(kitsrus::kitsrus_t &programmer, intelhex::hex_data &HexData)
+
+bool handle_progress(void* p, int i, int max_i)
 {
-	const intelhex::hex_data::size_type num_eeprom_bytes = HexData.size_in_range(programmer.get_eeprom_start(), programmer.get_eeprom_start() + programmer.get_eeprom_size());
-	
-	if(num_eeprom_bytes > 0)
-	{
-		programmer.chip_power_on();		//Activate programming voltages
-//		std::cout << "Programming " << num_eeprom_bytes << " EEPROM bytes for " << PartName << std::endl;
-		if( !programmer.write_eeprom(HexData) )
-		{
-			programmer.hard_reset();		//Do a hard reset to clear the error and turn power off
-			return false;
-		}
-		programmer.chip_power_off();		//Turn the chip off
-	}
-	else
-		std::cout << "No EEPROM bytes in file\n";
-	return true;
+	return static_cast<CentralWidget*>(p)->handleProgress(i, max_i);
 }
 
-bool do_rom_read(kitsrus::kitsrus_t &programmer, intelhex::hex_data &HexData)
+//One line verify status for the status bar
+QString verifyStatus(const verify::report_t &report)
 {
-	programmer.chip_power_on();		//Activate programming voltages
-	if( !programmer.read_rom(HexData) )	//Read ROM
+	QStringList	status;
+	for(unsigned i=0; i < verify::NUM_REGIONS; ++i)
 	{
-		programmer.hard_reset();		//Do a hard reset to clear the error and turn power off
-		return false;
+		const verify::region_report_t	&r = report.regions[i];
+		if( r.present )
+			status << QString("%1 %2").arg(verify::region_name(verify::region_id(i))).arg(r.status());
 	}
-	programmer.chip_power_off();	//Turn the chip off
-	return true;
+	return status.join("  ");
 }
 
-bool do_config_read(kitsrus::kitsrus_t &programmer, intelhex::hex_data &HexData)
+bool CentralWidget::doProgrammerInit(kitsrus::kitsrus_t& prog, QString *error)
 {
-	programmer.chip_power_on();			//Activate programming voltages
-	if( !programmer.read_config(HexData) )	//Read Config
+	std::string	message;
+	if( !programmer::init(prog, message) )
 	{
-		programmer.hard_reset();		//Do a hard reset to clear the error and turn power off
+		if( message.empty() )		//init_program_vars() doesn't say why
+			message = "Could not initialize the programmer";
+		if( error )
+			*error = QString::fromStdString(message);
+		else
+			QMessageBox::critical(this, "Error", QString::fromStdString(message));
 		return false;
 	}
-	programmer.chip_power_off();		//Turn the chip off
+
+	prog.set_callback(&handle_progress, this);	//Set the progress callback
+	
 	return true;
 }
 
-bool do_eeprom_read(kitsrus::kitsrus_t &programmer, intelhex::hex_data &HexData)
+//Open a programmer session for the current port and target, or reuse the one
+//	that's already open
+kitsrus::kitsrus_t *CentralWidget::openSession(chipinfo::chipinfo &chip_info, QString *error)
 {
-	programmer.chip_power_on();		//Activate programming voltages
-	if( !programmer.read_eeprom(HexData) )	//Read EEPROM
+	QString	path(currentPath());
+	QString	target(TargetType->itemText(TargetType->currentIndex()));
+	if( session && (sessionPort == path) && (sessionTarget == target) )
+		return session;
+
+	closeSession();
+	session = new kitsrus::kitsrus_t(path, chip_info);
+	if( !doProgrammerInit(*session, error) )
 	{
-		programmer.hard_reset();		//Do a hard reset to clear the error and turn power off
-		return false;
+		closeSession();
+		return NULL;
 	}
-	programmer.chip_power_off();		//Turn the chip off
-	return true;
-}
-
-bool handle_progress(void* p, int i, int max_i)
-{
-	return static_cast<CentralWidget*>(p)->handleProgress(i, max_i);
+	sessionPort = path;
+	sessionTarget = target;
+	return session;
 }
 
-//Handle the actual write sequence
-bool do_write_all(kitsrus::kitsrus_t& prog, intelhex::hex_data &HexData, bool erase_first, QProgressDialog *progressDialog)
+void CentralWidget::closeSession()
 {
-	//If erase before programming...
-	if( erase_first )
-		do_erase(prog);
-	
-	//Do the programming sequence
-	//	For some reason config has to be written first or the programmer locks up
-	progressDialog->setLabelText("Writing Config");	//Set the progress dialog label
-	if( !do_config_write(prog, HexData) )
-		return false;
-	
-	progressDialog->setLabelText("Writing EEPROM");	//Set the progress dialog label
-	if( !do_eeprom_write(prog, HexData) )
-		return false;
-	
-	progressDialog->setLabelText("Writing ROM");	//Set the progress dialog label
-	if( !do_rom_write(prog, HexData) )					//Write the ROM words
-		return false;
-
-	return true;
+	//Anything that takes the programmer away ends a production run
+	if( productionState != PRODUCTION_OFF )
+		stopProduction(tr("Continuous production stopped"));
+	delete session;		//Closes the serial port
+	session = NULL;
 }
 
-//Handle the actual write sequence
-bool do_read_all(kitsrus::kitsrus_t& prog, intelhex::hex_data &HexData, QProgressDialog *progressDialog)
+//Program, and optionally verify, the watched file on the open session
+//	Results go to the status bar instead of a dialog so that the
+//	edit-build-flash loop doesn't need any clicks
+void CentralWidget::reprogram()
 {
-	//		std::cout << "Reading " << prog.get_rom_size() << " ROM words\n";
-	progressDialog->setLabelText("Reading ROM");	//Set the progress dialog label
-	if( !do_rom_read(prog, HexData) )
-		return false;
-	
-	progressDialog->setLabelText("Reading Config");	//Set the progress dialog label
-	if( !do_config_read(prog, HexData) )
-		return false;
-
-	//		std::cout << "Reading " << prog.get_eeprom_size() << " EEPROM bytes\n";
-	progressDialog->setLabelText("Reading EEPROM");	//Set the progress dialog label
-	if( !do_eeprom_read(prog, HexData) )
-		return false;
+	chipinfo::chipinfo	chip_info;
+	QString	target(TargetType->itemText(TargetType->currentIndex()));
 
-	return true;
-}
+	//Load the chip info from the settings
+	if( !loadChipInfo(target, chip_info) )
+	    return;
 
-bool CentralWidget::doProgrammerInit(kitsrus::kitsrus_t& prog)
-{
-	if( !prog.open() )			//Open the port
+	const QString name(QFileInfo(watchedFile).fileName());
+	imagecache::image_t	*image = imageCache.get(watchedFile.toStdString(), chip_info);	//Load the hex file
+	if( !image )
 	{
-		QMessageBox::critical(this, "Error", "Could not open serial port");
-		return false;
+		emit statusMessage(tr("Could not load %1").arg(name), 0);
+		return;
 	}
 
-	if( !do_reset(prog) )			//Reset the programmer
-		return false;
-
-	//Check the protocol version
-	std::string protocol = prog.get_protocol();
-
-	if( (protocol != "P018") && (protocol != "P18A") )
+	busy = true;
+	QString	error;
+	kitsrus::kitsrus_t	*prog = openSession(chip_info, &error);
+	if( !prog )
+		emit statusMessage(tr("Could not program %1: %2").arg(name).arg(error), 0);
+	else
 	{
-		QMessageBox::critical(this, "Error", tr("Wrong protocol version ( %1 )").arg(QString(protocol.c_str())));
-		return false;
+		verify::report_t	report;
+		report.image = watchedFile.toStdString();
+		if( !programmer::write_all(*prog, *image, EraseCheckBox->isChecked(), observer) )
+		{
+			progressDialog->reset();
+			closeSession();			//The programmer was reset, start over next time
+			watchedHash.clear();	//Retry on the next change even if the contents are the same
+			emit statusMessage(tr("Error writing %1 to chip").arg(name), 0);
+		}
+		else if( VerifyCheckBox->isChecked() && !programmer::verify(*prog, image->hex, chip_info, observer, report, true) )
+		{
+			progressDialog->reset();
+			closeSession();
+			emit statusMessage(tr("Programmed %1, error reading chip").arg(name), 0);
+		}
+		else if( VerifyCheckBox->isChecked() )
+			emit statusMessage(tr("Programmed %1\t%2").arg(name).arg(verifyStatus(report)), 0);
+		else
+			emit statusMessage(tr("Programmed %1").arg(name), 0);
 	}
-
-	prog.init_program_vars();	//Initialize programming variables
-	
-	prog.set_callback(&handle_progress, this);	//Set the progress callback
-	
-	return true;
+	busy = false;
 }
 
 void CentralWidget::program_all()
@@ -491,16 +515,36 @@ void CentralWidget::program_all()
 	}
 	QString file_name = (FileName->itemData(FileName->currentIndex())).toString();
 
+	//Load the hex file, or reuse the copy that was parsed last time
+	imagecache::image_t	*image = imageCache.get(file_name.toStdString(), chip_info);
+	if( !image )
+	{
+		QMessageBox::critical(this, "Error", tr("Could not load %1").arg(file_name));
+		return;
+	}
+
+	closeSession();		//Release the port if reprogram-on-change is holding it
+
 	//Put this in a block to close the serial port early
 	{
 		QString	path(currentPath());
 		kitsrus::kitsrus_t	prog(path, chip_info);	//Programmer interface
-		intelhex::hex_data HexData(file_name.toStdString());	//Load the hex file
 
 		if( !doProgrammerInit(prog) )
 			return;
+
+		//Skip the bulk erase if the part is already blank
+		bool erase(EraseCheckBox->isChecked());
+		if( erase )
+		{
+			bool rom, eeprom;
+			if( programmer::blank_check(prog, rom, eeprom) )
+				erase = !(rom && eeprom);
+			else if( !doProgrammerInit(prog) )	//The blank check failed and the programmer was reset
+				return;
+		}
 		
-		if( !do_write_all(prog, HexData, EraseCheckBox->isChecked(), progressDialog) )
+		if( !programmer::write_all(prog, *image, erase, observer) )
 		{
 			progressDialog->reset();
 			QMessageBox::critical(this, "Error", tr("Error writing to chip"));
@@ -590,34 +634,64 @@ void CentralWidget::read()
 	if( !loadChipInfo(target, chip_info) )
 	    return;
 
+	//Pick the destination first so the words can be written out as they're read
+	bool	to_file(true);
+#ifdef	Q_OS_DARWIN
+	to_file = !NewWindowOnReadCheckBox->isChecked();
+#endif	//Q_OS_DARWIN
+	QString	out_file;
+	std::ofstream	ofs;
+	if( to_file )
+	{
+		out_file = QFileDialog::getSaveFileName(this);
+		if( out_file.isEmpty() )
+			return;
+		ofs.open(out_file.toStdString().c_str(), std::ios::out | std::ios::binary);
+		if( !ofs )
+		{
+			QMessageBox::critical(this, "Error", tr("Could not open %1").arg(out_file));
+			return;
+		}
+	}
+
 	QString	path(ProgrammerDeviceNode->itemData(ProgrammerDeviceNode->currentIndex()).toString());
+	closeSession();		//Release the port if reprogram-on-change is holding it
 
 	//Put this in a block to close the serial port early
 	{
 		kitsrus::kitsrus_t	prog(path, chip_info);	//Programmer interface
 		
-		if( !doProgrammerInit(prog) )
-			return;
-
-		if( !do_read_all(prog, HexData, progressDialog) )
+		bool	ok(doProgrammerInit(prog));
+		if( ok )
 		{
-			progressDialog->reset();
-			QMessageBox::critical(this, "Error", tr("Error reading chip"));
+			dialog_observer_t	observer(progressDialog);
+			if( to_file )
+				ok = programmer::read_file(prog, ofs, &observer, programmer::everything());
+			else
+			{
+				kitsrus::hex_sink_t	sink(HexData);
+				ok = programmer::read_all(prog, sink, &observer, programmer::everything());
+			}
+			if( !ok )
+			{
+				progressDialog->reset();
+				QMessageBox::critical(this, "Error", tr("Error reading chip"));
+			}
+		}
+		if( !ok )
+		{
+			if( to_file )
+			{
+				ofs.close();
+				QFile::remove(out_file);
+			}
+			return;
 		}
 	}
 
-
 #ifdef	Q_OS_DARWIN
-	if( NewWindowOnReadCheckBox->isChecked() )
+	if( !to_file )
 		handle_open_new_text(HexData);
-	else
-	{
-#endif	//Q_OS_DARWIN
-		QString out_file(QFileDialog::getSaveFileName(this));
-		if( !out_file.isEmpty() )
-			HexData.write(out_file.toStdString().c_str());
-#ifdef	Q_OS_DARWIN
-	}
 #endif	//Q_OS_DARWIN
 }
 
@@ -642,35 +716,43 @@ void CentralWidget::onVerify()
 	}
 	QString file_name = (FileName->itemData(FileName->currentIndex())).toString();
 	
+	//Load the hex file, or reuse the copy that was parsed for programming
+	imagecache::image_t	*image = imageCache.get(file_name.toStdString(), chip_info);
+	if( !image )
+	{
+		QMessageBox::critical(this, "Error", tr("Could not load %1").arg(file_name));
+		return;
+	}
+
+	closeSession();		//Release the port if reprogram-on-change is holding it
+
+	verify::report_t	report;
+
 	//Put this in a block to close the serial port early
 	{
 		QString	path(currentPath());
 		kitsrus::kitsrus_t	prog(path, chip_info);	//Programmer interface
-		intelhex::hex_data HexData(file_name.toStdString());	//Load the hex file
 		
 		if( !doProgrammerInit(prog) )
 			return;
 		
-		intelhex::hex_data VerifyData;
-		if( !do_read_all(prog, VerifyData, progressDialog) )
+		report.image = file_name.toStdString();
+		if( !programmer::verify(prog, image->hex, chip_info, observer, report, false) )
 		{
 			progressDialog->reset();
 			QMessageBox::critical(this, "Error", tr("Error reading chip"));
+			return;
 		}
+	}
 
-	// Compare ROM
-	const bool flash = intelhex::compare(HexData, VerifyData, chip_info.romBlank(), chip_info.romBegin(), chip_info.romEnd());
-	// Compare EEPROM
-	const bool eeprom = intelhex::compare(HexData, VerifyData, chip_info.eepromBlank(), chip_info.eepromBegin(), chip_info.eepromEnd());
-	// Compare Config
-//	const bool config = intelhex::compare(HexData, VerifyData, chip_info.configBlank(), chip_info.configBegin(), chip_info.configEnd());
-
-	QMessageBox::information(this, "Verify Results", 
-				 tr("Flash\t%1\nEEPROM\t%2\nConfig\t%3")
-				    .arg(flash?"Pass":"Fail")
-				    .arg(eeprom?"Pass":"Fail")
-				    .arg("Not Verified")
-				 );
+	QMessageBox	box(report.passed() ? QMessageBox::Information : QMessageBox::Warning, "Verify Results", QString::fromStdString(report.summary()), QMessageBox::Ok, this);
+	QPushButton	*save = box.addButton(tr("Save Report..."), QMessageBox::ActionRole);
+	box.exec();
+	if( box.clickedButton() == save )
+	{
+		QString out_file(QFileDialog::getSaveFileName(this, tr("Save Verify Report")));
+		if( !out_file.isEmpty() && !report.write(out_file.toStdString().c_str()) )
+			QMessageBox::critical(this, "Error", tr("Could not write %1").arg(out_file));
 	}
 }
 
@@ -684,6 +766,7 @@ void CentralWidget::bulk_erase()
 	    return;
 
 	QString	path(ProgrammerDeviceNode->itemData(ProgrammerDeviceNode->currentIndex()).toString());
+	closeSession();		//Release the port if reprogram-on-change is holding it
 
 	//Put this in a block to close the serial port early
 	{
@@ -692,12 +775,259 @@ void CentralWidget::bulk_erase()
 	if( !doProgrammerInit(prog) )
 	    return;
 
-		do_erase(prog);		//Do the erase	
+		if( !programmer::erase(prog) )		//Do the erase
+		{
+			QMessageBox::critical(this, "Error", "Could not erase part");
+			return;
+		}
 	}
 
 	QMessageBox::information(this, "Bulk Erase", "Successfully Erased");
 }
 
+void CentralWidget::blank_check()
+{
+	chipinfo::chipinfo	chip_info;
+	QString	target(TargetType->itemText(TargetType->currentIndex()));
+
+	//Load the chip info from the settings
+	if( !loadChipInfo(target, chip_info) )
+	    return;
+
+	QString	path(currentPath());
+	closeSession();		//Release the port if reprogram-on-change is holding it
+
+	bool rom, eeprom;
+	//Put this in a block to close the serial port early
+	{
+		kitsrus::kitsrus_t	prog(path, chip_info);	//Programmer interface
+
+		if( !doProgrammerInit(prog) )
+			return;
+
+		if( !programmer::blank_check(prog, rom, eeprom) )
+		{
+			QMessageBox::critical(this, "Error", tr("Error checking chip"));
+			return;
+		}
+	}
+
+	QMessageBox::information(this, "Blank Check",
+				 tr("Flash\t%1\nEEPROM\t%2")
+				    .arg(rom?"Blank":"Not Blank")
+				    .arg(chip_info.eeprom_size ? (eeprom?"Blank":"Not Blank") : "None")
+				 );
+}
+
+//The CSV log kept next to an image, unit numbers carry on across runs
+static std::string productionLog(const QString &image)
+{
+	const QFileInfo	info(image);
+	return QString(info.absolutePath() + "/" + info.completeBaseName() + "-production.csv").toStdString();
+}
+
+//Start a production run on the selected image
+//	Every part put in the socket is programmed and verified, then the run waits
+//	for it to be taken out. Results go to the production label and a CSV log
+//	next to the image, so the only thing the operator does is swap parts.
+void CentralWidget::startProduction()
+{
+	chipinfo::chipinfo	chip_info;
+	QString	target(TargetType->itemText(TargetType->currentIndex()));
+	productionFile = currentFile();
+	if( productionFile.isEmpty() || !loadChipInfo(target, chip_info) || !imageCache.get(productionFile.toStdString(), chip_info) )
+	{
+		stopProduction(tr("Select a file and a target for continuous production"));
+		return;
+	}
+
+	QString	error;
+	if( !openSession(chip_info, &error) )
+	{
+		stopProduction(tr("Could not open the programmer: %1").arg(error));
+		return;
+	}
+	tally.clear(production::last_unit(productionLog(productionFile).c_str()) + 1);
+	productionLabel->setText(tr("Insert a part"));
+	if( !waitForSocket(true) )
+		stopProduction(tr("The programmer doesn't support socket detection"));
+}
+
+void CentralWidget::stopProduction(const QString &message)
+{
+	productionTimer->stop();
+	if( session && (productionState != PRODUCTION_OFF) )
+		session->abort_transfer();		//The programmer is still waiting for the socket
+	productionState = PRODUCTION_OFF;
+
+	ContinuousCheckBox->blockSignals(true);
+	ContinuousCheckBox->setCheckState(Qt::Unchecked);
+	ContinuousCheckBox->blockSignals(false);
+
+	if( tally.count() )
+		emit statusMessage(tr("%1\t%2").arg(message).arg(QString::fromStdString(tally.summary())), 0);
+	else
+		emit statusMessage(message, 0);
+}
+
+bool CentralWidget::waitForSocket(bool inserted)
+{
+	if( !session || !session->start_socket_wait(inserted) )
+		return false;
+	productionState = inserted ? PRODUCTION_WAIT_INSERT : PRODUCTION_WAIT_REMOVE;
+	productionTimer->start();
+	return true;
+}
+
+void CentralWidget::onProductionPoll()
+{
+	if( busy || !session || (productionState == PRODUCTION_OFF) )
+		return;
+
+	const int	r = session->poll_socket();
+	if( r == 0 )
+		return;
+	productionTimer->stop();
+	if( r < 0 )
+	{
+		stopProduction(tr("Lost the programmer"));
+		return;
+	}
+
+	if( productionState == PRODUCTION_WAIT_INSERT )
+	{
+		productionState = PRODUCTION_OFF;	//Nothing to cancel while the cycle runs
+		if( !productionCycle() )
+			return;
+		if( !ContinuousCheckBox->isChecked() )		//Unchecked while the part was being programmed
+			stopProduction(tr("Continuous production stopped"));
+		else if( !waitForSocket(false) )
+			stopProduction(tr("Lost the programmer"));
+	}
+	else
+	{
+		productionLabel->setText(tr("%1\tInsert the next part").arg(productionLabel->text().section('\t', 0, 0)));
+		if( !waitForSocket(true) )
+			stopProduction(tr("Lost the programmer"));
+	}
+}
+
+//Program and verify the part that was just put in, returns false if the run had to stop
+bool CentralWidget::productionCycle()
+{
+	chipinfo::chipinfo	chip_info;
+	QString	target(TargetType->itemText(TargetType->currentIndex()));
+	if( !loadChipInfo(target, chip_info) )
+	{
+		stopProduction(tr("Unknown target %1").arg(target));
+		return false;
+	}
+
+	production::unit_t	unit;
+	unit.date = time(NULL);
+	QTime	timer;
+	timer.start();
+
+	busy = true;
+	bool	responding(true);
+	imagecache::image_t	*image = imageCache.get(productionFile.toStdString(), chip_info);
+	if( !image )
+		unit.detail = "Could not load image";
+	else if( !programmer::write_all(*session, *image, EraseCheckBox->isChecked(), observer) )
+	{
+		responding = false;
+		unit.detail = "Error writing chip";
+	}
+	else
+	{
+		verify::report_t	report;
+		report.image = productionFile.toStdString();
+		if( !programmer::verify(*session, image->hex, chip_info, observer, report, true) )
+		{
+			responding = false;
+			unit.detail = "Error reading chip";
+		}
+		else
+		{
+			unit.passed = report.passed();
+			unit.detail = verifyStatus(report).toStdString();
+		}
+	}
+	progressDialog->reset();
+	busy = false;
+	unit.seconds = timer.elapsed()/1000.0;
+
+	const production::unit_t	&u = tally.add(unit);
+	production::append(productionLog(productionFile).c_str(), u);
+	productionLabel->setText(tr("Unit %1: %2 in %3 s, %4\tRemove the part")
+		.arg(u.number).arg(u.passed ? tr("PASS") : tr("FAIL")).arg(u.seconds, 0, 'f', 1).arg(QString::fromStdString(tally.summary())));
+	if( !u.passed )
+		emit statusMessage(tr("Unit %1 failed: %2").arg(u.number).arg(QString::fromStdString(u.detail)), 0);
+
+	//The programmer was reset after the error, start a new session
+	if( !responding )
+	{
+		delete session;
+		session = NULL;
+		QString	error;
+		if( !openSession(chip_info, &error) )
+		{
+			stopProduction(tr("Lost the programmer: %1").arg(error));
+			return false;
+		}
+	}
+	return true;
+}
+
+//Read the device ID of the part in the socket and select it as the target
+//	A part that shares its ID with others keeps the current target if it's one of them
+void CentralWidget::detect()
+{
+	chipinfo::chipinfo	chip_info;
+	QString	target(TargetType->itemText(TargetType->currentIndex()));
+	loadChipInfo(target, chip_info);	//Only used to pick the family to try first
+
+	const devicelibrary::library_t	&library = devicelibrary::library();
+	QString	path(currentPath());
+	closeSession();		//Release the port if reprogram-on-change is holding it
+
+	devicelibrary::indices_t	matches;
+	uint16_t	id;
+	bool	found;
+	{
+		kitsrus::kitsrus_t	prog(path, chip_info);	//Programmer interface
+		if( !doProgrammerInit(prog) )
+			return;
+		found = devicelibrary::detect(prog, library, matches, id);
+	}
+	if( !found )
+	{
+		emit statusMessage(id ? tr("Unknown device ID 0x%1").arg(id, 4, 16, QChar('0')) : tr("No device detected"), 0);
+		return;
+	}
+
+	QStringList	names;
+	QString	pick;
+	for(devicelibrary::indices_t::const_iterator i=matches.begin(); i != matches.end(); ++i)
+	{
+		const QString	name(QString::fromStdString(library[*i].name));
+		names << name;
+		if( pick.isEmpty() || (name == target) )
+			pick = name;
+	}
+
+	const int	index = TargetType->findText(pick);
+	if( index >= 0 )
+	{
+		TargetType->setCurrentIndex(index);
+		onTargetComboChange(pick);
+	}
+	if( names.size() > 1 )
+		emit statusMessage(tr("Detected %1 (ID 0x%2), matches %3").arg(pick).arg(id, 4, 16, QChar('0')).arg(names.join(", ")), 0);
+	else
+		emit statusMessage(tr("Detected %1 (ID 0x%2)").arg(pick).arg(id, 4, 16, QChar('0')), 0);
+}
+
 #ifdef	Q_OS_DARWIN
 
 kern_return_t FindPorts(io_iterator_t *matchingServices)
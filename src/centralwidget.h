@@ -16,18 +16,25 @@
 
 #include <QCheckBox>
 #include <QComboBox>
+#include <QFileSystemWatcher>
+#include <QLabel>
+#include <QTimer>
 #include <QWidget>
 #include <QPushButton>
 #include <QProgressDialog>
 #include <QSettings>
 
+#include	"imagecache.h"
 #include	"kitsrus.h"
+#include	"production.h"
+#include	"programmer.h"
 
 class CentralWidget : public QWidget
 {
 	Q_OBJECT
 public:
 	CentralWidget();
+	~CentralWidget();
 	bool	FillTargetCombo();
 
 	//Handle a progress update from the programmer
@@ -39,13 +46,21 @@ public:
 		return !progressDialog->wasCanceled();
 	}
 
+signals:
+	void statusMessage(const QString &, int);
+
 private slots:
 	void onEraseCheckBoxChange(int);
 	void onVerifyCheckBoxChange(int);
 	void onNewWindowOnReadCheckBoxChange(int);
 	void onProgramOnFileChangeCheckBoxChange(int);
+	void onContinuousCheckBoxChange(int);
 	void onTargetComboChange(const QString &);
 	void onDeviceComboChange(const QString &);
+	void onFileNameComboChange(int);
+	void onWatchedFileChanged(const QString &);
+	void onReprogramTimeout();
+	void onProductionPoll();
 	void browse();
 #ifdef	Q_OS_LINUX
 	void device_browse();
@@ -54,6 +69,8 @@ private slots:
 	void program_all();
 	void read();
 	void bulk_erase();
+	void blank_check();
+	void detect();
 	void onVerify();
 
 private:
@@ -65,10 +82,37 @@ private:
 	QCheckBox	*VerifyCheckBox;
 	QCheckBox	*NewWindowOnReadCheckBox;
 	QCheckBox	*ProgramOnFileChangeCheckBox;
+	QCheckBox	*ContinuousCheckBox;
 	QProgressDialog *progressDialog;
+	programmer::observer_t	*observer;	//Labels progressDialog
 
 	QSettings	settings;
 
+	QFileSystemWatcher	*fileWatcher;	//Watches the selected file for reprogram-on-change
+	QTimer	*reprogramTimer;	//Debounces bursts of file change events
+	QString	watchedFile;
+	QByteArray	watchedHash;	//Content hash of the last programmed version of watchedFile
+	bool	busy;			//Set while a programming cycle is running
+
+	imagecache::cache_t	imageCache;	//Parsed images, so program and verify only parse once
+
+	kitsrus::kitsrus_t	*session;	//Programmer kept open while reprogramming on file change
+	QString	sessionPort;
+	QString	sessionTarget;
+
+	//Continuous production: program and verify every part put in the socket
+	enum production_state_t
+	{
+		PRODUCTION_OFF,
+		PRODUCTION_WAIT_INSERT,		//Waiting for a part to be put in the socket
+		PRODUCTION_WAIT_REMOVE		//Waiting for the finished part to be taken out
+	};
+	production_state_t	productionState;
+	QTimer	*productionTimer;	//Polls the programmer for socket changes
+	QLabel	*productionLabel;	//Last unit and the running tally
+	QString	productionFile;		//Image being programmed
+	production::tally_t	tally;
+
 	bool FillPortCombo();
 	
 	QString currentPath()
@@ -76,7 +120,25 @@ private:
 		return ProgrammerDeviceNode->itemData(ProgrammerDeviceNode->currentIndex()).toString();
 	}
 	
-	bool doProgrammerInit(kitsrus::kitsrus_t&);
+	//The error goes in a dialog, or back through error if one is given
+	bool doProgrammerInit(kitsrus::kitsrus_t&, QString *error=NULL);
+
+	QString currentFile()
+	{
+		return (FileName->currentIndex() == -1) ? QString() : FileName->itemData(FileName->currentIndex()).toString();
+	}
+
+	kitsrus::kitsrus_t	*openSession(chipinfo::chipinfo &, QString *error=NULL);
+	void	closeSession();
+	void	updateFileWatch();
+	void	reprogram();
+
+	void	startProduction();
+	void	stopProduction(const QString &);
+	bool	waitForSocket(bool inserted);
+	bool	productionCycle();
 };
 
+bool loadChipInfo(QString &, chipinfo::chipinfo &);	//Load a device description from the settings
+
 #endif	//CENTRALWIDGET_H
@@ -0,0 +1,357 @@
+/*	Filename:	checksum.cc
+	Image checksums and CRCs
+
+	The table CRCs are sliced eight bytes at a time. Patching a region
+	XORs the old and new words, takes the CRC of just that difference and
+	moves it past the rest of the region with a multiplication modulo the
+	polynomial, which is what the combine functions do as well.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+
+#include <string.h>
+
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	#if defined(__SSE2__)
+		#include <emmintrin.h>
+		#define	CHECKSUM_SSE2
+	#endif
+	//SSE4.2 is compiled with a target attribute and picked at run time
+	#if ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))) && !defined(__clang__)
+		#include <immintrin.h>
+		#define	CHECKSUM_SSE42
+	#elif defined(__clang__) && (__clang_major__ >= 4)
+		#include <immintrin.h>
+		#define	CHECKSUM_SSE42
+	#endif
+#endif
+
+#define	CRC32_POLY	0xEDB88320		//Reflected
+#define	CRC32C_POLY	0x82F63B78
+
+namespace checksum
+{
+	struct table_t
+	{
+		uint32_t	poly;
+		uint32_t	t[8][256];		//t[k][i] is the CRC of byte i followed by k zeros
+		uint32_t	x2n[32];		//x^(2^n) modulo the polynomial
+
+		table_t(uint32_t);
+	};
+
+	//a*b modulo the polynomial, bit 31 is x^0
+	static uint32_t multmodp(uint32_t a, uint32_t b, uint32_t poly)
+	{
+		uint32_t	m(1U << 31), p(0);
+		for(;;)
+		{
+			if( a & m )
+			{
+				p ^= b;
+				if( (a & (m - 1)) == 0 )
+					break;
+			}
+			m >>= 1;
+			b = (b & 1) ? ((b >> 1) ^ poly) : (b >> 1);
+		}
+		return p;
+	}
+
+	table_t::table_t(uint32_t p) : poly(p)
+	{
+		for(uint32_t i=0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for(unsigned k=0; k < 8; ++k)
+				c = (c & 1) ? (poly ^ (c >> 1)) : (c >> 1);
+			t[0][i] = c;
+		}
+		for(uint32_t i=0; i < 256; ++i)
+			for(unsigned k=1; k < 8; ++k)
+				t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xFF];
+
+		x2n[0] = 1U << 30;		//x^1
+		for(unsigned n=1; n < 32; ++n)
+			x2n[n] = multmodp(x2n[n-1], x2n[n-1], poly);
+	}
+
+	static const table_t &crc32_table()
+	{
+		static const table_t	table(CRC32_POLY);
+		return table;
+	}
+
+	static const table_t &crc32c_table()
+	{
+		static const table_t	table(CRC32C_POLY);
+		return table;
+	}
+
+	//The CRC state moved past n zero bytes
+	static uint32_t shift(const table_t &table, uint32_t crc, uint64_t n)
+	{
+		uint32_t	p(1U << 31);		//x^0
+		for(unsigned k=3; n; n >>= 1, ++k)	//8n bits
+			if( n & 1 )
+				p = multmodp(table.x2n[k & 31], p, table.poly);
+		return multmodp(p, crc, table.poly);
+	}
+
+	//Kernels take and return the CRC state, which is the complement of the CRC
+	typedef	uint32_t	(*crc_kernel_t)(uint32_t, const uint8_t *, size_t);
+
+	static uint32_t update(const table_t &table, uint32_t crc, const uint8_t *p, size_t n)
+	{
+		for(; n >= 8; n -= 8, p += 8)
+		{
+			crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+			crc = table.t[7][crc & 0xFF] ^ table.t[6][(crc >> 8) & 0xFF] ^ table.t[5][(crc >> 16) & 0xFF] ^ table.t[4][crc >> 24]
+				^ table.t[3][p[4]] ^ table.t[2][p[5]] ^ table.t[1][p[6]] ^ table.t[0][p[7]];
+		}
+		while( n-- )
+			crc = table.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+
+	static uint32_t crc32c_table_kernel(uint32_t crc, const uint8_t *p, size_t n)
+	{
+		return update(crc32c_table(), crc, p, n);
+	}
+
+#ifdef	CHECKSUM_SSE42
+	__attribute__((target("sse4.2")))
+	static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t n)
+	{
+		for(; n && (reinterpret_cast<uintptr_t>(p) & 7); --n)
+			crc = _mm_crc32_u8(crc, *p++);
+#ifdef	__x86_64__
+		uint64_t	c(crc);
+		for(; n >= 8; n -= 8, p += 8)
+			c = _mm_crc32_u64(c, *reinterpret_cast<const uint64_t*>(p));
+		crc = uint32_t(c);
+#else
+		for(; n >= 4; n -= 4, p += 4)
+			crc = _mm_crc32_u32(crc, *reinterpret_cast<const uint32_t*>(p));
+#endif
+		while( n-- )
+			crc = _mm_crc32_u8(crc, *p++);
+		return crc;
+	}
+#endif	//CHECKSUM_SSE42
+
+	static crc_kernel_t	kernel(NULL);
+	static const char	*kernel_label("table");
+
+	//Pick the CRC-32C kernel once
+	static crc_kernel_t pick_kernel()
+	{
+		if( kernel )
+			return kernel;
+		crc_kernel_t	k(crc32c_table_kernel);
+		const char	*label("table");
+#ifdef	CHECKSUM_SSE42
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports("sse4.2") )
+		{
+			k = crc32c_sse42;
+			label = "sse4.2";
+		}
+#endif
+		kernel_label = label;
+		return kernel = k;
+	}
+
+	const char *kernel_name()
+	{
+		pick_kernel();
+		return kernel_label;
+	}
+
+	uint32_t crc32(const uint8_t *p, size_t n, uint32_t crc)
+	{
+		return ~update(crc32_table(), ~crc, p, n);
+	}
+
+	uint32_t crc32c(const uint8_t *p, size_t n, uint32_t crc)
+	{
+		return ~pick_kernel()(~crc, p, n);
+	}
+
+	uint32_t crc32_combine(uint32_t a, uint32_t b, uint64_t n)
+	{
+		return shift(crc32_table(), a, n) ^ b;
+	}
+
+	uint32_t crc32c_combine(uint32_t a, uint32_t b, uint64_t n)
+	{
+		return shift(crc32c_table(), a, n) ^ b;
+	}
+
+	//Sums of the low and the high bytes of the words
+	static void sum_halves(const element_t *w, size_t n, uint64_t &lo, uint64_t &hi)
+	{
+		size_t	i(0);
+		lo = hi = 0;
+#ifdef	CHECKSUM_SSE2
+		//Each SAD adds eight bytes into a 64-bit lane, the high bytes are shifted down first
+		const __m128i	low_bytes(_mm_set1_epi16(0x00FF));
+		const __m128i	zero(_mm_setzero_si128());
+		__m128i	l(zero), h(zero);
+		for(; i + 8 <= n; i += 8)
+		{
+			const __m128i	v(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i)));
+			l = _mm_add_epi64(l, _mm_sad_epu8(_mm_and_si128(v, low_bytes), zero));
+			h = _mm_add_epi64(h, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+		}
+		uint64_t	lanes[2];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), l);
+		lo = lanes[0] + lanes[1];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), h);
+		hi = lanes[0] + lanes[1];
+#endif	//CHECKSUM_SSE2
+		for(; i < n; ++i)
+		{
+			lo += w[i] & 0xFF;
+			hi += w[i] >> 8;
+		}
+	}
+
+	uint32_t sum_words(const element_t *w, size_t n)
+	{
+		uint64_t	lo, hi;
+		sum_halves(w, n, lo, hi);
+		return uint32_t(lo + (hi << 8));
+	}
+
+	uint32_t sum_bytes(const element_t *w, size_t n)
+	{
+		uint64_t	lo, hi;
+		sum_halves(w, n, lo, hi);
+		return uint32_t(lo + hi);
+	}
+
+	static bool little_endian()
+	{
+		const uint16_t	one(1);
+		return *reinterpret_cast<const uint8_t*>(&one) == 1;
+	}
+
+	//CRC-32C state after words as little-endian byte pairs
+	static uint32_t update_words(uint32_t crc, const element_t *w, size_t n)
+	{
+		const crc_kernel_t	k(pick_kernel());
+		if( little_endian() )
+			return k(crc, reinterpret_cast<const uint8_t*>(w), 2*n);
+		for(size_t i=0; i < n; ++i)
+		{
+			const uint8_t	b[2] = {uint8_t(w[i]), uint8_t(w[i] >> 8)};
+			crc = k(crc, b, 2);
+		}
+		return crc;
+	}
+
+	image_t::image_t(chipinfo::chipinfo &info) : byte_sum(info.is16bit())
+	{
+		regions[verify::REGION_ROM].begin = info.romBegin();
+		regions[verify::REGION_ROM].end = info.romEnd();
+		regions[verify::REGION_ROM].mask = info.romBlank();
+
+		regions[verify::REGION_EEPROM].begin = info.eepromBegin();
+		regions[verify::REGION_EEPROM].end = info.eepromEnd();
+		regions[verify::REGION_EEPROM].mask = info.eepromBlank();
+
+		//Config and ID words are as wide as ROM words
+		const address_t	config(info.get_config_start());
+		if( config != 0 )	//Config bits are never at address zero
+		{
+			regions[verify::REGION_CONFIG].begin = config;
+			regions[verify::REGION_CONFIG].end = config + info.numConfigWords();
+			regions[verify::REGION_CONFIG].mask = info.romBlank();
+		}
+		regions[verify::REGION_ID].begin = info.get_id_start();
+		regions[verify::REGION_ID].end = regions[verify::REGION_ID].begin + 4;
+		regions[verify::REGION_ID].mask = info.romBlank();
+
+		intelhex::hex_data	blank;
+		set(blank);
+	}
+
+	void image_t::set(intelhex::hex_data &hex)
+	{
+		for(unsigned i=0; i < verify::NUM_REGIONS; ++i)
+		{
+			region_t	&r = regions[i];
+			r.words.assign(r.size(), r.mask);
+
+			//Walk the blocks once instead of looking up every word
+			for(intelhex::hex_data::iterator j = hex.begin(); j != hex.end(); ++j)
+			{
+				const address_t	first(j->first);
+				const address_t	lo(std::max(first, r.begin));
+				const address_t	hi(std::min(address_t(first + j->second.size()), r.end));
+				for(address_t a=lo; a < hi; ++a)
+					r.words[a - r.begin] = j->second[a - first] & r.mask;
+			}
+
+			const element_t	*w(r.words.empty() ? NULL : &r.words[0]);
+			r.sum = byte_sum ? sum_bytes(w, r.size()) : sum_words(w, r.size());
+			r.crc = ~update_words(~0U, w, r.size());
+		}
+	}
+
+	void image_t::patch(address_t address, element_t word)
+	{
+		patch(address, &word, 1);
+	}
+
+	void image_t::patch(address_t address, const element_t *words, size_t n)
+	{
+		const address_t	end(address + n);
+		for(unsigned i=0; i < verify::NUM_REGIONS; ++i)
+		{
+			region_t	&r = regions[i];
+			const address_t	lo(std::max(address, r.begin));
+			const address_t	hi(std::min(end, r.end));
+			if( lo >= hi )
+				continue;
+
+			//The CRC is linear, the CRC of the changed bits moved past the rest of
+			//	the region is what the region's CRC changes by
+			std::vector<element_t>	diff(hi - lo);
+			bool	changed(false);
+			for(address_t a=lo; a < hi; ++a)
+			{
+				element_t	&old(r.words[a - r.begin]);
+				const element_t	now(words[a - address] & r.mask);
+				if( byte_sum )
+					r.sum += (now & 0xFF) + (now >> 8) - (old & 0xFF) - (old >> 8);
+				else
+					r.sum += now - old;
+				diff[a - lo] = old ^ now;
+				changed = changed || (old != now);
+				old = now;
+			}
+			if( changed )
+				r.crc ^= shift(crc32c_table(), update_words(0, &diff[0], diff.size()), 2*uint64_t(r.end - hi));
+		}
+	}
+
+	uint16_t image_t::mplab() const
+	{
+		return uint16_t(regions[verify::REGION_ROM].sum + regions[verify::REGION_CONFIG].sum);
+	}
+
+	uint32_t image_t::crc() const
+	{
+		uint32_t	crc(0);
+		for(unsigned i=0; i < verify::NUM_REGIONS; ++i)
+			crc = crc32c_combine(crc, regions[i].crc, 2*uint64_t(regions[i].size()));
+		return crc;
+	}
+}
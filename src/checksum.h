@@ -0,0 +1,90 @@
+/*	Filename:	checksum.h
+	Image checksums and CRCs
+
+	An image's checksum is taken over each chip region the way MPLAB does
+	it: every word of the region, with the ones the image doesn't set
+	counted as blank. The 12 and 14-bit cores sum words, the 18F cores sum
+	bytes, and the device checksum is the 16-bit sum of ROM and config.
+	Each region also gets a CRC-32C of its words as little-endian byte
+	pairs, the same bytes a .qpimg payload holds. Both can be patched a
+	word at a time without going over the rest of the region again.
+
+	CRC-32C uses the SSE4.2 instruction when the CPU has it and sums are
+	taken a vector at a time, the kernels are picked at run time like the
+	verify kernels.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	CHECKSUM_H
+#define	CHECKSUM_H
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chipinfo.h"
+#include "intelhex.h"
+#include "verify.h"
+
+namespace checksum
+{
+	typedef	intelhex::hex_data::address_t	address_t;
+	typedef	intelhex::hex_data::element_t	element_t;
+	typedef	verify::region_id	region_id;		//Same regions as verify
+
+	//Standard (zlib) CRC-32 and CRC-32C (Castagnoli) of a run of bytes
+	//	Pass the CRC of the bytes before to continue it
+	uint32_t	crc32(const uint8_t *, size_t, uint32_t crc=0);
+	uint32_t	crc32c(const uint8_t *, size_t, uint32_t crc=0);
+
+	//CRC of a run of bytes A followed by a run of n bytes B, from the CRCs of A and B
+	uint32_t	crc32_combine(uint32_t a, uint32_t b, uint64_t n);
+	uint32_t	crc32c_combine(uint32_t a, uint32_t b, uint64_t n);
+
+	//Sum of the words, or of their bytes
+	uint32_t	sum_words(const element_t *, size_t);
+	uint32_t	sum_bytes(const element_t *, size_t);
+
+	struct region_t
+	{
+		address_t	begin;		//First word address
+		address_t	end;		//One past the last word address
+		element_t	mask;		//Implemented bits of each word, unset words are all ones
+		std::vector<element_t>	words;	//The image, masked and filled
+		uint32_t	sum;		//MPLAB sum of the words, see image_t
+		uint32_t	crc;		//CRC-32C of the words as little-endian byte pairs
+
+		region_t() : begin(0), end(0), mask(0), sum(0), crc(0) {}
+		size_t	size() const	{ return end - begin; }
+	};
+
+	//Checksums of an image as it would be programmed into a part
+	class image_t
+	{
+		region_t	regions[verify::NUM_REGIONS];
+		bool	byte_sum;		//18F checksums add bytes instead of words
+	public:
+		image_t(chipinfo::chipinfo &);
+
+		void	set(intelhex::hex_data &);		//Take every region from the image
+
+		//Change words of the image, the sums and CRCs are updated from the
+		//	words that changed. Words outside every region are ignored.
+		void	patch(address_t, element_t);
+		void	patch(address_t, const element_t *, size_t);
+
+		const region_t	&region(region_id r) const	{ return regions[r]; }
+		uint32_t	sum(region_id r) const	{ return regions[r].sum; }
+		uint32_t	crc(region_id r) const	{ return regions[r].crc; }
+
+		uint16_t	mplab() const;		//Device checksum as MPLAB shows it, without code protect
+		uint32_t	crc() const;		//CRC-32C of every region in region order
+	};
+
+	const char	*kernel_name();		//CRC-32C kernel picked for this CPU
+}
+
+#endif	//CHECKSUM_H
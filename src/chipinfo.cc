@@ -12,9 +12,9 @@
 	$Id: chipinfo.cc,v 1.6 2008/04/01 04:07:45 bfoz Exp $
 */
 
-#include <iostream>
 #include <stdlib.h>
 #include "chipinfo.h"
+#include "logging.h"
 
 namespace chipinfo
 {
@@ -162,80 +162,27 @@ namespace chipinfo
 			) {}
 		else
 		{
-			std::cout << "Unrecognized key: " << key << " => " << value << std::endl;
+			QLOG(logging::LEVEL_WARNING, "chipinfo")("msg", "Unrecognized key")("key", key)("value", value);
 			return false;
 		}
 		return true;
 	}
 
-	bool	chipinfo::is14bit()
+	corefamily::family_t	chipinfo::family() const
 	{
 		switch(core_type)
 		{
-			case Core14_G:
-			case Core14_A:
-			case Core14_B:
-			case Core14_C:
-			case Core14_D:
-			case Core14_E:
-			case Core14_F:
-				return true;
-			default:
-				return false;
-		}
-	}
-	
-	bool	chipinfo::is16bit()
-	{
-		switch(core_type)
-		{
-			case Core16_C:
+			case Core10_A:
+			case Core12_A:
+			case Core12_B:
+				return corefamily::FAMILY_12BIT;
 			case Core16_A:
 			case Core16_B:
-				return true;
+			case Core16_C:
+				return corefamily::FAMILY_16BIT;
 			default:
-				return false;
+				return corefamily::FAMILY_14BIT;
 		}
 	}
-		
-	uint32_t	chipinfo::get_eeprom_start()
-	{
-		if( (core_type==Core16_C) || (core_type==Core16_A) || (core_type==Core16_B))
-			return EEPROM_START_16BIT;
-		else
-			return EEPROM_START_14BIT;
-	}
-
-    uint32_t	chipinfo::get_config_start()
-    {
-	if( (core_type==Core12_A) || (core_type==Core12_B) )
-	    return CONFIG_START_12BIT;
-	else if( (core_type==Core16_C) || (core_type==Core16_A) || (core_type==Core16_B) )
-	    return CONFIG_START_16BIT;
-	else
-	    return CONFIG_START_14BIT;
-    }
-
-    uint32_t	chipinfo::get_id_start()
-    {
-	if( is12bit() )
-	    return rom_size;	// ID locations immediately follow program words
-	else if( is14bit() )
-	    return ID_START_14BIT;
-	else if( is16bit() )
-	    return ID_START_16BIT;
-	else
-	    return 0;	//FIXME
-    }
-
-	uint32_t	chipinfo::get_blank_value()
-	{
-		if( (core_type==Core16_C) || (core_type==Core16_A) || (core_type==Core16_B))
-			return BLANK_16BIT;
-		else if( (core_type==Core12_A) || (core_type==Core12_B) || (core_type==Core10_A) )
-			return BLANK_12BIT;
-		else
-			return BLANK_14BIT;
-	}
 
 }
@@ -19,6 +19,8 @@
 
 #include <sys/types.h>
 
+#include "corefamily.h"
+
 namespace chipinfo
 {
 	struct chipinfo
@@ -27,22 +29,6 @@ namespace chipinfo
 		typedef	uint32_t	rom_size_type;
 		typedef	uint16_t	eeprom_size_type;
 		
-		//Core ROM blank values
-		#define	BLANK_12BIT   0x0FFF
-		#define	BLANK_14BIT   0x3FFF
-		#define	BLANK_16BIT   0xFFFF
-
-		#define	EEPROM_START_12BIT	0x2100
-		#define	EEPROM_START_14BIT	0x2100
-		#define	EEPROM_START_16BIT	0xF0000
-		
-	#define	CONFIG_START_12BIT	0x0FFF
-		#define	CONFIG_START_14BIT	0x2007		
-		#define	CONFIG_START_16BIT	0x300000
-
-		#define	ID_START_14BIT	0x2000
-		#define	ID_START_16BIT	0x200000
-
 		//Core Type Codes	for chipinfo file
 		#define	Core16_C	0   // 18F6x2x
 		#define	Core16_A	1	 // 18Fx230x330
@@ -58,7 +44,7 @@ namespace chipinfo
 		#define	Core12_B	11   // 16F57
 		#define	Core10_A	12   // 10Fxxx
 
-		chipinfo() : fast_power(false) {}
+		chipinfo() : chip_id(0), fast_power(false) {}
 
 		std::string	name;						//Chip name
 		uint16_t	chip_id;
@@ -80,51 +66,25 @@ namespace chipinfo
 
 		bool	set(std::string, std::string);
 
-	bool	is12bit()
-	{
-	    return (core_type == Core12_A) || (core_type == Core12_B);
-	}
+		//The one place core types are mapped to families
+		corefamily::family_t	family() const;
+		const corefamily::layout_t	&layout() const	{ return corefamily::layout(family()); }
 
-		bool	is14bit();
-		bool	is16bit();
+		bool	is12bit() const	{ return family() == corefamily::FAMILY_12BIT; }
+		bool	is14bit() const	{ return family() == corefamily::FAMILY_14BIT; }
+		bool	is16bit() const	{ return family() == corefamily::FAMILY_16BIT; }
 		
-		uint32_t	get_eeprom_start();
-		uint32_t	get_config_start();
-		uint32_t	get_id_start();
-		uint32_t	get_blank_value();
+		uint32_t	get_eeprom_start() const	{ return layout().eeprom_start; }
+		uint32_t	get_config_start() const	{ return layout().config_start; }
+		uint32_t	get_id_start() const	{ return layout().id_begin(rom_size); }
+		uint32_t	get_blank_value() const	{ return layout().blank; }
 		const uint8_t	numConfigWords() const { return num_config_words;	}
 
 		const uint8_t	eepromBlank()	const { return 0xFF;	}
-		const address_t	eepromBegin()	const
-		{
-			switch(core_type)
-			{
-				case Core16_A:
-				case Core16_B:
-				case Core16_C:
-					return EEPROM_START_16BIT;
-				default:
-					return EEPROM_START_14BIT;
-			}
-		}
+		const address_t	eepromBegin()	const { return get_eeprom_start();	}
 		const address_t	eepromEnd()		const { return eepromBegin() + eeprom_size;	}
 
-		const uint16_t	romBlank()	const
-		{
-			switch(core_type)
-			{
-				case Core10_A:
-				case Core12_A:
-				case Core12_B:
-					return BLANK_12BIT;
-				case Core16_A:
-				case Core16_B:
-				case Core16_C:
-					return BLANK_16BIT;
-				default:
-					return BLANK_14BIT;
-			}
-		}
+		const uint16_t	romBlank()	const { return get_blank_value();	}
 		const address_t	romBegin()	const { return 0; }
 		const address_t	romEnd()	const { return romBegin() + rom_size; }
 		
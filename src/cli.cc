@@ -0,0 +1,530 @@
+/*	Filename:	cli.cc
+	Command line interface for QProg
+
+	qprog --convert <in> <out> [--chip <name>]
+		Convert between Intel HEX and .qpimg, the output format is picked by
+		the extension of <out>. The chip name and core type are recorded in
+		the .qpimg header when a chip is given.
+
+	qprog --compose <out> <base> [--<policy> <in>]... [--patch <address>=<word>[,<word>...]]...
+		Overlay images on top of base in the order given, <policy> is overlay,
+		underlay, match or disjoint. A bare <in> uses match. Patches overwrite
+		the words starting at a word address. Numbers may be given in hex with 0x.
+
+	qprog --serialize <out> <base> --chip <name> --state <file> [--first <n>] [--count <n>]
+			[--target id|rom:<address>|eeprom:<offset>] [--encoding nibble|byte|word|retlw] [--format <template>]
+		Write one image per unit with its serial patched in. <out> and <template>
+		take the fields serialno::expand() knows, e.g. "unit-{serial:6}.hex".
+		The next serial number is kept in the state file, which is created
+		starting at --first.
+
+	qprog --read <out> --port <device> --chip <name>|auto
+		Read a chip back into an Intel HEX file. Records are written as the
+		words arrive, a failed read leaves no file behind. With auto the part
+		is found by its device ID.
+
+	qprog --latency --port <device>
+		Measure the command turnaround of a programmer with echo commands and
+		say whether the port is in low latency mode.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QString>
+
+#include "centralwidget.h"
+#include "chipinfo.h"
+#include "cli.h"
+#include "compose.h"
+#include "devicelibrary.h"
+#include "imagecache.h"
+#include "intelhex.h"
+#include "kitsrus.h"
+#include "programmer.h"
+#include "qpimg.h"
+#include "serialno.h"
+
+namespace cli
+{
+	static bool has_suffix(const std::string &s, const char *suffix)
+	{
+		const std::string	x(suffix);
+		return (s.size() >= x.size()) && (s.compare(s.size()-x.size(), x.size(), x) == 0);
+	}
+
+	static void usage()
+	{
+		std::cerr << "usage: qprog --convert <in> <out> [--chip <name>]\n";
+		std::cerr << "       qprog --compose <out> <base> [--overlay|--underlay|--match|--disjoint <in>]... [--patch <address>=<word>[,<word>...]]...\n";
+		std::cerr << "       qprog --serialize <out> <base> --chip <name> --state <file> [--first <n>] [--count <n>]\n";
+		std::cerr << "             [--target id|rom:<address>|eeprom:<offset>] [--encoding nibble|byte|word|retlw] [--format <template>]\n";
+		std::cerr << "       qprog --read <out> --port <device> --chip <name>|auto\n";
+		std::cerr << "       qprog --latency --port <device>\n";
+	}
+
+	static int convert(int argc, char *argv[])
+	{
+		std::string	in, out, chip;
+		for(int i=2; i < argc; ++i)
+		{
+			const std::string	arg(argv[i]);
+			if( arg == "--chip" )
+			{
+				if( ++i == argc )
+				{
+					usage();
+					return 2;
+				}
+				chip = argv[i];
+			}
+			else if( in.empty() )
+				in = arg;
+			else if( out.empty() )
+				out = arg;
+			else
+			{
+				usage();
+				return 2;
+			}
+		}
+		if( in.empty() || out.empty() )
+		{
+			usage();
+			return 2;
+		}
+
+		intelhex::hex_data	hex;
+		if( !imagecache::load_image(in, hex) )
+		{
+			std::cerr << "Could not load " << in << "\n";
+			return 1;
+		}
+
+		if( !has_suffix(out, ".qpimg") )
+		{
+			if( !hex.write(out.c_str()) )
+			{
+				std::cerr << "Could not write " << out << "\n";
+				return 1;
+			}
+			return 0;
+		}
+
+		uint8_t	core_type(QPIMG_CORE_UNKNOWN);
+		if( chip.empty() && qpimg::is_qpimg(in.c_str()) )
+		{
+			//Keep the header of a .qpimg that's being rewritten
+			qpimg::file_t	f;
+			if( f.open(in.c_str()) )
+			{
+				chip = f.chip();
+				core_type = f.core_type();
+			}
+		}
+		else if( !chip.empty() )
+		{
+			QString	part(QString::fromStdString(chip));
+			chipinfo::chipinfo	info;
+			if( !loadChipInfo(part, info) || (info.name != chip) )
+			{
+				std::cerr << "Unknown chip " << chip << "\n";
+				return 1;
+			}
+			core_type = info.core_type;
+		}
+
+		if( !qpimg::write(out.c_str(), hex, chip, core_type) )
+		{
+			std::cerr << "Could not write " << out << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	static bool parse_number(const std::string &s, unsigned long &n)
+	{
+		char	*end;
+		n = strtoul(s.c_str(), &end, 0);
+		return !s.empty() && (*end == '\0');
+	}
+
+	//<address>=<word>[,<word>...]
+	static bool parse_patch(const std::string &s, compose::address_t &address, std::vector<compose::element_t> &words)
+	{
+		const std::string::size_type	eq(s.find('='));
+		unsigned long	n;
+		if( (eq == std::string::npos) || !parse_number(s.substr(0, eq), n) )
+			return false;
+		address = n;
+		words.clear();
+		for(std::string::size_type i=eq+1; i <= s.size(); )
+		{
+			std::string::size_type	comma(s.find(',', i));
+			if( comma == std::string::npos )
+				comma = s.size();
+			if( !parse_number(s.substr(i, comma-i), n) || (n > 0xFFFF) )
+				return false;
+			words.push_back(n);
+			i = comma + 1;
+		}
+		return true;
+	}
+
+	static int compose_images(int argc, char *argv[])
+	{
+		if( argc < 4 )
+		{
+			usage();
+			return 2;
+		}
+		const std::string	out(argv[2]);
+
+		std::list<intelhex::hex_data>	layers;		//Referenced by the image until it's written
+		compose::image_t	image;
+		for(int i=3; i < argc; ++i)
+		{
+			std::string	arg(argv[i]);
+			compose::policy_t	policy(compose::POLICY_MATCH);
+			compose::conflict_t	conflict;
+			if( arg == "--patch" )
+			{
+				compose::address_t	address;
+				std::vector<compose::element_t>	words;
+				if( (++i == argc) || !parse_patch(argv[i], address, words) )
+				{
+					usage();
+					return 2;
+				}
+				if( !image.patch(address, &words[0], words.size()) )
+					return 1;
+				continue;
+			}
+			if( arg.compare(0, 2, "--") == 0 )
+			{
+				if( !compose::parse_policy(arg.substr(2), policy) || (++i == argc) )
+				{
+					usage();
+					return 2;
+				}
+				arg = argv[i];
+			}
+
+			layers.push_back(intelhex::hex_data());
+			if( !imagecache::load_image(arg, layers.back()) )
+			{
+				std::cerr << "Could not load " << arg << "\n";
+				return 1;
+			}
+			if( !image.overlay(layers.back(), policy, &conflict) )
+			{
+				fprintf(stderr, "%s: %s conflict at 0x%04X, the image has 0x%04X and the file has 0x%04X\n", arg.c_str(),
+					compose::policy_name(policy), conflict.address, conflict.existing, conflict.incoming);
+				return 1;
+			}
+		}
+
+		bool	ok;
+		if( has_suffix(out, ".qpimg") )
+		{
+			intelhex::hex_data	hex;
+			image.flatten(hex);
+			ok = qpimg::write(out.c_str(), hex, std::string(), QPIMG_CORE_UNKNOWN);
+		}
+		else
+			ok = image.write(out.c_str());
+		if( !ok )
+		{
+			std::cerr << "Could not write " << out << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	static int serialize(int argc, char *argv[])
+	{
+		std::string	out, in, chip, state;
+		unsigned long	first(0), count(1);
+		serialno::config_t	config;
+		for(int i=2; i < argc; ++i)
+		{
+			const std::string	arg(argv[i]);
+			if( arg.compare(0, 2, "--") != 0 )
+			{
+				if( out.empty() )
+					out = arg;
+				else if( in.empty() )
+					in = arg;
+				else
+				{
+					usage();
+					return 2;
+				}
+				continue;
+			}
+			if( ++i == argc )
+			{
+				usage();
+				return 2;
+			}
+			const std::string	value(argv[i]);
+			bool	ok(true);
+			if( arg == "--chip" )
+				chip = value;
+			else if( arg == "--state" )
+				state = value;
+			else if( arg == "--first" )
+				ok = parse_number(value, first);
+			else if( arg == "--count" )
+				ok = parse_number(value, count);
+			else if( arg == "--target" )
+				ok = serialno::parse_target(value, config);
+			else if( arg == "--encoding" )
+				ok = serialno::parse_encoding(value, config.encoding);
+			else if( arg == "--format" )
+				config.format = value;
+			else
+				ok = false;
+			if( !ok )
+			{
+				usage();
+				return 2;
+			}
+		}
+		if( out.empty() || in.empty() || chip.empty() || state.empty() )
+		{
+			usage();
+			return 2;
+		}
+		if( (count > 1) && (out.find('{') == std::string::npos) )
+		{
+			std::cerr << "The output name needs a {serial} field to write more than one image\n";
+			return 2;
+		}
+
+		QString	part(QString::fromStdString(chip));
+		chipinfo::chipinfo	info;
+		if( !loadChipInfo(part, info) || (info.name != chip) )
+		{
+			std::cerr << "Unknown chip " << chip << "\n";
+			return 1;
+		}
+
+		intelhex::hex_data	hex;
+		compose::image_t	base;
+		if( !imagecache::load_image(in, hex) || !base.overlay(hex, compose::POLICY_OVERLAY) )
+		{
+			std::cerr << "Could not load " << in << "\n";
+			return 1;
+		}
+
+		serialno::counter_t	counter;
+		if( !counter.open(state, first) )
+		{
+			std::cerr << "Could not open or lock the serial number state " << state << "\n";
+			return 1;
+		}
+
+		const serialno::serializer_t	serializer(info, config);
+		compose::image_t	variant;
+		std::string	error;
+		for(unsigned long i=0; i < count; ++i)
+		{
+			//Check the template before a number is used up
+			const time_t	now(time(NULL));
+			std::vector<compose::element_t>	words;
+			std::vector<uint8_t>	name;
+			if( !serializer.words(counter.next(), now, words, error) || !serialno::expand(out, counter.next(), now, name, error) )
+			{
+				std::cerr << error << "\n";
+				return 1;
+			}
+
+			uint64_t	serial;
+			if( !counter.reserve(serial) )
+			{
+				std::cerr << "Could not update the serial number state " << state << "\n";
+				return 1;
+			}
+			const std::string	path(name.begin(), name.end());
+			if( !serializer.apply(base, variant, serial, now, error) || !variant.write(path.c_str()) )
+			{
+				std::cerr << "Could not write " << path << " " << error << "\n";
+				return 1;
+			}
+			std::cout << serial << " " << path << "\n";
+		}
+		return 0;
+	}
+
+	//Open the port and get the programmer into command mode
+	static bool init(kitsrus::kitsrus_t &prog)
+	{
+		std::string	error;
+		if( !programmer::init(prog, error) )
+		{
+			std::cerr << error << "\n";
+			return false;
+		}
+		return true;
+	}
+
+	//Switch the programmer to the part in the socket
+	static bool detect(kitsrus::kitsrus_t &prog)
+	{
+		const devicelibrary::library_t	&library = devicelibrary::library();
+		devicelibrary::indices_t	matches;
+		uint16_t	id;
+		if( !devicelibrary::detect(prog, library, matches, id) )
+		{
+			fprintf(stderr, id ? "Unknown device ID 0x%04X\n" : "No device detected\n", id);
+			return false;
+		}
+		if( matches.size() > 1 )
+		{
+			std::cerr << "Device ID could be";
+			for(devicelibrary::indices_t::const_iterator i=matches.begin(); i != matches.end(); ++i)
+				std::cerr << " " << library[*i].name;
+			std::cerr << ", using " << library[matches.front()].name << "\n";
+		}
+		prog.set_chip(library[matches.front()]);
+		return prog.init_program_vars();
+	}
+
+	static int read_chip(int argc, char *argv[])
+	{
+		std::string	out, port, chip;
+		for(int i=2; i < argc; ++i)
+		{
+			const std::string	arg(argv[i]);
+			if( (arg == "--port") || (arg == "--chip") )
+			{
+				if( ++i == argc )
+				{
+					usage();
+					return 2;
+				}
+				if( arg == "--port" )
+					port = argv[i];
+				else
+					chip = argv[i];
+			}
+			else if( out.empty() )
+				out = arg;
+			else
+			{
+				usage();
+				return 2;
+			}
+		}
+		if( out.empty() || port.empty() || chip.empty() )
+		{
+			usage();
+			return 2;
+		}
+
+		QString	part(QString::fromStdString(chip));
+		chipinfo::chipinfo	info;
+		const bool	autodetect(chip == "auto");
+		if( autodetect )
+		{
+			//Any part with an ID will do to get the programmer going
+			const devicelibrary::indices_t	families(devicelibrary::library().families());
+			if( families.empty() )
+			{
+				std::cerr << "No parts with device IDs in the device library\n";
+				return 1;
+			}
+			info = devicelibrary::library()[families.front()];
+		}
+		else if( !loadChipInfo(part, info) )
+		{
+			std::cerr << "Unknown chip " << chip << "\n";
+			return 1;
+		}
+
+		std::ofstream	ofs(out.c_str(), std::ios::out | std::ios::binary);
+		if( !ofs )
+		{
+			std::cerr << "Could not open " << out << "\n";
+			return 1;
+		}
+
+		bool	ok;
+		{
+			QString	path(QString::fromStdString(port));
+			kitsrus::kitsrus_t	prog(path, info);
+			intelhex::writer_t	writer(ofs);
+			kitsrus::writer_sink_t	sink(writer);
+			ok = init(prog) && (!autodetect || detect(prog)) && programmer::read_all(prog, sink, NULL, programmer::everything()) && writer.finish();
+		}
+		if( !ok )
+		{
+			std::cerr << "Error reading chip\n";
+			ofs.close();
+			remove(out.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	#define	TURNAROUND_ECHOES	32		//Echo commands timed by --latency
+
+	static int latency(int argc, char *argv[])
+	{
+		if( (argc != 4) || (std::string(argv[2]) != "--port") )
+		{
+			usage();
+			return 2;
+		}
+
+		QString	path(argv[3]);
+		kitsrus::kitsrus_t	prog(path, chipinfo::chipinfo());
+		if( !prog.open() )
+		{
+			std::cerr << "Could not open serial port\n";
+			return 1;
+		}
+		std::string	error;
+		if( !programmer::reset(prog, error) )
+		{
+			std::cerr << error << "\n";
+			return 1;
+		}
+		unsigned	usec;
+		if( !prog.measure_turnaround(TURNAROUND_ECHOES, usec) )
+		{
+			std::cerr << "Programmer didn't echo\n";
+			return 1;
+		}
+		printf("%u.%03u ms turnaround, low latency %s\n", usec/1000, usec%1000, prog.low_latency() ? "on" : "off");
+		return 0;
+	}
+
+	int run(int argc, char *argv[])
+	{
+		if( argc < 2 )
+			return -1;
+
+		const std::string	command(argv[1]);
+		if( command == "--convert" )
+			return convert(argc, argv);
+		if( command == "--compose" )
+			return compose_images(argc, argv);
+		if( command == "--serialize" )
+			return serialize(argc, argv);
+		if( command == "--read" )
+			return read_chip(argc, argv);
+		if( command == "--latency" )
+			return latency(argc, argv);
+		return -1;
+	}
+}
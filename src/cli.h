@@ -0,0 +1,19 @@
+/*	Filename:	cli.h
+	Command line interface for QProg
+	Handles the commands that don't need a window, for use by scripts and build farms
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	CLI_H
+#define	CLI_H
+
+namespace cli
+{
+	//Run a command line command
+	//	Returns the process exit status, or -1 if argv doesn't hold a command and the GUI should start
+	int	run(int argc, char *argv[]);
+}
+
+#endif	//CLI_H
@@ -0,0 +1,232 @@
+/*	Filename:	compose.cc
+	Image composition
+
+	Adding a layer only touches the extents it overlaps: they're trimmed or
+	kept according to the policy and the new extents are spliced in. Words
+	are only compared for POLICY_MATCH and only copied by flatten().
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "compose.h"
+
+namespace compose
+{
+	static const char *policy_names[] = {"overlay", "underlay", "match", "disjoint"};
+
+	const char *policy_name(policy_t p)
+	{
+		return policy_names[p];
+	}
+
+	bool parse_policy(const std::string &s, policy_t &p)
+	{
+		for(unsigned i=0; i < sizeof(policy_names)/sizeof(policy_names[0]); ++i)
+			if( s == policy_names[i] )
+			{
+				p = policy_t(i);
+				return true;
+			}
+		return false;
+	}
+
+	//Extents are sorted and don't overlap, so their ends are sorted too
+	static bool ends_at_or_before(const extent_t &e, address_t a)
+	{
+		return e.end <= a;
+	}
+
+	static bool begins_after(address_t a, const extent_t &e)
+	{
+		return a < e.begin;
+	}
+
+	//Add the words [b, e), the first of which is at offset in words (or the pool)
+	bool image_t::insert(address_t b, address_t e, const element_t *words, size_t offset, policy_t policy, conflict_t *conflict)
+	{
+		if( b == e )
+			return true;
+
+		//The extents that overlap [b, e)
+		const extents_t::iterator	first(std::lower_bound(extents_.begin(), extents_.end(), b, ends_at_or_before));
+		extents_t::iterator	last(first);
+		while( (last != extents_.end()) && (last->begin < e) )
+			++last;
+
+		const element_t	*incoming((words ? words : &pool[0]) + offset);
+		if( (policy == POLICY_DISJOINT) && (first != last) )
+		{
+			if( conflict )
+			{
+				conflict->address = std::max(first->begin, b);
+				conflict->existing = data(*first)[conflict->address - first->begin];
+				conflict->incoming = incoming[conflict->address - b];
+			}
+			return false;
+		}
+		if( policy == POLICY_MATCH )
+		{
+			for(extents_t::iterator i=first; i != last; ++i)
+			{
+				const element_t	*existing(data(*i));
+				for(address_t a=std::max(i->begin, b); a < std::min(i->end, e); ++a)
+					if( existing[a - i->begin] != incoming[a - b] )
+					{
+						if( conflict )
+						{
+							conflict->address = a;
+							conflict->existing = existing[a - i->begin];
+							conflict->incoming = incoming[a - b];
+						}
+						return false;
+					}
+			}
+		}
+
+		//Build the replacement for [first, last)
+		extents_t	pieces;
+		extent_t	x;
+		x.words = words;
+		if( policy == POLICY_OVERLAY )
+		{
+			if( (first != last) && (first->begin < b) )
+			{
+				pieces.push_back(*first);
+				pieces.back().end = b;
+			}
+			x.begin = b;
+			x.end = e;
+			x.offset = offset;
+			pieces.push_back(x);
+			if( (first != last) && ((last-1)->end > e) )
+			{
+				pieces.push_back(*(last-1));
+				pieces.back().offset += e - pieces.back().begin;
+				pieces.back().begin = e;
+			}
+		}
+		else	//The existing words stay, the new ones go in the gaps
+		{
+			address_t	cursor(b);
+			for(extents_t::iterator i=first; i != last; ++i)
+			{
+				if( i->begin > cursor )
+				{
+					x.begin = cursor;
+					x.end = i->begin;
+					x.offset = offset + (cursor - b);
+					pieces.push_back(x);
+				}
+				pieces.push_back(*i);
+				cursor = std::max(cursor, i->end);
+			}
+			if( cursor < e )
+			{
+				x.begin = cursor;
+				x.end = e;
+				x.offset = offset + (cursor - b);
+				pieces.push_back(x);
+			}
+		}
+
+		const size_t	at(first - extents_.begin());
+		extents_.erase(first, last);
+		extents_.insert(extents_.begin() + at, pieces.begin(), pieces.end());
+		return true;
+	}
+
+	bool image_t::overlay(const intelhex::hex_data &hex, policy_t policy, conflict_t *conflict)
+	{
+		const extents_t	saved(extents_);
+		for(intelhex::hex_data::lst_dblock::const_iterator i=hex.blocks.begin(); i != hex.blocks.end(); ++i)
+		{
+			if( i->second.empty() )
+				continue;
+			if( !insert(i->first, i->first + i->second.size(), &i->second[0], 0, policy, conflict) )
+			{
+				extents_ = saved;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool image_t::patch(address_t a, const element_t *w, size_t n, policy_t policy, conflict_t *conflict)
+	{
+		if( !n )
+			return true;
+		const size_t	offset(pool.size());
+		pool.insert(pool.end(), w, w + n);
+		if( !insert(a, a + n, NULL, offset, policy, conflict) )
+		{
+			pool.resize(offset);
+			return false;
+		}
+		return true;
+	}
+
+	size_t image_t::size() const
+	{
+		size_t	n(0);
+		for(extents_t::const_iterator i=extents_.begin(); i != extents_.end(); ++i)
+			n += i->end - i->begin;
+		return n;
+	}
+
+	bool image_t::get(address_t a, element_t &w) const
+	{
+		extents_t::const_iterator	i(std::upper_bound(extents_.begin(), extents_.end(), a, begins_after));
+		if( i == extents_.begin() )
+			return false;
+		--i;
+		if( a >= i->end )
+			return false;
+		w = data(*i)[a - i->begin];
+		return true;
+	}
+
+	void image_t::flatten(intelhex::hex_data &hex) const
+	{
+		hex.clear();
+		for(extents_t::const_iterator i=extents_.begin(); i != extents_.end(); ++i)
+		{
+			const element_t	*p(data(*i));
+			if( !hex.blocks.empty() && (hex.blocks.back().first + hex.blocks.back().second.size() == i->begin) )
+				hex.blocks.back().second.insert(hex.blocks.back().second.end(), p, p + (i->end - i->begin));
+			else
+			{
+				hex.blocks.push_back(intelhex::hex_data::dblock(i->begin, intelhex::hex_data::data_container()));
+				hex.blocks.back().second.assign(p, p + (i->end - i->begin));
+			}
+		}
+	}
+
+	bool image_t::write(std::ostream &os, unsigned record_bytes) const
+	{
+		if( !os )
+			return false;
+
+		//Word addresses past 0x7FFF need linear address records
+		const bool	linear(!extents_.empty() && (extents_.back().end - 1 > 0x7FFF));
+		intelhex::writer_t	writer(os, record_bytes, linear);
+		for(extents_t::const_iterator i=extents_.begin(); i != extents_.end(); ++i)
+			writer.put(i->begin, data(*i), i->end - i->begin);
+		return writer.finish();
+	}
+
+	bool image_t::write(const char *path, unsigned record_bytes) const
+	{
+		std::ofstream	ofs(path, std::ios::out | std::ios::binary);
+		if( !ofs )
+		{
+			std::cerr << "Couldn't open " << path << "\n";
+			return false;
+		}
+		return write(ofs, record_bytes);
+	}
+}
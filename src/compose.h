@@ -0,0 +1,95 @@
+/*	Filename:	compose.h
+	Image composition
+	Builds a programmable image out of several parsed images (bootloader,
+	application, EEPROM data, ...) and address range patches. The composed
+	image is a sorted list of extents that point into the source images, so
+	unchanged ranges are never copied and a per-unit variant only costs its
+	patch words.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	COMPOSE_H
+#define	COMPOSE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "intelhex.h"
+
+namespace compose
+{
+	typedef	intelhex::hex_data::address_t	address_t;
+	typedef	intelhex::hex_data::element_t	element_t;
+
+	//What to do where a new layer overlaps words that are already in the image
+	enum policy_t
+	{
+		POLICY_OVERLAY = 0,	//The new layer wins
+		POLICY_UNDERLAY,	//The image wins, the new layer only fills the gaps
+		POLICY_MATCH,		//Overlapping words must be equal
+		POLICY_DISJOINT		//Layers must not overlap at all
+	};
+
+	const char	*policy_name(policy_t);
+	bool	parse_policy(const std::string &, policy_t &);	//"overlay", "underlay", "match" or "disjoint"
+
+	//The first word that a layer couldn't be added at
+	struct conflict_t
+	{
+		address_t	address;
+		element_t	existing;	//Word already in the image
+		element_t	incoming;	//Word from the new layer
+
+		conflict_t() : address(0), existing(0), incoming(0) {}
+	};
+
+	//A run of words [begin, end) taken from one source
+	//	words is NULL for words owned by the image, offset is then an index into its pool
+	struct extent_t
+	{
+		address_t	begin;
+		address_t	end;
+		const element_t	*words;
+		size_t		offset;		//Index of the word at begin
+	};
+	typedef	std::vector<extent_t>	extents_t;
+
+	//A composed image
+	//	Layers added with overlay() are referenced, not copied, and must outlive the image
+	//	and every copy of it. Patch words are copied into the image. Copying an image
+	//	costs one extent per range plus the patch words, never the layer data.
+	class image_t
+	{
+		extents_t	extents_;			//Sorted, never overlapping
+		std::vector<element_t>	pool;	//Patch words
+
+		bool	insert(address_t, address_t, const element_t *, size_t, policy_t, conflict_t *);
+	public:
+		//Add every block of a parsed image, true if it was added
+		//	On a conflict the image is left as it was
+		bool	overlay(const intelhex::hex_data &, policy_t, conflict_t * = NULL);
+
+		//Set n words starting at address, the words are copied
+		bool	patch(address_t, const element_t *, size_t, policy_t = POLICY_OVERLAY, conflict_t * = NULL);
+		bool	patch(address_t a, element_t w, policy_t p = POLICY_OVERLAY, conflict_t *c = NULL)	{ return patch(a, &w, 1, p, c); }
+
+		const extents_t	&extents() const	{ return extents_; }
+		const element_t	*data(const extent_t &e) const	{ return (e.words ? e.words : &pool[0]) + e.offset; }
+
+		bool	empty() const	{ return extents_.empty(); }
+		size_t	size() const;						//Number of words
+		bool	get(address_t, element_t &) const;	//False if the word isn't set
+		void	clear()	{ extents_.clear(); pool.clear(); }
+
+		void	flatten(intelhex::hex_data &) const;	//Copy into a hex_data for programming, contiguous extents are merged
+		bool	write(std::ostream &, unsigned record_bytes=16) const;	//Intel HEX
+		bool	write(const char *, unsigned record_bytes=16) const;
+	};
+}
+
+#endif	//COMPOSE_H
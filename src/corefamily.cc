@@ -0,0 +1,34 @@
+/*	Filename:	corefamily.cc
+	Word width, blank value and memory map of each PIC core family
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include "corefamily.h"
+
+namespace corefamily
+{
+	template<class T> layout_t make_layout()
+	{
+		layout_t	l;
+		l.family = T::family;
+		l.word_bits = T::word_bits;
+		l.blank = T::blank;
+		l.eeprom_start = T::eeprom_start;
+		l.config_start = T::config_start;
+		l.id_start = T::id_start;
+		l.id_after_rom = T::id_after_rom;
+		l.id_readable = T::id_readable;
+		l.fuse_pass = T::fuse_pass;
+		l.retlw = T::retlw;
+		return l;
+	}
+
+	static const layout_t	layouts[NUM_FAMILIES] = {make_layout<core12_t>(), make_layout<core14_t>(), make_layout<core16_t>()};
+
+	const layout_t &layout(family_t family)
+	{
+		return layouts[family];
+	}
+}
@@ -0,0 +1,124 @@
+/*	Filename:	corefamily.h
+	Word width, blank value and memory map of each PIC core family
+
+	Every core type in the chipinfo file belongs to one of three families,
+	and nearly everything that differs between parts when talking to the
+	programmer is decided by the family alone. The traits hold those
+	differences as compile time constants so the per-word kernels can be
+	instantiated once per family, and the family is looked up once per job
+	instead of switching on the core type for every word.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	COREFAMILY_H
+#define	COREFAMILY_H
+
+#include <stdint.h>
+
+//Core ROM blank values
+#define	BLANK_12BIT   0x0FFF
+#define	BLANK_14BIT   0x3FFF
+#define	BLANK_16BIT   0xFFFF
+
+#define	EEPROM_START_12BIT	0x2100
+#define	EEPROM_START_14BIT	0x2100
+#define	EEPROM_START_16BIT	0xF0000
+
+#define	CONFIG_START_12BIT	0x0FFF
+#define	CONFIG_START_14BIT	0x2007
+#define	CONFIG_START_16BIT	0x300000
+
+#define	ID_START_14BIT	0x2000
+#define	ID_START_16BIT	0x200000
+
+namespace corefamily
+{
+	enum family_t
+	{
+		FAMILY_12BIT,	//10F, 12C50x, 16F5x
+		FAMILY_14BIT,	//Midrange 12F and 16F
+		FAMILY_16BIT,	//18F
+		NUM_FAMILIES
+	};
+
+	template<family_t F> struct traits;
+
+	template<> struct traits<FAMILY_12BIT>
+	{
+		static const family_t	family = FAMILY_12BIT;
+		static const unsigned	word_bits = 12;
+		static const uint16_t	blank = BLANK_12BIT;		//Also the mask of a ROM or config word
+		static const uint32_t	eeprom_start = EEPROM_START_12BIT;
+		static const uint32_t	config_start = CONFIG_START_12BIT;
+		static const uint32_t	id_start = 0;
+		static const bool	id_after_rom = true;		//ID words follow the last ROM word
+		static const bool	id_readable = true;			//The programmer reads back the low byte of each ID word
+		static const bool	fuse_pass = false;			//Config is sent a second time with CMD_WRITE_FUSE
+		static const uint16_t	retlw = 0x0800;
+	};
+
+	template<> struct traits<FAMILY_14BIT>
+	{
+		static const family_t	family = FAMILY_14BIT;
+		static const unsigned	word_bits = 14;
+		static const uint16_t	blank = BLANK_14BIT;
+		static const uint32_t	eeprom_start = EEPROM_START_14BIT;
+		static const uint32_t	config_start = CONFIG_START_14BIT;
+		static const uint32_t	id_start = ID_START_14BIT;
+		static const bool	id_after_rom = false;
+		static const bool	id_readable = true;
+		static const bool	fuse_pass = false;
+		static const uint16_t	retlw = 0x3400;
+	};
+
+	template<> struct traits<FAMILY_16BIT>
+	{
+		static const family_t	family = FAMILY_16BIT;
+		static const unsigned	word_bits = 16;
+		static const uint16_t	blank = BLANK_16BIT;
+		static const uint32_t	eeprom_start = EEPROM_START_16BIT;
+		static const uint32_t	config_start = CONFIG_START_16BIT;
+		static const uint32_t	id_start = ID_START_16BIT;
+		static const bool	id_after_rom = false;
+		static const bool	id_readable = false;
+		static const bool	fuse_pass = true;
+		static const uint16_t	retlw = 0x0C00;
+	};
+
+	typedef	traits<FAMILY_12BIT>	core12_t;
+	typedef	traits<FAMILY_14BIT>	core14_t;
+	typedef	traits<FAMILY_16BIT>	core16_t;
+
+	//The traits of one family as plain values, for code that only needs the
+	//	memory map and isn't worth instantiating per family
+	struct layout_t
+	{
+		family_t	family;
+		unsigned	word_bits;
+		uint16_t	blank;
+		uint32_t	eeprom_start;
+		uint32_t	config_start;
+		uint32_t	id_start;
+		bool	id_after_rom;
+		bool	id_readable;
+		bool	fuse_pass;
+		uint16_t	retlw;
+
+		//Where the ID words of a part with rom_size ROM words start
+		uint32_t	id_begin(uint32_t rom_size) const	{ return id_after_rom ? rom_size : id_start; }
+	};
+
+	const layout_t	&layout(family_t);
+
+	//Pick the instantiation of a kernel for a family
+	//	kernels must hold one entry per family, in family_t order
+	//	static bool (*const kernels[])(args) = {&f<core12_t>, &f<core14_t>, &f<core16_t>};
+	template<class K> K select(const K (&kernels)[NUM_FAMILIES], family_t family)
+	{
+		return kernels[family];
+	}
+}
+
+#endif	//COREFAMILY_H
@@ -0,0 +1,166 @@
+/*	Filename:	devicelibrary.cc
+	The device library from the settings
+
+	Walking the DeviceInfo/Devices array in QSettings costs a lookup per key
+	of every device, so it's done once and every later lookup is a map find.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+
+#include <QSettings>
+#include <QStringList>
+
+#include "devicelibrary.h"
+
+namespace devicelibrary
+{
+	//Blank or missing ID words never identify a part
+	static bool valid_id(uint16_t id)
+	{
+		return (id != 0) && (id != 0xFFFF) && (id != BLANK_14BIT);
+	}
+
+	bool library_t::load()
+	{
+		devices.clear();
+		by_name.clear();
+		by_id.clear();
+		by_family.clear();
+		loaded = true;
+
+		QSettings	settings;
+		if( !settings.childGroups().contains("DeviceInfo") )
+			return false;
+		settings.beginGroup("DeviceInfo");
+		if( !settings.childGroups().contains("Devices") )
+			return false;
+
+		settings.beginReadArray("Devices");
+		const size_t numDevices = settings.childGroups().count();	// Rude hack to deal with QSettings bug
+		for(size_t i=0; i<numDevices; ++i)
+		{
+			settings.setArrayIndex(i);
+			QVariant n = settings.value("Name");
+			if( !n.isValid() || (n.toString().length() == 0) )
+				continue;
+
+			chipinfo::chipinfo	info;
+			QStringListIterator	k(settings.childKeys());
+			while(k.hasNext())
+			{
+				QString	key(k.next());
+				QString	value(settings.value(key).toString());
+				if( value.size() == 0 )	//Skip empty keys
+					continue;
+				info.set(key.toStdString(), value.toStdString());
+			}
+
+			const size_t	index(devices.size());
+			devices.push_back(info);
+			by_name.insert(name_index_t::value_type(info.name, index));
+			if( valid_id(info.chip_id) )
+			{
+				by_id.insert(id_index_t::value_type(info.chip_id, index));
+				by_family.insert(id_index_t::value_type(info.chip_id & ~CHIP_ID_REVISION_MASK, index));
+			}
+		}
+		settings.endArray();
+		settings.endGroup();
+		return true;
+	}
+
+	const chipinfo::chipinfo *library_t::find(const std::string &name) const
+	{
+		name_index_t::const_iterator	i(by_name.find(name));
+		return (i == by_name.end()) ? NULL : &devices[i->second];
+	}
+
+	indices_t library_t::find(uint16_t id) const
+	{
+		indices_t	r;
+		if( !valid_id(id) )
+			return r;
+		std::pair<id_index_t::const_iterator, id_index_t::const_iterator>	range(by_id.equal_range(id));
+		if( range.first == range.second )
+			range = by_family.equal_range(id & ~CHIP_ID_REVISION_MASK);
+		for(id_index_t::const_iterator i=range.first; i != range.second; ++i)
+			r.push_back(i->second);
+		return r;
+	}
+
+	indices_t library_t::families() const
+	{
+		indices_t	r;
+		std::vector<bool>	seen(256, false);
+		for(id_index_t::const_iterator i=by_id.begin(); i != by_id.end(); ++i)
+		{
+			const uint8_t	core(devices[i->second].core_type);
+			if( !seen[core] )
+			{
+				seen[core] = true;
+				r.push_back(i->second);
+			}
+		}
+		return r;
+	}
+
+	library_t &library()
+	{
+		static library_t	shared;
+		if( !shared.is_loaded() )
+			shared.load();
+		return shared;
+	}
+
+	//Read the ID with the programming sequence of one part
+	static bool read_id(kitsrus::kitsrus_t &prog, const chipinfo::chipinfo &chip, uint16_t &id)
+	{
+		prog.set_chip(chip);
+		if( !prog.init_program_vars() )
+			return false;
+		prog.chip_power_on();
+		const bool	ok(prog.read_chip_id(id));
+		prog.chip_power_off();
+		return ok;
+	}
+
+	bool detect(kitsrus::kitsrus_t &prog, const library_t &lib, indices_t &matches, uint16_t &id)
+	{
+		const chipinfo::chipinfo	original(prog.get_chip());
+
+		//Try the selected part's family first, a line usually runs one family
+		indices_t	order(lib.families());
+		for(indices_t::iterator i=order.begin(); i != order.end(); ++i)
+			if( lib[*i].core_type == original.core_type )
+			{
+				std::swap(*i, order.front());
+				break;
+			}
+
+		bool	responded(false);
+		matches.clear();
+		id = 0;
+		for(indices_t::const_iterator i=order.begin(); (i != order.end()) && matches.empty(); ++i)
+		{
+			uint16_t	candidate;
+			if( !read_id(prog, lib[*i], candidate) )
+				continue;
+			responded = true;
+
+			//Only parts of the family whose sequence was used are believable
+			const indices_t	found(lib.find(candidate));
+			for(indices_t::const_iterator j=found.begin(); j != found.end(); ++j)
+				if( lib[*j].core_type == lib[*i].core_type )
+					matches.push_back(*j);
+			if( !matches.empty() || (id == 0) )
+				id = candidate;
+		}
+
+		prog.set_chip(original);
+		prog.init_program_vars();
+		return responded && !matches.empty();
+	}
+}
@@ -0,0 +1,62 @@
+/*	Filename:	devicelibrary.h
+	The device library from the settings, loaded once and indexed
+	by name and by device ID
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	DEVICELIBRARY_H
+#define	DEVICELIBRARY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "chipinfo.h"
+#include "kitsrus.h"
+
+namespace devicelibrary
+{
+	#define	CHIP_ID_REVISION_MASK	0x001F	//Low bits of a device ID word hold the silicon revision
+
+	typedef	std::vector<size_t>	indices_t;
+
+	class library_t
+	{
+		typedef	std::map<std::string, size_t>	name_index_t;
+		typedef	std::multimap<uint16_t, size_t>	id_index_t;
+
+		std::vector<chipinfo::chipinfo>	devices;
+		name_index_t	by_name;
+		id_index_t	by_id;			//Exact device IDs
+		id_index_t	by_family;		//Device IDs without the revision bits
+		bool	loaded;
+	public:
+		library_t() : loaded(false) {}
+
+		bool	load();				//(Re)read the device library from the settings
+		bool	is_loaded() const	{ return loaded; }
+		size_t	size() const	{ return devices.size(); }
+		const chipinfo::chipinfo	&operator[](size_t i) const	{ return devices[i]; }
+
+		const chipinfo::chipinfo	*find(const std::string &name) const;	//NULL if there's no such part
+		//Parts with a device ID, exact matches if there are any,
+		//	otherwise the parts that only differ in the revision bits
+		indices_t	find(uint16_t id) const;
+		//One part of each core type that has device IDs, for reading IDs from unknown parts
+		indices_t	families() const;
+	};
+
+	library_t	&library();		//Shared library, loaded on first use
+
+	//Read the device ID of the part in the socket and look it up
+	//	The programmer's current core type is tried first, then every other
+	//	family that has IDs. The programmer's part is restored afterwards.
+	//	Returns false if the programmer didn't respond or no part matched
+	bool	detect(kitsrus::kitsrus_t &, const library_t &, indices_t &matches, uint16_t &id);
+}
+
+#endif	//DEVICELIBRARY_H
@@ -0,0 +1,278 @@
+/*	Filename:	imagecache.cc
+	Cache of parsed hex files and their serialized programmer chunks
+	Entries are keyed by path, size, mtime and a hash of the file contents
+	and are persisted to a sidecar file next to the hex file
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#ifdef	_WIN32
+#include <windows.h>
+#endif
+
+#include "checksum.h"
+#include "imagecache.h"
+#include "qpimg.h"
+
+#if defined(__APPLE__)
+	#define	MTIME_NSEC(st)	((st).st_mtimespec.tv_nsec)
+#elif defined(__linux__)
+	#define	MTIME_NSEC(st)	((st).st_mtim.tv_nsec)
+#else
+	#define	MTIME_NSEC(st)	0
+#endif
+
+#define	SIDECAR_SUFFIX	".qpcache"
+#define	SIDECAR_MAGIC	0x33435051	//"QPC3", QPC1 sidecars hold FNV-1a hashes and QPC2 ones have no chip key
+#define	SIDECAR_ORDER	0x01020304	//Sidecars are host-order, reject foreign ones
+
+namespace imagecache
+{
+	//Fill in the key for path with everything that stat(2) can provide
+	bool stat_key(const std::string &path, key_t &key)
+	{
+		struct stat	st;
+		if( stat(path.c_str(), &st) != 0 )
+			return false;
+		key.path = path;
+		key.size = st.st_size;
+		key.mtime_sec = st.st_mtime;
+		key.mtime_nsec = MTIME_NSEC(st);
+		return true;
+	}
+
+	//Parse an image file, either a .qpimg or an Intel HEX file
+	bool load_image(const std::string &path, intelhex::hex_data &hex)
+	{
+		if( qpimg::is_qpimg(path.c_str()) )
+			return qpimg::load(path.c_str(), hex);
+		return hex.load(path);
+	}
+
+	//CRC-32C and CRC-32 of the file contents, in the high and low halves
+	//	Much cheaper than parsing, so it's used to detect touched-but-unchanged files
+	bool hash_file(const std::string &path, uint64_t &hash)
+	{
+		FILE	*fp;
+		if( (fp=fopen(path.c_str(), "rb")) == NULL )
+			return false;
+
+		uint8_t	buffer[16384];
+		size_t	n;
+		uint32_t	c(0), z(0);
+		while( (n = fread(buffer, 1, sizeof(buffer), fp)) > 0 )
+		{
+			c = checksum::crc32c(buffer, n, c);
+			z = checksum::crc32(buffer, n, z);
+		}
+		hash = (uint64_t(c) << 32) | z;
+		const bool ok = !ferror(fp);
+		fclose(fp);
+		return ok;
+	}
+
+	std::string sidecar_path(const std::string &path)
+	{
+		return path + SIDECAR_SUFFIX;
+	}
+
+	image_t *cache_t::get(const std::string &path, chipinfo::chipinfo &chip)
+	{
+		key_t	key;
+		if( !stat_key(path, key) )
+			return NULL;
+
+		bool	dirty(false);		//Set if the sidecar needs to be rewritten
+		lst_entry::iterator i = entries.begin();
+		while( (i != entries.end()) && (i->key.path != path) )
+			++i;
+
+		if( i != entries.end() )
+		{
+			if( (i->key.size != key.size) || (i->key.mtime_sec != key.mtime_sec) || (i->key.mtime_nsec != key.mtime_nsec) )
+			{
+				//The file was touched, but it may not have changed
+				if( (i->key.size == key.size) && hash_file(path, key.hash) && (key.hash == i->key.hash) )
+				{
+					i->key = key;
+					dirty = true;
+				}
+				else
+				{
+					entries.erase(i);
+					i = entries.end();
+				}
+			}
+			if( i != entries.end() )
+				entries.splice(entries.begin(), entries, i);	//Most recently used goes first
+		}
+
+		if( i == entries.end() )
+		{
+			entries.push_front(entry_t());
+			entry_t	&entry = entries.front();
+			if( !use_sidecar || !load_sidecar(key, entry) )
+			{
+				//Cache miss, parse the file
+				if( !hash_file(path, key.hash) || !load_image(path, entry.image.hex) )
+				{
+					entries.pop_front();
+					return NULL;
+				}
+				entry.key = key;
+				dirty = true;
+			}
+			while( entries.size() > capacity )
+				entries.pop_back();
+		}
+
+		//The name isn't enough, a library update can change a part under the same name
+		entry_t	&entry = entries.front();
+		const uint32_t	chip_key(kitsrus::serialize_key(chip));
+		if( (entry.image.chip != chip.name) || (entry.image.chip_key != chip_key) )
+		{
+			entry.image.chunks = kitsrus::chunks_t();
+			kitsrus::serialize(chip, entry.image.hex, entry.image.chunks);
+			entry.image.chip = chip.name;
+			entry.image.chip_key = chip_key;
+			dirty = true;
+		}
+
+		if( use_sidecar && dirty )
+			save_sidecar(entry);	//Not fatal if the directory isn't writable
+
+		return &entry.image;
+	}
+
+	//Sidecar file i/o
+	//	Everything is stored in host byte order; the cache is never shared between machines
+	namespace
+	{
+		bool write_bytes(FILE *fp, const void *p, size_t n)	{ return fwrite(p, 1, n, fp) == n; }
+		bool read_bytes(FILE *fp, void *p, size_t n)	{ return fread(p, 1, n, fp) == n; }
+
+		bool put_u32(FILE *fp, uint32_t a)	{ return write_bytes(fp, &a, sizeof(a)); }
+		bool get_u32(FILE *fp, uint32_t &a)	{ return read_bytes(fp, &a, sizeof(a)); }
+
+		bool put_buffer(FILE *fp, const std::vector<uint8_t> &b)
+		{
+			return put_u32(fp, b.size()) && (b.empty() || write_bytes(fp, &b[0], b.size()));
+		}
+
+		bool get_buffer(FILE *fp, std::vector<uint8_t> &b)
+		{
+			uint32_t	n;
+			if( !get_u32(fp, n) || (n > (1UL << 24)) )
+				return false;
+			b.resize(n);
+			return (n == 0) || read_bytes(fp, &b[0], n);
+		}
+	}
+
+	bool cache_t::save_sidecar(const entry_t &entry)
+	{
+		const std::string path(sidecar_path(entry.key.path));
+		const std::string tmp(path + ".tmp");
+		FILE	*fp;
+		if( (fp=fopen(tmp.c_str(), "wb")) == NULL )
+			return false;
+
+		const image_t	&image = entry.image;
+		bool	ok = put_u32(fp, SIDECAR_MAGIC) && put_u32(fp, SIDECAR_ORDER);
+		ok = ok && write_bytes(fp, &entry.key.size, sizeof(entry.key.size));
+		ok = ok && write_bytes(fp, &entry.key.mtime_sec, sizeof(entry.key.mtime_sec));
+		ok = ok && write_bytes(fp, &entry.key.mtime_nsec, sizeof(entry.key.mtime_nsec));
+		ok = ok && write_bytes(fp, &entry.key.hash, sizeof(entry.key.hash));
+
+		ok = ok && put_u32(fp, image.hex.blocks.size());
+		for(intelhex::hex_data::lst_dblock::const_iterator i = image.hex.blocks.begin(); ok && (i != image.hex.blocks.end()); ++i)
+		{
+			ok = put_u32(fp, i->first) && put_u32(fp, i->second.size());
+			if( ok && !i->second.empty() )
+				ok = write_bytes(fp, &i->second[0], i->second.size()*sizeof(intelhex::hex_data::element_t));
+		}
+
+		ok = ok && put_u32(fp, image.chip.size()) && write_bytes(fp, image.chip.data(), image.chip.size());
+		ok = ok && put_u32(fp, image.chip_key);
+		ok = ok && put_u32(fp, image.chunks.rom_words);
+		ok = ok && put_buffer(fp, image.chunks.rom) && put_buffer(fp, image.chunks.eeprom) && put_buffer(fp, image.chunks.config);
+
+		ok = (fclose(fp) == 0) && ok;
+		//Rename over the old sidecar so a crash never leaves a partial file behind
+		//	rename() won't replace an existing file on Windows
+#ifdef	_WIN32
+		ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+		ok = ok && (rename(tmp.c_str(), path.c_str()) == 0);
+#endif
+		if( !ok )
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	//Load the sidecar for key.path if it matches the file on disk
+	bool cache_t::load_sidecar(const key_t &key, entry_t &entry)
+	{
+		FILE	*fp;
+		if( (fp=fopen(sidecar_path(key.path).c_str(), "rb")) == NULL )
+			return false;
+
+		uint32_t	magic, order, count, n;
+		key_t	saved;
+		bool	ok = get_u32(fp, magic) && get_u32(fp, order) && (magic == SIDECAR_MAGIC) && (order == SIDECAR_ORDER);
+		ok = ok && read_bytes(fp, &saved.size, sizeof(saved.size));
+		ok = ok && read_bytes(fp, &saved.mtime_sec, sizeof(saved.mtime_sec));
+		ok = ok && read_bytes(fp, &saved.mtime_nsec, sizeof(saved.mtime_nsec));
+		ok = ok && read_bytes(fp, &saved.hash, sizeof(saved.hash));
+		ok = ok && (saved.size == key.size);
+		if( ok && ((saved.mtime_sec != key.mtime_sec) || (saved.mtime_nsec != key.mtime_nsec)) )
+		{
+			uint64_t	hash;
+			ok = hash_file(key.path, hash) && (hash == saved.hash);
+		}
+
+		image_t	&image = entry.image;
+		ok = ok && get_u32(fp, count);
+		for(uint32_t i=0; ok && (i < count); ++i)
+		{
+			uint32_t	address;
+			ok = get_u32(fp, address) && get_u32(fp, n) && (n < (1UL << 24));
+			if( ok )
+			{
+				intelhex::hex_data::dblock	*db = image.hex.add_block(address, n);
+				ok = (n == 0) || read_bytes(fp, &db->second[0], n*sizeof(intelhex::hex_data::element_t));
+			}
+		}
+
+		ok = ok && get_u32(fp, n) && (n < 256);
+		if( ok )
+		{
+			char	name[256];
+			ok = read_bytes(fp, name, n);
+			image.chip.assign(name, n);
+		}
+		ok = ok && get_u32(fp, image.chip_key);
+		ok = ok && get_u32(fp, n);
+		image.chunks.rom_words = n;
+		ok = ok && get_buffer(fp, image.chunks.rom) && get_buffer(fp, image.chunks.eeprom) && get_buffer(fp, image.chunks.config);
+		fclose(fp);
+
+		if( !ok )
+		{
+			entry = entry_t();
+			return false;
+		}
+		entry.key = saved;
+		entry.key.path = key.path;
+		entry.key.mtime_sec = key.mtime_sec;
+		entry.key.mtime_nsec = key.mtime_nsec;
+		return true;
+	}
+}
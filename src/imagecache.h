@@ -0,0 +1,79 @@
+/*	Filename:	imagecache.h
+	Cache of parsed hex files and their serialized programmer chunks
+	Entries are keyed by path, size, mtime and a hash of the file contents
+	and are persisted to a sidecar file next to the hex file
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	IMAGECACHE_H
+#define	IMAGECACHE_H
+
+#include <list>
+#include <string>
+
+#include <stdint.h>
+
+#include "chipinfo.h"
+#include "intelhex.h"
+#include "kitsrus.h"
+
+namespace imagecache
+{
+	//A parsed image along with everything derived from it
+	struct image_t
+	{
+		intelhex::hex_data	hex;		//The parsed file
+		std::string	chip;			//Name of the part the chunks were serialized for
+		uint32_t	chip_key;		//kitsrus::serialize_key() of that part
+		kitsrus::chunks_t	chunks;		//ROM/EEPROM/config as sent to the programmer
+
+		image_t() : chip_key(0) {}
+	};
+
+	//Identity of a file on disk
+	struct key_t
+	{
+		std::string	path;
+		uint64_t	size;
+		int64_t	mtime_sec;
+		int64_t	mtime_nsec;
+		uint64_t	hash;		//Hash of the file contents
+
+		key_t() : size(0), mtime_sec(0), mtime_nsec(0), hash(0) {}
+	};
+
+	class cache_t
+	{
+		struct entry_t
+		{
+			key_t	key;
+			image_t	image;
+		};
+		typedef	std::list<entry_t>	lst_entry;
+
+		lst_entry	entries;	//Most recently used entry first
+		size_t	capacity;
+		bool	use_sidecar;
+
+		bool	load_sidecar(const key_t &, entry_t &);
+		bool	save_sidecar(const entry_t &);
+	public:
+		cache_t(size_t n=8, bool sidecar=true) : capacity(n), use_sidecar(sidecar) {}
+
+		//Returns the image for path with chunks serialized for chip,
+		//	or NULL if the file can't be read
+		//	The pointer is only valid until the next call to get() or clear()
+		image_t	*get(const std::string &path, chipinfo::chipinfo &chip);
+		void	clear()	{ entries.clear(); }
+		size_t	size() const	{ return entries.size(); }
+	};
+
+	bool		stat_key(const std::string &, key_t &);		//Fill in everything but the hash
+	bool		load_image(const std::string &, intelhex::hex_data &);	//.qpimg or Intel HEX
+	bool		hash_file(const std::string &, uint64_t &);
+	std::string	sidecar_path(const std::string &);
+}
+
+#endif	//IMAGECACHE_H
@@ -11,12 +11,15 @@
 	$Id: intelhex.cc,v 1.13 2008/03/26 04:45:57 bfoz Exp $
  * */
 
+#include <algorithm>
 #include <iostream>
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "intelhex.h"
+#include "logging.h"
 
 namespace intelhex
 {
@@ -206,6 +209,8 @@ namespace intelhex
 		while( (i!=blocks.rend()) && (i->first > addr))
 			++i;
 
+		if( i == blocks.rend() )
+			return false;
 		if( (addr - i->first) > i->second.size() )
 			return false;
 		else
@@ -217,28 +222,42 @@ namespace intelhex
 	bool hex_data::load(const char *path)
 	{
 		FILE	*fp;
-		dblock	*db;		//Temporary pointer
-		unsigned int	hi, lo, address, count, rtype, i;
-		uint16_t	linear_address(0);
-		uint32_t	a;
-
 		if( (fp=fopen(path, "r"))==NULL )
 		{
 //			printf("%s: Can't open %s\n", __FUNCTION__, path);
 			return false;
 		}
+		const bool	ok = load(fp);
+		fclose(fp);
+		return ok;
+	}
+
+	bool hex_data::load(FILE *fp)
+	{
+		dblock	*db;		//Temporary pointer
+		unsigned int	hi, lo, address, count, rtype, i;
+		uint16_t	linear_address(0);
+		uint32_t	a;
+		bool	good(true);		//Every line parsed
 
 		clear();		//First, clean house
 		
 		//Start parsing the file
 		while(!feof(fp))
 		{
-			if(fgetc(fp)==':')	//First character of every line should be ':'
+			const int	c = fgetc(fp);
+			if( c==':' )	//First character of every line should be ':'
 			{
 //				std::cout << __FUNCTION__ << ": Got line" << std::endl;
-				fscanf(fp, "%2x", &count);			//Read in byte count
-				fscanf(fp, "%4x", &address);		//Read in address
-				fscanf(fp, "%2x", &rtype);			//Read type
+				if( (fscanf(fp, "%2x", &count) != 1) ||		//Read in byte count
+				    (fscanf(fp, "%4x", &address) != 1) ||	//Read in address
+				    (fscanf(fp, "%2x", &rtype) != 1) )		//Read type
+				{
+					QLOG(logging::LEVEL_WARNING, __FUNCTION__)("msg", "Bad record header")("offset", ftell(fp));
+					good = false;
+					fscanf(fp, "%*[^\n]\n");	//Ignore the rest of the line
+					continue;
+				}
 
 				unsigned numWords(count/2);			//Convert byte count to word count
 				address /= 2;							//Byte address to word address
@@ -253,8 +272,13 @@ namespace intelhex
 //						std::cout << __FUNCTION__ << ": db->first*2 = " << std::hex << (db->first*2) << std::endl;
 						for(i=0; i<numWords; i++)				//Read all of the data bytes
 						{
-							fscanf(fp, "%2x", &lo);			//Low byte
-							fscanf(fp, "%2x", &hi);			//High byte
+							if( (fscanf(fp, "%2x", &lo) != 1) ||		//Low byte
+							    (fscanf(fp, "%2x", &hi) != 1) )		//High byte
+							{
+								QLOG(logging::LEVEL_WARNING, __FUNCTION__)("msg", "Short data record")("offset", ftell(fp));
+								good = false;
+								break;
+							}
 							db->second[i] = ((hi<<8)&0xFF00) | (lo&0x00FF);	//Assemble the word
 						}
 						break;
@@ -278,122 +302,192 @@ namespace intelhex
 				}
 				fscanf(fp,"%*[^\n]\n");		//Ignore the checksum and the newline
 			}
-			else
+			else if( (c != EOF) && !isspace(c) )	//Blank lines are fine
 			{
-				printf("%s: Bad line\n", __FUNCTION__);
+				QLOG(logging::LEVEL_WARNING, __FUNCTION__)("msg", "Bad line")("offset", ftell(fp));
+				good = false;
 				fscanf(fp, "%*[^\n]\n");	//Ignore the rest of the line
 			}
 		}
-		fclose(fp);
 
 		blocks.sort();		//Sort the data blocks by address (ascending)
-		return true;
+		return good;
 	}
 
 	//Write all data to a file
-	void	hex_data::write(const char *path)
+	bool	hex_data::write(const char *path, unsigned record_bytes) const
 	{
-		std::ofstream	ofs(path);
+		std::ofstream	ofs(path, std::ios::out | std::ios::binary);
 		if(!ofs)
 		{
-			std::cerr << "Couldn't open the output file stream\n";
-			exit(1);
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Couldn't open the output file")("path", path);
+			return false;
 		}
-		write(ofs);
-		ofs.close();
+		return write(ofs, record_bytes);
 	}
 
-	//Write all data to an output stream
-	void	hex_data::write(std::ostream &os)
+	namespace
 	{
-		uint8_t	checksum;
-		uint16_t	linear_address(0);
+		#define	WRITE_BUFFER_SIZE	65536	//Records are written out in chunks of about this size
+		#define	MAX_RECORD_LINE	(1+2+4+2+2*255+2+1)	//Longest possible record
 
+		//Two ASCII hex digits for every byte value
+		struct hex_table_t
+		{
+			char	digits[256][2];
+			hex_table_t()
+			{
+				static const char	hex[] = "0123456789ABCDEF";
+				for(unsigned i=0; i < 256; ++i)
+				{
+					digits[i][0] = hex[i >> 4];
+					digits[i][1] = hex[i & 0x0F];
+				}
+			}
+		};
+		const hex_table_t	hex_table;
+
+		//Byte address of a word, the inverse of what load() does
+		//	The upper 16 bits are the linear address and the lower 16 bits are a word offset
+		uint32_t byte_address(hex_data::address_t a)
+		{
+			return (a & 0xFFFF0000) + 2*(a & 0x0000FFFF);
+		}
+
+		bool block_address_less(const hex_data::dblock *a, const hex_data::dblock *b)
+		{
+			return a->first < b->first;
+		}
+	}
+
+	//Write all data to an output stream
+	bool	hex_data::write(std::ostream &os, unsigned record_bytes) const
+	{
 		if(!os)
 		{
-			std::cerr << "Couldn't open the output file stream\n";
-			exit(1);
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Couldn't open the output file stream");
+			return false;
 		}
 
-		truncate(8);				//Truncate each record to length=8 (purely aesthetic)
-		blocks.sort();				//Sort the data blocks by address (ascending)
+		//Sort pointers to the blocks instead of the blocks themselves
+		std::vector<const dblock*>	sorted;
+		for(lst_dblock::const_iterator i=blocks.begin(); i!=blocks.end(); ++i)
+			if( !i->second.empty() )
+				sorted.push_back(&*i);
+		std::stable_sort(sorted.begin(), sorted.end(), block_address_less);
+
+		//If we already know that this is an INHX32M file, start with a linear address record
+		//	otherwise check the last block to see if one is needed
+		bool	linear(linear_addr_rec);
+		if( !linear && !sorted.empty() )
+			linear = byte_address(sorted.back()->first + sorted.back()->second.size() - 1) > 0xFFFF;
+
+		writer_t	out(os, record_bytes, linear);
+		for(std::vector<const dblock*>::const_iterator i=sorted.begin(); i!=sorted.end(); ++i)
+			out.put((*i)->first, &(*i)->second[0], (*i)->second.size());
+		return out.finish();
+	}
 
-		os.setf(std::ios::hex, std::ios::basefield);	//Set the stream to ouput hex instead of decimal
-		os.setf(std::ios::uppercase);				//Use uppercase hex notation
-		os.fill('0');								//Pad with zeroes
-		
-		//If we already know that this is an INHX32M file, start with a segment address record
-		//	otherwise check all of the blocks just to make sure
-		if( linear_addr_rec )
+	writer_t::writer_t(std::ostream &s, unsigned record_bytes, bool linear) : os(s), buffer(WRITE_BUFFER_SIZE), length(0), checksum(0),
+		record_words(std::max(1U, std::min(record_bytes, 255U)/2)), segment(0), start(0), count(0), finished(false)
+	{
+		if( linear )
+			linear_address(0);
+	}
+
+	void	writer_t::put_byte(uint8_t b)
+	{
+		buffer[length++] = hex_table.digits[b][0];
+		buffer[length++] = hex_table.digits[b][1];
+		checksum += b;
+	}
+
+	void	writer_t::begin(uint8_t n, uint16_t address, uint8_t type)
+	{
+		if( length + MAX_RECORD_LINE > buffer.size() )
+			flush();
+		checksum = 0;
+		buffer[length++] = ':';
+		put_byte(n);
+		put_byte(address >> 8);
+		put_byte(address & 0xFF);
+		put_byte(type);
+	}
+
+	void	writer_t::end()
+	{
+		put_byte(0x01 + ~checksum);
+		buffer[length++] = '\n';
+	}
+
+	bool	writer_t::flush()
+	{
+		os.write(&buffer[0], length);
+		length = 0;
+		return os.good();
+	}
+
+	void	writer_t::linear_address(uint16_t s)
+	{
+		begin(2, 0, 0x04);
+		put_byte(s >> 8);
+		put_byte(s & 0xFF);
+		end();
+	}
+
+	//Emit the pending words as one data record, words are stored LSB first
+	void	writer_t::record()
+	{
+		if( !count )
+			return;
+		const uint32_t	byte(byte_address(start));
+		if( (byte >> 16) != segment )
 		{
-			os << INH32M_HEADER << std::endl;
-//			std::cout << __FUNCTION__ << ": linear_addr_rec == true\n";
+			segment = byte >> 16;
+			linear_address(segment);
 		}
-		else
+		begin(count*2, byte & 0xFFFF, 0x00);
+		for(size_t i=0; i < count; ++i)
 		{
-			for(iterator i=blocks.begin(); i!=blocks.end(); i++)
-			{
-				if(i->first > 0xFFFF)	//Check the upper 16 bits
-				{
-					linear_addr_rec = true;
-					os << INH32M_HEADER << std::endl;
-//					std::cout << __FUNCTION__ << ": Found an 04 at " << i->first << std::endl;
-//					std::cout << __FUNCTION__ << ": i->first & 0xFFFF0000 == " << (i->first  & 0xFFFF0000) << std::endl;
-					break;	//Only need to find one
-				}
-			}
+			put_byte(pending[i] & 0xFF);
+			put_byte(pending[i] >> 8);
 		}
+		end();
+		count = 0;
+	}
 
-		for(iterator i=blocks.begin(); i!=blocks.end(); i++)
+	void	writer_t::put(hex_data::address_t a, const hex_data::element_t *p, size_t n)
+	{
+		while( n )
 		{
-			//Check upper 16 bits of the block address for non-zero,
-			//	which indicates that a segment address record is needed
-			if( i->first > 0xFFFF )
-			{
-				const uint16_t addr(i->first >> 16);
-				//Has a record for this segment already been emitted?
-				if( addr != linear_address )
-				{
-					//Emit a new segment address record
-					os << ":02000004";
-					os.width(4);
-					os << addr;	//Address
-		    // Create a checksum for the linear address record
-		    checksum = 0x06 + addr + (addr >> 8);
-		    checksum = 0x01 + ~checksum;
-		    os.width(2);
-		    // OSX (or maybe GCC), seems unable to handle uint8_t 
-		    //  arguments to a stream
-		    os << static_cast<uint16_t>(checksum);	// Checksum byte
-					os << std::endl;
-					linear_address = addr;
- 				}
-			}
-			checksum = 0;
-			os << ':';	//Every line begins with ':'
-			os.width(2);
-			os << i->second.size()*2;	//Record length
-			checksum += i->second.size()*2;
-			os.width(4);
-			os << static_cast<uint16_t>(i->first*2);	//Address
-	    checksum += (i->first * 2) + (i->first >> 7);
-			os << "00";											//Record type
-			for(unsigned j=0; j<i->second.size(); ++j)	//Store the data bytes, LSB first, ASCII HEX
-			{
-				os.width(2);
-				os << (i->second[j] & 0x00FF);
-				os.width(2);
-				os << ((i->second[j]>>8) & 0x00FF);
-				checksum += static_cast<uint8_t>(i->second[j] & 0x00FF);
-				checksum += static_cast<uint8_t>(i->second[j] >> 8);
-			}
-			checksum = 0x01 + ~checksum;
-			os.width(2);
-	    // OSX (or maybe GCC), seems unable to handle uint8_t arguments to a stream
-	    os << static_cast<uint16_t>(checksum);	// Checksum byte
-			os << std::endl;
+			if( count && (a != start + count) )
+				record();
+			if( !count )
+				start = a;
+
+			//Records can't cross a 64K boundary
+			const uint32_t	byte(byte_address(start));
+			const size_t	limit(std::min(record_words, size_t((0x10000 - (byte & 0xFFFF))/2)));
+			const size_t	k(std::min(n, limit - count));
+			std::copy(p, p + k, pending + count);
+			count += k;
+			a += k;
+			p += k;
+			n -= k;
+			if( count == limit )
+				record();
 		}
-		os << ":00000001FF\n";			//EOF marker
+	}
+
+	bool	writer_t::finish()
+	{
+		if( finished )
+			return os.good();
+		finished = true;
+		record();
+		begin(0, 0, 0x01);	//EOF marker
+		end();
+		return flush();
 	}
 
 	//Truncate all of the blocks to a given length
@@ -419,6 +513,35 @@ namespace intelhex
 		}
 	}
 
+	ranges_t populated_ranges(hex_data &hex)
+	{
+		ranges_t	r;
+		for(hex_data::iterator i = hex.begin(); i != hex.end(); ++i)
+			if( !i->second.empty() )
+				r.push_back(range_t(i->first, i->first + i->second.size()));
+		std::sort(r.begin(), r.end());
+
+		//Merge overlapping and adjacent ranges
+		ranges_t	merged;
+		for(ranges_t::iterator i = r.begin(); i != r.end(); ++i)
+		{
+			if( !merged.empty() && (i->first <= merged.back().second) )
+				merged.back().second = std::max(merged.back().second, i->second);
+			else
+				merged.push_back(*i);
+		}
+		return merged;
+	}
+
+	hex_data::address_t range_end(const ranges_t &r, hex_data::address_t lo, hex_data::address_t hi)
+	{
+		hex_data::address_t	end(lo);
+		for(ranges_t::const_iterator i = r.begin(); i != r.end(); ++i)
+			if( (i->first < hi) && (i->second > lo) )
+				end = std::max(end, std::min(i->second, hi));
+		return end;
+	}
+
     //Compare two sets of hex data
     //	Return true if every word in hex1 has a corresponding, and equivalent, word in hex2
     //	Assumes both data sets are sorted
@@ -17,6 +17,7 @@
 #include <vector>
 #include <list>
 
+#include <stdio.h>
 #include <unistd.h>
 
 namespace intelhex
@@ -73,11 +74,56 @@ namespace intelhex
 		dblock	*add_block(address_t, size_type, element_t = 0xFFFF);	//Append a new block with address/length
 		bool		load(const char *);			//Load a hex file from disk
 		bool		load(const std::string &s) {return load(s.c_str());}	//Load a hex file from disk
-		void		write(const char *);			//Save hex data to a hex file
-		void		write(std::ostream &);			//Write all data to an output stream
+		bool		load(FILE *);				//Parse records from an open stream, it isn't closed. False if a line is malformed
+		//Write all data as Intel HEX with record_bytes data bytes per record
+		//	The data isn't modified, blocks are written in address order
+		bool		write(const char *, unsigned record_bytes=16) const;	//Save hex data to a hex file
+		bool		write(std::ostream &, unsigned record_bytes=16) const;	//Write all data to an output stream
 		void		truncate(size_type);			//Truncate all of the blocks to a given length
 	};
 
 	bool compare(hex_data&, hex_data&, hex_data::element_t, hex_data::address_t, hex_data::address_t);
+
+	//Encodes words as Intel HEX records while they arrive
+	//	Consecutive words are packed into records of up to record_bytes, a gap starts a
+	//	new record and linear address records are emitted whenever the segment changes.
+	//	Memory use doesn't depend on how much is written.
+	class writer_t
+	{
+		std::ostream	&os;
+		std::vector<char>	buffer;		//Formatted records waiting to be written
+		size_t		length;
+		uint8_t		checksum;
+		size_t		record_words;
+		uint32_t	segment;			//Current linear address segment
+		hex_data::address_t	start;		//Address of the first pending word
+		size_t		count;				//Number of pending words
+		hex_data::element_t	pending[127];	//Words of the record being built
+		bool		finished;
+
+		writer_t(const writer_t&);	//No copy
+		writer_t &operator=(const writer_t&);
+
+		void	put_byte(uint8_t);
+		void	begin(uint8_t, uint16_t, uint8_t);
+		void	end();
+		bool	flush();
+		void	linear_address(uint16_t);
+		void	record();
+	public:
+		//Start with a linear address record if linear is set
+		writer_t(std::ostream &, unsigned record_bytes=16, bool linear=false);
+
+		void	put(hex_data::address_t a, hex_data::element_t w)	{ put(a, &w, 1); }
+		void	put(hex_data::address_t, const hex_data::element_t *, size_t);
+		bool	finish();		//Write the last record and the EOF record, true if everything was written
+	};
+
+	//Sets of half-open [first, second) word address ranges
+	typedef	std::pair<hex_data::address_t, hex_data::address_t>	range_t;
+	typedef	std::vector<range_t>	ranges_t;
+
+	ranges_t	populated_ranges(hex_data&);	//Sorted ranges that hold data, adjacent blocks merged
+	hex_data::address_t	range_end(const ranges_t&, hex_data::address_t lo, hex_data::address_t hi);	//End of the data in [lo, hi), or lo if there isn't any
 }
 #endif
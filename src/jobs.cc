@@ -0,0 +1,227 @@
+/*	Filename:	jobs.cc
+	Requests and events of the qprogd job protocol
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "jobs.h"
+
+namespace jobs
+{
+	static const char *const op_names[] = {"program", "read", "verify", "erase", "blank"};
+
+	const char *op_name(op_t op)
+	{
+		return op_names[op];
+	}
+
+	bool parse_op(const std::string &s, op_t &op)
+	{
+		for(unsigned i=0; i < sizeof(op_names)/sizeof(op_names[0]); ++i)
+			if( s == op_names[i] )
+			{
+				op = static_cast<op_t>(i);
+				return true;
+			}
+		return false;
+	}
+
+	//Characters that go through unencoded
+	static bool plain(char c)
+	{
+		return ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (strchr("-_.,:/+", c) != NULL);
+	}
+
+	std::string encode(const std::string &s)
+	{
+		std::string	r;
+		r.reserve(s.size());
+		for(std::string::const_iterator i=s.begin(); i != s.end(); ++i)
+		{
+			if( plain(*i) )
+				r += *i;
+			else
+			{
+				char	hex[4];
+				snprintf(hex, sizeof(hex), "%%%02X", static_cast<unsigned char>(*i));
+				r += hex;
+			}
+		}
+		return r;
+	}
+
+	static int hex_digit(char c)
+	{
+		if( (c >= '0') && (c <= '9') )
+			return c - '0';
+		if( (c >= 'A') && (c <= 'F') )
+			return c - 'A' + 10;
+		if( (c >= 'a') && (c <= 'f') )
+			return c - 'a' + 10;
+		return -1;
+	}
+
+	bool decode(const std::string &s, std::string &r)
+	{
+		r.clear();
+		r.reserve(s.size());
+		for(size_t i=0; i < s.size(); ++i)
+		{
+			if( s[i] != '%' )
+			{
+				r += s[i];
+				continue;
+			}
+			if( i+2 >= s.size() )
+				return false;
+			const int	hi(hex_digit(s[i+1])), lo(hex_digit(s[i+2]));
+			if( (hi < 0) || (lo < 0) )
+				return false;
+			r += static_cast<char>((hi << 4) | lo);
+			i += 2;
+		}
+		return true;
+	}
+
+	bool split(const std::string &line, std::string &verb, fields_t &fields, std::string &error)
+	{
+		verb.clear();
+		fields.clear();
+		size_t	i(0);
+		while( i < line.size() )
+		{
+			//Skip the separators, a trailing \r is tolerated
+			while( (i < line.size()) && ((line[i] == ' ') || (line[i] == '\t') || (line[i] == '\r')) )
+				++i;
+			if( i == line.size() )
+				break;
+			size_t	end(line.find_first_of(" \t\r", i));
+			if( end == std::string::npos )
+				end = line.size();
+			const std::string	word(line.substr(i, end-i));
+			i = end;
+
+			if( verb.empty() )
+			{
+				verb = word;
+				continue;
+			}
+			const size_t	eq(word.find('='));
+			if( (eq == std::string::npos) || (eq == 0) )
+			{
+				error = "Expected key=value, got " + word;
+				return false;
+			}
+			std::string	value;
+			if( !decode(word.substr(eq+1), value) )
+			{
+				error = "Bad percent encoding in " + word.substr(0, eq);
+				return false;
+			}
+			fields[word.substr(0, eq)] = value;
+		}
+		if( verb.empty() )
+		{
+			error = "Empty request";
+			return false;
+		}
+		return true;
+	}
+
+	static bool parse_flag(const fields_t &fields, const char *key, bool &flag, std::string &error)
+	{
+		fields_t::const_iterator	i(fields.find(key));
+		if( i == fields.end() )
+			return true;
+		if( (i->second == "1") || (i->second == "yes") )
+			flag = true;
+		else if( (i->second == "0") || (i->second == "no") )
+			flag = false;
+		else
+		{
+			error = std::string("Bad value for ") + key;
+			return false;
+		}
+		return true;
+	}
+
+	bool parse(const fields_t &fields, job_t &job, std::string &error)
+	{
+		static const char *const known[] = {"id", "op", "part", "image", "data", "port", "out", "erase", "verify"};
+		for(fields_t::const_iterator i=fields.begin(); i != fields.end(); ++i)
+		{
+			unsigned	j(0);
+			while( (j < sizeof(known)/sizeof(known[0])) && (i->first != known[j]) )
+				++j;
+			if( j == sizeof(known)/sizeof(known[0]) )
+			{
+				error = "Unknown field " + i->first;
+				return false;
+			}
+		}
+
+		job = job_t();
+		fields_t::const_iterator	i;
+		if( ((i=fields.find("op")) == fields.end()) || !parse_op(i->second, job.op) )
+		{
+			error = "Missing or unknown op";
+			return false;
+		}
+		if( ((i=fields.find("part")) == fields.end()) || i->second.empty() )
+		{
+			error = "Missing part";
+			return false;
+		}
+		job.part = i->second;
+		if( (i=fields.find("id")) != fields.end() )
+			job.tag = i->second;
+		if( (i=fields.find("image")) != fields.end() )
+			job.image = i->second;
+		if( (i=fields.find("data")) != fields.end() )
+			job.data = i->second;
+		if( (i=fields.find("port")) != fields.end() )
+			job.port = i->second;
+		if( (i=fields.find("out")) != fields.end() )
+			job.out = i->second;
+		if( !parse_flag(fields, "erase", job.erase, error) || !parse_flag(fields, "verify", job.verify, error) )
+			return false;
+
+		const bool	needs_image((job.op == OP_PROGRAM) || (job.op == OP_VERIFY));
+		if( needs_image && (job.image.empty() == job.data.empty()) )
+		{
+			error = std::string("Op ") + op_name(job.op) + " needs one of image or data";
+			return false;
+		}
+		if( !needs_image && !(job.image.empty() && job.data.empty()) )
+		{
+			error = std::string("Op ") + op_name(job.op) + " doesn't take an image";
+			return false;
+		}
+		if( (job.op == OP_READ) != !job.out.empty() )
+		{
+			error = (job.op == OP_READ) ? "Op read needs out" : "Only op read takes out";
+			return false;
+		}
+		return true;
+	}
+
+	event_t &event_t::operator()(const char *key, const std::string &value)
+	{
+		s += ' ';
+		s += key;
+		s += '=';
+		s += encode(value);
+		return *this;
+	}
+
+	event_t &event_t::operator()(const char *key, unsigned value)
+	{
+		char	n[16];
+		snprintf(n, sizeof(n), "%u", value);
+		return (*this)(key, std::string(n));
+	}
+}
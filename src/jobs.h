@@ -0,0 +1,88 @@
+/*	Filename:	jobs.h
+	Requests and events of the qprogd job protocol
+
+	The protocol is line based. A line is a verb followed by key=value fields,
+	values are percent encoded so they never hold spaces or newlines.
+
+	Requests
+		job [id=<tag>] op=program|read|verify|erase|blank part=<name>
+			[image=<path>|data=<Intel HEX text>] [port=<device>] [erase=0|1] [verify=0|1] [out=<path>]
+		cancel job=<n>
+		ports
+	Events
+		accepted job=<n> [id=<tag>]
+		started job=<n> port=<device>
+		phase job=<n> name=<step>
+		progress job=<n> done=<i> total=<n>
+		result job=<n> status=ok|fail|error|cancelled [detail=<text>]
+		port name=<device> state=idle|busy [parts=<name>,...] [latency_us=<command turnaround>]
+		error msg=<text>
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	JOBS_H
+#define	JOBS_H
+
+#include <map>
+#include <string>
+
+namespace jobs
+{
+	enum op_t
+	{
+		OP_PROGRAM,		//Write an image, optionally erasing first and verifying after
+		OP_READ,		//Read the whole part into an Intel HEX file
+		OP_VERIFY,		//Compare the part against an image
+		OP_ERASE,
+		OP_BLANK		//Blank check
+	};
+
+	const char	*op_name(op_t);
+	bool	parse_op(const std::string &, op_t &);
+
+	typedef	std::map<std::string, std::string>	fields_t;
+
+	std::string	encode(const std::string &);
+	bool	decode(const std::string &, std::string &);
+
+	//Split a request into its verb and decoded fields
+	bool	split(const std::string &line, std::string &verb, fields_t &, std::string &error);
+
+	//One queued unit of work
+	struct job_t
+	{
+		unsigned	number;		//Assigned by the daemon, used in every event
+		std::string	tag;		//Client's own name for the job, echoed back
+		op_t		op;
+		std::string	part;
+		std::string	image;		//Path of the image to program or verify against
+		std::string	data;		//Or the image itself
+		std::string	port;		//Only run on this port, any compatible port if empty
+		std::string	out;		//Where a read goes
+		bool		erase;		//Erase before programming
+		bool		verify;		//Verify after programming
+
+		job_t() : number(0), op(OP_PROGRAM), erase(true), verify(true) {}
+	};
+
+	//Fill in a job from the fields of a job request
+	//	error says what's wrong with the request when false is returned
+	bool	parse(const fields_t &, job_t &, std::string &error);
+
+	//Builds an event line
+	//	event_t("progress")("job", 3)("done", 10)("total", 100).line()
+	class event_t
+	{
+		std::string	s;
+	public:
+		event_t(const char *verb) : s(verb) {}
+
+		event_t	&operator()(const char *key, const std::string &value);
+		event_t	&operator()(const char *key, unsigned value);
+		std::string	line() const	{ return s + "\n"; }
+	};
+}
+
+#endif	//JOBS_H
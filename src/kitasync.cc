@@ -0,0 +1,494 @@
+/*	Filename:	kitasync.cc
+	Non-blocking Kitsrus protocol, for driving many programmers from one thread
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "kitasync.h"
+
+#define	RX_COMPACT	4096	//Bytes taken before the receive buffer is moved down
+
+namespace kitasync
+{
+	bool link_t::open(const std::string &path, std::string &error)
+	{
+		close();
+		if( (fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0 )
+		{
+			error = path + ": " + strerror(errno);
+			return false;
+		}
+		ioctl(fd, TIOCEXCL);		//Only one program at a time can drive a programmer
+
+		struct termios	t;
+		if( tcgetattr(fd, &t) < 0 )
+		{
+			error = path + ": " + strerror(errno);
+			close();
+			return false;
+		}
+		cfmakeraw(&t);
+		t.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+		t.c_cflag |= CLOCAL | CREAD;
+		t.c_cc[VMIN] = 0;
+		t.c_cc[VTIME] = 0;
+		cfsetispeed(&t, B19200);
+		cfsetospeed(&t, B19200);
+		if( tcsetattr(fd, TCSANOW, &t) < 0 )
+		{
+			error = path + ": " + strerror(errno);
+			close();
+			return false;
+		}
+		tcflush(fd, TCIOFLUSH);
+		return true;
+	}
+
+	void link_t::close()
+	{
+		if( fd >= 0 )
+			::close(fd);
+		fd = -1;
+		rx.clear();
+		tx.clear();
+		rx_head = tx_head = 0;
+	}
+
+	void link_t::set_dtr(bool set)
+	{
+		int	bits(TIOCM_DTR);
+		ioctl(fd, set ? TIOCMBIS : TIOCMBIC, &bits);
+	}
+
+	void link_t::discard()
+	{
+		tcflush(fd, TCIFLUSH);
+		rx.clear();
+		rx_head = 0;
+	}
+
+	int link_t::transfer()
+	{
+		int	moved(0);
+		while( tx_head < tx.size() )
+		{
+			const ssize_t	r(::write(fd, &tx[tx_head], tx.size() - tx_head));
+			if( r < 0 )
+			{
+				if( errno == EINTR )
+					continue;
+				if( errno == EAGAIN )
+					break;
+				return -1;
+			}
+			tx_head += r;
+			moved += r;
+		}
+		if( tx_head == tx.size() )
+		{
+			tx.clear();
+			tx_head = 0;
+		}
+
+		if( rx_head == rx.size() )
+		{
+			rx.clear();
+			rx_head = 0;
+		}
+		else if( rx_head >= RX_COMPACT )
+		{
+			rx.erase(rx.begin(), rx.begin() + rx_head);
+			rx_head = 0;
+		}
+		uint8_t	b[512];
+		for(;;)
+		{
+			const ssize_t	r(::read(fd, b, sizeof(b)));
+			if( r > 0 )
+			{
+				rx.insert(rx.end(), b, b+r);
+				moved += r;
+				continue;
+			}
+			if( r == 0 )		//Nothing waiting, VMIN is 0
+				break;
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN )
+				break;
+			return -1;
+		}
+		return moved;
+	}
+
+	session_t::session_t(const std::string &path, const chipinfo::chipinfo &chip) : info(chip), port(path), job(NULL), listener(NULL),
+		job_deadline(NO_DEADLINE), reply_timeout(REPLY_TIMEOUT), reply_deadline(NO_DEADLINE), firmware(-1), dtr_inverted(false),
+		op_line(0), op_i(0), op_n(0), op_pass(0)
+	{
+		cancel = &stop;
+	}
+
+	bool session_t::open(std::string &error)
+	{
+		return link.open(port, error);
+	}
+
+	void session_t::start(job_t *j, listener_t *l, reactor::msec_t deadline)
+	{
+		job = j;
+		job->line = 0;
+		listener = l;
+		job_deadline = deadline;
+		op_line = 0;
+		stop.reset();
+	}
+
+	reactor::status_t session_t::resume()
+	{
+		return job ? job->run(*this) : reactor::DONE;
+	}
+
+	//The listener is free to start another job from here
+	void session_t::finished(reactor::status_t s)
+	{
+		listener_t	*const l(listener);
+		job = NULL;
+		op_line = 0;
+		if( l )
+			l->finished(*this, s);
+	}
+
+	void session_t::command(uint8_t c, reactor::msec_t timeout)
+	{
+		command(&c, 1, timeout);
+	}
+
+	void session_t::command(const uint8_t *p, size_t n, reactor::msec_t timeout)
+	{
+		send(p, n);
+		reply_timeout = timeout;
+		reply_deadline = reactor::now() + timeout;
+	}
+
+	//The one place a session waits
+	reactor::status_t session_t::need(size_t n)
+	{
+		const int	moved(link.transfer());
+		if( moved < 0 )
+			return reactor::FAILED;
+		const reactor::msec_t	t(reactor::now());
+		if( moved > 0 )
+			reply_deadline = t + reply_timeout;
+		if( stop.requested() )		//Before the data, a long read would never stop otherwise
+			return reactor::CANCELLED;
+		if( link.available() >= n )
+			return reactor::DONE;
+
+		const reactor::msec_t	deadline(std::min(reply_deadline, job_deadline));
+		if( t >= deadline )
+			return reactor::TIMED_OUT;
+		wait.fd = link.handle();
+		wait.events = POLLIN | (link.pending() ? POLLOUT : 0);
+		wait.deadline = deadline;
+		return reactor::PENDING;
+	}
+
+	reactor::status_t session_t::expect(uint8_t cmd, uint8_t reply, reactor::msec_t timeout)
+	{
+		TASK_BEGIN(op_line);
+		command(cmd, timeout);
+		TASK_AWAIT(op_line, need(1));
+		if( link.take() != reply )
+			TASK_RETURN(op_line, reactor::FAILED);
+		TASK_END(op_line);
+	}
+
+	//Same sequence as kitsrus_t::hard_reset(), without the polarity shared between sessions
+	reactor::status_t session_t::hard_reset()
+	{
+		reactor::status_t	s(reactor::PENDING);
+		TASK_BEGIN(op_line);
+		for(op_pass=1; ; ++op_pass)
+		{
+			link.discard();
+			link.set_dtr(!dtr_inverted);
+			::usleep(10);
+			link.set_dtr(dtr_inverted);
+			reply_timeout = RESET_TIMEOUT;
+			reply_deadline = reactor::now() + RESET_TIMEOUT;
+
+			banner = kitsrus::banner_t();
+			for(;;)
+			{
+				TASK_AWAIT_RESULT(op_line, s, need(1));
+				if( (s != reactor::DONE) || banner.put(link.take()) )
+					break;
+			}
+			if( s == reactor::DONE )
+			{
+				firmware = banner.firmware;
+				if( !kitsrus::wrong_polarity(firmware, dtr_inverted) || (op_pass >= 3) )
+					break;
+				dtr_inverted = kitsrus::is_k149(firmware);
+			}
+			else if( (s == reactor::TIMED_OUT) && (op_pass < 2) )
+				dtr_inverted = !dtr_inverted;
+			else
+				TASK_RETURN(op_line, s);
+		}
+		TASK_END(op_line);
+	}
+
+	reactor::status_t session_t::check_protocol()
+	{
+		TASK_BEGIN(op_line);
+		command(CMD_GET_PROTOCOL);
+		TASK_AWAIT(op_line, need(4));
+		if( (memcmp(link.peek(), "P018", 4) != 0) && (memcmp(link.peek(), "P18A", 4) != 0) )
+			TASK_RETURN(op_line, reactor::FAILED);
+		link.skip(4);
+		TASK_END(op_line);
+	}
+
+	reactor::status_t session_t::init_program_vars()
+	{
+		TASK_BEGIN(op_line);
+		command(op_command, kitsrus::init_program_vars_command(info, info.rom_size, info.eeprom_size, op_command));
+		TASK_AWAIT(op_line, need(1));
+		if( !kitsrus::init_program_vars_ok(link.take()) )
+			TASK_RETURN(op_line, reactor::FAILED);
+		TASK_END(op_line);
+	}
+
+	//The programmer asks for each 32 bytes with a 'Y' and says 'P' when it has them all
+	reactor::status_t session_t::write_rom(const kitsrus::chunks_t &chunks)
+	{
+		TASK_BEGIN(op_line);
+		op_n = chunks.rom_words;
+		op_i = 0;		//Bytes sent
+		command(op_command, kitsrus::write_command(CMD_WRITE_ROM, op_n, op_command));
+		for(;;)
+		{
+			TASK_AWAIT(op_line, need(1));
+			{
+				const kitsrus::handshake_t	h(kitsrus::parse_handshake(link.take()));
+				if( h == kitsrus::HANDSHAKE_DONE )
+					break;
+				if( h != kitsrus::HANDSHAKE_NEXT )
+					TASK_RETURN(op_line, reactor::FAILED);
+			}
+			send(kitsrus::rom_block(chunks, op_i, info.layout().blank, op_command), kitsrus::ROM_BLOCK_SIZE);
+			op_i += kitsrus::ROM_BLOCK_SIZE;
+			progress(std::min(op_i/2, op_n), op_n);
+		}
+		progress(op_n, op_n);
+		TASK_END(op_line);
+	}
+
+	//Two bytes per handshake
+	reactor::status_t session_t::write_eeprom(const kitsrus::chunks_t &chunks)
+	{
+		TASK_BEGIN(op_line);
+		op_n = chunks.eeprom.size();
+		op_i = 0;
+		command(op_command, kitsrus::write_command(CMD_WRITE_EEPROM, op_n, op_command));
+		for(;;)
+		{
+			TASK_AWAIT(op_line, need(1));
+			{
+				const kitsrus::handshake_t	h(kitsrus::parse_handshake(link.take()));
+				if( h == kitsrus::HANDSHAKE_DONE )
+					break;
+				if( h != kitsrus::HANDSHAKE_NEXT )
+					TASK_RETURN(op_line, reactor::FAILED);
+			}
+			send(kitsrus::eeprom_block(chunks, op_i, op_command), kitsrus::EEPROM_BLOCK_SIZE);
+			op_i += kitsrus::EEPROM_BLOCK_SIZE;
+			progress(std::min(op_i, op_n), op_n);
+		}
+		progress(op_n, op_n);
+		TASK_END(op_line);
+	}
+
+	//18F parts get the config block a second time with CMD_WRITE_FUSE
+	reactor::status_t session_t::write_config(const kitsrus::chunks_t &chunks)
+	{
+		TASK_BEGIN(op_line);
+		if( chunks.config.size() != 22 )
+			TASK_RETURN(op_line, reactor::FAILED);
+		op_n = info.layout().fuse_pass ? 2 : 1;
+		for(op_pass=0; op_pass < op_n; ++op_pass)
+		{
+			command(op_pass ? CMD_WRITE_FUSE : CMD_WRITE_CONFIG);
+			send('0');
+			send('0');
+			send(&chunks.config[0], chunks.config.size());
+			TASK_AWAIT(op_line, need(1));
+			link.take();		//Throw away the ack, like kitsrus_t does
+			progress(25*(op_pass+1), 25*op_n);
+		}
+		TASK_END(op_line);
+	}
+
+	//Whole words are handed to the sink as they arrive
+	reactor::status_t session_t::read_rom(kitsrus::sink_t &sink)
+	{
+		TASK_BEGIN(op_line);
+		op_n = info.rom_size;
+		op_i = 0;
+		op_pass = 0;		//Set once the sink has stopped
+		command(CMD_READ_ROM);
+		while( op_i < op_n )
+		{
+			TASK_AWAIT(op_line, need(2));
+			for(; (op_i < op_n) && (link.available() >= 2); ++op_i)
+			{
+				const uint8_t	*const p(link.peek());
+				if( !op_pass && !sink.put(op_i, (p[0] << 8) | p[1]) )
+					op_pass = 1;
+				link.skip(2);
+			}
+			progress(op_i, op_n);
+		}
+		TASK_END(op_line);
+	}
+
+	reactor::status_t session_t::read_eeprom(kitsrus::sink_t &sink)
+	{
+		TASK_BEGIN(op_line);
+		op_n = info.eeprom_size;
+		op_i = 0;
+		op_pass = 0;
+		if( op_n == 0 )
+			TASK_RETURN(op_line, reactor::DONE);
+		command(CMD_READ_EEPROM);
+		while( op_i < op_n )
+		{
+			TASK_AWAIT(op_line, need(1));
+			for(; (op_i < op_n) && (link.available() > 0); ++op_i)
+			{
+				const uint8_t	c(link.take());
+				if( !op_pass && !sink.put(info.get_eeprom_start() + op_i, c) )
+					op_pass = 1;
+			}
+			progress(op_i, op_n);
+		}
+		TASK_END(op_line);
+	}
+
+	//'C', the device ID, four ID bytes, four more and then the config words low byte first
+	reactor::status_t session_t::read_config(kitsrus::sink_t &sink)
+	{
+		TASK_BEGIN(op_line);
+		command(CMD_READ_CONFIG);
+		TASK_AWAIT(op_line, need(1 + sizeof(op_buffer)));
+		if( link.take() != 'C' )
+			TASK_RETURN(op_line, reactor::FAILED);
+		memcpy(op_buffer, link.peek(), sizeof(op_buffer));
+		link.skip(sizeof(op_buffer));
+		progress(sizeof(op_buffer), sizeof(op_buffer));
+		{
+			const corefamily::layout_t	&layout(info.layout());
+			if( layout.id_readable )
+			{
+				intelhex::hex_data::address_t	a(layout.id_begin(info.rom_size));
+				for(unsigned i=2; i < 6; ++i)
+					if( !sink.put(a++, op_buffer[i]) )
+						TASK_RETURN(op_line, reactor::DONE);
+			}
+			intelhex::hex_data::address_t	a(layout.config_start);
+			const intelhex::hex_data::address_t	end(a + info.numConfigWords());
+			for(unsigned i=0x0A; (a < end) && (i+1 < sizeof(op_buffer)); i+=2, ++a)
+				if( !sink.put(a, (op_buffer[i+1] << 8) | op_buffer[i]) )
+					break;
+		}
+		TASK_END(op_line);
+	}
+
+	reactor::status_t init_job_t::run(session_t &s)
+	{
+		TASK_BEGIN(line);
+		if( reset )
+		{
+			s.phase("Resetting");
+			TASK_AWAIT(line, s.hard_reset());
+		}
+		TASK_AWAIT(line, s.command_mode());
+		TASK_AWAIT(line, s.check_protocol());
+		TASK_AWAIT(line, s.init_program_vars());
+		TASK_END(line);
+	}
+
+	//Every region is written with the chip powered, and it's turned off again after
+	reactor::status_t program_job_t::run(session_t &s)
+	{
+		TASK_BEGIN(line);
+		TASK_AWAIT(line, init.run(s));
+		if( erase_first )
+		{
+			s.phase("Erasing");
+			TASK_AWAIT(line, s.power_on());
+			TASK_AWAIT(line, s.erase());
+			TASK_AWAIT(line, s.power_off());
+		}
+
+		//Config has to be written first or the programmer locks up
+		s.phase("Writing Config");
+		TASK_AWAIT(line, s.power_on());
+		TASK_AWAIT(line, s.write_config(image.chunks));
+		TASK_AWAIT(line, s.power_off());
+
+		if( !image.chunks.eeprom.empty() )
+		{
+			s.phase("Writing EEPROM");
+			TASK_AWAIT(line, s.power_on());
+			TASK_AWAIT(line, s.write_eeprom(image.chunks));
+			TASK_AWAIT(line, s.power_off());
+		}
+
+		if( image.chunks.rom_words > 0 )
+		{
+			s.phase("Writing ROM");
+			TASK_AWAIT(line, s.power_on());
+			TASK_AWAIT(line, s.write_rom(image.chunks));
+			TASK_AWAIT(line, s.power_off());
+		}
+		TASK_END(line);
+	}
+
+	reactor::status_t read_job_t::run(session_t &s)
+	{
+		TASK_BEGIN(line);
+		TASK_AWAIT(line, init.run(s));
+
+		s.phase("Reading ROM");
+		TASK_AWAIT(line, s.power_on());
+		TASK_AWAIT(line, s.read_rom(sink));
+		TASK_AWAIT(line, s.power_off());
+
+		s.phase("Reading Config");
+		TASK_AWAIT(line, s.power_on());
+		TASK_AWAIT(line, s.read_config(sink));
+		TASK_AWAIT(line, s.power_off());
+
+		if( s.chip().eeprom_size > 0 )
+		{
+			s.phase("Reading EEPROM");
+			TASK_AWAIT(line, s.power_on());
+			TASK_AWAIT(line, s.read_eeprom(sink));
+			TASK_AWAIT(line, s.power_off());
+		}
+		TASK_END(line);
+	}
+}
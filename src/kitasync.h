@@ -0,0 +1,201 @@
+/*	Filename:	kitasync.h
+	Non-blocking Kitsrus protocol, for driving many programmers from one thread
+
+	A session owns a programmer's port in non-blocking mode and is run by a
+	reactor::executor_t. Its commands are resumable: each returns PENDING
+	while it waits for the programmer and picks up where it left off the
+	next time it's called, so a job reads as a plain sequence of commands
+
+		TASK_AWAIT(line, s.command_mode());
+		TASK_AWAIT(line, s.write_rom(image.chunks));
+
+	Every reply is waited for with a deadline, the sooner of the reply
+	timeout counted from the last byte sent and the deadline of the whole
+	job, and every wait ends early if the session's cancel token is set.
+	A session runs one command at a time. After anything other than DONE
+	the programmer is in an unknown state and has to be reset.
+
+	The blocking kitsrus_t is still what the GUI, the command line and
+	qprogd use, this is for stations running a fleet of programmers.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	KITASYNC_H
+#define	KITASYNC_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "chipinfo.h"
+#include "imagecache.h"
+#include "kitsrus.h"
+#include "reactor.h"
+
+namespace kitasync
+{
+	#define	REPLY_TIMEOUT	2000	//Milliseconds for the programmer to answer a command
+	#define	ERASE_TIMEOUT	10000	//Erasing and blank checking take longer
+	#define	RESET_TIMEOUT	250		//For the firmware to restart and send its banner
+
+	//A serial port in non-blocking mode with a buffer each way
+	class link_t
+	{
+		int	fd;
+		std::vector<uint8_t>	rx;
+		size_t	rx_head;		//Next byte to take
+		std::vector<uint8_t>	tx;
+		size_t	tx_head;		//Next byte to write
+
+		link_t(const link_t &);	//No copy
+	public:
+		link_t() : fd(-1), rx_head(0), tx_head(0) {}
+		~link_t()	{ close(); }
+
+		//Exclusive, raw, 8N1 at 19200 baud
+		//	error says why when false is returned
+		bool	open(const std::string &path, std::string &error);
+		void	close();
+		int	handle() const	{ return fd; }
+		void	set_dtr(bool);
+
+		void	send(uint8_t c)	{ tx.push_back(c); }
+		void	send(const uint8_t *p, size_t n)	{ tx.insert(tx.end(), p, p+n); }
+		bool	pending() const	{ return tx_head < tx.size(); }
+		size_t	available() const	{ return rx.size() - rx_head; }
+		uint8_t	take()	{ return rx[rx_head++]; }
+		const uint8_t	*peek() const	{ return &rx[rx_head]; }
+		void	skip(size_t n)	{ rx_head += n; }
+		void	discard();		//Drop everything received so far
+
+		//Write and read whatever the port takes without blocking
+		//	Returns the number of bytes moved either way, -1 if the port failed
+		int	transfer();
+	};
+
+	class session_t;
+
+	//Told about a session's progress, from the executor's thread
+	//	progress() gets the units done so far and the total
+	class listener_t
+	{
+	public:
+		virtual ~listener_t() {}
+		virtual void	phase(session_t &, const char *) {}
+		virtual void	progress(session_t &, unsigned, unsigned) {}
+		virtual void	finished(session_t &, reactor::status_t) {}
+	};
+
+	//What a session does once it's added to an executor
+	class job_t
+	{
+	public:
+		int	line;		//Resume point, see TASK_BEGIN
+		job_t() : line(0) {}
+		virtual ~job_t() {}
+		virtual reactor::status_t	run(session_t &) = 0;
+	};
+
+	class session_t : public reactor::task_t
+	{
+		link_t	link;
+		chipinfo::chipinfo	info;
+		std::string	port;
+		job_t	*job;
+		listener_t	*listener;
+		reactor::cancel_t	stop;
+		reactor::msec_t	job_deadline;
+		reactor::msec_t	reply_timeout;
+		reactor::msec_t	reply_deadline;		//Pushed back whenever a byte is sent or received
+		int	firmware;
+		bool	dtr_inverted;
+
+		//State of the command in progress
+		int	op_line;
+		unsigned	op_i;
+		unsigned	op_n;
+		unsigned	op_pass;
+		uint8_t	op_buffer[26];
+		uint8_t	op_command[kitsrus::ROM_BLOCK_SIZE];		//Command or block being sent, the largest is a ROM block
+		kitsrus::banner_t	banner;		//Of the reset in progress
+
+		void	send(uint8_t c)	{ link.send(c); }
+		void	send(const uint8_t *p, size_t n)	{ link.send(p, n); }
+		void	command(uint8_t c, reactor::msec_t timeout=REPLY_TIMEOUT);	//Send c and start timing the reply
+		void	command(const uint8_t *p, size_t n, reactor::msec_t timeout=REPLY_TIMEOUT);
+		reactor::status_t	need(size_t n);		//DONE once n bytes have arrived
+		reactor::status_t	expect(uint8_t cmd, uint8_t reply, reactor::msec_t timeout=REPLY_TIMEOUT);
+		void	progress(unsigned done, unsigned total)	{ if( listener ) listener->progress(*this, done, total); }
+
+		session_t(const session_t &);	//No copy
+	public:
+		session_t(const std::string &port, const chipinfo::chipinfo &);
+
+		bool	open(std::string &error);	//Open the port
+		const std::string	&name() const	{ return port; }
+		const chipinfo::chipinfo	&chip() const	{ return info; }
+		int	firmware_type() const	{ return firmware; }
+
+		//The job is run the next time the executor resumes the session
+		//	deadline is in reactor::now() time, NO_DEADLINE for none
+		void	start(job_t *, listener_t *, reactor::msec_t deadline=NO_DEADLINE);
+		void	cancel_job()	{ stop.request(); }		//From any thread
+		void	phase(const char *p)	{ if( listener ) listener->phase(*this, p); }
+
+		reactor::status_t	resume();
+		void	finished(reactor::status_t);
+
+		//Resumable commands, call again with the same arguments until they aren't PENDING
+		//	If a read's sink stops the transfer, the rest of the region is
+		//	received and dropped so the programmer stays in step
+		reactor::status_t	hard_reset();		//Pulse DTR and wait for the banner
+		reactor::status_t	command_mode()	{ return expect('P', 'P'); }
+		reactor::status_t	check_protocol();	//P018 or P18A
+		reactor::status_t	init_program_vars();
+		reactor::status_t	power_on()	{ return expect(CMD_VPP_ON, 'V'); }
+		reactor::status_t	power_off()	{ return expect(CMD_VPP_OFF, 'v'); }
+		reactor::status_t	erase()	{ return expect(CMD_ERASE, 'Y', ERASE_TIMEOUT); }
+		reactor::status_t	write_rom(const kitsrus::chunks_t &);
+		reactor::status_t	write_eeprom(const kitsrus::chunks_t &);
+		reactor::status_t	write_config(const kitsrus::chunks_t &);
+		reactor::status_t	read_rom(kitsrus::sink_t &);
+		reactor::status_t	read_eeprom(kitsrus::sink_t &);
+		reactor::status_t	read_config(kitsrus::sink_t &);
+	};
+
+	//Get the programmer ready for a part, optionally starting with a hard reset
+	//	A job that embeds this awaits it as TASK_AWAIT(line, init.run(s))
+	class init_job_t : public job_t
+	{
+		const bool	reset;
+	public:
+		init_job_t(bool hard_reset=true) : reset(hard_reset) {}
+		reactor::status_t	run(session_t &);
+	};
+
+	//Same sequence as programmer::write_all()
+	class program_job_t : public job_t
+	{
+		init_job_t	init;
+		imagecache::image_t	&image;
+		const bool	erase_first;
+	public:
+		program_job_t(imagecache::image_t &i, bool erase=true, bool hard_reset=true) : init(hard_reset), image(i), erase_first(erase) {}
+		reactor::status_t	run(session_t &);
+	};
+
+	//Same sequence as programmer::read_all(), of the whole part
+	class read_job_t : public job_t
+	{
+		init_job_t	init;
+		kitsrus::sink_t	&sink;
+	public:
+		read_job_t(kitsrus::sink_t &s, bool hard_reset=true) : init(hard_reset), sink(s) {}
+		reactor::status_t	run(session_t &);
+	};
+}
+
+#endif	//KITASYNC_H
@@ -0,0 +1,282 @@
+/*	Filename:	kitsim.cc
+	A stand-in for a Kitsrus programmer on the far side of a pseudo terminal
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "kitsim.h"
+#include "kitsrus.h"		//For the command codes
+
+#define	POLL_INTERVAL	100		//Milliseconds between checks for stop()
+#define	MIN_SLEEP	1000		//Microseconds of wire time worth sleeping for
+
+namespace kitsim
+{
+	sim_t::sim_t(uint16_t id) : master(-1), slave(-1), byte_usec(0), owed_usec(0), quit(false), chip_id(id), rom_words(0), eeprom_bytes(0)
+	{
+		config.assign(22, 0xFF);
+	}
+
+	sim_t::~sim_t()
+	{
+		stop();
+	}
+
+	bool sim_t::open(unsigned baud, std::string &error)
+	{
+		if( (master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 )
+		{
+			error = std::string("posix_openpt: ") + strerror(errno);
+			return false;
+		}
+		const char	*name;
+		if( (grantpt(master) < 0) || (unlockpt(master) < 0) || ((name = ptsname(master)) == NULL) )
+		{
+			error = std::string("Can't unlock the pty: ") + strerror(errno);
+			::close(master);
+			master = -1;
+			return false;
+		}
+		path = name;
+		if( (slave = ::open(name, O_RDWR | O_NOCTTY)) < 0 )
+		{
+			error = path + ": " + strerror(errno);
+			::close(master);
+			master = -1;
+			return false;
+		}
+
+		//kitsrus_t configures the slave end when it opens it, raw it until then
+		//	so nothing sent early gets echoed back
+		struct termios	t;
+		if( tcgetattr(slave, &t) == 0 )
+		{
+			cfmakeraw(&t);
+			tcsetattr(slave, TCSANOW, &t);
+		}
+
+		byte_usec = baud ? (10*1000000 + baud - 1)/baud : 0;	//Start, 8 data and stop bits
+		owed_usec = 0;
+		quit = false;
+		start();
+		return true;
+	}
+
+	void sim_t::stop()
+	{
+		if( master < 0 )
+			return;
+		quit = true;
+		wait();
+		::close(slave);
+		::close(master);
+		slave = master = -1;
+	}
+
+	//Sleep off the time the bytes would have spent on the wire
+	void sim_t::pace(size_t bytes)
+	{
+		if( byte_usec == 0 )
+			return;
+		owed_usec += double(bytes)*byte_usec;
+		if( owed_usec >= MIN_SLEEP )
+		{
+			::usleep(static_cast<useconds_t>(owed_usec));
+			owed_usec = 0;
+		}
+	}
+
+	//Blocks until n bytes have arrived, false if stop() was called first
+	bool sim_t::get(uint8_t *p, size_t n)
+	{
+		while( n > 0 )
+		{
+			struct pollfd	pfd;
+			pfd.fd = master;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if( quit )
+				return false;
+			if( poll(&pfd, 1, POLL_INTERVAL) <= 0 )
+				continue;
+			const ssize_t	r(::read(master, p, n));
+			if( r < 0 )
+			{
+				if( (errno == EINTR) || (errno == EAGAIN) )
+					continue;
+				return false;
+			}
+			pace(r);
+			p += r;
+			n -= r;
+		}
+		return true;
+	}
+
+	//Sent a slice at a time so long replies trickle in the way they would on the wire
+	bool sim_t::put(const uint8_t *p, size_t n)
+	{
+		const size_t	slice(byte_usec ? std::max<size_t>(1, MIN_SLEEP/byte_usec) : n);
+		while( n > 0 )
+		{
+			if( quit )
+				return false;
+			size_t	m(std::min(n, slice));
+			pace(m);
+			while( m > 0 )
+			{
+				const ssize_t	r(::write(master, p, m));
+				if( r < 0 )
+				{
+					if( errno == EINTR )
+						continue;
+					return false;
+				}
+				p += r;
+				n -= r;
+				m -= r;
+			}
+		}
+		return true;
+	}
+
+	void sim_t::erase()
+	{
+		std::fill(rom.begin(), rom.end(), 0xFFFF);
+		std::fill(eeprom.begin(), eeprom.end(), 0xFF);
+		config.assign(22, 0xFF);
+	}
+
+	//Handle one command, false if the link went away in the middle of it
+	bool sim_t::command(uint8_t c)
+	{
+		uint8_t	b[32];
+		switch(c)
+		{
+			case 'P':			//Power-on mode to command mode, harmless in command mode
+				return put('P');
+			case CMD_RESET:
+				return put('Q');
+			case CMD_ECHO:
+				return get(b[0]) && put(b[0]);
+			case CMD_INITVAR:
+				if( !get(b, 11) )
+					return false;
+				rom_words = (b[0] << 8) | b[1];
+				eeprom_bytes = (b[2] << 8) | b[3];
+				//Short reads are done by shrinking the sizes, so memory is never truncated
+				if( rom.size() < rom_words )
+					rom.resize(rom_words, 0xFFFF);
+				if( eeprom.size() < eeprom_bytes )
+					eeprom.resize(eeprom_bytes, 0xFF);
+				return put('I');
+			case CMD_VPP_ON:
+			case CMD_VPP_CYCLE:
+				return put('V');
+			case CMD_VPP_OFF:
+				return put('v');
+			case CMD_WRITE_ROM:
+			{
+				if( !get(b, 2) )
+					return false;
+				const unsigned	size((b[0] << 8) | b[1]);
+				for(unsigned i=0; i < size; i += 16)
+				{
+					if( !put('Y') || !get(b, 32) )
+						return false;
+					for(unsigned j=0; (j < 16) && (i+j < rom.size()); ++j)
+						rom[i+j] = (b[2*j] << 8) | b[2*j+1];
+				}
+				return put('P');
+			}
+			case CMD_WRITE_EEPROM:
+			{
+				if( !get(b, 2) )
+					return false;
+				const unsigned	size((b[0] << 8) | b[1]);
+				for(unsigned i=0; i < size; i += 2)
+				{
+					if( !put('Y') || !get(b, 2) )
+						return false;
+					for(unsigned j=0; (j < 2) && (i+j < eeprom.size()); ++j)
+						eeprom[i+j] = b[j];
+				}
+				return put('P');
+			}
+			case CMD_WRITE_CONFIG:
+			case CMD_WRITE_FUSE:
+				if( !get(b, 2) || !get(&config[0], config.size()) )
+					return false;
+				return put('Y');
+			case CMD_READ_ROM:
+			{
+				std::vector<uint8_t>	out(2*rom_words);
+				for(unsigned i=0; i < rom_words; ++i)
+				{
+					out[2*i] = rom[i] >> 8;
+					out[2*i+1] = rom[i] & 0xFF;
+				}
+				return out.empty() || put(&out[0], out.size());
+			}
+			case CMD_READ_EEPROM:
+				return (eeprom_bytes == 0) || put(&eeprom[0], eeprom_bytes);
+			case CMD_READ_CONFIG:
+			{
+				//Device ID, the ID and 'F' bytes as written, then the config words
+				uint8_t	out[27];
+				memset(out, 0xFF, sizeof(out));
+				out[0] = 'C';
+				out[1] = chip_id & 0xFF;
+				out[2] = chip_id >> 8;
+				memcpy(out+3, &config[0], config.size());
+				return put(out, sizeof(out));
+			}
+			case CMD_ERASE:
+				erase();
+				return put('Y');
+			case CMD_CHECK_ROM:
+			{
+				if( !get(b[0]) )
+					return false;
+				const uint16_t	blank((b[0] << 8) | 0xFF);
+				bool	clean(true);
+				for(unsigned i=0; clean && (i < rom_words); ++i)
+					clean = (rom[i] & blank) == blank;
+				return put(clean ? 'Y' : 'N');
+			}
+			case CMD_CHECK_EEPROM:
+			{
+				bool	clean(true);
+				for(unsigned i=0; clean && (i < eeprom_bytes); ++i)
+					clean = (eeprom[i] == 0xFF);
+				return put(clean ? 'Y' : 'N');
+			}
+			case CMD_IN_SOCKET:
+			case CMD_NOT_IN_SOCKET:
+				return put('A') && put('Y');		//The socket is never empty
+			case CMD_GET_VERSION:
+				return put(KIT_150);
+			case CMD_GET_PROTOCOL:
+				return put(reinterpret_cast<const uint8_t*>("P018"), 4);
+			default:			//Unknown commands are ignored, like the firmware does
+				return true;
+		}
+	}
+
+	void sim_t::run()
+	{
+		uint8_t	c;
+		while( get(c) && command(c) ) {}
+	}
+}
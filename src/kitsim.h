@@ -0,0 +1,68 @@
+/*	Filename:	kitsim.h
+	A stand-in for a Kitsrus programmer on the far side of a pseudo terminal
+
+	kitsrus_t opens the slave end like any serial port. The simulator answers
+	the P018 commands from a thread on the master end, keeping a chip's memory
+	so that whatever is written can be read back and verified. Replies can be
+	paced to the time a byte takes at a given baud rate, otherwise the link is
+	as fast as the pty.
+
+	There's no DTR on a pty, so the hard reset can't be simulated. Sessions
+	start in power-on mode, call command_mode() instead of hard_reset().
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	KITSIM_H
+#define	KITSIM_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <QThread>
+
+namespace kitsim
+{
+	class sim_t : public QThread
+	{
+		int	master;
+		int	slave;			//Held open so the master never sees a hangup between sessions
+		std::string	path;
+		unsigned	byte_usec;	//Time on the wire for one byte, 0 for no pacing
+		double	owed_usec;		//Wire time not slept yet, short waits are batched
+		volatile bool	quit;
+
+		//State of the simulated chip
+		uint16_t	chip_id;
+		uint16_t	rom_words;
+		uint16_t	eeprom_bytes;
+		std::vector<uint16_t>	rom;
+		std::vector<uint8_t>	eeprom;
+		std::vector<uint8_t>	config;		//The 22 bytes of the last CMD_WRITE_CONFIG
+
+		bool	get(uint8_t *, size_t);
+		bool	get(uint8_t &c)	{ return get(&c, 1); }
+		bool	put(const uint8_t *, size_t);
+		bool	put(uint8_t c)	{ return put(&c, 1); }
+		void	pace(size_t bytes);
+		void	erase();
+		bool	command(uint8_t);
+	public:
+		sim_t(uint16_t chip_id=0);
+		~sim_t();
+
+		//Create the pty, baud 0 doesn't pace the replies
+		//	error says why when false is returned
+		bool	open(unsigned baud, std::string &error);
+		const std::string	&port() const	{ return path; }
+		void	stop();			//Stop the thread and close the pty
+
+	protected:
+		void	run();
+	};
+}
+
+#endif	//KITSIM_H
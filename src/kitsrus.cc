@@ -10,9 +10,16 @@
 
 	$Id: kitsrus.cc,v 1.14 2009/03/31 05:21:30 bfoz Exp $
  * */
+#include <algorithm>
 #include <fcntl.h>
 #include <iostream>
+#include <map>
 #include <string>
+
+#include <QMutex>
+#include <QTime>
+
+#include "checksum.h"
 #include "kitsrus.h"
 #include "intelhex.h"
 
@@ -32,7 +39,74 @@ namespace kitsrus
 	#define	HIBYTE(a)	(uint8_t)(a>>8)
 	#define	LOBYTE(a)	(uint8_t)(a&0x00FF)
 #endif	//Q_WS_WIN
-    
+
+	size_t init_program_vars_command(const chipinfo::chipinfo &info, unsigned rom_size, unsigned eeprom_size, uint8_t *command)
+	{
+		command[0] = CMD_INITVAR;
+		command[1] = HIBYTE(rom_size);
+		command[2] = LOBYTE(rom_size);
+		command[3] = HIBYTE(eeprom_size);
+		command[4] = LOBYTE(eeprom_size);
+		command[5] = info.core_type;
+		command[6] = (info.cal_word ? 0x01 : 0) | (info.band_gap ? 0x02 : 0) | (info.single_panel ? 0x04 : 0) | (info.fast_power ? 0x08 : 0);	//Program flags
+		command[7] = info.program_delay;
+		command[8] = info.power_sequence;
+		command[9] = info.erase_mode;
+		command[10] = info.program_tries;
+		command[11] = info.over_program;
+		return INITVAR_SIZE;
+	}
+
+	size_t write_command(uint8_t cmd, unsigned count, uint8_t *command)
+	{
+		command[0] = cmd;
+		command[1] = HIBYTE(count);
+		command[2] = LOBYTE(count);
+		return WRITE_HEADER_SIZE;
+	}
+
+	const uint8_t *rom_block(const chunks_t &chunks, size_t offset, uint16_t blank, uint8_t *scratch)
+	{
+		if( offset + ROM_BLOCK_SIZE <= chunks.rom.size() )
+			return &chunks.rom[offset];
+		for(unsigned i=0; i < ROM_BLOCK_SIZE; i += 2)
+		{
+			scratch[i] = HIBYTE(blank);
+			scratch[i+1] = LOBYTE(blank);
+		}
+		return scratch;
+	}
+
+	const uint8_t *eeprom_block(const chunks_t &chunks, size_t offset, uint8_t *scratch)
+	{
+		if( offset + EEPROM_BLOCK_SIZE <= chunks.eeprom.size() )
+			return &chunks.eeprom[offset];
+		memset(scratch, 0xFF, EEPROM_BLOCK_SIZE);
+		return scratch;
+	}
+
+	handshake_t parse_handshake(int c)
+	{
+		switch(c)
+		{
+			case 'Y':	return HANDSHAKE_NEXT;
+			case 'P':	return HANDSHAKE_DONE;
+			case 'N':	return HANDSHAKE_REJECTED;
+			default:	return HANDSHAKE_UNEXPECTED;
+		}
+	}
+
+	bool banner_t::put(uint8_t c)
+	{
+		if( started && is_kit(c) )
+		{
+			firmware = c;
+			return true;
+		}
+		started = (c == 'B');
+		return false;
+	}
+
 	//Switch from power-on mode to command mode
 	bool kitsrus_t::command_mode()
 	{
@@ -56,73 +130,150 @@ namespace kitsrus
 			return false;
 	}
 
-	//Do a hard reset of the device
-	bool kitsrus_t::hard_reset()
+	#define	RESET_BANNER_TIMEOUT	250		//Milliseconds for the firmware to restart and send its banner
+	#define	RESET_SETTLE	20		//Milliseconds for data sent before a reset to drain, well short of the banner
+	#define	ABORT_TRIES	3		//Resets abort_transfer() tries before giving up
+
+	//DTR polarity of each port, learned from the first kit that answers on it
+	//	Every session used to start out guessing, and a wrong guess on a K149 costs
+	//	a second reset. Sessions on different ports can run in different threads.
+	static QMutex	polarity_mutex;
+	static std::map<std::string, bool>	port_polarity;
+
+	//Toggle DTR to reset the programmer
+	void kitsrus_t::pulse_reset()
 	{
-	
-	static bool set_d   = true;
-	static bool clear_d = false;
-	static std::string kitName;
-	
-	
-		set_dtr(set_d);		//Set DTR high or low in K149
+		set_dtr(!dtr_inverted);		//Set DTR high, or low on a K149
 		
 #ifdef	Q_WS_WIN	//Deal with win32 stupidity
 		Sleep(100);
 #else
 		usleep(10);		//Delay
 #endif
-		clear_dtr(clear_d);	//Set DTR low or high in K149
+		set_dtr(dtr_inverted);		//Set DTR low, or high on a K149
+	}
 
-		if( read()=='B' )
+	//The firmware keeps sending until the reset takes effect, and a USB bridge
+	//	can hold on to some of it for a while longer, so drop input again after
+	//	a short wait. The firmware takes longer than that to restart.
+	void kitsrus_t::restart()
+	{
+		com.discardInput();
+		pulse_reset();
+#ifdef	Q_WS_WIN
+		Sleep(RESET_SETTLE);
+#else
+		usleep(RESET_SETTLE*1000);
+#endif
+		com.discardInput();
+	}
+
+	int16_t kitsrus_t::read_within(int ms)
+	{
+		QTime	timer;
+		timer.start();
+		while( com.bytesAvailable() <= 0 )
 		{
-		    firmware = read();	//Ignore the firmware type
-		    qDebug("Found Firmware Type=%X '%s'\n", firmware, firmwareName());
-		
-		    if( (firmwareName() == "Kit 149B") || (firmwareName() == "Kit 149A") && (kitName != firmwareName() ) )	
-		    {
-			    set_d   = false;		
-			    clear_d = true;
-		    }
-		    else if( (firmwareName() != "Kit 149B") || (firmwareName() != "Kit 149A") && (kitName != firmwareName() ) )
-		    {
-			    set_d   = true; 
-			    clear_d = false;
-		    }		
-		
-		    if(kitName != firmwareName())
-		    {
-			    kitName = firmwareName();
-			    hard_reset();
-		    }
-		
-		    return true;
+			if( timer.elapsed() >= ms )
+				return -1;
+#ifdef	Q_WS_WIN
+			Sleep(1);
+#else
+			usleep(1000);
+#endif
 		}
-		else
-		    return false;
+		return read() & 0xFF;
+	}
+
+	//The firmware sends 'B' and its type after a reset
+	//	Anything still in flight from before the reset is skipped
+	bool kitsrus_t::wait_banner(int ms)
+	{
+		QTime	timer;
+		timer.start();
+		banner_t	banner;
+		int16_t	c;
+		do
+		{
+			if( (c=read_within(ms - timer.elapsed())) < 0 )
+				return false;
+		} while( !banner.put(c) );
+		firmware = banner.firmware;
+		return true;
+	}
+
+	//Do a hard reset of the device
+	//	The first pulse uses the polarity last seen on this port. If nothing answers the
+	//	other polarity is tried, and if the kit that answers wants the other polarity it's
+	//	reset again with that one so DTR is left at its idle level.
+	bool kitsrus_t::hard_reset()
+	{
+		enum { PULSE, WAIT_BANNER, CHECK_KIT, DONE, FAILED }	state(PULSE);
+		const std::string	port(com.portName().toStdString());
+		if( !polarity_known )
+		{
+			QMutexLocker	lock(&polarity_mutex);
+			std::map<std::string, bool>::const_iterator	i(port_polarity.find(port));
+			if( i != port_polarity.end() )
+				dtr_inverted = i->second;
+			polarity_known = true;
+		}
+
+		unsigned	pulses(0);
+		while( (state != DONE) && (state != FAILED) )
+		{
+			switch( state )
+			{
+				case PULSE:
+					restart();
+					++pulses;
+					state = WAIT_BANNER;
+					break;
+				case WAIT_BANNER:
+					if( wait_banner(RESET_BANNER_TIMEOUT) )
+						state = CHECK_KIT;
+					else if( pulses < 2 )
+					{
+						dtr_inverted = !dtr_inverted;
+						state = PULSE;
+					}
+					else
+						state = FAILED;
+					break;
+				case CHECK_KIT:
+					QLOG(logging::LEVEL_INFO, __FUNCTION__)("msg", "Found firmware")("type", logging::hex(firmware, 2))("name", firmwareName());
+					if( wrong_polarity(firmware, dtr_inverted) && (pulses < 3) )
+					{
+						dtr_inverted = is_k149(firmware);
+						state = PULSE;
+					}
+					else
+						state = DONE;
+					break;
+				default:
+					break;
+			}
+		}
+		if( state == FAILED )
+			return false;
+
+		QMutexLocker	lock(&polarity_mutex);
+		port_polarity[port] = dtr_inverted;
+		return true;
 	}
 
 	bool kitsrus_t::init_program_vars()
 	{
-		write(CMD_INITVAR);
-		write(HIBYTE(info.rom_size));
-		write(LOBYTE(info.rom_size));
-		write(HIBYTE(info.eeprom_size));
-		write(LOBYTE(info.eeprom_size));
-		write(info.core_type);   //FIXME  CoreType
-		uint8_t i = (info.cal_word)?0x01:0x00;
-		i |= (info.band_gap)?0x02:0x00;
-		i |= (info.single_panel)?0x04:0x00;
-		i |= (info.fast_power)?0x08:0x00;
-		write(i);	 //Program flags
-		write(info.program_delay);
-		write(info.power_sequence);
-		write(info.erase_mode);
-		write(info.program_tries);
-		write(info.over_program);
-		if(read() == 'I')
-			return true;
-		return false;
+		return init_program_vars(info.rom_size, info.eeprom_size);
+	}
+
+	//The firmware reads back as many words as it's told the chip has,
+	//	so smaller sizes are used to limit a read
+	bool kitsrus_t::init_program_vars(rom_size_type rom_size, eeprom_size_type eeprom_size)
+	{
+		uint8_t	command[INITVAR_SIZE];
+		write(command, init_program_vars_command(info, rom_size, eeprom_size, command));
+		return init_program_vars_ok(read());
 	}
 	
 
@@ -153,127 +304,214 @@ namespace kitsrus
 			return false;
 	}
 
+	//Serialize the ROM words that fit in the part
+	template<class T> static void serialize_rom_words(chipinfo::chipinfo &info, intelhex::hex_data &HexData, chunks_t &chunks)
+	{
+		const intelhex::hex_data::element_t blank(T::blank);
+
+		//Figure out how many ROM words need to be written
+		chunks.rom_words = 1 + HexData.max_addr_below(info.rom_size-1);
+		const intelhex::hex_data::address_t padded((chunks.rom_words + 15) & ~15);
+
+		//Start with blank words and then copy in every block that lands in ROM
+		chunks.rom.resize(2*padded);
+		for(intelhex::hex_data::address_t i=0; i < padded; ++i)
+		{
+			chunks.rom[2*i] = HIBYTE(blank);
+			chunks.rom[2*i+1] = LOBYTE(blank);
+		}
+		for(intelhex::hex_data::iterator i = HexData.begin(); i != HexData.end(); ++i)
+		{
+			intelhex::hex_data::address_t a(i->first);
+			for(intelhex::hex_data::data_container::iterator j = i->second.begin(); (j != i->second.end()) && (a < padded); ++j, ++a)
+			{
+				chunks.rom[2*a] = HIBYTE(*j);
+				chunks.rom[2*a+1] = LOBYTE(*j);
+			}
+		}
+	}
+
+	void serialize_rom(chipinfo::chipinfo &info, intelhex::hex_data &HexData, chunks_t &chunks)
+	{
+		static void (*const kernels[])(chipinfo::chipinfo &, intelhex::hex_data &, chunks_t &) =
+			{&serialize_rom_words<corefamily::core12_t>, &serialize_rom_words<corefamily::core14_t>, &serialize_rom_words<corefamily::core16_t>};
+		corefamily::select(kernels, info.family())(info, HexData, chunks);
+	}
+
+	//Serialize the EEPROM bytes
+	void serialize_eeprom(chipinfo::chipinfo &info, intelhex::hex_data &HexData, chunks_t &chunks)
+	{
+		const intelhex::hex_data::address_t eeprom_start(info.get_eeprom_start());
+		intelhex::hex_data::size_type size;
+
+		//Ideally we would figure out how many ROM words are going to be written
+		//	and then write only that. But, to make things simpler we'll just write
+		//	to all of the ROM.
+		size = HexData.size_in_range(eeprom_start, eeprom_start + info.eeprom_size);
+		//Make size an even number
+		if( (size % 2) != 0 )
+			++size;
+
+		chunks.eeprom.assign(size, 0xFF);
+		for(intelhex::hex_data::iterator i = HexData.begin(); i != HexData.end(); ++i)
+		{
+			intelhex::hex_data::address_t a(i->first);
+			for(intelhex::hex_data::data_container::iterator j = i->second.begin(); j != i->second.end(); ++j, ++a)
+			{
+				if( (a >= eeprom_start) && (a < eeprom_start + size) )
+					chunks.eeprom[a - eeprom_start] = LOBYTE(*j);
+			}
+		}
+	}
+
+	//Serialize the ID and config words
+	template<class T> static void serialize_config_words(chipinfo::chipinfo &info, intelhex::hex_data &HexData, chunks_t &chunks)
+	{
+		chunks.config.assign(22, 0xFF);
+
+		intelhex::hex_data::address_t	i;
+		//If the ID bits were specified use them
+		//	otherwise use blanks
+		i = T::id_after_rom ? info.rom_size : T::id_start;
+		if( HexData.isset(i) )
+		{
+			chunks.config[0] = HexData.get(i++, 0xFF);
+			chunks.config[1] = HexData.get(i++, 0xFF);
+			chunks.config[2] = HexData.get(i++, 0xFF);
+			chunks.config[3] = HexData.get(i, 0xFF);
+		}
+		chunks.config[4] = 'F';
+		chunks.config[5] = 'F';
+		chunks.config[6] = 'F';
+		chunks.config[7] = 'F';
+
+		i = T::config_start;
+		const intelhex::hex_data::address_t end(i + info.numConfigWords());
+		for(unsigned j=8; (i < end) && (j+1 < chunks.config.size()); ++i, j+=2)
+		{
+			if( !HexData.isset(i) )
+				continue;
+			const intelhex::hex_data::element_t a = HexData.get(i, 0xFFFF);
+			chunks.config[j] = LOBYTE(a);
+			chunks.config[j+1] = HIBYTE(a);
+		}
+	}
+
+	void serialize_config(chipinfo::chipinfo &info, intelhex::hex_data &HexData, chunks_t &chunks)
+	{
+		static void (*const kernels[])(chipinfo::chipinfo &, intelhex::hex_data &, chunks_t &) =
+			{&serialize_config_words<corefamily::core12_t>, &serialize_config_words<corefamily::core14_t>, &serialize_config_words<corefamily::core16_t>};
+		corefamily::select(kernels, info.family())(info, HexData, chunks);
+	}
+
+	void serialize(chipinfo::chipinfo &info, intelhex::hex_data &HexData, chunks_t &chunks)
+	{
+		serialize_rom(info, HexData, chunks);
+		serialize_eeprom(info, HexData, chunks);
+		serialize_config(info, HexData, chunks);
+	}
+
+	uint32_t serialize_key(const chipinfo::chipinfo &info)
+	{
+		const corefamily::layout_t	&l = info.layout();
+		const uint32_t	fields[] = {info.core_type, l.family, info.rom_size, info.eeprom_size, info.num_config_words,
+			l.blank, l.eeprom_start, l.config_start, l.id_begin(info.rom_size), l.fuse_pass};
+		return checksum::crc32(reinterpret_cast<const uint8_t*>(fields), sizeof(fields));
+	}
+
 	bool kitsrus_t::write_rom(intelhex::hex_data &HexData)
 	{
-//		uint8_t	c;
-		uint8_t i;
-		intelhex::hex_data::address_t	j(0);
+		chunks_t	chunks;
+		serialize_rom(info, HexData, chunks);
+		return write_rom(chunks);
+	}
+
+	bool kitsrus_t::write_rom(const chunks_t &chunks)
+	{
+		static bool (kitsrus_t::*const kernels[])(const chunks_t &) =
+			{&kitsrus_t::write_rom_words<corefamily::core12_t>, &kitsrus_t::write_rom_words<corefamily::core14_t>, &kitsrus_t::write_rom_words<corefamily::core16_t>};
+		return (this->*corefamily::select(kernels, info.family()))(chunks);
+	}
+
+	template<class T> bool kitsrus_t::write_rom_words(const chunks_t &chunks)
+	{
+		const intelhex::hex_data::size_type size(chunks.rom_words);
+		intelhex::hex_data::size_type	j(0);	//Byte offset into the ROM chunks
 		uint16_t k;
-		intelhex::hex_data::size_type size;
-		
-		//Figure out how many ROM words need to be written
-		size = 1 + HexData.max_addr_below(info.rom_size-1);
-//		std::cout << __FUNCTION__ << ": size = " << size << std::endl;
+		uint8_t	block[ROM_BLOCK_SIZE];
 
 		//Send program rom command
-		write(CMD_WRITE_ROM);
-		write( (size & 0xFF00) >> 8);  //Send size hi
-		write(size & 0x00FF); //Send size low
+		write(block, write_command(CMD_WRITE_ROM, size, block));
 
 		while(1)
 		{
-			switch(read())
+			const int16_t	c = read();
+			switch( parse_handshake(c) )
 			{
-				case 'P':
-//					std::cout << ".\n";
-					emit_callback((j>size)?size:j,size);
+				case HANDSHAKE_DONE:
+					emit_callback((j/2>size)?size:j/2,size);
 					return true;
-				case 'N':
-					std::cerr << __FUNCTION__ << ": Got N at address ";
-					k = read();
-					k = k << 8;
-					k |= (0x00FF & read());
-					std::cerr << std::hex << k;
-					std::cerr << " with word ";
+				case HANDSHAKE_REJECTED:
+				{
+					//The programmer sends the address and word that didn't verify
 					k = read();
 					k = k << 8;
 					k |= (0x00FF & read());
-					std::cerr << std::hex << k;
-					std::cerr << std::endl;
+					uint16_t	w = read();
+					w = w << 8;
+					w |= (0x00FF & read());
+					QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Got N")("address", logging::hex(k, 4))("word", logging::hex(w, 4));
 					return false;
-				case 'Y':
-					for(i=0; i<(32/2); ++i)
-					{
-//					std::cout << __FUNCTION__ << ": Pre get\n";
-						const intelhex::hex_data::element_t a = HexData.get(j, info.get_blank_value());
-//					std::cout << __FUNCTION__ << ": " << std::hex << a << " @ " << std::hex << j << "\n";
-						write( (a & 0xFF00) >> 8);
-						write( a & 0x00FF);
-						++j;
-					}
-					if( !emit_callback((j>size)?size:j,size) )	//Emit callback and check for cancellation
+				}
+				case HANDSHAKE_NEXT:
+					//Send the next 32 bytes in one go, padding with blanks if the
+					//	programmer asks for more than was serialized
+					write(rom_block(chunks, j, T::blank, block), ROM_BLOCK_SIZE);
+					j += ROM_BLOCK_SIZE;
+					if( !emit_callback((j/2>size)?size:j/2,size) )	//Emit callback and check for cancellation
 						return false;
-//					std::cout << "." << std::flush;
 					break;
 				default:
-					std::cerr << __FUNCTION__ << ": Got unexpected character\n";
+					QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Got unexpected character")("got", c);
 					return false;
 			}
 		}
 		return true;
 	}
 
-//#define	WRITE_EEPROM_DEBUG
 	bool kitsrus_t::write_eeprom(intelhex::hex_data &HexData)
 	{
-//		uint8_t	c;
-//		uint8_t i;
-		intelhex::hex_data::address_t	j(info.get_eeprom_start());
-		intelhex::hex_data::address_t	eeprom_start(info.get_eeprom_start());
-		intelhex::hex_data::address_t	eeprom_end;
-		uint16_t progress(0);
-		intelhex::hex_data::size_type size;
-		
-		//Ideally we would figure out how many ROM words are going to be written
-		//	and then write only that. But, to make things simpler we'll just write
-		//	to all of the ROM.
-#if defined(WRITE_EEPROM_DEBUG)
-		std::cout << __FUNCTION__ << ": eeprom_start = " << std::hex << j << std::endl;
-		std::cout << __FUNCTION__ << ": eeprom_size = " << std::hex << info.eeprom_size << std::endl;
-#endif
-		size = HexData.size_in_range(j, info.get_eeprom_start() + info.eeprom_size);
-		//Make size an even number
-		if( (size % 2) != 0 )
-			++size;
-		eeprom_end = j + size - 1;
-#if defined(WRITE_EEPROM_DEBUG)
-		std::cout << __FUNCTION__ << ": size = " << size << std::endl;
-		std::cout << __FUNCTION__ << ": eeprom_end = " << std::hex << eeprom_end << std::endl;
-#endif
+		chunks_t	chunks;
+		serialize_eeprom(info, HexData, chunks);
+		return write_eeprom(chunks);
+	}
 
-		//Send program rom command
-		write(CMD_WRITE_EEPROM);
-		write( (size & 0xFF00) >> 8);  //Send size hi
-		write(size & 0x00FF); //Send size low
+	bool kitsrus_t::write_eeprom(const chunks_t &chunks)
+	{
+		const intelhex::hex_data::size_type size(chunks.eeprom.size());
+		intelhex::hex_data::size_type	j(0);
+		uint8_t	block[WRITE_HEADER_SIZE];
+
+		//Send program eeprom command
+		write(block, write_command(CMD_WRITE_EEPROM, size, block));
 
 		while(1)
 		{
-			switch(read())
+			const int16_t	c = read();
+			switch( parse_handshake(c) )
 			{
-				case 'P':
-//					std::cout << ".\n";
-					emit_callback((progress>size)?size:progress,size);
+				case HANDSHAKE_DONE:
+					emit_callback((j>size)?size:j,size);
 					return true;
-				case 'Y':			
-#if !defined(WRITE_EEPROM_DEBUG)
-//					std::cout << "." << std::flush;
-#endif
-					write( HexData.get(j, 0xFF) & 0x00FF);
-#if defined(WRITE_EEPROM_DEBUG)
-					std::cout << __FUNCTION__ << ": wrote " << std::hex << HexData[j] << "\n";
-#endif
-					++j;
-					write( HexData.get(j, 0xFF) & 0x00FF);
-#if defined(WRITE_EEPROM_DEBUG)
-					std::cout << __FUNCTION__ << ": wrote " << std::hex << HexData[j] << "\n";
-#endif
-					++j;
-					progress = j - eeprom_start;
-					if( !emit_callback((progress>size)?size:progress,size) )	//Emit callback and check for cancellation
+				case HANDSHAKE_NEXT:
+					//Two bytes per handshake, blank if the programmer asks for more
+					write(eeprom_block(chunks, j, block), EEPROM_BLOCK_SIZE);
+					j += EEPROM_BLOCK_SIZE;
+					if( !emit_callback((j>size)?size:j,size) )	//Emit callback and check for cancellation
 						return false;
 					break;
 				default:
-					std::cerr << __FUNCTION__ << ": Got unexpected character\n";
+					QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Got unexpected character")("got", c);
 					return false;
 			}
 		}
@@ -282,63 +520,46 @@ namespace kitsrus
 
 	bool kitsrus_t::write_config(intelhex::hex_data &HexData)
 	{
-		std::vector<uint8_t> tmp_config(22, 0xFF);
-		
-//		std::cout << __FUNCTION__ << std::endl;
-		
-		intelhex::hex_data::address_t	i;
-		//If the ID bits were specified use them
-		//	otherwise use blanks
-		i = info.get_id_start();
-		if( HexData.isset(i) )
-		{
-			tmp_config[0] = HexData[i++];
-			tmp_config[1] = HexData[i++];
-			tmp_config[2] = HexData[i++];
-			tmp_config[3] = HexData[i];
-		}
-		tmp_config[4] = 'F';
-		tmp_config[5] = 'F';
-		tmp_config[6] = 'F';
-		tmp_config[7] = 'F';
-
-		i = info.get_config_start();
-		if( i == 0 )
-			return false;		// Config bits are never at address zero
-		const intelhex::hex_data::address_t end(i + info.numConfigWords());
-		for(unsigned j=8; i < end; ++i, j+=2)
-		{
-			if( !HexData.isset(i) )
-				continue;
-			tmp_config[j] = HexData[i] & 0x00FF;
-			tmp_config[j+1] = (HexData[i] & 0xFF00) >> 8;
-		}
+		chunks_t	chunks;
+		serialize_config(info, HexData, chunks);
+		return write_config(chunks);
+	}
+
+	bool kitsrus_t::write_config(const chunks_t &chunks)
+	{
+		static bool (kitsrus_t::*const kernels[])(const chunks_t &) =
+			{&kitsrus_t::write_config_words<corefamily::core12_t>, &kitsrus_t::write_config_words<corefamily::core14_t>, &kitsrus_t::write_config_words<corefamily::core16_t>};
+		return (this->*corefamily::select(kernels, info.family()))(chunks);
+	}
+
+	template<class T> bool kitsrus_t::write_config_words(const chunks_t &chunks)
+	{
+		if( chunks.config.size() != 22 )
+			return false;
 
 		unsigned progress(0);
-		const unsigned finished(info.is16bit() ? 50 : 25);
+		const unsigned finished(T::fuse_pass ? 50 : 25);
 		write(CMD_WRITE_CONFIG);	// 16F parts
 		write('0');
 		write('0');
 		progress += 3;
-		for( i=0; i<22; ++i, ++progress)
+		for(unsigned i=0; i<22; ++i, ++progress)
 		{
-			write(tmp_config[i]);
+			write(chunks.config[i]);
 			if( !emit_callback(progress, finished) )	//Emit callback and check for cancellation
 				return false;
 		}
-//		std::cout << __FUNCTION__ << "1" << std::endl;
 		read();	//Throw away the ack
-//		std::cout << __FUNCTION__ << "2" << std::endl;
 
-		if( info.is16bit() )
+		if( T::fuse_pass )
 		{
 			write(CMD_WRITE_FUSE);		// 18F parts
 			write('0');
 			write('0');
 			progress += 3;
-			for( i=0; i<22; ++i, ++progress)
+			for(unsigned i=0; i<22; ++i, ++progress)
 			{
-				write(tmp_config[i]);
+				write(chunks.config[i]);
 				if( !emit_callback(progress, finished) )	//Emit callback and check for cancellation
 					return false;
 			}
@@ -354,30 +575,89 @@ namespace kitsrus
 
 	//Read from a PIC into a hex_data structure
 	bool kitsrus_t::read_rom(intelhex::hex_data &HexData)
+	{
+		hex_sink_t	sink(HexData);
+		return read_rom(sink);
+	}
+
+	bool kitsrus_t::read_rom(sink_t &sink)
+	{
+		return read_rom(sink, info.rom_size);
+	}
+
+	bool kitsrus_t::read_rom(sink_t &sink, const intelhex::ranges_t &ranges)
+	{
+		return read_rom(sink, intelhex::range_end(ranges, 0, info.rom_size));
+	}
+
+	//Read the first n ROM words
+	//	The firmware is told the chip is smaller so that it stops after the last
+	//	word. If it doesn't take that, the transfer is stopped with a reset instead.
+	bool kitsrus_t::read_rom(sink_t &sink, rom_size_type n)
 	{
 		intelhex::hex_data::element_t a;
+		n = std::min(n, info.rom_size);
+		if( n == 0 )
+			return true;
+
+		rom_size_type	total(info.rom_size);	//Words the firmware is going to send
+		if( (n < total) && init_program_vars(n, info.eeprom_size) )
+			total = n;
 		
 		write(CMD_READ_ROM);
 //		std::cout << "About to read " << info.rom_size << " words\n";
-		for(unsigned i=0; i<info.rom_size; ++i)
+		for(unsigned i=0; i<n; ++i)
 		{
 //			std::cout << "\r" << i;
 			a = (read() << 8) & 0xFF00;
 			a |= read() & 0x00FF;
-			HexData[i] = a;
-			if( !emit_callback(i+1, info.rom_size) )	//Emit callback and check for cancellation
+			if( !sink.put(i, a) )
+			{
+				if( i+1 < total )
+					return abort_transfer();
+				break;
+			}
+			if( !emit_callback(i+1, n) )	//Emit callback and check for cancellation
 				return false;
 		}
 
 //		std::cout << "\r";
 //		std::cout << "\nRead " << info.rom_size << " words\n";
-		return true;
+		if( n < total )
+			return abort_transfer();
+		return (total == info.rom_size) || init_program_vars();	//Restore the real sizes
 	}
 
 	bool kitsrus_t::read_eeprom(intelhex::hex_data &HexData)
 	{
+		hex_sink_t	sink(HexData);
+		return read_eeprom(sink);
+	}
+
+	bool kitsrus_t::read_eeprom(sink_t &sink)
+	{
+		return read_eeprom(sink, info.eeprom_size);
+	}
+
+	bool kitsrus_t::read_eeprom(sink_t &sink, const intelhex::ranges_t &ranges)
+	{
+		const intelhex::hex_data::address_t	start(info.get_eeprom_start());
+		return read_eeprom(sink, intelhex::range_end(ranges, start, start + info.eeprom_size) - start);
+	}
+
+	//Read the first n EEPROM bytes, limited the same way as read_rom()
+	bool kitsrus_t::read_eeprom(sink_t &sink, eeprom_size_type n)
+	{
+		n = std::min(n, info.eeprom_size);
+		if( n == 0 )
+			return true;
+
+		eeprom_size_type	total(info.eeprom_size);	//Bytes the firmware is going to send
+		if( (n < total) && init_program_vars(info.rom_size, n) )
+			total = n;
+
 		intelhex::hex_data::address_t i(info.get_eeprom_start());
-		const intelhex::hex_data::address_t stop(i + info.eeprom_size);
+		const intelhex::hex_data::address_t stop(i + n);
 
 //		intelhex::hex_data::element_t a;
 		intelhex::hex_data::address_t j(1);
@@ -387,66 +667,101 @@ namespace kitsrus
 //		std::cout << __FUNCTION__ << ": eeprom_size = " << std::hex << info.eeprom_size << std::endl;
 
 		write(CMD_READ_EEPROM);
-		for(; i<stop; ++i)
+		for(; i<stop; ++i, ++j)
 		{
-			HexData[i] = read();
-			if( !emit_callback(j++, info.eeprom_size) )	//Emit callback and check for cancellation
+			if( !sink.put(i, read()) )
+			{
+				if( j < total )
+					return abort_transfer();
+				break;
+			}
+			if( !emit_callback(j, n) )	//Emit callback and check for cancellation
 				return false;
-//			std::cout << __FUNCTION__ << ": HexData[" << std::hex << i << "] = " << std::hex << HexData[i] << std::endl;
-//			a = read();
-//			std::cout << __FUNCTION__ << ": j = " << std::hex << (j++) << "\t" << std::hex << a << "\n";
 		}
-		return true;
+		if( n < total )
+			return abort_transfer();
+		return (total == info.eeprom_size) || init_program_vars();	//Restore the real sizes
 	}
 
 	bool kitsrus_t::read_config(intelhex::hex_data &HexData)
+	{
+		hex_sink_t	sink(HexData);
+		return read_config(sink);
+	}
+
+	//The whole config block has been received by the time anything is stored,
+	//	so a sink that stops early doesn't need the programmer to be reset
+	bool kitsrus_t::read_config(sink_t &sink)
+	{
+		static bool (kitsrus_t::*const kernels[])(sink_t &) =
+			{&kitsrus_t::read_config_words<corefamily::core12_t>, &kitsrus_t::read_config_words<corefamily::core14_t>, &kitsrus_t::read_config_words<corefamily::core16_t>};
+		return (this->*corefamily::select(kernels, info.family()))(sink);
+	}
+
+	template<class T> bool kitsrus_t::read_config_words(sink_t &sink)
 	{
 		intelhex::hex_data::element_t	a[26];
 		write(CMD_READ_CONFIG);
 		
 		uint8_t b = read();	//Throw away the ack
 		if(b != 'C')
-			std::cerr << __FUNCTION__ << ": Bad config ack\n\tExpected C got " << b << std::endl;
+			QLOG(logging::LEVEL_WARNING, __FUNCTION__)("msg", "Bad config ack")("expected", "C")("got", b);
 //		else
 //			std::cout << __FUNCTION__ << ": Got ack\n";
 
 		for(unsigned i=0; i<26; ++i)
 		{
-			a[i] = read();
+			a[i] = read() & 0xFF;
 			if( !emit_callback(i+1, 26) )	//Emit callback and check for cancellation
 				return false;
 //			std::cout << __FUNCTION__ << ": read " << std::hex << a[i] << "\n";
 		}
 
-	// Store the config bytes
-	if( info.is12bit() || info.is14bit() )
-	{
-	    intelhex::hex_data::address_t j(info.get_id_start());
-	    HexData[j++] = a[2];
-	    HexData[j++] = a[3];
-	    HexData[j++] = a[4];
-	    HexData[j++] = a[5];
-	}
+		//Store the config bytes
+		if( T::id_readable )
+		{
+			intelhex::hex_data::address_t j(T::id_after_rom ? info.rom_size : T::id_start);
+			for(unsigned i=2; i < 6; ++i)
+				if( !sink.put(j++, a[i]) )
+					return true;
+		}
 
-		intelhex::hex_data::address_t j(info.get_config_start());
-		if( j == 0 )	// Config bits are never at address zero
-			return false;
+		intelhex::hex_data::address_t j(T::config_start);
 		const intelhex::hex_data::address_t end(j + info.numConfigWords());
 		for(unsigned i=0x0A; j < end; i+=2, ++j)
 		{
-			HexData[j] = (a[i+1] << 8) | a[i];
+			if( !sink.put(j, (a[i+1] << 8) | a[i]) )
+				break;
 		}
 
 		return true;
 	}
 
+	//Stop a transfer that's in progress
+	//	The firmware doesn't read the port while it's sending, so a soft reset
+	//	can't get through until the whole region has been sent. Use the reset
+	//	line instead, drop whatever was in flight, and go back to command mode.
+	//	Stale data can still pass for the banner, so if command mode doesn't
+	//	answer the programmer is reset again.
+	bool kitsrus_t::abort_transfer()
+	{
+		for(unsigned i=0; i < ABORT_TRIES; ++i)
+		{
+			restart();
+			if( wait_banner(RESET_BANNER_TIMEOUT) && command_mode() && init_program_vars() )
+				return true;
+			QLOG(logging::LEVEL_WARNING, __FUNCTION__)("msg", "Out of step after the reset, trying again")("try", i+1);
+		}
+		return false;
+	}
+
 	bool kitsrus_t::erase_chip()
 	{
 		write(CMD_ERASE);
 		uint8_t a = read();
 		if( a != 'Y')
 		{
-			std::cerr << __FUNCTION__ << ": Bad erase\n\tExpected Y got: " << a << std::endl;
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad erase")("expected", "Y")("got", a);
 			return false;
 		}
 //		else
@@ -454,6 +769,44 @@ namespace kitsrus
 		return true;
 	}
 
+	//Let the programmer check that the ROM is blank, without reading it back
+	//	Returns false if the programmer didn't answer, blank is only set when it did
+	bool kitsrus_t::blank_check_rom(bool &blank)
+	{
+		write(CMD_CHECK_ROM);
+		write(HIBYTE(info.romBlank()));		//High byte of a blank word, the low byte is always 0xFF
+
+		//The programmer sends a 'B' every so often while it's checking
+		int16_t a;
+		while( (a = read()) == 'B' ) {}
+		switch(a)
+		{
+			case 'Y':
+				blank = true;
+				return true;
+			case 'N':
+			case 'C':	//Blank except for the config words
+				blank = false;
+				return true;
+			default:
+				QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad blank check")("expected", "Y or N")("got", a);
+				return false;
+		}
+	}
+
+	bool kitsrus_t::blank_check_eeprom(bool &blank)
+	{
+		write(CMD_CHECK_EEPROM);
+		const int16_t a = read();
+		if( (a != 'Y') && (a != 'N') )
+		{
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad blank check")("expected", "Y or N")("got", a);
+			return false;
+		}
+		blank = (a == 'Y');
+		return true;
+	}
+
 	bool kitsrus_t::detect_chip()
 	{
 		write(CMD_IN_SOCKET);
@@ -466,6 +819,70 @@ namespace kitsrus
 			return false;
 	}
 
+	bool kitsrus_t::start_socket_wait(bool inserted)
+	{
+		write(inserted ? CMD_IN_SOCKET : CMD_NOT_IN_SOCKET);
+		const int16_t a = read();
+		if( a != 'A' )
+		{
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad ack")("expected", "A")("got", a);
+			return false;
+		}
+		return true;
+	}
+
+	int kitsrus_t::poll_socket()
+	{
+		//With a zero timeout bytesAvailable() doesn't wait, it returns -1 when nothing has arrived
+		if( com.bytesAvailable() <= 0 )
+			return 0;
+		const int16_t a = read();
+		if( a != 'Y' )
+		{
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad socket poll")("expected", "Y")("got", a);
+			return -1;
+		}
+		return 1;
+	}
+
+	//The device ID is in the first two bytes of the config block, low byte first
+	//	Parts that don't have one read back as blank
+	bool kitsrus_t::read_chip_id(uint16_t &id)
+	{
+		write(CMD_READ_CONFIG);
+		const int16_t ack = read();
+		int16_t a[26];
+		for(unsigned i=0; i<26; ++i)
+			a[i] = read();
+		if( ack != 'C' )
+		{
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad config ack")("expected", "C")("got", ack);
+			return false;
+		}
+		id = (a[0] & 0xFF) | ((a[1] & 0xFF) << 8);
+		return true;
+	}
+
+	//Every command costs at least one turnaround, so this is the floor on how
+	//	fast the handshaked transfers can go
+	bool kitsrus_t::measure_turnaround(unsigned n, unsigned &usec)
+	{
+		if( n == 0 )
+			return false;
+		QTime	timer;
+		timer.start();
+		for(unsigned i=0; i < n; ++i)
+		{
+			const uint8_t	c(0x55 ^ i);		//Vary the byte so a stale echo doesn't pass
+			write(CMD_ECHO);
+			write(c);
+			if( (read() & 0xFF) != c )
+				return false;
+		}
+		usec = (timer.elapsed()*1000)/n;
+		return true;
+	}
+
 	int kitsrus_t::get_version()
 	{
 		if(firmware < 0)
@@ -494,13 +911,4 @@ namespace kitsrus
 	return NULL;
     }
 
-	//Ugly kludge to work around the K149 reset logic
-	//	This function is only used to set the firmware type for reset purposes
-	//	Once the programmer has been reset, get_version() should be used to get the real
-	//		firmware type
-	//void kitsrus_t::set_149()
-	//{
-	//	firmware = KIT_149A;
-	//}
-
 }	//namespace pocket
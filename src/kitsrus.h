@@ -15,7 +15,10 @@
 #define KITSRUS_H
 
 #include <fstream>
+#include <iostream>
+#include <vector>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,11 +26,69 @@
 
 #include "chipinfo.h"
 #include "intelhex.h"
+#include "logging.h"
 
 #include "qextserialport.h"
 
 namespace kitsrus
 {
+	//Image data laid out the way the programmer expects to receive it
+	//	Building these once per image saves a block search for every word sent
+	struct chunks_t
+	{
+		typedef	std::vector<uint8_t>	buffer_t;
+
+		intelhex::hex_data::size_type	rom_words;	//Word count sent with CMD_WRITE_ROM
+		buffer_t	rom;		//ROM words, high byte first, padded to whole 32 byte chunks
+		buffer_t	eeprom;		//EEPROM bytes, padded to an even count
+		buffer_t	config;		//ID and config bytes for CMD_WRITE_CONFIG
+
+		chunks_t() : rom_words(0) {}
+	};
+
+	void	serialize_rom(chipinfo::chipinfo &, intelhex::hex_data &, chunks_t &);
+	void	serialize_eeprom(chipinfo::chipinfo &, intelhex::hex_data &, chunks_t &);
+	void	serialize_config(chipinfo::chipinfo &, intelhex::hex_data &, chunks_t &);
+	void	serialize(chipinfo::chipinfo &, intelhex::hex_data &, chunks_t &);
+	//A hash of everything about a part that serialize() depends on
+	//	Chunks are good for any part with the same key, whatever it's called
+	uint32_t	serialize_key(const chipinfo::chipinfo &);
+
+	//Receives words as they're read back from the chip
+	class sink_t
+	{
+	public:
+		virtual ~sink_t() {}
+		//Return false to stop the transfer
+		virtual bool	put(intelhex::hex_data::address_t, intelhex::hex_data::element_t) = 0;
+	};
+
+	//Store words into a hex_data
+	class hex_sink_t : public sink_t
+	{
+		intelhex::hex_data	&hex;
+	public:
+		hex_sink_t(intelhex::hex_data &h) : hex(h) {}
+		bool	put(intelhex::hex_data::address_t a, intelhex::hex_data::element_t w)
+		{
+			hex[a] = w;
+			return true;
+		}
+	};
+
+	//Encodes the words straight into an Intel HEX stream
+	class writer_sink_t : public sink_t
+	{
+		intelhex::writer_t	&writer;
+	public:
+		writer_sink_t(intelhex::writer_t &w) : writer(w) {}
+		bool	put(intelhex::hex_data::address_t a, intelhex::hex_data::element_t w)
+		{
+			writer.put(a, w);
+			return true;
+		}
+	};
+
 	class kitsrus_t
 	{
 		//Kitsrus Commands
@@ -75,35 +136,39 @@ namespace kitsrus
 //		bool	write(const unsigned char c) {	return com.putChar(c);	}
 		bool	write(const unsigned char c) 
 		{
-#ifdef	DEBUG
-			if( isalnum(c) )
-				printf("write \"%c\"\n", c);
-			else
-				printf("write 0x%02X\n", (unsigned)c);
-#endif	//DEBUG
+			QLOG(logging::LEVEL_DEBUG, __FUNCTION__)("byte", logging::hex(c, 2));
 			char d = c;
 			return com.write(&d, 1);
 		}
+		bool	write(const uint8_t *p, size_t n)
+		{
+			return com.write(reinterpret_cast<const char*>(p), n) == (qint64)n;
+		}
 
 	int16_t	read()
 		{
 			char c;
 			if( com.read(&c,1) != 1 )
-	    {
-		std::cerr << "read error\n";
-		return -1;
-	    }
-#ifdef DEBUG
-			if( isalnum(c) )
-				printf("read \"%c\"\n", c);
-			else
-				printf("read 0x%02X\n", c);
-#endif	//DEBUG
+			{
+				QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Read failed")("error", com.lastError());
+				return -1;
+			}
+			QLOG(logging::LEVEL_DEBUG, __FUNCTION__)("byte", logging::hex(uint8_t(c), 2));
 			return c;
 		}
-		//These two are inverted when using a K149
 		void	set_dtr(bool set)	{	com.setDtr(set);	}
-		void	clear_dtr(bool set)	{	com.setDtr(set);	}
+
+		//The K149 resets on the opposite DTR edge to the other kits
+		bool	dtr_inverted;
+		bool	polarity_known;		//dtr_inverted has been looked up for this port
+		bool	wait_banner(int ms);	//Wait for the reset banner and read the firmware type
+		void	restart();		//Pulse reset and drop anything sent before it took effect
+		int16_t	read_within(int ms);	//-1 if nothing arrives in time
+
+		//Per-family kernels, picked once per call from info.family()
+		template<class T> bool	write_rom_words(const chunks_t &);
+		template<class T> bool	write_config_words(const chunks_t &);
+		template<class T> bool	read_config_words(sink_t &);
 
 		kitsrus_t(const kitsrus_t&);	//No copy
 		void	close()	{	com.close();	}
@@ -123,38 +188,75 @@ public:
 		typedef	chipinfo::chipinfo::eeprom_size_type	eeprom_size_type;
 		typedef	bool(*callback_t)(void*,int,int);
 
-		kitsrus_t(QString &port, chipinfo::chipinfo chip) : com(port), info(chip), firmware(-1), callback(NULL)
+		kitsrus_t(QString &port, chipinfo::chipinfo chip) : com(port), info(chip), firmware(-1), dtr_inverted(false), polarity_known(false), callback(NULL)
 		{
-			com.setBaudRate(BAUD19200);
-			com.setDataBits(DATA_8);
-			com.setParity(PAR_NONE);
-			com.setStopBits(STOP_1);
-			com.setFlowControl(FLOW_OFF);
-			com.setTimeout(0,0);
+			const PortSettings	settings = {BAUD19200, DATA_8, PAR_NONE, STOP_1, FLOW_OFF, 0, 0};
+			com.setPortSettings(settings);
+			com.setExclusive(true);		//Only one program at a time can drive a programmer
 		}
 		~kitsrus_t() { close(); }
 
-		bool	open()	{	return com.open(QIODevice::ReadWrite) ? true : false;	}
+		//Ports are opened in low latency mode where the driver supports it, the
+		//	protocol waits for a reply after every command and every 32 bytes of data
+		bool	open()
+		{
+			com.setLowLatency(true);
+			if( com.open(QIODevice::ReadWrite) )
+				return true;
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Could not open the port")("device", com.portName().toStdString())("error", strerror(errno));
+			return false;
+		}
+		bool	low_latency() const	{ return com.lowLatency(); }
 		bool	command_mode();
 		bool	soft_reset();
 		bool	hard_reset();
+		void	pulse_reset();
 
 		bool	init_program_vars();
+		bool	init_program_vars(rom_size_type, eeprom_size_type);
 		bool	chip_power_on();
 		bool	chip_power_off();
 		bool	chip_power_cycle();
 		bool	write_rom(intelhex::hex_data &);
+		bool	write_rom(const chunks_t &);
 		bool	write_eeprom(intelhex::hex_data &);
+		bool	write_eeprom(const chunks_t &);
 		bool	write_config(intelhex::hex_data &);
+		bool	write_config(const chunks_t &);
 		void	write_calibration();
 		bool	read_rom(intelhex::hex_data &);
 		bool	read_eeprom(intelhex::hex_data &);
 		bool	read_config(intelhex::hex_data &);
+		//Stream the words to a sink as they arrive
+		//	If the sink stops a ROM or EEPROM transfer the programmer is reset
+		//	and put back in command mode. Returns false on errors and cancellation,
+		//	but not when the sink stopped the transfer.
+		bool	read_rom(sink_t &);
+		bool	read_eeprom(sink_t &);
+		bool	read_config(sink_t &);
+		//Read only as much as the ranges need
+		//	The firmware always starts at the beginning of a region, so everything up
+		//	to the end of the last range is read
+		bool	read_rom(sink_t &, const intelhex::ranges_t &);
+		bool	read_eeprom(sink_t &, const intelhex::ranges_t &);
+		bool	read_rom(sink_t &, rom_size_type);
+		bool	read_eeprom(sink_t &, eeprom_size_type);
+		bool	abort_transfer();
 		bool	erase_chip();
-		void	blank_check_rom();
-		void	blank_check_eeprom();
+		bool	blank_check_rom(bool &blank);
+		bool	blank_check_eeprom(bool &blank);
 		void	write_18F_fuse();
 		bool	detect_chip();
+		//Wait for a part to be put in or taken out of the socket without blocking
+		//	start_socket_wait() sends the command, then poll_socket() returns 1 once
+		//	the programmer reports the change, 0 while it's still waiting and -1
+		//	on errors. abort_transfer() cancels a wait.
+		bool	start_socket_wait(bool inserted);
+		int	poll_socket();
+		bool	read_chip_id(uint16_t &);	//Device ID word from the config block
+		//Time n echo commands, the mean round trip is returned in usec
+		//	Must be in command mode
+		bool	measure_turnaround(unsigned n, unsigned &usec);
 		int	get_version();
 
 		void set_callback(callback_t f, void *p)	//Function and pointer to pass to function
@@ -171,11 +273,65 @@ public:
 */
 		std::string	get_protocol();
 	const char *const firmwareName();
+		//Switch to another part, call init_program_vars() before using it
+		void	set_chip(const chipinfo::chipinfo &chip)	{ info = chip; }
+		const chipinfo::chipinfo	&get_chip() const	{ return info; }
 		rom_size_type	get_rom_size() {return info.rom_size; }
 		eeprom_size_type	get_eeprom_size() {return info.eeprom_size; }
 		uint32_t	get_eeprom_start() {return info.get_eeprom_start(); }
-		//void	set_149();	//Ugly kludge to work around the K149 reset logic
 	};
 
+	//Commands and replies at the byte level
+	//	kitsrus_t and the non-blocking kitasync sessions both build their
+	//	commands and read the replies with these, only the waiting differs
+	enum
+	{
+		INITVAR_SIZE = 12,		//CMD_INITVAR and its arguments
+		WRITE_HEADER_SIZE = 3,	//CMD_WRITE_ROM or CMD_WRITE_EEPROM and the count
+		ROM_BLOCK_SIZE = 32,	//Bytes sent for each handshake of a ROM write
+		EEPROM_BLOCK_SIZE = 2	//Bytes sent for each handshake of an EEPROM write
+	};
+
+	//Fill in the command and return its length
+	size_t	init_program_vars_command(const chipinfo::chipinfo &, unsigned rom_size, unsigned eeprom_size, uint8_t *command);
+	size_t	write_command(uint8_t cmd, unsigned count, uint8_t *command);
+
+	//The block to send after a write's handshake for byte offset
+	//	Past the end of the data the block is blanks, made in scratch
+	const uint8_t	*rom_block(const chunks_t &, size_t offset, uint16_t blank, uint8_t *scratch);
+	const uint8_t	*eeprom_block(const chunks_t &, size_t offset, uint8_t *scratch);
+
+	//What a write's handshake byte means
+	enum handshake_t
+	{
+		HANDSHAKE_NEXT,			//'Y', send the next block
+		HANDSHAKE_DONE,			//'P', everything was programmed
+		HANDSHAKE_REJECTED,		//'N', followed by the address and word that didn't verify
+		HANDSHAKE_UNEXPECTED
+	};
+	handshake_t	parse_handshake(int c);
+
+	inline bool	init_program_vars_ok(int reply)	{ return reply == 'I'; }
+
+	inline bool	is_kit(int type)
+	{
+		return ((type >= KIT_128) && (type <= KIT_182)) || (type == KIT_185);
+	}
+
+	//Picks the firmware type out of what arrives after a reset
+	//	Anything still in flight from before the reset is skipped, and a 'B'
+	//	in it only counts if a known firmware type follows
+	class banner_t
+	{
+		bool	started;	//Got the 'B'
+	public:
+		int	firmware;
+		banner_t() : started(false), firmware(-1) {}
+		bool	put(uint8_t c);		//True once the type has arrived
+	};
+
+	inline bool	is_k149(int firmware)	{ return (firmware == KIT_149A) || (firmware == KIT_149B); }
+	//The K149 wants the other DTR polarity, reset it again so DTR is left idle
+	inline bool	wrong_polarity(int firmware, bool dtr_inverted)	{ return is_k149(firmware) != dtr_inverted; }
 }	//namespace kitsrus
 #endif
@@ -0,0 +1,411 @@
+/*	Filename:	logging.cc
+	Leveled, structured diagnostics
+
+	The queue is a ring of slots, each with a sequence number that says
+	whose turn it is. A writer claims the next free slot with a
+	compare-and-swap on the enqueue position, fills it in and publishes it
+	by bumping the slot's sequence. The logging thread is the only reader,
+	it formats the slot where it is and hands it back the same way.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "logging.h"
+
+#define	QUEUE_SIZE	256		//Entries, a power of two
+
+namespace logging
+{
+	volatile int	threshold = LEVEL_WARNING;
+	LOGGING_THREAD const char	*context[NUM_CONTEXTS];
+
+	static const char	*const context_keys[NUM_CONTEXTS] = {"job", "port", "phase"};
+	static const char	*const level_names[] = {"debug", "info", "warning", "error", "off"};
+
+	//Take the threshold from the environment before main() runs
+	static struct environment_t
+	{
+		environment_t()
+		{
+			const char	*const s = getenv("QPROG_LOG");
+			level_t	l;
+			if( s && parse_level(s, l) )
+				threshold = l;
+		}
+	} environment;
+
+	void set_level(level_t l)
+	{
+		threshold = l;
+	}
+
+	const char *level_name(level_t l)
+	{
+		return ((l >= LEVEL_DEBUG) && (l <= LEVEL_OFF)) ? level_names[l] : "unknown";
+	}
+
+	bool parse_level(const std::string &s, level_t &l)
+	{
+		for(int i=LEVEL_DEBUG; i <= LEVEL_OFF; ++i)
+			if( s == level_names[i] )
+			{
+				l = level_t(i);
+				return true;
+			}
+		return false;
+	}
+
+	//Copy at most TEXT_SIZE-1 characters, NULL is an empty string
+	static void copy_text(char *to, const char *from)
+	{
+		size_t	n = from ? strlen(from) : 0;
+		if( n > TEXT_SIZE - 1 )
+			n = TEXT_SIZE - 1;
+		if( n )
+			memcpy(to, from, n);
+		to[n] = 0;
+	}
+
+	//Fill in everything but the fields
+	static void stamp(entry_t &e, level_t l, const char *site)
+	{
+		struct timeval	tv;
+		gettimeofday(&tv, NULL);
+		e.usec = uint64_t(tv.tv_sec)*1000000 + tv.tv_usec;
+		e.level = l;
+		e.site = site;
+		for(unsigned i=0; i < NUM_CONTEXTS; ++i)
+			copy_text(e.context[i], context[i]);
+		e.num_fields = 0;
+	}
+
+	scope_t::scope_t(context_id i, const char *value) : id(i), saved(context[i])
+	{
+		text[0] = 0;
+		context[id] = value;
+	}
+
+	scope_t::scope_t(context_id i, const std::string &value) : id(i), saved(context[i])
+	{
+		copy_text(text, value.c_str());
+		context[id] = text;
+	}
+
+	scope_t::scope_t(context_id i, unsigned value) : id(i), saved(context[i])
+	{
+		snprintf(text, sizeof(text), "%u", value);
+		context[id] = text;
+	}
+
+	//The queue and the thread that empties it
+	class writer_t : public QThread
+	{
+		struct slot_t
+		{
+			volatile unsigned	sequence;	//Position it can be claimed at, or position+1 once it's filled
+			entry_t	entry;
+		};
+
+		slot_t	ring[QUEUE_SIZE];
+		volatile unsigned	enqueue_pos;
+		unsigned	dequeue_pos;		//Only the logging thread moves it
+		volatile unsigned	written;		//Entries formatted and written out
+		volatile unsigned long	lost;		//Entries dropped because the queue was full
+		unsigned long	lost_reported;
+
+		QMutex	mutex;
+		QWaitCondition	wake;
+		QWaitCondition	drained;		//The logging thread caught up, for flush()
+		volatile int	waiting;		//The logging thread is parked on wake
+
+		FILE	*volatile out;
+
+		void	write(const entry_t &);
+	protected:
+		virtual void	run();
+	public:
+		writer_t();
+
+		bool	push(const entry_t &);
+		void	flush();
+		void	set_output(FILE *f)	{ out = f; }
+		unsigned long	dropped() const	{ return lost; }
+	};
+
+	writer_t::writer_t() : enqueue_pos(0), dequeue_pos(0), written(0), lost(0), lost_reported(0), waiting(0), out(stderr)
+	{
+		for(unsigned i=0; i < QUEUE_SIZE; ++i)
+			ring[i].sequence = i;
+	}
+
+	bool writer_t::push(const entry_t &e)
+	{
+		unsigned	pos = enqueue_pos;
+		slot_t	*s;
+		while( true )
+		{
+			s = &ring[pos & (QUEUE_SIZE - 1)];
+			const int	diff = int(s->sequence - pos);
+			if( diff == 0 )
+			{
+				if( __sync_bool_compare_and_swap(&enqueue_pos, pos, pos + 1) )
+					break;
+				pos = enqueue_pos;
+			}
+			else if( diff < 0 )		//Still holds an entry from a lap ago, the queue is full
+			{
+				__sync_fetch_and_add(&lost, 1);
+				return false;
+			}
+			else		//Another thread claimed it first
+				pos = enqueue_pos;
+		}
+
+		//Only the fields that were set are copied
+		memcpy(&s->entry, &e, reinterpret_cast<const char*>(&e.fields[e.num_fields]) - reinterpret_cast<const char*>(&e));
+		__sync_synchronize();
+		s->sequence = pos + 1;
+		__sync_synchronize();
+
+		//Only take the lock if the logging thread is asleep
+		if( waiting )
+		{
+			QMutexLocker	lock(&mutex);
+			wake.wakeOne();
+		}
+		return true;
+	}
+
+	void writer_t::flush()
+	{
+		const unsigned	target = enqueue_pos;
+		QMutexLocker	lock(&mutex);
+		while( int(written - target) < 0 )
+		{
+			wake.wakeOne();
+			if( !drained.wait(&mutex, 1000) )		//Give up if the logging thread is stuck
+				break;
+		}
+		fflush(out);
+	}
+
+	//Quote a value if it needs it, logfmt style
+	static void put_value(std::string &line, const char *s)
+	{
+		if( *s && (strcspn(s, " \"=\\\t\r\n") == strlen(s)) )
+		{
+			line += s;
+			return;
+		}
+		line += '"';
+		for(; *s; ++s)
+		{
+			switch(*s)
+			{
+				case '"':	line += "\\\"";	break;
+				case '\\':	line += "\\\\";	break;
+				case '\n':	line += "\\n";	break;
+				case '\r':	line += "\\r";	break;
+				case '\t':	line += "\\t";	break;
+				default:	line += *s;
+			}
+		}
+		line += '"';
+	}
+
+	void writer_t::write(const entry_t &e)
+	{
+		char	s[48];
+		const time_t	seconds(e.usec / 1000000);
+		const struct tm	*const t = gmtime(&seconds);	//Only this thread calls it
+		strftime(s, sizeof(s), "%Y-%m-%dT%H:%M:%S", t);
+		std::string	line(s);
+		snprintf(s, sizeof(s), ".%06uZ ", unsigned(e.usec % 1000000));
+		line += s;
+		line += level_name(e.level);
+		line += ' ';
+		line += e.site;
+		for(unsigned i=0; i < NUM_CONTEXTS; ++i)
+			if( e.context[i][0] )
+			{
+				line += ' ';
+				line += context_keys[i];
+				line += '=';
+				put_value(line, e.context[i]);
+			}
+		for(unsigned i=0; i < e.num_fields; ++i)
+		{
+			const field_t	&f = e.fields[i];
+			line += ' ';
+			line += f.key;
+			line += '=';
+			switch(f.kind)
+			{
+				case field_t::TEXT:
+					put_value(line, f.text);
+					continue;
+				case field_t::SIGNED:
+					snprintf(s, sizeof(s), "%ld", f.number);
+					break;
+				case field_t::UNSIGNED:
+					snprintf(s, sizeof(s), "%lu", (unsigned long)f.number);
+					break;
+				case field_t::HEX:
+					snprintf(s, sizeof(s), "0x%0*lX", f.width, (unsigned long)f.number);
+					break;
+			}
+			line += s;
+		}
+		line += '\n';
+		fputs(line.c_str(), out);
+	}
+
+	void writer_t::run()
+	{
+		while( true )
+		{
+			//Format everything that's been published
+			slot_t	*s;
+			while( (s = &ring[dequeue_pos & (QUEUE_SIZE - 1)])->sequence == dequeue_pos + 1 )
+			{
+				__sync_synchronize();
+				write(s->entry);
+				__sync_synchronize();
+				s->sequence = dequeue_pos + QUEUE_SIZE;
+				++dequeue_pos;
+				__sync_fetch_and_add(&written, 1);
+			}
+
+			//Written directly, the queue may well be full again
+			if( lost != lost_reported )
+			{
+				const unsigned long	n = lost;
+				entry_t	e;
+				stamp(e, LEVEL_WARNING, "logging");
+				e.num_fields = 2;
+				e.fields[0].key = "msg";
+				e.fields[0].kind = field_t::TEXT;
+				copy_text(e.fields[0].text, "Queue full, records dropped");
+				e.fields[1].key = "dropped";
+				e.fields[1].kind = field_t::UNSIGNED;
+				e.fields[1].number = long(n - lost_reported);
+				write(e);
+				lost_reported = n;
+			}
+			fflush(out);
+
+			//Sleep until a writer wakes us, checking the queue again with
+			//	the flag set so a record pushed in between isn't missed
+			QMutexLocker	lock(&mutex);
+			drained.wakeAll();
+			waiting = 1;
+			__sync_synchronize();
+			if( ring[dequeue_pos & (QUEUE_SIZE - 1)].sequence != dequeue_pos + 1 )
+				wake.wait(&mutex, 1000);
+			waiting = 0;
+		}
+	}
+
+	//Never deleted, records can be made while static objects are destroyed
+	static writer_t *start_writer()
+	{
+		writer_t	*const w = new writer_t;
+		w->start();
+		atexit(logging::flush);
+		return w;
+	}
+
+	//Started by the first record
+	static writer_t &writer()
+	{
+		static writer_t	*const w = start_writer();
+		return *w;
+	}
+
+	void set_output(FILE *f)
+	{
+		writer().set_output(f);
+	}
+
+	void flush()
+	{
+		writer().flush();
+	}
+
+	unsigned long dropped()
+	{
+		return writer().dropped();
+	}
+
+	record_t::record_t(level_t l, const char *site)
+	{
+		stamp(entry, l, site);
+	}
+
+	record_t::~record_t()
+	{
+		writer().push(entry);
+	}
+
+	field_t *record_t::add(const char *key, field_t::kind_t kind)
+	{
+		if( entry.num_fields == MAX_FIELDS )
+			return NULL;
+		field_t	*const f = &entry.fields[entry.num_fields++];
+		f->key = key;
+		f->kind = kind;
+		f->width = 0;
+		return f;
+	}
+
+	record_t &record_t::operator()(const char *key, const char *value)
+	{
+		if( field_t *const f = add(key, field_t::TEXT) )
+			copy_text(f->text, value);
+		return *this;
+	}
+
+	record_t &record_t::operator()(const char *key, int value)
+	{
+		return (*this)(key, long(value));
+	}
+
+	record_t &record_t::operator()(const char *key, long value)
+	{
+		if( field_t *const f = add(key, field_t::SIGNED) )
+			f->number = value;
+		return *this;
+	}
+
+	record_t &record_t::operator()(const char *key, unsigned value)
+	{
+		return (*this)(key, (unsigned long)value);
+	}
+
+	record_t &record_t::operator()(const char *key, unsigned long value)
+	{
+		if( field_t *const f = add(key, field_t::UNSIGNED) )
+			f->number = long(value);
+		return *this;
+	}
+
+	record_t &record_t::operator()(const char *key, hex_t value)
+	{
+		if( field_t *const f = add(key, field_t::HEX) )
+		{
+			f->number = long(value.value);
+			f->width = value.width;
+		}
+		return *this;
+	}
+}
@@ -0,0 +1,153 @@
+/*	Filename:	logging.h
+	Leveled, structured diagnostics
+
+	A record is a level, the place it comes from and a few key=value fields,
+	built up the same way as a jobs::event_t:
+
+		QLOG(logging::LEVEL_ERROR, "write_rom")("msg", "Got N")("address", logging::hex(a, 4));
+
+	A record below the threshold is dropped where it's made, before any of
+	its fields are evaluated, so a disabled call site costs one compare.
+	An enabled one copies its fields and the calling thread's job, port and
+	phase into a fixed size entry and puts it on a lock-free queue. A
+	background thread formats the entries as logfmt lines and writes them
+	out, so nothing waits on stderr. If the queue fills up records are
+	dropped and counted, and the count is logged once there's room.
+
+	The threshold starts at warning and can be set with QPROG_LOG=debug,
+	info, warning, error or off.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	LOGGING_H
+#define	LOGGING_H
+
+#include <string>
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+	#define	LOGGING_THREAD	__declspec(thread)
+#else
+	#define	LOGGING_THREAD	__thread
+#endif
+
+//Make a record if level is enabled, the fields are only evaluated if it is
+//	An expression rather than an if so it can't capture a following else
+#define	QLOG(level, site)	!logging::enabled(level) ? (void)0 : logging::voidify_t() & logging::record_t((level), (site))
+
+namespace logging
+{
+	enum level_t
+	{
+		LEVEL_DEBUG,
+		LEVEL_INFO,
+		LEVEL_WARNING,
+		LEVEL_ERROR,
+		LEVEL_OFF
+	};
+
+	enum context_id
+	{
+		CONTEXT_JOB,
+		CONTEXT_PORT,
+		CONTEXT_PHASE,
+		NUM_CONTEXTS
+	};
+
+	enum
+	{
+		MAX_FIELDS = 6,		//Per record, more are ignored
+		TEXT_SIZE = 64		//Longest string field or context value kept, with the terminator
+	};
+
+	extern volatile int	threshold;		//Lowest level that makes a record
+
+	inline bool	enabled(level_t l)	{ return l >= threshold; }
+	void	set_level(level_t);
+	const char	*level_name(level_t);
+	bool	parse_level(const std::string &, level_t &);
+
+	void	set_output(FILE *);		//Where the lines go, stderr by default
+	void	flush();		//Wait until every record made so far has been written
+	unsigned long	dropped();		//Records lost to a full queue
+
+	//Context the calling thread's records carry
+	//	The value is used in place, it has to outlive the setting
+	extern LOGGING_THREAD const char	*context[NUM_CONTEXTS];
+	inline void	set_context(context_id id, const char *value)	{ context[id] = value; }
+
+	//Set a context value until the end of the scope
+	class scope_t
+	{
+		const context_id	id;
+		const char	*const saved;
+		char	text[TEXT_SIZE];
+	public:
+		scope_t(context_id, const char *);
+		scope_t(context_id, const std::string &);		//Copied
+		scope_t(context_id, unsigned);
+		~scope_t()	{ context[id] = saved; }
+	};
+
+	//An integer written in hex, zero padded to width digits
+	struct hex_t
+	{
+		unsigned long	value;
+		int	width;
+		hex_t(unsigned long v, int w) : value(v), width(w) {}
+	};
+	inline hex_t	hex(unsigned long value, int width=0)	{ return hex_t(value, width); }
+
+	struct field_t
+	{
+		enum kind_t { TEXT, SIGNED, UNSIGNED, HEX };
+
+		const char	*key;		//A string literal
+		kind_t	kind;
+		int	width;
+		long	number;
+		char	text[TEXT_SIZE];
+	};
+
+	//Everything a record holds, formatted later by the logging thread
+	struct entry_t
+	{
+		uint64_t	usec;		//Since the epoch
+		level_t	level;
+		const char	*site;		//A string literal
+		char	context[NUM_CONTEXTS][TEXT_SIZE];
+		unsigned	num_fields;
+		field_t	fields[MAX_FIELDS];
+	};
+
+	//One record, queued when it goes out of scope
+	//	Use it through QLOG so a disabled level costs nothing
+	class record_t
+	{
+		entry_t	entry;
+		field_t	*add(const char *key, field_t::kind_t);
+	public:
+		record_t(level_t, const char *site);
+		~record_t();
+
+		record_t	&operator()(const char *key, const char *value);
+		record_t	&operator()(const char *key, const std::string &value)	{ return (*this)(key, value.c_str()); }
+		record_t	&operator()(const char *key, int value);
+		record_t	&operator()(const char *key, long value);
+		record_t	&operator()(const char *key, unsigned value);
+		record_t	&operator()(const char *key, unsigned long value);
+		record_t	&operator()(const char *key, hex_t value);
+	};
+
+	//Turns a record into void for the other side of QLOG's ?:
+	struct voidify_t
+	{
+		void	operator&(const record_t &) {}
+	};
+}
+
+#endif	//LOGGING_H
@@ -16,23 +16,29 @@
 #endif	//Q_OS_DARWIN
 
 #include "../include/delegate.h"
+#include "cli.h"
 #include "mainwindow.h"
 
 Delegate delegate;
 
 int main(int argc, char *argv[])
 {
+	//These need to be set before QSettings is used by either interface
+    QCoreApplication::setOrganizationName("bfoz.net");
+	QCoreApplication::setOrganizationDomain("bfoz.net");
+	QCoreApplication::setApplicationName("QProg");
+
+	//Command line commands don't need a window
+	const int status = cli::run(argc, argv);
+	if( status >= 0 )
+		return status;
+
 	QApplication app(argc, argv);
 
 #ifdef	Q_OS_DARWIN
 	Cocoa::initialize();
 #endif	//Q_OS_DARWIN
 
-	//These need to be set before QProg is constructed
-    QCoreApplication::setOrganizationName("bfoz.net");
-	QCoreApplication::setOrganizationDomain("bfoz.net");
-	QCoreApplication::setApplicationName("QProg");
-
     // Post a startup event to the application delegate
     app.postEvent(&delegate, new QEvent((QEvent::Type)Delegate::Startup), Qt::LowEventPriority);
 
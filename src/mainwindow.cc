@@ -15,6 +15,7 @@
 #include <QMenuBar>
 #include <QMessageBox>
 #include <QSettings>
+#include <QStatusBar>
 #include <QTextStream>
 
 #include "../include/delegate.h"
@@ -26,6 +27,7 @@ MainWindow::MainWindow() : buffer(NULL)
     CentralWidget* central = new CentralWidget();
     central->FillTargetCombo();
     setCentralWidget(central);
+    connect(central, SIGNAL(statusMessage(const QString&, int)), statusBar(), SLOT(showMessage(const QString&, int)));
 	
 	QAction	*updateInfoAct = new QAction(QString("Update"), this);
 	updateInfoAct->setStatusTip(tr("Update the Device Info"));
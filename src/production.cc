@@ -0,0 +1,85 @@
+/*	Filename:	production.cc
+	Per-unit results of a continuous production run
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "production.h"
+
+namespace production
+{
+	void tally_t::clear(unsigned first_number)
+	{
+		first = first_number;
+		units.clear();
+		passed_ = failed_ = 0;
+		total_seconds = 0;
+	}
+
+	unit_t &tally_t::add(unit_t u)
+	{
+		u.number = first + units.size();
+		if( u.passed )
+			++passed_;
+		else
+			++failed_;
+		total_seconds += u.seconds;
+		units.push_back(u);
+		return units.back();
+	}
+
+	std::string tally_t::summary() const
+	{
+		char	s[96];
+		snprintf(s, sizeof(s), "%u passed, %u failed, %.1f s average", passed_, failed_, mean_seconds());
+		return s;
+	}
+
+	bool append(const char *path, const unit_t &u)
+	{
+		struct stat	st;
+		const bool	fresh(stat(path, &st) != 0);
+		FILE	*fp;
+		if( (fp=fopen(path, "a")) == NULL )
+			return false;
+
+		char	date[32];
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&u.date));
+		if( fresh )
+			fprintf(fp, "unit,date,result,seconds,detail\n");
+
+		//Quote the detail, it can hold commas
+		std::string	detail;
+		for(std::string::const_iterator i=u.detail.begin(); i != u.detail.end(); ++i)
+		{
+			if( *i == '"' )
+				detail += '"';
+			detail += (*i == '\n') ? ' ' : *i;
+		}
+		fprintf(fp, "%u,%s,%s,%.2f,\"%s\"\n", u.number, date, u.passed ? "Pass" : "Fail", u.seconds, detail.c_str());
+		return fclose(fp) == 0;
+	}
+
+	unsigned last_unit(const char *path)
+	{
+		FILE	*fp;
+		if( (fp=fopen(path, "r")) == NULL )
+			return 0;
+
+		//The unit number leads every row, the header doesn't have one
+		unsigned	last(0), n;
+		int	c;
+		do
+		{
+			if( (fscanf(fp, "%u", &n) == 1) && (n > last) )
+				last = n;
+			while( ((c = fgetc(fp)) != EOF) && (c != '\n') ) {}
+		} while( c != EOF );
+		fclose(fp);
+		return last;
+	}
+}
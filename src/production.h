@@ -0,0 +1,57 @@
+/*	Filename:	production.h
+	Per-unit results of a continuous production run
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	PRODUCTION_H
+#define	PRODUCTION_H
+
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+namespace production
+{
+	//One programmed part
+	struct unit_t
+	{
+		unsigned	number;		//Position in the log, carries on from the units already in it
+		time_t		date;		//When the part was inserted
+		bool		passed;
+		double		seconds;	//Insertion to done
+		std::string	detail;		//Why it failed, or the verify summary
+
+		unit_t() : number(0), date(0), passed(false), seconds(0) {}
+	};
+
+	//Running totals of a run
+	class tally_t
+	{
+		std::vector<unit_t>	units;
+		unsigned	first;		//Number of the first unit
+		unsigned	passed_, failed_;
+		double		total_seconds;
+	public:
+		tally_t() : first(1), passed_(0), failed_(0), total_seconds(0) {}
+
+		void	clear(unsigned first_number=1);
+		unit_t	&add(unit_t);	//Numbers the unit and counts it
+
+		const std::vector<unit_t>	&all() const	{ return units; }
+		unsigned	count() const	{ return units.size(); }
+		unsigned	passed() const	{ return passed_; }
+		unsigned	failed() const	{ return failed_; }
+		double		mean_seconds() const	{ return units.empty() ? 0 : total_seconds/units.size(); }
+
+		std::string	summary() const;	//"12 passed, 1 failed, 4.2 s average"
+	};
+
+	//Append one unit to a CSV log, writing the header if the file is new
+	bool	append(const char *path, const unit_t &);
+	unsigned	last_unit(const char *path);	//Highest unit number in a CSV log, 0 if there's none
+}
+
+#endif	//PRODUCTION_H
@@ -0,0 +1,302 @@
+/*	Filename:	programmer.cc
+	Programming sequences built on kitsrus_t
+
+	Every sequence powers the chip for each region and turns it off again.
+	A failed transfer leaves the programmer hard reset, so the caller has to
+	put it back in command mode before the next job.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <iostream>
+
+#include <time.h>
+
+#include "checksum.h"
+#include "logging.h"
+#include "programmer.h"
+
+namespace programmer
+{
+	bool reset(kitsrus::kitsrus_t &prog, std::string &error)
+	{
+		if(!prog.hard_reset())		//Tries both DTR polarities itself
+		{
+			error = "Could not reset programmer";
+			return false;
+		}
+
+		//Enter command mode
+		if(!prog.command_mode())
+		{
+			error = "Could not enter Command Mode";
+			return false;
+		}
+		return true;
+	}
+
+	bool init(kitsrus::kitsrus_t &prog, std::string &error)
+	{
+		if( !prog.open() )			//Open the port
+		{
+			error = "Could not open serial port";
+			return false;
+		}
+
+		if( !reset(prog, error) )			//Reset the programmer
+			return false;
+
+		//Check the protocol version
+		std::string protocol = prog.get_protocol();
+
+		if( (protocol != "P018") && (protocol != "P18A") )
+		{
+			error = "Wrong protocol version ( " + protocol + " )";
+			return false;
+		}
+
+		return prog.init_program_vars();	//Initialize programming variables
+	}
+
+	bool erase(kitsrus::kitsrus_t &prog)
+	{
+		prog.chip_power_on();		//Activate programming voltages
+		if( !prog.erase_chip() )	//Erase the chip first
+		{
+			prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+			return false;
+		}
+		prog.chip_power_off();		//Turn the chip off
+		return true;
+	}
+
+	//Use the programmer's blank check, much faster than reading the part back
+	bool blank_check(kitsrus::kitsrus_t &prog, bool &rom, bool &eeprom)
+	{
+		rom = eeprom = true;
+		prog.chip_power_on();		//Activate programming voltages
+		if( !prog.blank_check_rom(rom) || ((prog.get_eeprom_size() != 0) && !prog.blank_check_eeprom(eeprom)) )
+		{
+			prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+			return false;
+		}
+		prog.chip_power_off();		//Turn the chip off
+		return true;
+	}
+
+	bool write_rom(kitsrus::kitsrus_t &prog, imagecache::image_t &image)
+	{
+		const intelhex::hex_data::size_type num_rom_bytes = image.hex.size_below_addr(prog.get_rom_size());
+
+		if( num_rom_bytes > 0 )
+		{
+			prog.chip_power_on();		//Activate programming voltages
+	//		std::cout << "Programming " << num_rom_bytes << " ROM words for " << PartName << std::endl;
+			if( !prog.write_rom(image.chunks) )
+			{
+				QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Error programming ROM");
+				prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+				return false;								// and then bail out
+			}
+			prog.chip_power_off();		//Turn the chip off
+		}
+		else
+			QLOG(logging::LEVEL_INFO, __FUNCTION__)("msg", "No ROM words in file");
+		return true;
+	}
+
+	bool write_config(kitsrus::kitsrus_t &prog, imagecache::image_t &image)
+	{
+		prog.chip_power_on();		//Activate programming voltages
+	//	std::cout << "Programming Config for " << PartName << std::endl;
+		if( !prog.write_config(image.chunks) )
+		{
+			prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+			return false;
+		}
+		prog.chip_power_off();		//Turn the chip off
+		return true;
+	}
+
+	bool write_eeprom(kitsrus::kitsrus_t &prog, imagecache::image_t &image)
+	{
+		const intelhex::hex_data::size_type num_eeprom_bytes = image.hex.size_in_range(prog.get_eeprom_start(), prog.get_eeprom_start() + prog.get_eeprom_size());
+
+		if(num_eeprom_bytes > 0)
+		{
+			prog.chip_power_on();		//Activate programming voltages
+	//		std::cout << "Programming " << num_eeprom_bytes << " EEPROM bytes for " << PartName << std::endl;
+			if( !prog.write_eeprom(image.chunks) )
+			{
+				prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+				return false;
+			}
+			prog.chip_power_off();		//Turn the chip off
+		}
+		else
+			QLOG(logging::LEVEL_INFO, __FUNCTION__)("msg", "No EEPROM bytes in file");
+		return true;
+	}
+
+	//Read the part of the ROM that the ranges need
+	bool read_rom(kitsrus::kitsrus_t &prog, kitsrus::sink_t &sink, const intelhex::ranges_t &ranges)
+	{
+		prog.chip_power_on();		//Activate programming voltages
+		if( !prog.read_rom(sink, ranges) )	//Read ROM
+		{
+			prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+			return false;
+		}
+		prog.chip_power_off();	//Turn the chip off
+		return true;
+	}
+
+	bool read_config(kitsrus::kitsrus_t &prog, kitsrus::sink_t &sink)
+	{
+		prog.chip_power_on();			//Activate programming voltages
+		if( !prog.read_config(sink) )	//Read Config
+		{
+			prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+			return false;
+		}
+		prog.chip_power_off();		//Turn the chip off
+		return true;
+	}
+
+	//Read the part of the EEPROM that the ranges need
+	bool read_eeprom(kitsrus::kitsrus_t &prog, kitsrus::sink_t &sink, const intelhex::ranges_t &ranges)
+	{
+		prog.chip_power_on();		//Activate programming voltages
+		if( !prog.read_eeprom(sink, ranges) )	//Read EEPROM
+		{
+			prog.hard_reset();		//Do a hard reset to clear the error and turn power off
+			return false;
+		}
+		prog.chip_power_off();		//Turn the chip off
+		return true;
+	}
+
+	//Tell the observer which step is starting, and tag the thread's log records with it
+	static void phase(observer_t *observer, const char *name)
+	{
+		logging::set_context(logging::CONTEXT_PHASE, name);
+		if( observer )
+			observer->phase(name);
+	}
+
+	//Handle the actual write sequence
+	bool write_all(kitsrus::kitsrus_t& prog, imagecache::image_t &image, bool erase_first, observer_t *observer)
+	{
+		logging::scope_t	step(logging::CONTEXT_PHASE, "");	//No step once the sequence is done
+
+		//If erase before programming...
+		if( erase_first && !erase(prog) )
+			return false;
+
+		//Do the programming sequence
+		//	For some reason config has to be written first or the programmer locks up
+		phase(observer, "Writing Config");
+		if( !write_config(prog, image) )
+			return false;
+
+		phase(observer, "Writing EEPROM");
+		if( !write_eeprom(prog, image) )
+			return false;
+
+		phase(observer, "Writing ROM");
+		if( !write_rom(prog, image) )					//Write the ROM words
+			return false;
+
+		return true;
+	}
+
+	//Handle the actual read sequence
+	//	Only the parts of ROM and EEPROM covered by the ranges are read
+	bool read_all(kitsrus::kitsrus_t& prog, kitsrus::sink_t &sink, observer_t *observer, const intelhex::ranges_t &ranges)
+	{
+		logging::scope_t	step(logging::CONTEXT_PHASE, "");
+
+		//		std::cout << "Reading " << prog.get_rom_size() << " ROM words\n";
+		phase(observer, "Reading ROM");
+		if( !read_rom(prog, sink, ranges) )
+			return false;
+
+		phase(observer, "Reading Config");
+		if( !read_config(prog, sink) )
+			return false;
+
+		//		std::cout << "Reading " << prog.get_eeprom_size() << " EEPROM bytes\n";
+		phase(observer, "Reading EEPROM");
+		if( !read_eeprom(prog, sink, ranges) )
+			return false;
+
+		return true;
+	}
+
+	//Ranges that cover the whole chip
+	const intelhex::ranges_t &everything()
+	{
+		static const intelhex::ranges_t	all(1, intelhex::range_t(0, ~intelhex::hex_data::address_t(0)));
+		return all;
+	}
+
+	//Read the chip straight into an Intel HEX stream
+	//	Records are written as the words arrive so nothing is held in memory
+	bool read_file(kitsrus::kitsrus_t& prog, std::ostream &os, observer_t *observer, const intelhex::ranges_t &ranges)
+	{
+		intelhex::writer_t	writer(os);
+		kitsrus::writer_sink_t	sink(writer);
+		return read_all(prog, sink, observer, ranges) && writer.finish();
+	}
+
+	//Number of words of a region to compare after a streaming readback
+	//	A region that was cut short by the image's ranges is still complete,
+	//	only a stop at a mismatch leaves the rest of it unknown
+	static size_t received(const verify::engine_t &engine, const verify::stream_t &stream, verify::region_id r)
+	{
+		return stream.stopped() ? stream.received(r) : engine.region(r).size();
+	}
+
+	bool verify(kitsrus::kitsrus_t& prog, intelhex::hex_data &HexData, chipinfo::chipinfo &chip_info, observer_t *observer, verify::report_t &report, bool fail_fast)
+	{
+		verify::engine_t	engine(chip_info);
+		engine.set_expected(HexData);
+		report.chip = chip_info.name;
+		report.date = time(NULL);
+
+		checksum::image_t	sums(chip_info);
+		sums.set(HexData);
+		report.checksum = sums.mplab();
+		report.crc = sums.crc();
+		report.checksummed = true;
+
+		//Only read as far as the image goes, words past its end aren't compared anyway
+		const intelhex::ranges_t	ranges(intelhex::populated_ranges(HexData));
+
+		verify::stream_t	stream(engine, fail_fast);
+		logging::scope_t	step(logging::CONTEXT_PHASE, "");
+
+		phase(observer, "Reading ROM");
+		if( !read_rom(prog, stream, ranges) )
+			return false;
+		engine.report(verify::REGION_ROM, report, received(engine, stream, verify::REGION_ROM));
+		if( stream.stopped() )
+			return true;
+
+		//The config read also returns the ID words
+		phase(observer, "Reading Config");
+		if( !read_config(prog, stream) )
+			return false;
+		engine.report(verify::REGION_ID, report, received(engine, stream, verify::REGION_ID));
+		engine.report(verify::REGION_CONFIG, report, received(engine, stream, verify::REGION_CONFIG));
+		if( stream.stopped() )
+			return true;
+
+		phase(observer, "Reading EEPROM");
+		if( !read_eeprom(prog, stream, ranges) )
+			return false;
+		engine.report(verify::REGION_EEPROM, report, received(engine, stream, verify::REGION_EEPROM));
+		return true;
+	}
+}
@@ -0,0 +1,60 @@
+/*	Filename:	programmer.h
+	Programming sequences built on kitsrus_t
+	Shared by the GUI, the command line and qprogd, so nothing in here
+	touches a window. Failures are returned, callers decide how to report them.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	PROGRAMMER_H
+#define	PROGRAMMER_H
+
+#include <ostream>
+#include <string>
+
+#include "chipinfo.h"
+#include "imagecache.h"
+#include "intelhex.h"
+#include "kitsrus.h"
+#include "verify.h"
+
+namespace programmer
+{
+	//Told about each step of a job, e.g. to label a progress dialog
+	class observer_t
+	{
+	public:
+		virtual ~observer_t() {}
+		virtual void	phase(const char *) = 0;
+	};
+
+	//Open the port, reset the programmer and check its protocol
+	//	error says what went wrong when false is returned
+	bool	init(kitsrus::kitsrus_t &, std::string &error);
+	bool	reset(kitsrus::kitsrus_t &, std::string &error);	//Hard reset and command mode
+
+	bool	erase(kitsrus::kitsrus_t &);
+	bool	blank_check(kitsrus::kitsrus_t &, bool &rom, bool &eeprom);
+
+	bool	write_rom(kitsrus::kitsrus_t &, imagecache::image_t &);
+	bool	write_config(kitsrus::kitsrus_t &, imagecache::image_t &);
+	bool	write_eeprom(kitsrus::kitsrus_t &, imagecache::image_t &);
+	bool	write_all(kitsrus::kitsrus_t &, imagecache::image_t &, bool erase_first, observer_t *);
+
+	//Only the parts of ROM and EEPROM covered by the ranges are read
+	bool	read_rom(kitsrus::kitsrus_t &, kitsrus::sink_t &, const intelhex::ranges_t &);
+	bool	read_config(kitsrus::kitsrus_t &, kitsrus::sink_t &);
+	bool	read_eeprom(kitsrus::kitsrus_t &, kitsrus::sink_t &, const intelhex::ranges_t &);
+	bool	read_all(kitsrus::kitsrus_t &, kitsrus::sink_t &, observer_t *, const intelhex::ranges_t &);
+	bool	read_file(kitsrus::kitsrus_t &, std::ostream &, observer_t *, const intelhex::ranges_t &);
+	const intelhex::ranges_t	&everything();		//Ranges that cover the whole chip
+
+	//Read back the chip a region at a time, comparing each word as it arrives
+	//	If fail_fast is set the readback stops at the first mismatched word
+	//	and the remaining regions aren't read
+	//	Returns false if the chip couldn't be read
+	bool	verify(kitsrus::kitsrus_t &, intelhex::hex_data &, chipinfo::chipinfo &, observer_t *, verify::report_t &, bool fail_fast);
+}
+
+#endif	//PROGRAMMER_H
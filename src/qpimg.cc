@@ -0,0 +1,282 @@
+/*	Filename:	qpimg.cc
+	Native binary image container (.qpimg)
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef	_WIN32
+#include <stdlib.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "checksum.h"
+#include "logging.h"
+#include "qpimg.h"
+
+namespace qpimg
+{
+	static const uint8_t	magic[8] = {'Q', 'P', 'I', 'M', 'G', '\r', '\n', 0x1A};
+
+	//Little-endian field access
+	static uint16_t	get16(const uint8_t *p)	{ return p[0] | (p[1] << 8); }
+	static uint32_t	get32(const uint8_t *p)	{ return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+	static void	put16(uint8_t *p, uint16_t a)	{ p[0] = a; p[1] = a >> 8; }
+	static void	put32(uint8_t *p, uint32_t a)	{ p[0] = a; p[1] = a >> 8; p[2] = a >> 16; p[3] = a >> 24; }
+
+	using	checksum::crc32;		//Standard (zlib) CRC-32
+
+#ifndef	O_BINARY
+	#define	O_BINARY	0		//Only Windows has a text mode
+#endif
+
+	bool file_t::open(const char *path)
+	{
+		close();
+
+		int	fd;
+		struct stat	st;
+		if( (fd = ::open(path, O_RDONLY | O_BINARY)) < 0 )
+			return false;
+		if( (fstat(fd, &st) != 0) || (st.st_size < QPIMG_HEADER_SIZE) )
+		{
+			::close(fd);
+			return false;
+		}
+		length = st.st_size;
+
+#ifdef	_WIN32
+		//No mmap(2), read the whole thing instead
+		uint8_t	*p = static_cast<uint8_t*>(malloc(length));
+		if( p && (::read(fd, p, length) != (int)length) )
+		{
+			free(p);
+			p = NULL;
+		}
+		::close(fd);
+		if( !p )
+			return false;
+#else
+		void	*p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);		//The mapping keeps the file open
+		if( p == MAP_FAILED )
+			return false;
+#endif
+		base = static_cast<const uint8_t*>(p);
+
+		//Check the header and make sure the range table and payloads are inside the file
+		bool ok = (memcmp(base, magic, sizeof(magic)) == 0) && (get16(base+8) == QPIMG_VERSION) && (get16(base+10) == QPIMG_HEADER_SIZE);
+		ok = ok && (crc32(base, 56) == get32(base+56));
+		count = get32(base+12);
+		ok = ok && (count <= (length - QPIMG_HEADER_SIZE)/QPIMG_RANGE_SIZE);
+		for(uint32_t i=0; ok && (i < count); ++i)
+		{
+			const range_t r = range(i);
+			ok = (r.offset % QPIMG_ALIGN == 0) && (r.offset <= length) && (r.words <= (length - r.offset)/2);
+		}
+		if( !ok )
+		{
+			close();
+			return false;
+		}
+
+		core = base[20];
+		chip_name.assign(reinterpret_cast<const char*>(base+24), strnlen(reinterpret_cast<const char*>(base+24), 24));
+		return true;
+	}
+
+	void file_t::close()
+	{
+		if( base )
+		{
+#ifdef	_WIN32
+			free(const_cast<uint8_t*>(base));
+#else
+			munmap(const_cast<uint8_t*>(base), length);
+#endif
+		}
+		base = NULL;
+		length = 0;
+		count = 0;
+		core = QPIMG_CORE_UNKNOWN;
+		chip_name.clear();
+	}
+
+	range_t file_t::range(size_t i) const
+	{
+		const uint8_t	*p = base + QPIMG_HEADER_SIZE + i*QPIMG_RANGE_SIZE;
+		range_t	r;
+		r.address = get32(p);
+		r.words = get32(p+4);
+		r.offset = get32(p+8);
+		r.crc = get32(p+12);
+		return r;
+	}
+
+	//Check the table and payload CRCs
+	//	Not done by open() because it touches every page of the file, load() does it
+	bool file_t::verify() const
+	{
+		if( !base )
+			return false;
+		if( crc32(base + QPIMG_HEADER_SIZE, count*QPIMG_RANGE_SIZE) != get32(base+52) )
+			return false;
+
+		uint32_t	crc(0);
+		for(size_t i=0; i < count; ++i)
+		{
+			const range_t	r = range(i);
+			if( crc32(base + r.offset, 2*r.words) != r.crc )
+				return false;
+			crc = checksum::crc32_combine(crc, r.crc, 2*r.words);
+		}
+		return crc == get32(base+48);
+	}
+
+	//Copy every range into a block of a hex_data
+	void file_t::to_hex_data(intelhex::hex_data &HexData) const
+	{
+		HexData.clear();
+		for(size_t i=0; i < count; ++i)
+		{
+			const range_t	r = range(i);
+			intelhex::hex_data::dblock	*db = HexData.add_block(r.address, r.words);
+			const uint8_t	*p = base + r.offset;
+			for(uint32_t j=0; j < r.words; ++j, p+=2)
+				db->second[j] = get16(p);
+		}
+	}
+
+	bool is_qpimg(const char *path)
+	{
+		FILE	*fp;
+		uint8_t	buffer[sizeof(magic)];
+		if( (fp=fopen(path, "rb")) == NULL )
+			return false;
+		const bool ok = (fread(buffer, 1, sizeof(buffer), fp) == sizeof(buffer)) && (memcmp(buffer, magic, sizeof(magic)) == 0);
+		fclose(fp);
+		return ok;
+	}
+
+	bool load(const char *path, intelhex::hex_data &HexData)
+	{
+		file_t	file;
+		if( !file.open(path) )
+			return false;
+		if( !file.verify() )		//A truncated or damaged image mustn't get programmed
+		{
+			QLOG(logging::LEVEL_ERROR, __FUNCTION__)("msg", "Bad CRC")("path", path);
+			return false;
+		}
+		file.to_hex_data(HexData);
+		return true;
+	}
+
+	static bool by_address(const intelhex::hex_data::dblock *a, const intelhex::hex_data::dblock *b)
+	{
+		return a->first < b->first;
+	}
+
+	//Write a hex_data as a .qpimg
+	//	Blocks that are adjacent in memory are merged into a single range
+	bool write(const char *path, intelhex::hex_data &HexData, const std::string &chip, uint8_t core_type)
+	{
+		std::vector<const intelhex::hex_data::dblock*>	blocks;
+		for(intelhex::hex_data::iterator i = HexData.begin(); i != HexData.end(); ++i)
+			if( !i->second.empty() )
+				blocks.push_back(&*i);
+		std::stable_sort(blocks.begin(), blocks.end(), by_address);
+
+		//Lay out the payloads, merging adjacent blocks
+		std::vector<range_t>	ranges;
+		std::vector<size_t>	owner(blocks.size());	//Range that each block was merged into
+		uint32_t	offset(QPIMG_HEADER_SIZE);
+		for(size_t i=0; i < blocks.size(); ++i)
+		{
+			const intelhex::hex_data::dblock	*b = blocks[i];
+			if( ranges.empty() || (ranges.back().address + ranges.back().words != b->first) )
+			{
+				range_t	r;
+				r.address = b->first;
+				r.words = 0;
+				r.offset = 0;
+				r.crc = 0;
+				ranges.push_back(r);
+			}
+			ranges.back().words += b->second.size();
+			owner[i] = ranges.size() - 1;
+		}
+		offset += ranges.size()*QPIMG_RANGE_SIZE;
+		for(size_t i=0; i < ranges.size(); ++i)
+		{
+			offset = (offset + QPIMG_ALIGN - 1) & ~(QPIMG_ALIGN - 1);
+			ranges[i].offset = offset;
+			offset += 2*ranges[i].words;
+		}
+
+		std::vector<uint8_t>	image(offset, 0);
+		uint8_t	*p = &image[0];
+		for(size_t i=0; i < blocks.size(); ++i)
+		{
+			const range_t	&r = ranges[owner[i]];
+			uint8_t	*q = p + r.offset + 2*(blocks[i]->first - r.address);
+			for(size_t k=0; k < blocks[i]->second.size(); ++k, q+=2)
+				put16(q, blocks[i]->second[k]);
+		}
+
+		uint32_t	crc(0);
+		for(size_t i=0; i < ranges.size(); ++i)
+		{
+			ranges[i].crc = crc32(p + ranges[i].offset, 2*ranges[i].words);
+			crc = crc32(p + ranges[i].offset, 2*ranges[i].words, crc);
+
+			uint8_t	*t = p + QPIMG_HEADER_SIZE + i*QPIMG_RANGE_SIZE;
+			put32(t, ranges[i].address);
+			put32(t+4, ranges[i].words);
+			put32(t+8, ranges[i].offset);
+			put32(t+12, ranges[i].crc);
+		}
+
+		memcpy(p, magic, sizeof(magic));
+		put16(p+8, QPIMG_VERSION);
+		put16(p+10, QPIMG_HEADER_SIZE);
+		put32(p+12, ranges.size());
+		put32(p+16, 0);
+		p[20] = core_type;
+		strncpy(reinterpret_cast<char*>(p+24), chip.c_str(), 24);
+		put32(p+48, crc);
+		put32(p+52, crc32(p + QPIMG_HEADER_SIZE, ranges.size()*QPIMG_RANGE_SIZE));
+		put32(p+56, crc32(p, 56));
+
+		//Write to a temporary file and rename it so readers never see a partial image
+		const std::string	tmp(std::string(path) + ".tmp");
+		FILE	*fp;
+		if( (fp=fopen(tmp.c_str(), "wb")) == NULL )
+			return false;
+		bool ok = fwrite(p, 1, image.size(), fp) == image.size();
+		ok = (fclose(fp) == 0) && ok;
+		//rename() won't replace an existing file on Windows
+#ifdef	_WIN32
+		ok = ok && MoveFileExA(tmp.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+#else
+		ok = ok && (rename(tmp.c_str(), path) == 0);
+#endif
+		if( !ok )
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+}
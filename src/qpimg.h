@@ -0,0 +1,93 @@
+/*	Filename:	qpimg.h
+	Native binary image container (.qpimg)
+
+	A .qpimg file is a 64 byte header, a table of contiguous address ranges
+	and the raw little-endian words of each range, each payload starting on
+	a 64 byte boundary so that a mapped file can be used in place.
+
+	Header (all fields little-endian)
+	  0	magic		"QPIMG\r\n\x1A"
+	  8	version		uint16
+	 10	header size	uint16 (64)
+	 12	range count	uint32
+	 16	flags		uint32 (reserved, 0)
+	 20	core type	uint8, 3 bytes padding
+	 24	chip name	24 bytes, NUL padded
+	 48	payload CRC	CRC-32 of all payloads in range order
+	 52	table CRC	CRC-32 of the range table
+	 56	header CRC	CRC-32 of header bytes 0-55
+	 60	reserved	uint32
+	Range table entry (16 bytes)
+	  0	word address, word count, payload offset from the start of the file, payload CRC-32
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	QPIMG_H
+#define	QPIMG_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include "intelhex.h"
+
+namespace qpimg
+{
+	#define	QPIMG_VERSION		1
+	#define	QPIMG_HEADER_SIZE	64
+	#define	QPIMG_RANGE_SIZE	16
+	#define	QPIMG_ALIGN			64
+	#define	QPIMG_CORE_UNKNOWN	0xFF
+
+	struct range_t
+	{
+		uint32_t	address;	//Word address of the first word
+		uint32_t	words;		//Number of words
+		uint32_t	offset;		//Byte offset of the payload from the start of the file
+		uint32_t	crc;		//CRC-32 of the payload bytes
+	};
+
+	//A read-only view of a .qpimg file
+	//	The file is mapped and the header is checked, nothing else is read until it's used
+	class file_t
+	{
+		const uint8_t	*base;		//Start of the mapped file
+		size_t	length;
+		std::string	chip_name;
+		uint8_t	core;
+		uint32_t	count;
+
+		file_t(const file_t&);	//No copy
+	public:
+		file_t() : base(NULL), length(0), core(QPIMG_CORE_UNKNOWN), count(0) {}
+		~file_t()	{ close(); }
+
+		bool	open(const char *);
+		void	close();
+		bool	is_open() const	{ return base != NULL; }
+
+		const std::string	&chip() const	{ return chip_name; }
+		uint8_t	core_type() const	{ return core; }
+		size_t	num_ranges() const	{ return count; }
+		range_t	range(size_t) const;
+
+		//Little-endian payload of a range, aligned to QPIMG_ALIGN
+		const uint8_t	*payload(size_t i) const	{ return base + range(i).offset; }
+		uint16_t	word(size_t i, size_t j) const
+		{
+			const uint8_t *p = payload(i) + 2*j;
+			return p[0] | (p[1] << 8);
+		}
+
+		bool	verify() const;		//Check every CRC
+		void	to_hex_data(intelhex::hex_data &) const;
+	};
+
+	bool	is_qpimg(const char *);			//Check the magic of a file on disk
+	bool	load(const char *, intelhex::hex_data &);		//False if a CRC doesn't match
+	bool	write(const char *, intelhex::hex_data &, const std::string &chip, uint8_t core_type);
+}
+
+#endif	//QPIMG_H
@@ -0,0 +1,795 @@
+/*	Filename:	qprogbench_main.cc
+	Main file for qprogbench, benchmarks of the host side of programming
+
+	qprogbench [--filter <text>] [--samples <n>] [--min-time <ms>] [--baud <rate>]
+		[--library <chipinfo.cid>] [--fleet <n>] [--tag <text>]
+
+		Times Intel HEX parsing and access, checksums, chipinfo parsing over a
+		device library, log records and whole program/read/verify cycles
+		against a simulated programmer on a pty. --baud paces the simulated
+		link, the default is as fast as the pty goes, which leaves only the
+		host side overhead. port_open opens and closes the pty through
+		Posix_QextSerialPort, set up the way kitsrus_t sets up a programmer's.
+		Without --library a made up library of the same shape is used.
+		The kitsrus_fleet cases read --fleet simulated programmers at once
+		from one thread with kitasync, the kitsrus_threads cases read as many
+		with a blocking kitsrus_t each on its own thread, once with the ports
+		on read() and select() and once with them on io_uring. The other
+		cases use whichever the ports default to, io_uring where the kernel
+		has it.
+
+		Every result is printed as one JSON object per line on stdout,
+		--tag is copied into each of them to tell runs apart.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "checksum.h"
+#include "chipinfo.h"
+#include "imagecache.h"
+#include "intelhex.h"
+#include "kitasync.h"
+#include "kitsim.h"
+#include "kitsrus.h"
+#include "logging.h"
+#include "posix_qextserialport.h"
+#include "programmer.h"
+
+typedef	std::vector<std::pair<std::string, std::string> >	keys_t;
+typedef	std::vector<keys_t>	library_t;
+
+typedef	intelhex::hex_data::address_t	address_t;
+
+#define	SMALL_ROM_WORDS	2048		//A 16F628A
+#define	LARGE_ROM_WORDS	65536		//A 128KB 18F
+#define	FRAGMENTS	4096			//Records of the fragmented image
+#define	FRAGMENT_STRIDE	8			//Words from one fragment to the next, two of them are set
+#define	SYNTHETIC_DEVICES	512
+
+//Every chip of the made up library is a variation on this one, it's also the chip on the pty
+static const char *const part_keys[][2] =
+{
+	{"CHIPname", "16F628A"}, {"INCLUDE", "Y"}, {"SocketImage", "18pin"}, {"EraseMode", "4"},
+	{"FlashChip", "Y"}, {"PowerSequence", "VccVpp1"}, {"ProgramDelay", "10"}, {"ProgramTries", "1"},
+	{"OverProgram", "0"}, {"CoreType", "bit14_B"}, {"NumROMWords", "2048"}, {"NumEEPROMBytes", "128"},
+	{"NumConfigWords", "1"}, {"FUSEblank", "3FFF"}, {"CPwarn", "N"}, {"CALword", "N"},
+	{"BandGap", "N"}, {"ICSPonly", "N"}, {"ChipID", "1060"}, {"ConfigWordDescriptions0", "FOSC"},
+	{"FastPowerSequence", "0"}, {"Status", "Y"}
+};
+#define	NUM_PART_KEYS	(sizeof(part_keys)/sizeof(part_keys[0]))
+
+static const char *const core_names[] = {"bit12_A", "bit12_B", "bit14_A", "bit14_B", "bit14_C", "bit14_D", "bit14_E", "bit14_F", "bit14_G", "bit14_H", "bit16_A", "bit16_B", "bit16_C"};
+
+static void usage()
+{
+	std::cerr << "Usage: qprogbench [--filter <text>] [--samples <n>] [--min-time <ms>] [--baud <rate>] [--library <chipinfo.cid>] [--fleet <n>] [--tag <text>]\n";
+}
+
+//Deterministic filler so every run times the same data
+static uint32_t next_random(uint32_t &state)
+{
+	state = state*1103515245 + 12345;
+	return state >> 8;
+}
+
+static void fill(intelhex::hex_data &hex, address_t begin, size_t n, uint16_t mask, uint32_t &state)
+{
+	intelhex::hex_data::dblock	*b(hex.add_block(begin, n));
+	for(size_t i=0; i < n; ++i)
+		b->second[i] = next_random(state) & mask;
+}
+
+static void make_images(intelhex::hex_data &small, intelhex::hex_data &large, intelhex::hex_data &fragmented)
+{
+	uint32_t	state(1);
+	fill(small, 0, SMALL_ROM_WORDS, BLANK_14BIT, state);
+	fill(small, CONFIG_START_14BIT, 1, BLANK_14BIT, state);
+	fill(small, EEPROM_START_14BIT, 128, 0xFF, state);
+
+	fill(large, 0, LARGE_ROM_WORDS, BLANK_16BIT, state);
+	fill(large, CONFIG_START_16BIT, 7, BLANK_16BIT, state);
+
+	for(address_t i=0; i < FRAGMENTS; ++i)
+		fill(fragmented, i*FRAGMENT_STRIDE, 2, BLANK_14BIT, state);
+}
+
+static chipinfo::chipinfo bench_part()
+{
+	chipinfo::chipinfo	info;
+	for(size_t i=0; i < NUM_PART_KEYS; ++i)
+		info.set(part_keys[i][0], part_keys[i][1]);
+	return info;
+}
+
+static void synthetic_library(library_t &library)
+{
+	for(unsigned d=0; d < SYNTHETIC_DEVICES; ++d)
+	{
+		keys_t	keys;
+		for(size_t i=0; i < NUM_PART_KEYS; ++i)
+			keys.push_back(keys_t::value_type(part_keys[i][0], part_keys[i][1]));
+		std::ostringstream	name, id;
+		name << "BENCH" << d;
+		id << std::hex << (0x1000 + 0x20*d);
+		keys[0].second = name.str();
+		keys[9].second = core_names[d % (sizeof(core_names)/sizeof(core_names[0]))];
+		keys[18].second = id.str();
+		library.push_back(keys);
+	}
+}
+
+//Read a chipinfo.cid, each chip starts at its CHIPname line
+//	Keys chipinfo doesn't know are dropped, so the timing isn't spent printing warnings
+static bool load_library(const char *path, library_t &library)
+{
+	std::ifstream	in(path);
+	if( !in )
+		return false;
+
+	std::ostringstream	discard;
+	std::streambuf	*const saved(std::cout.rdbuf(discard.rdbuf()));
+	chipinfo::chipinfo	scratch;
+	std::string	line;
+	while( std::getline(in, line) )
+	{
+		if( !line.empty() && (line[line.size()-1] == '\r') )
+			line.erase(line.size()-1);
+		const size_t	eq(line.find('='));
+		if( (eq == std::string::npos) || (eq == 0) || (eq+1 == line.size()) )
+			continue;
+		const std::string	key(line.substr(0, eq)), value(line.substr(eq+1));
+		if( key == "CHIPname" )
+			library.push_back(keys_t());
+		if( library.empty() || !scratch.set(key, value) )
+			continue;
+		library.back().push_back(keys_t::value_type(key, value));
+	}
+	std::cout.rdbuf(saved);
+	return !library.empty();
+}
+
+class load_case : public bench::case_t
+{
+	const std::string	path;
+public:
+	load_case(const std::string &p) : path(p) {}
+	bool	run()
+	{
+		intelhex::hex_data	hex;
+		return hex.load(path) && (hex.begin() != hex.end());
+	}
+};
+
+class write_case : public bench::case_t
+{
+	const intelhex::hex_data	&hex;
+	std::ostringstream	os;
+public:
+	write_case(const intelhex::hex_data &h) : hex(h) {}
+	bool	run()
+	{
+		os.str(std::string());
+		return hex.write(os);
+	}
+};
+
+class get_case : public bench::case_t
+{
+	intelhex::hex_data	&hex;
+	const address_t	begin, end;
+	volatile uint32_t	sum;
+public:
+	get_case(intelhex::hex_data &h, address_t b, address_t e) : hex(h), begin(b), end(e), sum(0) {}
+	bool	run()
+	{
+		uint32_t	s(0);
+		for(address_t a=begin; a < end; ++a)
+			s += hex.get(a, 0xFFFF);
+		sum = s;
+		return true;
+	}
+};
+
+//Words stored one at a time the way read_rom() hands them to a hex_sink_t,
+//	into an empty image or over the words of an existing one
+class fill_case : public bench::case_t
+{
+	intelhex::hex_data	*const into;
+	const address_t	begin, end;
+public:
+	fill_case(intelhex::hex_data *h, address_t b, address_t e) : into(h), begin(b), end(e) {}
+	bool	run()
+	{
+		intelhex::hex_data	fresh;
+		kitsrus::hex_sink_t	sink(into ? *into : fresh);
+		for(address_t a=begin; a < end; ++a)
+			sink.put(a, a & BLANK_14BIT);
+		return true;
+	}
+};
+
+class size_below_case : public bench::case_t
+{
+	intelhex::hex_data	&hex;
+	const address_t	limit;
+	volatile size_t	size;
+public:
+	size_below_case(intelhex::hex_data &h, address_t l) : hex(h), limit(l), size(0) {}
+	bool	run()
+	{
+		size = hex.size_below_addr(limit);
+		return true;
+	}
+};
+
+class size_in_range_case : public bench::case_t
+{
+	intelhex::hex_data	&hex;
+	const address_t	begin, end;
+	volatile size_t	size;
+public:
+	size_in_range_case(intelhex::hex_data &h, address_t b, address_t e) : hex(h), begin(b), end(e), size(0) {}
+	bool	run()
+	{
+		size = hex.size_in_range(begin, end);
+		return true;
+	}
+};
+
+class compare_case : public bench::case_t
+{
+	intelhex::hex_data	&a, &b;
+	const intelhex::hex_data::element_t	mask;
+	const address_t	end;
+public:
+	compare_case(intelhex::hex_data &x, intelhex::hex_data &y, intelhex::hex_data::element_t m, address_t e) : a(x), b(y), mask(m), end(e) {}
+	bool	run()
+	{
+		return intelhex::compare(a, b, mask, 0, end);
+	}
+};
+
+class crc_case : public bench::case_t
+{
+	uint32_t	(*const crc)(const uint8_t *, size_t, uint32_t);
+	const std::vector<uint8_t>	&data;
+	volatile uint32_t	result;
+public:
+	crc_case(uint32_t (*f)(const uint8_t *, size_t, uint32_t), const std::vector<uint8_t> &d) : crc(f), data(d), result(0) {}
+	bool	run()
+	{
+		result = crc(&data[0], data.size(), 0);
+		return true;
+	}
+};
+
+class checksum_case : public bench::case_t
+{
+	checksum::image_t	&sums;
+	intelhex::hex_data	&hex;
+	volatile uint32_t	result;
+public:
+	checksum_case(checksum::image_t &s, intelhex::hex_data &h) : sums(s), hex(h), result(0) {}
+	bool	run()
+	{
+		sums.set(hex);
+		result = sums.crc() + sums.mplab();
+		return true;
+	}
+};
+
+//Patch one word and read the checksums back, as incremental programming would
+class checksum_patch_case : public bench::case_t
+{
+	checksum::image_t	&sums;
+	const address_t	words;
+	uint32_t	state;
+	volatile uint32_t	result;
+public:
+	checksum_patch_case(checksum::image_t &s, address_t n) : sums(s), words(n), state(1), result(0) {}
+	bool	run()
+	{
+		const uint32_t	r(next_random(state));
+		sums.patch(r % words, r >> 16);
+		result = sums.crc() + sums.mplab();
+		return true;
+	}
+};
+
+//A record below the threshold, all it should cost is the compare
+class log_disabled_case : public bench::case_t
+{
+	unsigned	n;
+public:
+	log_disabled_case() : n(0) {}
+	bool	run()
+	{
+		QLOG(logging::LEVEL_DEBUG, "bench")("msg", "Disabled")("n", n)("word", logging::hex(n, 4));
+		++n;
+		return true;
+	}
+};
+
+//A burst of records made, formatted and written out
+class log_burst_case : public bench::case_t
+{
+	const unsigned	burst;
+	unsigned	n;
+public:
+	log_burst_case(unsigned b) : burst(b), n(0) {}
+	bool	run()
+	{
+		const unsigned long	dropped(logging::dropped());
+		for(unsigned i=0; i < burst; ++i, ++n)
+			QLOG(logging::LEVEL_ERROR, "bench")("msg", "Enabled")("n", n)("word", logging::hex(n, 4));
+		logging::flush();
+		return logging::dropped() == dropped;
+	}
+};
+
+class chipinfo_case : public bench::case_t
+{
+	const library_t	&library;
+public:
+	chipinfo_case(const library_t &l) : library(l) {}
+	bool	run()
+	{
+		for(library_t::const_iterator i=library.begin(); i != library.end(); ++i)
+		{
+			chipinfo::chipinfo	info;
+			for(keys_t::const_iterator j=i->begin(); j != i->end(); ++j)
+				info.set(j->first, j->second);
+		}
+		return true;
+	}
+};
+
+class program_case : public bench::case_t
+{
+	kitsrus::kitsrus_t	&prog;
+	imagecache::image_t	&image;
+public:
+	program_case(kitsrus::kitsrus_t &p, imagecache::image_t &i) : prog(p), image(i) {}
+	bool	run()	{ return programmer::write_all(prog, image, true, NULL); }
+};
+
+//Open and close the port, set up the way kitsrus_t sets up a programmer's
+class port_open_case : public bench::case_t
+{
+	Posix_QextSerialPort	com;
+public:
+	port_open_case(const QString &port) : com(port)
+	{
+		const PortSettings	settings = {BAUD19200, DATA_8, PAR_NONE, STOP_1, FLOW_OFF, 0, 0};
+		com.setPortSettings(settings);
+		com.setExclusive(true);
+		com.setLowLatency(true);
+	}
+	bool	run()
+	{
+		if( !com.open(QIODevice::ReadWrite) )
+			return false;
+		com.close();
+		return true;
+	}
+};
+
+class read_case : public bench::case_t
+{
+	kitsrus::kitsrus_t	&prog;
+public:
+	read_case(kitsrus::kitsrus_t &p) : prog(p) {}
+	bool	run()
+	{
+		intelhex::hex_data	hex;
+		kitsrus::hex_sink_t	sink(hex);
+		return programmer::read_all(prog, sink, NULL, programmer::everything());
+	}
+};
+
+class verify_case : public bench::case_t
+{
+	kitsrus::kitsrus_t	&prog;
+	intelhex::hex_data	&hex;
+	chipinfo::chipinfo	&info;
+public:
+	verify_case(kitsrus::kitsrus_t &p, intelhex::hex_data &h, chipinfo::chipinfo &c) : prog(p), hex(h), info(c) {}
+	bool	run()
+	{
+		verify::report_t	report;
+		return programmer::verify(prog, hex, info, NULL, report, false) && report.passed();
+	}
+};
+
+//Reads every programmer of a fleet at once, from this thread
+class fleet_case : public bench::case_t, public kitasync::listener_t
+{
+	std::vector<kitasync::session_t*>	&sessions;
+	unsigned	failures;
+public:
+	fleet_case(std::vector<kitasync::session_t*> &s) : sessions(s), failures(0) {}
+	void	finished(kitasync::session_t &, reactor::status_t s)
+	{
+		if( s != reactor::DONE )
+			++failures;
+	}
+	bool	run()
+	{
+		std::vector<intelhex::hex_data>	hex(sessions.size());
+		std::vector<kitsrus::hex_sink_t>	sinks;
+		std::vector<kitasync::read_job_t>	jobs;
+		sinks.reserve(sessions.size());
+		jobs.reserve(sessions.size());
+		reactor::executor_t	executor;
+		failures = 0;
+		for(size_t i=0; i < sessions.size(); ++i)
+		{
+			sinks.push_back(kitsrus::hex_sink_t(hex[i]));
+			jobs.push_back(kitasync::read_job_t(sinks.back(), false));	//No DTR on a pty
+			sessions[i]->start(&jobs.back(), this);
+			executor.add(sessions[i]);
+		}
+		executor.run();
+		return failures == 0;
+	}
+};
+
+//Reads every programmer of a fleet at once, a thread each
+class threads_case : public bench::case_t
+{
+	class reader_t : public QThread
+	{
+		read_case	read;
+	public:
+		volatile bool	ok;
+		reader_t(kitsrus::kitsrus_t &p) : read(p), ok(false) {}
+		void	run()	{ ok = read.run(); }
+	};
+
+	std::vector<kitsrus::kitsrus_t*>	&progs;
+public:
+	threads_case(std::vector<kitsrus::kitsrus_t*> &p) : progs(p) {}
+	bool	run()
+	{
+		std::vector<reader_t*>	readers;
+		for(size_t i=0; i < progs.size(); ++i)
+		{
+			readers.push_back(new reader_t(*progs[i]));
+			readers.back()->start();
+		}
+		bool	ok(true);
+		for(size_t i=0; i < readers.size(); ++i)
+		{
+			readers[i]->wait();
+			ok = ok && readers[i]->ok;
+			delete readers[i];
+		}
+		return ok;
+	}
+};
+
+static void hex_benchmarks(bench::runner_t &runner, const std::string &dir)
+{
+	intelhex::hex_data	small, large, fragmented;
+	make_images(small, large, fragmented);
+
+	const std::string	small_path(dir + "/small.hex"), large_path(dir + "/large.hex"), fragmented_path(dir + "/fragmented.hex");
+	if( !small.write(small_path.c_str()) || !large.write(large_path.c_str()) || !fragmented.write(fragmented_path.c_str()) )
+	{
+		runner.fail("hex", "Couldn't write the test images to " + dir);
+		return;
+	}
+
+	load_case	load_small(small_path), load_large(large_path), load_fragmented(fragmented_path);
+	runner.run("hex_load/small", load_small, small.size());
+	runner.run("hex_load/large", load_large, large.size());
+	runner.run("hex_load/fragmented", load_fragmented, fragmented.size());
+
+	write_case	write_large(large), write_fragmented(fragmented);
+	runner.run("hex_write/large", write_large, large.size());
+	runner.run("hex_write/fragmented", write_fragmented, fragmented.size());
+
+	get_case	get_large(large, 0, LARGE_ROM_WORDS), get_fragmented(fragmented, 0, FRAGMENTS*FRAGMENT_STRIDE);
+	runner.run("hex_get/large", get_large, LARGE_ROM_WORDS);
+	runner.run("hex_get/fragmented", get_fragmented, FRAGMENTS*FRAGMENT_STRIDE);
+
+	intelhex::hex_data	readback(small);
+	fill_case	fill_empty(NULL, 0, SMALL_ROM_WORDS), fill_over(&readback, 0, SMALL_ROM_WORDS);
+	runner.run("hex_fill/empty", fill_empty, SMALL_ROM_WORDS);
+	runner.run("hex_fill/overwrite", fill_over, SMALL_ROM_WORDS);
+
+	size_below_case	below_large(large, LARGE_ROM_WORDS), below_fragmented(fragmented, FRAGMENTS*FRAGMENT_STRIDE);
+	runner.run("hex_size_below_addr/large", below_large, large.size());
+	runner.run("hex_size_below_addr/fragmented", below_fragmented, fragmented.size());
+
+	size_in_range_case	range_small(small, EEPROM_START_14BIT, EEPROM_START_14BIT + 256), range_fragmented(fragmented, FRAGMENTS*FRAGMENT_STRIDE/4, FRAGMENTS*FRAGMENT_STRIDE/2);
+	runner.run("hex_size_in_range/small", range_small, small.size());
+	runner.run("hex_size_in_range/fragmented", range_fragmented, fragmented.size());
+
+	intelhex::hex_data	large_copy(large), fragmented_copy(fragmented);
+	compare_case	compare_large(large, large_copy, BLANK_16BIT, LARGE_ROM_WORDS), compare_fragmented(fragmented, fragmented_copy, BLANK_14BIT, FRAGMENTS*FRAGMENT_STRIDE);
+	runner.run("hex_compare/large", compare_large, large.size());
+	runner.run("hex_compare/fragmented", compare_fragmented, fragmented.size());
+
+	unlink(small_path.c_str());
+	unlink(large_path.c_str());
+	unlink(fragmented_path.c_str());
+}
+
+static void checksum_benchmarks(bench::runner_t &runner)
+{
+	std::vector<uint8_t>	data(1 << 20);
+	uint32_t	state(1);
+	for(size_t i=0; i < data.size(); ++i)
+		data[i] = next_random(state);
+	crc_case	crc32(checksum::crc32, data), crc32c(checksum::crc32c, data);
+	runner.run("checksum_crc32/1MiB", crc32, data.size());
+	runner.run(std::string("checksum_crc32c/1MiB/") + checksum::kernel_name(), crc32c, data.size());
+
+	intelhex::hex_data	small, large, fragmented;
+	make_images(small, large, fragmented);
+	chipinfo::chipinfo	info(bench_part());
+	checksum::image_t	sums(info);
+	checksum_case	set(sums, small);
+	runner.run("checksum_image/" + info.name, set, info.rom_size + info.eeprom_size);
+	sums.set(small);
+	checksum_patch_case	patch(sums, info.rom_size);
+	runner.run("checksum_patch/" + info.name, patch, 1);
+}
+
+static void logging_benchmarks(bench::runner_t &runner)
+{
+	if( !runner.wanted("log_") )
+		return;
+
+	FILE	*const null = fopen("/dev/null", "w");
+	if( null == NULL )
+	{
+		runner.fail("log_burst/64", "Couldn't open /dev/null");
+		return;
+	}
+	const logging::level_t	level(logging::level_t(logging::threshold));
+	logging::set_output(null);
+	logging::set_level(logging::LEVEL_WARNING);
+
+	//Records carry the context a qprogd worker sets
+	const logging::scope_t	port(logging::CONTEXT_PORT, "/dev/ttyUSB0");
+	const logging::scope_t	job(logging::CONTEXT_JOB, 1U);
+	const logging::scope_t	phase(logging::CONTEXT_PHASE, "Writing ROM");
+
+	log_disabled_case	disabled;
+	runner.run("log_disabled", disabled, 1);
+	log_burst_case	burst(64);
+	runner.run("log_burst/64", burst, 64);
+
+	logging::set_level(level);
+	logging::set_output(stderr);
+	fclose(null);
+}
+
+static void port_benchmarks(bench::runner_t &runner)
+{
+	if( !runner.wanted("port_open") )
+		return;
+
+	chipinfo::chipinfo	info(bench_part());
+	kitsim::sim_t	sim(info.chip_id);
+	std::string	error;
+	if( !sim.open(0, error) )
+	{
+		runner.fail("port_open/pty", error);
+		return;
+	}
+	port_open_case	open(QString(sim.port().c_str()));
+	runner.run("port_open/pty", open, 1);
+}
+
+static void kitsrus_benchmarks(bench::runner_t &runner, unsigned baud)
+{
+	if( !runner.wanted("kitsrus_program") && !runner.wanted("kitsrus_read") && !runner.wanted("kitsrus_verify") )
+		return;
+
+	chipinfo::chipinfo	info(bench_part());
+	kitsim::sim_t	sim(info.chip_id);
+	std::string	error;
+	if( !sim.open(baud, error) )
+	{
+		runner.fail("kitsrus", error);
+		return;
+	}
+
+	//Not programmer::init(), the simulator can't see DTR so there's no hard reset
+	QString	port(sim.port().c_str());
+	kitsrus::kitsrus_t	prog(port, info);
+	if( !prog.open() || !prog.command_mode() || (prog.get_protocol() != "P018") || !prog.init_program_vars() )
+	{
+		runner.fail("kitsrus", "Couldn't start a session with the simulator on " + sim.port());
+		return;
+	}
+
+	intelhex::hex_data	small, large, fragmented;
+	make_images(small, large, fragmented);
+	imagecache::image_t	image;
+	image.hex = small;
+	image.chip = info.name;
+	kitsrus::serialize(info, image.hex, image.chunks);
+
+	std::ostringstream	suffix;
+	suffix << "/" << info.name << "@" << baud;
+	const uint64_t	items(info.rom_size + info.eeprom_size);
+
+	program_case	program(prog, image);
+	read_case	read(prog);
+	verify_case	verify(prog, image.hex, info);
+	runner.run("kitsrus_program" + suffix.str(), program, items);
+	runner.run("kitsrus_read" + suffix.str(), read, items);
+	if( runner.wanted("kitsrus_verify" + suffix.str()) && !programmer::write_all(prog, image, true, NULL) )	//Whether or not the program case ran
+		runner.fail("kitsrus_verify" + suffix.str(), "Couldn't program the image to verify");
+	else
+		runner.run("kitsrus_verify" + suffix.str(), verify, items);
+}
+
+static void fleet_benchmarks(bench::runner_t &runner, unsigned baud, unsigned fleet)
+{
+	std::ostringstream	name;
+	chipinfo::chipinfo	info(bench_part());
+	name << "kitsrus_fleet_read/" << info.name << "@" << baud << "x" << fleet;
+	if( (fleet == 0) || !runner.wanted(name.str()) )
+		return;
+
+	std::vector<kitsim::sim_t*>	sims;
+	std::vector<kitasync::session_t*>	sessions;
+	std::string	error;
+	for(unsigned i=0; i < fleet; ++i)
+	{
+		sims.push_back(new kitsim::sim_t(info.chip_id));
+		if( !sims.back()->open(baud, error) )
+			break;
+		sessions.push_back(new kitasync::session_t(sims.back()->port(), info));
+		if( !sessions.back()->open(error) )
+			break;
+	}
+	if( sessions.size() == fleet )
+	{
+		fleet_case	read(sessions);
+		runner.run(name.str(), read, uint64_t(fleet)*(info.rom_size + info.eeprom_size));
+	}
+	else
+		runner.fail(name.str(), error);
+
+	for(size_t i=0; i < sessions.size(); ++i)
+		delete sessions[i];
+	for(size_t i=0; i < sims.size(); ++i)
+		delete sims[i];
+}
+
+//The same fleet as fleet_benchmarks(), but blocking and a thread per programmer
+//	transport is "posix" or "uring", see Posix_QextSerialPort::setIoUring()
+static void threads_benchmarks(bench::runner_t &runner, unsigned baud, unsigned fleet, const char *transport)
+{
+	std::ostringstream	name;
+	chipinfo::chipinfo	info(bench_part());
+	name << "kitsrus_threads_read/" << info.name << "@" << baud << "x" << fleet << "/" << transport;
+	if( (fleet == 0) || !runner.wanted(name.str()) )
+		return;
+	const bool	uring(std::string(transport) == "uring");
+	const bool	saved(Posix_QextSerialPort::ioUringDefault());
+	//kitsrus_t doesn't know about transports, pick one for the ports it constructs
+	if( !Posix_QextSerialPort::setIoUringDefault(uring) && uring )
+	{
+		Posix_QextSerialPort::setIoUringDefault(saved);
+		std::cerr << "Skipping " << name.str() << ", io_uring isn't available\n";
+		return;
+	}
+	std::vector<kitsim::sim_t*>	sims;
+	std::vector<kitsrus::kitsrus_t*>	progs;
+	std::string	error;
+	for(unsigned i=0; i < fleet; ++i)
+	{
+		sims.push_back(new kitsim::sim_t(info.chip_id));
+		if( !sims.back()->open(baud, error) )
+			break;
+		QString	port(sims.back()->port().c_str());
+		kitsrus::kitsrus_t	*prog(new kitsrus::kitsrus_t(port, info));
+		if( !prog->open() || !prog->command_mode() || (prog->get_protocol() != "P018") || !prog->init_program_vars() )
+		{
+			error = "Couldn't start a session with the simulator on " + sims.back()->port();
+			delete prog;
+			break;
+		}
+		progs.push_back(prog);
+	}
+	Posix_QextSerialPort::setIoUringDefault(saved);
+	if( progs.size() == fleet )
+	{
+		threads_case	read(progs);
+		runner.run(name.str(), read, uint64_t(fleet)*(info.rom_size + info.eeprom_size));
+	}
+	else
+		runner.fail(name.str(), error);
+
+	for(size_t i=0; i < progs.size(); ++i)
+		delete progs[i];
+	for(size_t i=0; i < sims.size(); ++i)
+		delete sims[i];
+}
+
+int main(int argc, char *argv[])
+{
+	bench::runner_t	runner(std::cout);
+	unsigned	baud(0);
+	unsigned	fleet(16);
+	const char	*library_path(NULL);
+	for(int i=1; i < argc; ++i)
+	{
+		const std::string	arg(argv[i]);
+		if( i+1 == argc )
+		{
+			usage();
+			return 2;
+		}
+		const char	*value(argv[++i]);
+		if( arg == "--filter" )
+			runner.set_filter(value);
+		else if( arg == "--samples" )
+			runner.set_samples(strtoul(value, NULL, 10));
+		else if( arg == "--min-time" )
+			runner.set_min_sample_time(1000*strtoul(value, NULL, 10));
+		else if( arg == "--baud" )
+			baud = strtoul(value, NULL, 10);
+		else if( arg == "--library" )
+			library_path = value;
+		else if( arg == "--fleet" )
+			fleet = strtoul(value, NULL, 10);
+		else if( arg == "--tag" )
+			runner.set_tag(value);
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	char	dir[] = "/tmp/qprogbench.XXXXXX";
+	if( mkdtemp(dir) == NULL )
+	{
+		std::cerr << "Couldn't make a directory for the test images\n";
+		return 1;
+	}
+	hex_benchmarks(runner, dir);
+	rmdir(dir);
+
+	library_t	library;
+	if( library_path ? load_library(library_path, library) : (synthetic_library(library), true) )
+	{
+		size_t	keys(0);
+		for(library_t::const_iterator i=library.begin(); i != library.end(); ++i)
+			keys += i->size();
+		chipinfo_case	parse(library);
+		runner.run(library_path ? "chipinfo_set/library" : "chipinfo_set/synthetic", parse, keys);
+	}
+	else
+		runner.fail("chipinfo_set/library", std::string("Couldn't read ") + library_path);
+
+	checksum_benchmarks(runner);
+	logging_benchmarks(runner);
+	port_benchmarks(runner);
+	kitsrus_benchmarks(runner, baud);
+	fleet_benchmarks(runner, baud, fleet);
+	threads_benchmarks(runner, baud, fleet, "posix");
+	threads_benchmarks(runner, baud, fleet, "uring");
+	return runner.failed() ? 1 : 0;
+}
@@ -0,0 +1,495 @@
+/*	Filename:	qprogd.cc
+	Programming daemon, takes jobs over a local socket and runs them on
+	whichever programmer is free
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <fstream>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "devicelibrary.h"
+#include "logging.h"
+#include "qprogd.h"
+#include "verify.h"
+
+namespace qprogd
+{
+	#define	TURNAROUND_ECHOES	8	//Echo commands timed when a port is opened
+
+	worker_t::worker_t(const QString &port, const parts_t &p) : port_name(port), parts(p), pending(false), quit(false), cancelled(false), turnaround_usec(0), current(0), percent(0), prog(NULL), cache(4, false)
+	{
+	}
+
+	worker_t::~worker_t()
+	{
+		stop();
+		delete prog;
+	}
+
+	bool worker_t::accepts(const jobs::job_t &j) const
+	{
+		if( !j.port.empty() && (j.port != port_name.toStdString()) )
+			return false;
+		return parts.empty() || (parts.find(j.part) != parts.end());
+	}
+
+	void worker_t::submit(const jobs::job_t &j)
+	{
+		QMutexLocker	lock(&mutex);
+		job = j;
+		pending = true;
+		cancelled = false;
+		wake.wakeOne();
+	}
+
+	void worker_t::stop()
+	{
+		{
+			QMutexLocker	lock(&mutex);
+			quit = true;
+			cancelled = true;
+			wake.wakeOne();
+		}
+		wait();
+	}
+
+	void worker_t::send(const jobs::event_t &e)
+	{
+		emit notify(current, QString::fromStdString(e.line()));
+	}
+
+	void worker_t::phase(const char *name)
+	{
+		logging::set_context(logging::CONTEXT_PHASE, name);
+		percent = 101;		//Always report the start of the next step
+		send(jobs::event_t("phase")("job", current)("name", name));
+	}
+
+	//Report progress at most once per percent, and stop the transfer on cancellation
+	bool worker_t::progress(void *p, int i, int max)
+	{
+		worker_t	*const w = static_cast<worker_t*>(p);
+		const unsigned	pc((max > 0) ? (100*i)/max : 0);
+		if( pc != w->percent )
+		{
+			w->percent = pc;
+			w->send(jobs::event_t("progress")("job", w->current)("done", i)("total", max));
+		}
+		return !w->cancelled;
+	}
+
+	//Get the session ready for a part
+	//	The port stays open between jobs, it's only reopened after an error
+	bool worker_t::session(const chipinfo::chipinfo &chip, std::string &error)
+	{
+		if( prog == NULL )
+		{
+			prog = new kitsrus::kitsrus_t(port_name, chip);
+			prog->set_callback(progress, this);
+			if( !programmer::init(*prog, error) )
+			{
+				delete prog;
+				prog = NULL;
+				return false;
+			}
+			unsigned	usec;
+			if( prog->measure_turnaround(TURNAROUND_ECHOES, usec) )
+				turnaround_usec = usec;
+			return true;
+		}
+		if( prog->get_chip().name == chip.name )
+			return true;
+		prog->set_chip(chip);
+		if( !prog->init_program_vars() )
+		{
+			error = "Could not set up the programmer for " + chip.name;
+			return false;
+		}
+		return true;
+	}
+
+	//Run one job, returns the status for the result event
+	const char *worker_t::execute(const jobs::job_t &j, std::string &detail)
+	{
+		const chipinfo::chipinfo	*const part = devicelibrary::library().find(j.part);
+		if( part == NULL )
+		{
+			detail = "Unknown part " + j.part;
+			return "error";
+		}
+		chipinfo::chipinfo	chip(*part);
+		if( !session(chip, detail) )
+			return "error";
+
+		//Images given inline aren't worth caching, clients send them because they change
+		imagecache::image_t	inline_image;
+		imagecache::image_t	*image = NULL;
+		if( !j.data.empty() )
+		{
+			FILE	*fp(fmemopen(const_cast<char*>(j.data.data()), j.data.size(), "r"));
+			if( fp == NULL )
+			{
+				detail = "Could not read the image data";
+				return "error";
+			}
+			const bool	parsed = inline_image.hex.load(fp);
+			fclose(fp);
+			if( !parsed )
+			{
+				detail = "Inline image is malformed";
+				return "error";
+			}
+			if( inline_image.hex.begin() == inline_image.hex.end() )
+			{
+				detail = "Inline image holds no data";
+				return "error";
+			}
+			inline_image.chip = chip.name;
+			kitsrus::serialize(chip, inline_image.hex, inline_image.chunks);
+			image = &inline_image;
+		}
+		else if( !j.image.empty() && ((image=cache.get(j.image, chip)) == NULL) )
+		{
+			detail = "Could not load " + j.image;
+			return "error";
+		}
+
+		bool	ok(false);
+		const char	*status("ok");
+		verify::report_t	report;
+		report.chip = chip.name;
+		report.image = j.image;
+		report.date = time(NULL);
+		switch( j.op )
+		{
+			case jobs::OP_PROGRAM:
+				ok = programmer::write_all(*prog, *image, j.erase, this);
+				if( ok && j.verify )
+				{
+					ok = programmer::verify(*prog, image->hex, chip, this, report, true);
+					if( ok && !report.passed() )
+					{
+						status = "fail";
+						detail = report.summary();
+					}
+				}
+				break;
+			case jobs::OP_VERIFY:
+				ok = programmer::verify(*prog, image->hex, chip, this, report, false);
+				if( ok )
+				{
+					detail = report.summary();
+					if( !report.passed() )
+						status = "fail";
+				}
+				break;
+			case jobs::OP_READ:
+			{
+				std::ofstream	ofs(j.out.c_str(), std::ios::out | std::ios::binary);
+				if( !ofs )
+				{
+					detail = "Could not open " + j.out;
+					return "error";
+				}
+				ok = programmer::read_file(*prog, ofs, this, programmer::everything());
+				ofs.close();
+				if( !ok )
+					remove(j.out.c_str());	//Don't leave a partial image behind
+				break;
+			}
+			case jobs::OP_ERASE:
+				phase("Erasing");
+				ok = programmer::erase(*prog);
+				break;
+			case jobs::OP_BLANK:
+			{
+				phase("Blank checking");
+				bool	rom, eeprom;
+				ok = programmer::blank_check(*prog, rom, eeprom);
+				if( ok && !(rom && eeprom) )
+				{
+					status = "fail";
+					detail = !rom ? "ROM is not blank" : "EEPROM is not blank";
+				}
+				break;
+			}
+		}
+		if( ok )
+			return status;
+
+		//A failed transfer leaves the programmer reset, start over on the next job
+		delete prog;
+		prog = NULL;
+		if( cancelled )
+			return "cancelled";
+		if( detail.empty() )
+			detail = std::string("Error during ") + jobs::op_name(j.op);
+		return "error";
+	}
+
+	void worker_t::run()
+	{
+		const logging::scope_t	port_context(logging::CONTEXT_PORT, port_name.toStdString());
+		while( true )
+		{
+			jobs::job_t	j;
+			{
+				QMutexLocker	lock(&mutex);
+				while( !pending && !quit )
+					wake.wait(&mutex);
+				if( quit )
+					break;
+				j = job;
+				pending = false;
+			}
+
+			current = j.number;
+			percent = 101;
+			send(jobs::event_t("started")("job", current)("port", port_name.toStdString()));
+			std::string	detail;
+			const char	*status;
+			{
+				const logging::scope_t	job_context(logging::CONTEXT_JOB, current);
+				const logging::scope_t	phase_context(logging::CONTEXT_PHASE, "");
+				status = execute(j, detail);
+				QLOG(logging::LEVEL_INFO, "qprogd")("msg", "Job finished")("status", status)("detail", detail);
+			}
+			jobs::event_t	result("result");
+			result("job", current)("status", status);
+			if( !detail.empty() )
+				result("detail", detail);
+			send(result);
+			emit done(current);
+		}
+		delete prog;
+		prog = NULL;
+	}
+
+	server_t::server_t(QObject *parent) : QObject(parent), next_job(1)
+	{
+		connect(&server, SIGNAL(newConnection()), this, SLOT(onConnection()));
+	}
+
+	server_t::~server_t()
+	{
+		for(std::vector<worker_t*>::iterator i=workers.begin(); i != workers.end(); ++i)
+			delete *i;
+	}
+
+	void server_t::add_port(const QString &port, const parts_t &parts)
+	{
+		worker_t	*const w = new worker_t(port, parts);
+		connect(w, SIGNAL(notify(uint, QString)), this, SLOT(onEvent(uint, QString)));
+		connect(w, SIGNAL(done(uint)), this, SLOT(onDone(uint)));
+		workers.push_back(w);
+		idle.insert(w);
+		w->start();
+	}
+
+	bool server_t::listen(const QString &path, std::string &error)
+	{
+		QLocalServer::removeServer(path);		//Clear out a socket left by a crash
+		if( !server.listen(path) )
+		{
+			error = server.errorString().toStdString();
+			return false;
+		}
+		return true;
+	}
+
+	void server_t::onConnection()
+	{
+		QLocalSocket	*client;
+		while( (client=server.nextPendingConnection()) != NULL )
+		{
+			connect(client, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+			connect(client, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+		}
+	}
+
+	void server_t::onReadyRead()
+	{
+		QLocalSocket	*const client = qobject_cast<QLocalSocket*>(sender());
+		if( client == NULL )
+			return;
+		while( client->canReadLine() )
+		{
+			const QByteArray	line(client->readLine());
+			handle(client, std::string(line.constData(), line.size()));
+		}
+	}
+
+	//Drop a client's waiting jobs and stop its running ones
+	void server_t::onDisconnected()
+	{
+		QLocalSocket	*const client = qobject_cast<QLocalSocket*>(sender());
+		if( client == NULL )
+			return;
+		for(std::deque<jobs::job_t>::iterator i=queue.begin(); i != queue.end(); )
+			if( owners[i->number] == client )
+			{
+				owners.erase(i->number);
+				i = queue.erase(i);
+			}
+			else
+				++i;
+		for(std::map<unsigned, worker_t*>::iterator i=running.begin(); i != running.end(); ++i)
+			if( owners[i->first] == client )
+			{
+				owners[i->first] = NULL;
+				i->second->cancel();
+			}
+		client->deleteLater();
+	}
+
+	void server_t::onEvent(uint job, QString line)
+	{
+		send(job, line.toStdString());
+	}
+
+	void server_t::onDone(uint job)
+	{
+		std::map<unsigned, worker_t*>::iterator	i(running.find(job));
+		if( i != running.end() )
+		{
+			idle.insert(i->second);
+			running.erase(i);
+		}
+		owners.erase(job);
+		schedule();
+	}
+
+	void server_t::handle(QLocalSocket *client, const std::string &line)
+	{
+		std::string	verb, error;
+		jobs::fields_t	fields;
+		if( !jobs::split(line.substr(0, line.find('\n')), verb, fields, error) )
+			send(client, jobs::event_t("error")("msg", error).line());
+		else if( verb == "job" )
+			submit(client, fields);
+		else if( verb == "cancel" )
+			cancel(client, fields);
+		else if( verb == "ports" )
+			list_ports(client);
+		else
+			send(client, jobs::event_t("error")("msg", "Unknown request " + verb).line());
+	}
+
+	void server_t::submit(QLocalSocket *client, const jobs::fields_t &fields)
+	{
+		jobs::job_t	job;
+		std::string	error;
+		if( !jobs::parse(fields, job, error) )
+		{
+			send(client, jobs::event_t("error")("msg", error).line());
+			return;
+		}
+		if( devicelibrary::library().find(job.part) == NULL )
+		{
+			send(client, jobs::event_t("error")("msg", "Unknown part " + job.part).line());
+			return;
+		}
+
+		//Refuse jobs that would wait forever
+		bool	runnable(false);
+		for(std::vector<worker_t*>::const_iterator i=workers.begin(); !runnable && (i != workers.end()); ++i)
+			runnable = (*i)->accepts(job);
+		if( !runnable )
+		{
+			send(client, jobs::event_t("error")("msg", "No port takes " + job.part + (job.port.empty() ? "" : " on " + job.port)).line());
+			return;
+		}
+
+		job.number = next_job++;
+		owners[job.number] = client;
+		queue.push_back(job);
+		jobs::event_t	accepted("accepted");
+		accepted("job", job.number);
+		if( !job.tag.empty() )
+			accepted("id", job.tag);
+		send(client, accepted.line());
+		schedule();
+	}
+
+	void server_t::cancel(QLocalSocket *client, const jobs::fields_t &fields)
+	{
+		jobs::fields_t::const_iterator	f(fields.find("job"));
+		const unsigned	job((f == fields.end()) ? 0 : strtoul(f->second.c_str(), NULL, 10));
+		std::map<unsigned, QLocalSocket*>::iterator	owner(owners.find(job));
+		if( (owner == owners.end()) || (owner->second != client) )
+		{
+			send(client, jobs::event_t("error")("msg", "No such job").line());
+			return;
+		}
+
+		std::map<unsigned, worker_t*>::iterator	r(running.find(job));
+		if( r != running.end() )
+		{
+			r->second->cancel();		//The worker sends the result
+			return;
+		}
+		for(std::deque<jobs::job_t>::iterator i=queue.begin(); i != queue.end(); ++i)
+			if( i->number == job )
+			{
+				queue.erase(i);
+				break;
+			}
+		send(client, jobs::event_t("result")("job", job)("status", "cancelled").line());
+		owners.erase(owner);
+	}
+
+	void server_t::list_ports(QLocalSocket *client)
+	{
+		for(std::vector<worker_t*>::const_iterator i=workers.begin(); i != workers.end(); ++i)
+		{
+			jobs::event_t	port("port");
+			port("name", (*i)->port().toStdString())("state", idle.count(*i) ? "idle" : "busy");
+			std::string	parts;
+			const parts_t	&accepted((*i)->accepted_parts());
+			for(parts_t::const_iterator j=accepted.begin(); j != accepted.end(); ++j)
+				parts += (parts.empty() ? "" : ",") + *j;
+			if( !parts.empty() )
+				port("parts", parts);
+			if( (*i)->turnaround() )
+				port("latency_us", (*i)->turnaround());
+			send(client, port.line());
+		}
+	}
+
+	//Hand waiting jobs to idle ports, oldest first
+	void server_t::schedule()
+	{
+		for(std::deque<jobs::job_t>::iterator i=queue.begin(); (i != queue.end()) && !idle.empty(); )
+		{
+			std::set<worker_t*>::iterator	w(idle.begin());
+			while( (w != idle.end()) && !(*w)->accepts(*i) )
+				++w;
+			if( w == idle.end() )
+			{
+				++i;
+				continue;
+			}
+			running[i->number] = *w;
+			(*w)->submit(*i);
+			idle.erase(w);
+			i = queue.erase(i);
+		}
+	}
+
+	void server_t::send(QLocalSocket *client, const std::string &line)
+	{
+		if( client != NULL )
+			client->write(line.data(), line.size());
+	}
+
+	void server_t::send(unsigned job, const std::string &line)
+	{
+		std::map<unsigned, QLocalSocket*>::const_iterator	i(owners.find(job));
+		if( i != owners.end() )
+			send(i->second, line);
+	}
+}
@@ -0,0 +1,122 @@
+/*	Filename:	qprogd.h
+	Programming daemon, takes jobs over a local socket and runs them on
+	whichever programmer is free
+
+	Each programmer gets a worker thread that keeps its port open between
+	jobs. Jobs wait in a single FIFO and are handed to the first idle port
+	that accepts the part, a job that can't run yet doesn't hold up the jobs
+	behind it that can.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	QPROGD_H
+#define	QPROGD_H
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "imagecache.h"
+#include "jobs.h"
+#include "kitsrus.h"
+#include "programmer.h"
+
+namespace qprogd
+{
+	typedef	std::set<std::string>	parts_t;
+
+	//Runs jobs on one programmer
+	class worker_t : public QThread, public programmer::observer_t
+	{
+		Q_OBJECT
+
+		QString	port_name;
+		const parts_t	parts;		//Parts this port takes, empty for any part
+
+		QMutex	mutex;				//Guards job, pending and quit
+		QWaitCondition	wake;
+		jobs::job_t	job;
+		bool	pending;
+		bool	quit;
+
+		volatile bool	cancelled;	//Set by the server thread, polled by the progress callback
+		volatile unsigned	turnaround_usec;	//Measured when the port is opened, 0 until then
+		unsigned	current;		//Number of the running job
+		unsigned	percent;		//Last progress reported
+
+		kitsrus::kitsrus_t	*prog;	//Open session, NULL until the first job or after an error
+		imagecache::cache_t	cache;
+
+		bool	session(const chipinfo::chipinfo &, std::string &error);
+		const char	*execute(const jobs::job_t &, std::string &detail);
+		void	send(const jobs::event_t &);
+		static bool	progress(void *, int, int);
+	public:
+		worker_t(const QString &port, const parts_t &);
+		~worker_t();
+
+		const QString	&port() const	{ return port_name; }
+		const parts_t	&accepted_parts() const	{ return parts; }
+		bool	accepts(const jobs::job_t &) const;
+		unsigned	turnaround() const	{ return turnaround_usec; }
+
+		void	submit(const jobs::job_t &);	//Start a job, only while idle
+		void	cancel()	{ cancelled = true; }	//Stop the running job
+		void	stop();		//Finish the running job and exit the thread
+
+		void	phase(const char *);
+
+	signals:
+		void	notify(uint job, QString line);
+		void	done(uint job);
+
+	protected:
+		void	run();
+	};
+
+	class server_t : public QObject
+	{
+		Q_OBJECT
+
+		QLocalServer	server;
+		std::vector<worker_t*>	workers;
+		std::set<worker_t*>	idle;
+		std::deque<jobs::job_t>	queue;		//Jobs waiting for a port
+		std::map<unsigned, QLocalSocket*>	owners;	//Client of each queued or running job, NULL once it's gone
+		std::map<unsigned, worker_t*>	running;
+		unsigned	next_job;
+
+		void	handle(QLocalSocket *, const std::string &line);
+		void	submit(QLocalSocket *, const jobs::fields_t &);
+		void	cancel(QLocalSocket *, const jobs::fields_t &);
+		void	list_ports(QLocalSocket *);
+		void	schedule();
+		void	send(QLocalSocket *, const std::string &);
+		void	send(unsigned job, const std::string &);
+	public:
+		server_t(QObject *parent=0);
+		~server_t();
+
+		void	add_port(const QString &, const parts_t &);
+		bool	listen(const QString &path, std::string &error);
+
+	private slots:
+		void	onConnection();
+		void	onReadyRead();
+		void	onDisconnected();
+		void	onEvent(uint, QString);
+		void	onDone(uint);
+	};
+}
+
+#endif	//QPROGD_H
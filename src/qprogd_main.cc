@@ -0,0 +1,125 @@
+/*	Filename:	qprogd_main.cc
+	Main file for qprogd, the programming daemon
+
+	qprogd [--socket <path>] [--io-uring | --no-io-uring] [--log <level>] --port <device>[=<part>,<part>...]...
+		Listen for jobs on a local socket, qprogd by default. Every --port
+		adds a programmer, limited to the parts listed after it if any are.
+		Every port's reads and writes go through one io_uring thread where
+		the kernel supports it, --no-io-uring uses read() and write() on
+		each port instead. --io-uring says so when it isn't available.
+		--log sets the lowest level logged to stderr, one of debug, info,
+		warning, error or off, overriding QPROG_LOG.
+		See jobs.h for the protocol.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <iostream>
+#include <string>
+
+#include <QCoreApplication>
+
+#include "devicelibrary.h"
+#include "logging.h"
+#include "posix_qextserialport.h"
+#include "qprogd.h"
+
+static void usage()
+{
+	std::cerr << "Usage: qprogd [--socket <path>] [--io-uring | --no-io-uring] [--log <level>] --port <device>[=<part>,<part>...]...\n";
+}
+
+int main(int argc, char *argv[])
+{
+	//Same settings as QProg, that's where the device library lives
+	QCoreApplication::setOrganizationName("bfoz.net");
+	QCoreApplication::setOrganizationDomain("bfoz.net");
+	QCoreApplication::setApplicationName("QProg");
+
+	QCoreApplication	app(argc, argv);
+
+	std::string	socket("qprogd");
+	std::vector<std::pair<std::string, qprogd::parts_t> >	ports;
+	for(int i=1; i < argc; ++i)
+	{
+		const std::string	arg(argv[i]);
+		if( arg == "--io-uring" )
+		{
+			if( !Posix_QextSerialPort::setIoUringDefault(true) )
+				std::cerr << "io_uring isn't available, using read() and write()\n";
+			continue;
+		}
+		if( arg == "--no-io-uring" )
+		{
+			Posix_QextSerialPort::setIoUringDefault(false);
+			continue;
+		}
+		if( ((arg != "--socket") && (arg != "--port") && (arg != "--log")) || (++i == argc) )
+		{
+			usage();
+			return 2;
+		}
+		if( arg == "--socket" )
+		{
+			socket = argv[i];
+			continue;
+		}
+		if( arg == "--log" )
+		{
+			logging::level_t	level;
+			if( !logging::parse_level(argv[i], level) )
+			{
+				usage();
+				return 2;
+			}
+			logging::set_level(level);
+			continue;
+		}
+
+		const std::string	spec(argv[i]);
+		const size_t	eq(spec.find('='));
+		qprogd::parts_t	parts;
+		for(size_t start=eq; start != std::string::npos; )
+		{
+			const size_t	comma(spec.find(',', start+1));
+			const std::string	part(spec.substr(start+1, (comma == std::string::npos) ? std::string::npos : comma-start-1));
+			if( !part.empty() )
+				parts.insert(part);
+			start = comma;
+		}
+		ports.push_back(std::make_pair(spec.substr(0, eq), parts));
+	}
+	if( ports.empty() )
+	{
+		usage();
+		return 2;
+	}
+
+	//Load the library before any worker can look a part up
+	const devicelibrary::library_t	&library(devicelibrary::library());
+	if( library.size() == 0 )
+	{
+		std::cerr << "The device library is empty, run QProg once to fetch it\n";
+		return 1;
+	}
+	for(std::vector<std::pair<std::string, qprogd::parts_t> >::const_iterator i=ports.begin(); i != ports.end(); ++i)
+		for(qprogd::parts_t::const_iterator j=i->second.begin(); j != i->second.end(); ++j)
+			if( library.find(*j) == NULL )
+			{
+				std::cerr << "Unknown part " << *j << " for " << i->first << "\n";
+				return 1;
+			}
+
+	qprogd::server_t	server;
+	for(std::vector<std::pair<std::string, qprogd::parts_t> >::const_iterator i=ports.begin(); i != ports.end(); ++i)
+		server.add_port(QString::fromStdString(i->first), i->second);
+
+	std::string	error;
+	if( !server.listen(QString::fromStdString(socket), error) )
+	{
+		std::cerr << "Could not listen on " << socket << ": " << error << "\n";
+		return 1;
+	}
+	return app.exec();
+}
@@ -0,0 +1,95 @@
+/*	Filename:	reactor.cc
+	Single threaded executor for resumable tasks waiting on file descriptors
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "reactor.h"
+
+namespace reactor
+{
+	const char *status_name(status_t s)
+	{
+		static const char *const names[] = {"pending", "ok", "fail", "timeout", "cancelled"};
+		return names[s];
+	}
+
+	msec_t now()
+	{
+		struct timespec	ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return msec_t(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+	}
+
+	void executor_t::add(task_t *t)
+	{
+		t->wait = wait_t();
+		t->wait.deadline = 0;		//Already due
+		tasks.push_back(t);
+	}
+
+	void executor_t::run()
+	{
+		while( run_once(NO_DEADLINE) ) {}
+	}
+
+	bool executor_t::run_once(msec_t timeout)
+	{
+		if( tasks.empty() )
+			return false;
+
+		//Sleep until the first deadline, or until a cancel could have been requested
+		const msec_t	start(now());
+		std::vector<struct pollfd>	fds;
+		std::vector<size_t>	slot(tasks.size());		//Index into fds of each task's descriptor
+		fds.reserve(tasks.size());
+		for(size_t i=0; i < tasks.size(); ++i)
+		{
+			const task_t	&t(*tasks[i]);
+			timeout = std::min(timeout, std::max<msec_t>(t.wait.deadline - start, 0));
+			if( t.cancel != NULL )
+				timeout = std::min<msec_t>(timeout, CANCEL_POLL_INTERVAL);
+			slot[i] = fds.size();
+			if( t.wait.fd >= 0 )
+			{
+				struct pollfd	p;
+				p.fd = t.wait.fd;
+				p.events = t.wait.events;
+				p.revents = 0;
+				fds.push_back(p);
+			}
+		}
+		const int	n(poll(fds.empty() ? NULL : &fds[0], fds.size(), (timeout == NO_DEADLINE) ? -1 : int(std::min<msec_t>(timeout, 0x7FFFFFFF))));
+		if( (n < 0) && (errno != EINTR) )
+			return false;
+
+		//Resume whatever is ready, tasks added meanwhile wait for the next round
+		const msec_t	when(now());
+		std::vector<task_t*>	current;
+		current.swap(tasks);
+		for(size_t i=0; i < current.size(); ++i)
+		{
+			task_t	*const t(current[i]);
+			const bool	ready((t->wait.fd >= 0) && (n > 0) && (fds[slot[i]].revents != 0));
+			const bool	cancelled((t->cancel != NULL) && t->cancel->requested());
+			if( !ready && !cancelled && (when < t->wait.deadline) )
+			{
+				tasks.push_back(t);
+				continue;
+			}
+			const status_t	s(t->resume());
+			if( s == PENDING )
+				tasks.push_back(t);
+			else
+				t->finished(s);
+		}
+		return !tasks.empty();
+	}
+}
@@ -0,0 +1,114 @@
+/*	Filename:	reactor.h
+	Single threaded executor for resumable tasks waiting on file descriptors
+
+	A task runs until it would block, says which descriptor it's waiting on
+	and until when, and returns PENDING. The executor polls every waiting
+	descriptor at once and resumes each task when its descriptor is ready,
+	its deadline has passed or its cancel token has been set, so one thread
+	can drive any number of programmers without a context switch per byte.
+
+	Tasks are written as straight line code with the TASK_* macros, which
+	keep the resume point in an int the way a protothread does. Anything
+	that has to survive a wait must be a member, not a local. Only one
+	TASK_AWAIT may be used per source line.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	REACTOR_H
+#define	REACTOR_H
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace reactor
+{
+	enum status_t
+	{
+		PENDING,		//Waiting, resume later
+		DONE,
+		FAILED,			//The other end said something unexpected
+		TIMED_OUT,
+		CANCELLED
+	};
+
+	const char	*status_name(status_t);
+
+	typedef	int64_t	msec_t;
+	#define	NO_DEADLINE	((reactor::msec_t)0x7FFFFFFFFFFFFFFFLL)
+	#define	CANCEL_POLL_INTERVAL	50		//Milliseconds
+
+	msec_t	now();		//Monotonic milliseconds
+
+	//Set from anywhere, including another thread, to stop the tasks holding it
+	//	Tasks see it the next time they're resumed, which is within
+	//	CANCEL_POLL_INTERVAL even if their descriptor stays quiet
+	class cancel_t
+	{
+		volatile bool	flag;
+	public:
+		cancel_t() : flag(false) {}
+		void	request()	{ flag = true; }
+		void	reset()		{ flag = false; }
+		bool	requested() const	{ return flag; }
+	};
+
+	//What a suspended task is waiting for
+	struct wait_t
+	{
+		int	fd;			//-1 to only wait for the deadline
+		short	events;		//POLLIN and/or POLLOUT
+		msec_t	deadline;
+
+		wait_t() : fd(-1), events(0), deadline(NO_DEADLINE) {}
+	};
+
+	class task_t
+	{
+	public:
+		wait_t	wait;			//Filled in by resume() before it returns PENDING
+		cancel_t	*cancel;	//NULL if the task can't be cancelled
+
+		task_t() : cancel(NULL) {}
+		virtual ~task_t() {}
+
+		//Run until the task has to wait or has finished
+		virtual status_t	resume() = 0;
+		//Called once with the final status, the task may be deleted from here
+		virtual void	finished(status_t) {}
+	};
+
+	class executor_t
+	{
+		std::vector<task_t*>	tasks;
+	public:
+		void	add(task_t *);		//The task is first resumed on the next round
+		size_t	size() const	{ return tasks.size(); }
+
+		//Resume the tasks until they've all finished
+		//	Tasks can be added from finished() and resume()
+		void	run();
+		//One round of polling, waiting at most timeout ms, for callers
+		//	that have their own loop. Returns false once there are no tasks left
+		bool	run_once(msec_t timeout);
+	};
+}
+
+//Resumable task bodies, line is an int member that starts out 0
+#define	TASK_BEGIN(line)	switch(line) { case 0:
+//Evaluate expr, which returns a status_t, every time the task is resumed until it isn't PENDING
+//	Anything other than DONE finishes the task with that status
+#define	TASK_AWAIT(line, expr)	\
+	do { (line) = __LINE__; case __LINE__: { const reactor::status_t	status_(expr);	\
+		if( status_ == reactor::PENDING ) return reactor::PENDING;	\
+		if( status_ != reactor::DONE ) { (line) = 0; return status_; } } } while(0)
+//Like TASK_AWAIT, but leaves anything other than PENDING in result for the task to handle
+#define	TASK_AWAIT_RESULT(line, result, expr)	\
+	do { (line) = __LINE__; case __LINE__: if( ((result) = (expr)) == reactor::PENDING ) return reactor::PENDING; } while(0)
+//Finish early with status
+#define	TASK_RETURN(line, status)	do { (line) = 0; return (status); } while(0)
+#define	TASK_END(line)	} (line) = 0; return reactor::DONE
+
+#endif	//REACTOR_H
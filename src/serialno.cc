@@ -0,0 +1,359 @@
+/*	Filename:	serialno.cc
+	Per-unit serialization
+
+	The state file is a single "next=<n>" line. A number is handed out only
+	after the file saying that the following number is next has been synced
+	and renamed over the old one, so a crash can skip a number but never
+	reuse one.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef	_WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/file.h>
+#endif
+
+#include "serialno.h"
+
+namespace serialno
+{
+	bool counter_t::open(const std::string &p, uint64_t first)
+	{
+		close();
+		path = p;
+
+#ifndef	_WIN32
+		lock_fd = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+		if( (lock_fd < 0) || (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) )
+		{
+			close();
+			return false;
+		}
+#endif
+
+		FILE	*fp = fopen(path.c_str(), "rb");
+		if( fp == NULL )
+		{
+			//A new counter, but don't paper over a state file we can't read
+			if( (access(path.c_str(), F_OK) == 0) || !save(first) )
+			{
+				close();
+				return false;
+			}
+			next_ = first;
+			return true;
+		}
+
+		char	line[64];
+		char	*end;
+		bool	ok = (fgets(line, sizeof(line), fp) != NULL) && (strncmp(line, "next=", 5) == 0);
+		if( ok )
+		{
+			next_ = strtoull(line+5, &end, 10);
+			ok = (end != line+5) && ((*end == '\n') || (*end == '\0'));
+		}
+		fclose(fp);
+		if( !ok )
+			close();
+		return ok;
+	}
+
+	void counter_t::close()
+	{
+#ifndef	_WIN32
+		if( lock_fd >= 0 )
+			::close(lock_fd);		//Releases the lock
+#endif
+		lock_fd = -1;
+		path.clear();
+		next_ = 0;
+	}
+
+	//Write the state to a temporary file, sync it and rename it over the old one
+	bool counter_t::save(uint64_t n)
+	{
+		const std::string	tmp(path + ".tmp");
+		FILE	*fp;
+		if( (fp=fopen(tmp.c_str(), "wb")) == NULL )
+			return false;
+
+		bool	ok = fprintf(fp, "next=%llu\n", (unsigned long long)n) > 0;
+		ok = (fflush(fp) == 0) && ok;
+#ifdef	_WIN32
+		ok = ok && (_commit(_fileno(fp)) == 0);
+#else
+		ok = ok && (fsync(fileno(fp)) == 0);
+#endif
+		ok = (fclose(fp) == 0) && ok;
+
+#ifdef	_WIN32
+		ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+		ok = ok && (rename(tmp.c_str(), path.c_str()) == 0);
+		if( ok )
+		{
+			//Sync the directory so the rename itself survives a power cut
+			const std::string::size_type	slash(path.rfind('/'));
+			const std::string	dir(slash == std::string::npos ? std::string(".") : path.substr(0, slash+1));
+			const int	fd = ::open(dir.c_str(), O_RDONLY);
+			if( fd >= 0 )
+			{
+				fsync(fd);
+				::close(fd);
+			}
+		}
+#endif
+		if( !ok )
+			remove(tmp.c_str());
+		return ok;
+	}
+
+	bool counter_t::reserve(uint64_t &n)
+	{
+		if( path.empty() || (next_ == ~uint64_t(0)) || !save(next_ + 1) )
+			return false;
+		n = next_++;
+		return true;
+	}
+
+	//Parse "N", "Nx" or "Nb" after "serial:"
+	static bool put_serial(const std::string &spec, uint64_t serial, std::vector<uint8_t> &out, std::string &error)
+	{
+		char	*end;
+		const unsigned long	width = spec.empty() ? 0 : strtoul(spec.c_str(), &end, 10);
+		const char	kind = spec.empty() ? 'd' : (*end ? *end : 'd');
+		if( !spec.empty() && ((end == spec.c_str()) || (*end && end[1])) )
+		{
+			error = "bad serial width \"" + spec + "\"";
+			return false;
+		}
+
+		if( kind == 'b' )
+		{
+			if( (width == 0) || (width > 8) || ((width < 8) && (serial >> (8*width))) )
+			{
+				error = "serial number doesn't fit in " + spec;
+				return false;
+			}
+			for(unsigned long i=width; i > 0; --i)
+				out.push_back((serial >> (8*(i-1))) & 0xFF);
+			return true;
+		}
+		if( (kind != 'd') && (kind != 'x') )
+		{
+			error = "bad serial format \"" + spec + "\"";
+			return false;
+		}
+
+		char	digits[32];
+		snprintf(digits, sizeof(digits), (kind == 'x') ? "%0*llX" : "%0*llu", int(width), (unsigned long long)serial);
+		if( width && (strlen(digits) > width) )
+		{
+			error = "serial number doesn't fit in " + spec;
+			return false;
+		}
+		out.insert(out.end(), digits, digits + strlen(digits));
+		return true;
+	}
+
+	static int hex_digit(char c)
+	{
+		if( (c >= '0') && (c <= '9') )
+			return c - '0';
+		if( (c >= 'A') && (c <= 'F') )
+			return c - 'A' + 10;
+		if( (c >= 'a') && (c <= 'f') )
+			return c - 'a' + 10;
+		return -1;
+	}
+
+	bool expand(const std::string &format, uint64_t serial, time_t when, std::vector<uint8_t> &out, std::string &error)
+	{
+		out.clear();
+		for(std::string::size_type i=0; i < format.size(); ++i)
+		{
+			if( format[i] != '{' )
+			{
+				out.push_back(format[i]);
+				continue;
+			}
+			if( (i+1 < format.size()) && (format[i+1] == '{') )
+			{
+				out.push_back('{');
+				++i;
+				continue;
+			}
+
+			const std::string::size_type	last(format.find('}', i));
+			if( last == std::string::npos )
+			{
+				error = "unterminated field in \"" + format + "\"";
+				return false;
+			}
+			const std::string	field(format.substr(i+1, last-i-1));
+			const std::string::size_type	colon(field.find(':'));
+			const std::string	name(field.substr(0, colon));
+			const std::string	arg(colon == std::string::npos ? std::string() : field.substr(colon+1));
+			i = last;
+
+			if( name == "serial" )
+			{
+				if( !put_serial(arg, serial, out, error) )
+					return false;
+			}
+			else if( name == "date" )
+			{
+				char	s[64];
+				struct tm	*t = localtime(&when);
+				const size_t	n = t ? strftime(s, sizeof(s), arg.empty() ? "%y%W" : arg.c_str(), t) : 0;
+				if( n == 0 )
+				{
+					error = "bad date format \"" + arg + "\"";
+					return false;
+				}
+				out.insert(out.end(), s, s + n);
+			}
+			else if( name == "hex" )
+			{
+				if( arg.empty() || (arg.size() % 2) )
+				{
+					error = "odd number of digits in \"" + field + "\"";
+					return false;
+				}
+				for(std::string::size_type j=0; j < arg.size(); j += 2)
+				{
+					const int	hi(hex_digit(arg[j])), lo(hex_digit(arg[j+1]));
+					if( (hi < 0) || (lo < 0) )
+					{
+						error = "bad hex digits in \"" + field + "\"";
+						return false;
+					}
+					out.push_back((hi << 4) | lo);
+				}
+			}
+			else
+			{
+				error = "unknown field \"" + field + "\"";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool parse_target(const std::string &s, config_t &config)
+	{
+		const std::string::size_type	colon(s.find(':'));
+		const std::string	name(s.substr(0, colon));
+		if( name == "id" )
+		{
+			config.target = TARGET_ID;
+			config.address = 0;
+			return colon == std::string::npos;
+		}
+		if( (name != "rom") && (name != "eeprom") )
+			return false;
+		if( colon == std::string::npos )
+			return false;
+
+		char	*end;
+		const std::string	a(s.substr(colon+1));
+		config.address = strtoul(a.c_str(), &end, 0);
+		config.target = (name == "rom") ? TARGET_ROM : TARGET_EEPROM;
+		return !a.empty() && (*end == '\0');
+	}
+
+	bool parse_encoding(const std::string &s, encoding_t &e)
+	{
+		static const char	*names[] = {"default", "nibble", "byte", "word", "retlw"};
+		for(unsigned i=0; i < sizeof(names)/sizeof(names[0]); ++i)
+			if( s == names[i] )
+			{
+				e = encoding_t(i);
+				return true;
+			}
+		return false;
+	}
+
+	serializer_t::serializer_t(chipinfo::chipinfo &info, const config_t &c) : config(c), start(0), limit(0), encoding(c.encoding), retlw(info.layout().retlw)
+	{
+		switch( config.target )
+		{
+			case TARGET_ID:
+				start = info.get_id_start();
+				limit = 4;		//The programmer only takes four ID words
+				if( encoding == ENCODE_DEFAULT )
+					encoding = info.is16bit() ? ENCODE_BYTE : ENCODE_NIBBLE;
+				break;
+			case TARGET_ROM:
+				start = config.address;
+				limit = (config.address < info.rom_size) ? info.rom_size - config.address : 0;
+				if( encoding == ENCODE_DEFAULT )
+					encoding = ENCODE_RETLW;
+				break;
+			case TARGET_EEPROM:
+				start = info.get_eeprom_start() + config.address;
+				limit = (config.address < info.eeprom_size) ? info.eeprom_size - config.address : 0;
+				if( encoding == ENCODE_DEFAULT )
+					encoding = ENCODE_BYTE;
+				break;
+		}
+	}
+
+	bool serializer_t::words(uint64_t serial, time_t when, std::vector<element_t> &w, std::string &error) const
+	{
+		std::vector<uint8_t>	bytes;
+		if( !expand(config.format, serial, when, bytes, error) )
+			return false;
+
+		w.clear();
+		for(size_t i=0; i < bytes.size(); ++i)
+		{
+			switch( encoding )
+			{
+				case ENCODE_NIBBLE:
+					w.push_back(bytes[i] >> 4);
+					w.push_back(bytes[i] & 0x0F);
+					break;
+				case ENCODE_WORD:
+					if( i % 2 )
+						w.back() |= bytes[i];
+					else
+						w.push_back(element_t(bytes[i]) << 8);
+					break;
+				case ENCODE_RETLW:
+					w.push_back(retlw | bytes[i]);
+					break;
+				default:
+					w.push_back(bytes[i]);
+					break;
+			}
+		}
+		if( w.size() > limit )
+		{
+			char	s[96];
+			snprintf(s, sizeof(s), "%lu words don't fit in the %lu the target has", (unsigned long)w.size(), (unsigned long)limit);
+			error = s;
+			return false;
+		}
+		return true;
+	}
+
+	bool serializer_t::apply(const compose::image_t &base, compose::image_t &variant, uint64_t serial, time_t when, std::string &error) const
+	{
+		std::vector<element_t>	w;
+		if( !words(serial, when, w, error) )
+			return false;
+		variant = base;
+		return w.empty() || variant.patch(start, &w[0], w.size());
+	}
+}
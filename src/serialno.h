@@ -0,0 +1,119 @@
+/*	Filename:	serialno.h
+	Per-unit serialization
+	Expands a format template (serial number, date code, fixed prefix bytes)
+	for each unit and patches it into the ID words or a ROM/EEPROM range of a
+	shared base image. The counter is kept in a state file that's updated
+	before a number is handed out, so a number is never used twice even if
+	the program crashes.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	SERIALNO_H
+#define	SERIALNO_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "chipinfo.h"
+#include "compose.h"
+
+namespace serialno
+{
+	typedef	compose::address_t	address_t;
+	typedef	compose::element_t	element_t;
+
+	//A counter persisted in a state file
+	//	The file holds the next number to hand out and is replaced atomically
+	class counter_t
+	{
+		std::string	path;
+		uint64_t	next_;
+		int		lock_fd;		//Keeps other processes off the same counter
+
+		counter_t(const counter_t&);	//No copy
+		counter_t &operator=(const counter_t&);
+
+		bool	save(uint64_t);
+	public:
+		counter_t() : next_(0), lock_fd(-1) {}
+		~counter_t()	{ close(); }
+
+		//Lock and load the state file, creating it with first if it doesn't exist
+		bool	open(const std::string &, uint64_t first=0);
+		void	close();
+
+		uint64_t	next() const	{ return next_; }
+		//Hand out the next number, it's on disk as used before this returns
+		bool	reserve(uint64_t &);
+	};
+
+	//Expand a format template into bytes
+	//	Literal characters are copied as ASCII, "{{" is a literal '{'
+	//	{serial}		Decimal serial number
+	//	{serial:N}		Decimal, zero padded to N digits
+	//	{serial:Nx}		Hex, N digits
+	//	{serial:Nb}		N bytes, most significant first
+	//	{date}			Date code as ASCII, strftime "%y%W" (year and week)
+	//	{date:<fmt>}	Date code with any strftime format
+	//	{hex:<digits>}	Fixed bytes, e.g. a MAC prefix
+	//	Returns false with a message in error if the template is bad or the serial doesn't fit
+	bool	expand(const std::string &format, uint64_t serial, time_t when, std::vector<uint8_t> &, std::string &error);
+
+	enum target_t
+	{
+		TARGET_ID = 0,	//The ID locations
+		TARGET_ROM,		//Program words starting at a word address
+		TARGET_EEPROM	//EEPROM bytes starting at an offset into the EEPROM
+	};
+
+	//How bytes are stored in words
+	enum encoding_t
+	{
+		ENCODE_DEFAULT = 0,	//Nibbles for ID words, RETLW for ROM, bytes for EEPROM and 16-bit IDs
+		ENCODE_NIBBLE,		//One nibble per word, high nibble first (the usual ID word layout)
+		ENCODE_BYTE,		//One byte per word
+		ENCODE_WORD,		//Two bytes per word, first byte high
+		ENCODE_RETLW		//One RETLW instruction per byte, a table the firmware can call
+	};
+
+	struct config_t
+	{
+		target_t	target;
+		address_t	address;	//ROM word address or EEPROM offset, not used for the ID
+		encoding_t	encoding;
+		std::string	format;		//Template given to expand()
+
+		config_t() : target(TARGET_ID), address(0), encoding(ENCODE_DEFAULT), format("{serial:4x}") {}
+	};
+
+	bool	parse_target(const std::string &, config_t &);		//"id", "rom:<address>" or "eeprom:<offset>"
+	bool	parse_encoding(const std::string &, encoding_t &);	//"nibble", "byte", "word" or "retlw"
+
+	//Builds the patch for each unit
+	class serializer_t
+	{
+		config_t	config;
+		address_t	start;		//First word address of the target
+		size_t		limit;		//Number of words the target can hold
+		encoding_t	encoding;
+		element_t	retlw;		//RETLW opcode for the core
+	public:
+		serializer_t(chipinfo::chipinfo &, const config_t &);
+
+		address_t	address() const	{ return start; }
+
+		//Words of the patch for one unit
+		bool	words(uint64_t serial, time_t, std::vector<element_t> &, std::string &error) const;
+
+		//variant is made a copy of base with the unit's words patched in
+		//	Only the base's extents are copied, not its data
+		bool	apply(const compose::image_t &base, compose::image_t &variant, uint64_t serial, time_t, std::string &error) const;
+	};
+}
+
+#endif	//SERIALNO_H
@@ -0,0 +1,458 @@
+/*	Filename:	verify.cc
+	Image comparison for verify
+
+	The kernels look for the first word where (expected ^ actual) & care is
+	non-zero, a whole vector at a time. Verified images are almost always
+	equal, so the scalar work is limited to building the runs around the
+	words that actually differ.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verify.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	#if defined(__SSE2__)
+		#include <emmintrin.h>
+		#define	VERIFY_SSE2
+	#endif
+	//AVX2 is compiled with a target attribute and picked at run time
+	#if ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))) && !defined(__clang__)
+		#include <immintrin.h>
+		#define	VERIFY_AVX2
+	#elif defined(__clang__) && (__clang_major__ >= 4)
+		#include <immintrin.h>
+		#define	VERIFY_AVX2
+	#endif
+#endif
+
+#define	VECTOR_WORDS	16		//Buffers are padded to this many words
+#define	VECTOR_ALIGN	32		//Buffers are aligned to this many bytes
+
+namespace verify
+{
+	const char *region_name(region_id r)
+	{
+		switch(r)
+		{
+			case REGION_ROM:	return "Flash";
+			case REGION_EEPROM:	return "EEPROM";
+			case REGION_CONFIG:	return "Config";
+			case REGION_ID:		return "ID";
+			default:			return "";
+		}
+	}
+
+	buffer_t::~buffer_t()
+	{
+		free(raw);
+	}
+
+	void buffer_t::assign(size_t n, element_t fill)
+	{
+		const size_t	padded((n + VECTOR_WORDS - 1) & ~size_t(VECTOR_WORDS - 1));
+		free(raw);
+		raw = static_cast<uint8_t*>(malloc(padded*sizeof(element_t) + VECTOR_ALIGN - 1));
+		if( raw == NULL )
+		{
+			words = NULL;
+			count = 0;
+			return;
+		}
+		words = reinterpret_cast<element_t*>((reinterpret_cast<uintptr_t>(raw) + VECTOR_ALIGN - 1) & ~uintptr_t(VECTOR_ALIGN - 1));
+		count = n;
+		std::fill(words, words + n, fill);
+		memset(words + n, 0, (padded - n)*sizeof(element_t));
+	}
+
+	engine_t::engine_t(chipinfo::chipinfo &info)
+	{
+		regions[REGION_ROM].begin = info.romBegin();
+		regions[REGION_ROM].end = info.romEnd();
+		regions[REGION_ROM].mask = info.romBlank();
+
+		regions[REGION_EEPROM].begin = info.eepromBegin();
+		regions[REGION_EEPROM].end = info.eepromEnd();
+		regions[REGION_EEPROM].mask = info.eepromBlank();
+
+		//Config words are as wide as ROM words
+		const address_t	config(info.get_config_start());
+		if( config != 0 )	//Config bits are never at address zero
+		{
+			regions[REGION_CONFIG].begin = config;
+			regions[REGION_CONFIG].end = config + info.numConfigWords();
+			regions[REGION_CONFIG].mask = info.romBlank();
+		}
+
+		//The programmer only reads back the low byte of the 12/14-bit ID words
+		//	and doesn't read the 16-bit ID words at all
+		if( info.layout().id_readable )
+		{
+			regions[REGION_ID].begin = info.get_id_start();
+			regions[REGION_ID].end = regions[REGION_ID].begin + 4;
+			regions[REGION_ID].mask = 0xFF;
+		}
+
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+		{
+			regions[i].expected.assign(regions[i].size(), 0);
+			regions[i].care.assign(regions[i].size(), 0);
+			regions[i].actual.assign(regions[i].size(), regions[i].mask);
+		}
+	}
+
+	//Copy the part of every block that falls inside the region
+	//	Blocks are walked once, instead of searching the block list for every word
+	template<typename F>
+	static void flatten(intelhex::hex_data &hex, const region_t &r, F f)
+	{
+		for(intelhex::hex_data::iterator i = hex.begin(); i != hex.end(); ++i)
+		{
+			const address_t	first(i->first);
+			const address_t	last(first + i->second.size());
+			const address_t	lo(std::max(first, r.begin));
+			const address_t	hi(std::min(last, r.end));
+			for(address_t a=lo; a < hi; ++a)
+				f(a - r.begin, i->second[a - first]);
+		}
+	}
+
+	struct set_expected_word
+	{
+		region_t	&r;
+		set_expected_word(region_t &region) : r(region) {}
+		void operator()(size_t i, element_t w)
+		{
+			r.expected[i] = w & r.mask;
+			r.care[i] = r.mask;
+		}
+	};
+
+	struct set_actual_word
+	{
+		region_t	&r;
+		set_actual_word(region_t &region) : r(region) {}
+		void operator()(size_t i, element_t w)	{ r.actual[i] = w & r.mask; }
+	};
+
+	void engine_t::set_expected(intelhex::hex_data &hex)
+	{
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+		{
+			regions[i].expected.assign(regions[i].size(), 0);
+			regions[i].care.assign(regions[i].size(), 0);
+			flatten(hex, regions[i], set_expected_word(regions[i]));
+		}
+	}
+
+	//Words that weren't read compare as blank
+	void engine_t::set_actual(intelhex::hex_data &hex)
+	{
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+			set_actual(region_id(i), hex);
+	}
+
+	void engine_t::set_actual(region_id id, intelhex::hex_data &hex)
+	{
+		region_t	&r = regions[id];
+		r.actual.assign(r.size(), r.mask);
+		flatten(hex, r, set_actual_word(r));
+	}
+
+	size_t engine_t::compare(region_id id, mismatches_t &out) const
+	{
+		const region_t	&r = regions[id];
+		return verify::compare(r.expected.data(), r.actual.data(), r.care.data(), r.size(), id, r.begin, out);
+	}
+
+	size_t engine_t::compare(mismatches_t &out) const
+	{
+		size_t	n(0);
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+			n += compare(region_id(i), out);
+		return n;
+	}
+
+	bool engine_t::report(region_id id, report_t &report) const
+	{
+		return engine_t::report(id, report, regions[id].size());
+	}
+
+	bool engine_t::report(region_id id, report_t &report, size_t n) const
+	{
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+			report.regions[i].present = regions[i].size() != 0;
+
+		const region_t	&r = regions[id];
+		region_report_t	&rr = report.regions[id];
+		const size_t	start(report.runs.size());
+		n = std::min(n, r.size());
+		rr.checked = true;
+		rr.complete = (n == r.size());
+		rr.mismatches = verify::compare(r.expected.data(), r.actual.data(), r.care.data(), n, id, r.begin, report.runs);
+		if( rr.mismatches == 0 )
+			return true;
+
+		const mismatch_t	&last = report.runs.back();
+		rr.first = report.runs[start].address;
+		rr.last = last.address + last.words - 1;
+		rr.first_expected = r.expected[rr.first - r.begin];
+		rr.first_actual = r.actual[rr.first - r.begin];
+		rr.last_expected = r.expected[rr.last - r.begin];
+		rr.last_actual = r.actual[rr.last - r.begin];
+		return false;
+	}
+
+	stream_t::stream_t(engine_t &e, bool stop) : engine(e), stop_on_mismatch(stop), stopped_(false), current(REGION_ROM)
+	{
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+			count[i] = 0;
+	}
+
+	//Make the region holding address current
+	bool stream_t::find(address_t address)
+	{
+		const region_t	&r = engine.region(current);
+		if( (address >= r.begin) && (address < r.end) )
+			return true;
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+		{
+			const region_t	&s = engine.region(region_id(i));
+			if( (address >= s.begin) && (address < s.end) )
+			{
+				current = region_id(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool stream_t::put(address_t address, element_t w)
+	{
+		if( !find(address) )
+			return true;		//Not part of any region, nothing to compare
+
+		region_t	&r = engine.region(current);
+		const size_t	i(address - r.begin);
+		r.actual[i] = w & r.mask;
+		count[current] = std::max(count[current], i + 1);
+		if( stop_on_mismatch && ((r.expected[i] ^ r.actual[i]) & r.care[i]) )
+		{
+			stopped_ = true;
+			return false;
+		}
+		return true;
+	}
+
+	const char *region_report_t::status() const
+	{
+		if( !checked || (!complete && !mismatches) )
+			return "Not Verified";
+		return mismatches ? "Fail" : "Pass";
+	}
+
+	bool report_t::passed() const
+	{
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+			if( regions[i].present && (!regions[i].checked || !regions[i].complete || regions[i].mismatches) )
+				return false;
+		return true;
+	}
+
+	bool report_t::failed() const
+	{
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+			if( regions[i].mismatches )
+				return true;
+		return false;
+	}
+
+	static std::string hex(unsigned long v, int width)
+	{
+		char	s[16];
+		snprintf(s, sizeof(s), "0x%0*lX", width, v);
+		return s;
+	}
+
+	std::string report_t::summary() const
+	{
+		std::ostringstream	os;
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+		{
+			const region_report_t	&r = regions[i];
+			if( !r.present )
+				continue;
+			os << region_name(region_id(i)) << "\t" << r.status();
+			if( r.checked && !r.complete )
+				os << " (stopped at first mismatch)";
+			if( r.mismatches )
+			{
+				os << "\t" << r.mismatches << " word" << ((r.mismatches == 1) ? "" : "s")
+				   << ", first " << hex(r.first, 4) << " (expected " << hex(r.first_expected, 4) << ", read " << hex(r.first_actual, 4) << ")";
+				if( r.last != r.first )
+					os << ", last " << hex(r.last, 4) << " (expected " << hex(r.last_expected, 4) << ", read " << hex(r.last_actual, 4) << ")";
+			}
+			os << "\n";
+		}
+		return os.str();
+	}
+
+	//Plain text with a CSV table per section, easy to archive and to parse
+	bool report_t::write(std::ostream &os) const
+	{
+		char	when[32] = "";
+		struct tm	*t = gmtime(&date);
+		if( t )
+			strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", t);
+
+		os << "chip=" << chip << "\n";
+		os << "image=" << image << "\n";
+		os << "date=" << when << "\n";
+		if( checksummed )
+		{
+			os << "checksum=" << hex(checksum, 4) << "\n";
+			os << "crc32c=" << hex(crc, 8) << "\n";
+		}
+		os << "result=" << (passed() ? "Pass" : (failed() ? "Fail" : "Incomplete")) << "\n";
+		os << "\n";
+		os << "region,status,complete,mismatches,first,first_expected,first_actual,last,last_expected,last_actual\n";
+		for(unsigned i=0; i < NUM_REGIONS; ++i)
+		{
+			const region_report_t	&r = regions[i];
+			if( !r.present )
+				continue;
+			os << region_name(region_id(i)) << "," << r.status() << "," << ((r.checked && r.complete) ? "yes" : "no") << "," << r.mismatches;
+			if( r.mismatches )
+				os << "," << hex(r.first, 4) << "," << hex(r.first_expected, 4) << "," << hex(r.first_actual, 4)
+				   << "," << hex(r.last, 4) << "," << hex(r.last_expected, 4) << "," << hex(r.last_actual, 4);
+			else
+				os << ",,,,,,";
+			os << "\n";
+		}
+		if( !runs.empty() )
+		{
+			os << "\n";
+			os << "region,address,words\n";
+			for(mismatches_t::const_iterator i = runs.begin(); i != runs.end(); ++i)
+				os << region_name(i->region) << "," << hex(i->address, 4) << "," << i->words << "\n";
+		}
+		return os.good();
+	}
+
+	bool report_t::write(const char *path) const
+	{
+		std::ofstream	ofs(path);
+		if( !ofs )
+			return false;
+		return write(ofs);
+	}
+
+	//Kernels return the index of the first mismatched word at or after from, or n
+	typedef	size_t	(*find_t)(const element_t *, const element_t *, const element_t *, size_t, size_t);
+
+	static size_t find_scalar(const element_t *a, const element_t *b, const element_t *care, size_t from, size_t n)
+	{
+		for(size_t i=from; i < n; ++i)
+			if( (a[i] ^ b[i]) & care[i] )
+				return i;
+		return n;
+	}
+
+#ifdef	VERIFY_SSE2
+	static size_t find_sse2(const element_t *a, const element_t *b, const element_t *care, size_t from, size_t n)
+	{
+		const __m128i	zero(_mm_setzero_si128());
+		for(size_t v = from & ~size_t(7); v < n; v += 8)
+		{
+			const __m128i	x(_mm_xor_si128(_mm_load_si128((const __m128i*)(a+v)), _mm_load_si128((const __m128i*)(b+v))));
+			const __m128i	d(_mm_and_si128(x, _mm_load_si128((const __m128i*)(care+v))));
+			unsigned	m(~_mm_movemask_epi8(_mm_cmpeq_epi16(d, zero)) & 0xFFFF);
+			if( v < from )
+				m &= ~0U << (2*(from - v));
+			if( m )
+				return v + __builtin_ctz(m)/2;
+		}
+		return n;
+	}
+#endif	//VERIFY_SSE2
+
+#ifdef	VERIFY_AVX2
+	__attribute__((target("avx2")))
+	static size_t find_avx2(const element_t *a, const element_t *b, const element_t *care, size_t from, size_t n)
+	{
+		const __m256i	zero(_mm256_setzero_si256());
+		for(size_t v = from & ~size_t(15); v < n; v += 16)
+		{
+			const __m256i	x(_mm256_xor_si256(_mm256_load_si256((const __m256i*)(a+v)), _mm256_load_si256((const __m256i*)(b+v))));
+			const __m256i	d(_mm256_and_si256(x, _mm256_load_si256((const __m256i*)(care+v))));
+			unsigned	m(~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi16(d, zero))));
+			if( v < from )
+				m &= ~0U << (2*(from - v));
+			if( m )
+				return v + __builtin_ctz(m)/2;
+		}
+		return n;
+	}
+#endif	//VERIFY_AVX2
+
+	static find_t	kernel(NULL);
+	static const char	*kernel_label("scalar");
+
+	//Pick the widest kernel the CPU supports, once
+	static find_t pick_kernel()
+	{
+		if( kernel )
+			return kernel;
+		find_t	k(find_scalar);
+		const char	*label("scalar");
+#ifdef	VERIFY_SSE2
+		k = find_sse2;
+		label = "sse2";
+#endif
+#ifdef	VERIFY_AVX2
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports("avx2") )
+		{
+			k = find_avx2;
+			label = "avx2";
+		}
+#endif
+		kernel_label = label;
+		return kernel = k;
+	}
+
+	const char *kernel_name()
+	{
+		pick_kernel();
+		return kernel_label;
+	}
+
+	size_t compare(const element_t *a, const element_t *b, const element_t *care, size_t n, region_id region, address_t base, mismatches_t &out)
+	{
+		const find_t	find(pick_kernel());
+		size_t	total(0);
+		for(size_t i = find(a, b, care, 0, n); i < n; i = find(a, b, care, i, n))
+		{
+			const size_t	first(i);
+			while( (i < n) && ((a[i] ^ b[i]) & care[i]) )
+				++i;
+
+			mismatch_t	m;
+			m.region = region;
+			m.address = base + first;
+			m.words = i - first;
+			out.push_back(m);
+			total += m.words;
+		}
+		return total;
+	}
+}
@@ -0,0 +1,173 @@
+/*	Filename:	verify.h
+	Image comparison for verify
+	Both images are flattened into aligned word buffers, one per chip region,
+	and compared a vector at a time. The result is a list of mismatched ranges.
+
+	This code is made available to the public under a BSD-like license, a copy of which
+	should have been provided with this code in the file LICENSE.
+*/
+
+#ifndef	VERIFY_H
+#define	VERIFY_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "chipinfo.h"
+#include "intelhex.h"
+#include "kitsrus.h"
+
+namespace verify
+{
+	typedef	intelhex::hex_data::address_t	address_t;
+	typedef	intelhex::hex_data::element_t	element_t;
+
+	enum region_id
+	{
+		REGION_ROM = 0,
+		REGION_EEPROM,
+		REGION_CONFIG,
+		REGION_ID,
+		NUM_REGIONS
+	};
+
+	const char	*region_name(region_id);
+
+	//Word buffer aligned and padded to whole vectors so the kernels never need a tail loop
+	class buffer_t
+	{
+		uint8_t	*raw;
+		element_t	*words;
+		size_t	count;
+
+		buffer_t(const buffer_t&);	//No copy
+		buffer_t &operator=(const buffer_t&);
+	public:
+		buffer_t() : raw(NULL), words(NULL), count(0) {}
+		~buffer_t();
+
+		void	assign(size_t, element_t);	//Resize and fill, padding is always zero
+		size_t	size() const	{ return count; }
+		element_t	*data()	{ return words; }
+		const element_t	*data() const	{ return words; }
+		element_t	&operator[](size_t i)	{ return words[i]; }
+		element_t	operator[](size_t i) const	{ return words[i]; }
+	};
+
+	struct region_t
+	{
+		address_t	begin;		//First word address
+		address_t	end;		//One past the last word address
+		element_t	mask;		//Implemented bits of each word
+		buffer_t	expected;	//Image words, masked
+		buffer_t	care;		//mask where the image defines a word, zero elsewhere
+		buffer_t	actual;		//Words read from the chip, blank where nothing was read
+
+		region_t() : begin(0), end(0), mask(0) {}
+		size_t	size() const	{ return end - begin; }
+	};
+
+	//A run of consecutive mismatched words
+	struct mismatch_t
+	{
+		region_id	region;
+		address_t	address;	//First mismatched word
+		size_t		words;		//Length of the run
+	};
+	typedef	std::vector<mismatch_t>	mismatches_t;
+
+	//Verify results of one region
+	struct region_report_t
+	{
+		bool		present;		//The chip has this region
+		bool		checked;		//The region was read back and compared
+		bool		complete;		//The whole region was read back
+		size_t		mismatches;		//Number of mismatched words
+		address_t	first, last;	//First and last mismatched words
+		element_t	first_expected, first_actual;
+		element_t	last_expected, last_actual;
+
+		region_report_t() : present(false), checked(false), complete(false), mismatches(0), first(0), last(0),
+			first_expected(0), first_actual(0), last_expected(0), last_actual(0) {}
+		const char	*status() const;	//"Pass", "Fail" or "Not Verified"
+	};
+
+	//Verify results of a whole chip
+	struct report_t
+	{
+		std::string	chip;		//Chip name
+		std::string	image;		//Path of the expected image
+		time_t		date;		//When the verify was done
+		bool		checksummed;	//checksum and crc are set, see checksum::image_t
+		uint16_t	checksum;	//MPLAB device checksum of the expected image
+		uint32_t	crc;		//CRC-32C of the expected image's regions
+		region_report_t	regions[NUM_REGIONS];
+		mismatches_t	runs;	//Every mismatched run, in region order
+
+		report_t() : date(0), checksummed(false), checksum(0), crc(0) {}
+		bool	passed() const;		//Every region was checked and matched
+		bool	failed() const;		//At least one region mismatched
+
+		std::string	summary() const;		//Human readable, one line per region
+		bool	write(std::ostream &) const;	//Export for traceability records
+		bool	write(const char *) const;
+	};
+
+	class engine_t
+	{
+		region_t	regions[NUM_REGIONS];
+
+		engine_t(const engine_t&);	//No copy
+	public:
+		engine_t(chipinfo::chipinfo &);
+
+		region_t	&region(region_id r)	{ return regions[r]; }
+		const region_t	&region(region_id r) const	{ return regions[r]; }
+
+		void	set_expected(intelhex::hex_data &);
+		void	set_actual(intelhex::hex_data &);
+		void	set_actual(region_id, intelhex::hex_data &);
+
+		//Append the mismatched runs of a region, or of every region
+		//	Returns the number of mismatched words
+		size_t	compare(region_id, mismatches_t &) const;
+		size_t	compare(mismatches_t &) const;
+
+		//Compare a region and record the result, returns true if it matched
+		//	Only the first n words are compared when the readback was stopped early
+		bool	report(region_id, report_t &) const;
+		bool	report(region_id, report_t &, size_t n) const;
+	};
+
+	//Compare words against the expected image as they're read back from the chip
+	//	The words are stored in the engine's actual buffers so that a report
+	//	can be made afterwards
+	class stream_t : public kitsrus::sink_t
+	{
+		engine_t	&engine;
+		bool		stop_on_mismatch;
+		bool		stopped_;
+		region_id	current;			//Region of the last word, checked first
+		size_t		count[NUM_REGIONS];	//Words received, including skipped ones
+
+		bool	find(address_t);
+	public:
+		stream_t(engine_t &, bool stop);
+
+		bool	put(address_t, element_t);
+		bool	stopped() const	{ return stopped_; }	//The transfer was stopped at a mismatch
+		size_t	received(region_id r) const	{ return count[r]; }
+	};
+
+	//Append the runs of words where (a ^ b) & care is non-zero
+	//	Buffers must be aligned and padded as buffer_t does it
+	size_t	compare(const element_t *a, const element_t *b, const element_t *care, size_t n, region_id, address_t base, mismatches_t &);
+
+	const char	*kernel_name();		//Kernel picked for this CPU
+}
+
+#endif	//VERIFY_H